@@ -33,6 +33,8 @@ HSM_CALLBACKS engine_hsm_callbacks = {
 		NULL, // HSM_OPENSSL_is_fips_mode, 
 		/* General Sign */
 		NULL, // HSM_ENGINE_sign,
+		/* Batch Sign */
+		NULL,
 		/* General Verify */
 		NULL,
 		/* Key Generation */
@@ -421,43 +421,320 @@ int HSM_set_sign_algor ( PKI_X509_ALGOR_VALUE *alg, HSM *hsm ) {
 	return (ret);
 }
 
+/* --------------------- Verification Results Cache ---------------------- */
+
+/*
+ * Positive signature verification results, indexed by a digest over the
+ * verifying key, the algorithm, the signed data and the signature. The
+ * table is split in sets of VERIFY_CACHE_WAYS entries, an entry is
+ * replaced when expired or when it is the oldest in its set.
+ */
+
+#define VERIFY_CACHE_WAYS	4
+#define VERIFY_CACHE_ID_SIZE	SHA256_DIGEST_LENGTH
+
+typedef struct verify_cache_entry_st {
+	unsigned char id[VERIFY_CACHE_ID_SIZE];
+	unsigned char key_id[VERIFY_CACHE_ID_SIZE];
+	time_t expires;
+	unsigned int gen;
+} VERIFY_CACHE_ENTRY;
+
+static struct {
+	pthread_mutex_t lock;
+	VERIFY_CACHE_ENTRY *entries;
+	int size;
+	int ttl;
+	// Entries from older generations are invalid (O(1) flush)
+	unsigned int gen;
+	unsigned long hits;
+	unsigned long misses;
+} __verify_cache = { PTHREAD_MUTEX_INITIALIZER, NULL,
+	PKI_VERIFY_CACHE_DEFAULT_SIZE, PKI_VERIFY_CACHE_DEFAULT_TTL, 1, 0, 0 };
+
+/* Calculates the digest of the public key (identifies the verifier) */
+static int __verify_cache_key_id(const PKI_X509_KEYPAIR *key,
+				 unsigned char *key_id) {
+
+	unsigned char *der = NULL;
+	int der_len = 0;
+
+	if (!key || !key->value) return PKI_ERR;
+
+	if ((der_len = i2d_PUBKEY((EVP_PKEY *) key->value, &der)) <= 0) {
+		ERR_clear_error();
+		return PKI_ERR;
+	}
+
+	SHA256(der, (size_t) der_len, key_id);
+	OPENSSL_free(der);
+
+	return PKI_OK;
+}
+
+/* Calculates the identifier of a verification (key, alg, data and sig) */
+static int __verify_cache_id(const unsigned char *key_id,
+			     const PKI_X509_ALGOR_VALUE *alg,
+			     const PKI_MEM *data,
+			     const PKI_MEM *sig,
+			     unsigned char *id) {
+
+	unsigned char *alg_der = NULL;
+	int alg_len = 0;
+	SHA256_CTX ctx;
+
+	if ((alg_len = i2d_X509_ALGOR((X509_ALGOR *) alg, &alg_der)) <= 0) {
+		ERR_clear_error();
+		return PKI_ERR;
+	}
+
+	SHA256_Init(&ctx);
+	SHA256_Update(&ctx, key_id, VERIFY_CACHE_ID_SIZE);
+	SHA256_Update(&ctx, alg_der, (size_t) alg_len);
+	SHA256_Update(&ctx, data->data, data->size);
+	SHA256_Update(&ctx, sig->data, sig->size);
+	SHA256_Final(id, &ctx);
+
+	OPENSSL_free(alg_der);
+
+	return PKI_OK;
+}
+
+/* Returns the first entry of the set for the id, must be called with the
+ * lock held and with an allocated table */
+static VERIFY_CACHE_ENTRY *__verify_cache_set(const unsigned char *id) {
+
+	unsigned int h = 0;
+	int sets = __verify_cache.size / VERIFY_CACHE_WAYS;
+
+	// The id is a digest, its first bytes are already well distributed
+	memcpy(&h, id, sizeof(h));
+
+	return &__verify_cache.entries[(h % (unsigned int) sets) * VERIFY_CACHE_WAYS];
+}
+
+/* Returns PKI_OK if a valid (positive) result for the id is cached */
+static int __verify_cache_lookup(const unsigned char *id) {
+
+	VERIFY_CACHE_ENTRY *e = NULL;
+	time_t now = time(NULL);
+	int ret = PKI_ERR;
+	int i = 0;
+
+	pthread_mutex_lock(&__verify_cache.lock);
+
+	if (__verify_cache.entries) {
+
+		e = __verify_cache_set(id);
+
+		for (i = 0; i < VERIFY_CACHE_WAYS; i++) {
+			if (e[i].gen == __verify_cache.gen && e[i].expires > now &&
+				memcmp(e[i].id, id, VERIFY_CACHE_ID_SIZE) == 0) {
+				ret = PKI_OK;
+				break;
+			}
+		}
+
+		if (ret == PKI_OK) __verify_cache.hits++;
+		else __verify_cache.misses++;
+	}
+
+	pthread_mutex_unlock(&__verify_cache.lock);
+
+	return ret;
+}
+
+/* Stores a positive verification result */
+static void __verify_cache_add(const unsigned char *id,
+			       const unsigned char *key_id) {
+
+	VERIFY_CACHE_ENTRY *e = NULL;
+	VERIFY_CACHE_ENTRY *victim = NULL;
+	time_t now = time(NULL);
+	int i = 0;
+
+	pthread_mutex_lock(&__verify_cache.lock);
+
+	// The table is allocated at the first use
+	if (!__verify_cache.entries && __verify_cache.size > 0) {
+		__verify_cache.entries = PKI_Malloc(sizeof(VERIFY_CACHE_ENTRY) *
+					(size_t) __verify_cache.size);
+	}
+
+	if (!__verify_cache.entries) goto end;
+
+	e = __verify_cache_set(id);
+
+	for (i = 0; i < VERIFY_CACHE_WAYS; i++) {
+
+		// Free (or invalid) slot
+		if (e[i].gen != __verify_cache.gen || e[i].expires <= now) {
+			victim = &e[i];
+			break;
+		}
+
+		// Oldest entry in the set
+		if (!victim || e[i].expires < victim->expires) victim = &e[i];
+	}
+
+	memcpy(victim->id, id, VERIFY_CACHE_ID_SIZE);
+	memcpy(victim->key_id, key_id, VERIFY_CACHE_ID_SIZE);
+	victim->expires = now + __verify_cache.ttl;
+	victim->gen = __verify_cache.gen;
+
+end:
+	pthread_mutex_unlock(&__verify_cache.lock);
+}
+
+/*!
+ * \brief Sets the number of cached verification results (0 disables the
+ *        cache). The cache is flushed.
+ */
+
+int PKI_VERIFY_CACHE_set_size ( int entries ) {
+
+	if (entries < 0) return PKI_ERROR(PKI_ERR_PARAM_TYPE, NULL);
+
+	// Rounds up to a multiple of the set size
+	entries = (entries + VERIFY_CACHE_WAYS - 1) / VERIFY_CACHE_WAYS *
+							VERIFY_CACHE_WAYS;
+
+	pthread_mutex_lock(&__verify_cache.lock);
+
+	if (__verify_cache.entries) PKI_Free(__verify_cache.entries);
+	__verify_cache.entries = NULL;
+	__verify_cache.size = entries;
+
+	pthread_mutex_unlock(&__verify_cache.lock);
+
+	return PKI_OK;
+}
+
+/*!
+ * \brief Sets the lifetime (secs) of new cached verification results
+ */
+
+int PKI_VERIFY_CACHE_set_ttl ( int secs ) {
+
+	if (secs <= 0) return PKI_ERROR(PKI_ERR_PARAM_TYPE, NULL);
+
+	pthread_mutex_lock(&__verify_cache.lock);
+	__verify_cache.ttl = secs;
+	pthread_mutex_unlock(&__verify_cache.lock);
+
+	return PKI_OK;
+}
+
+/*!
+ * \brief Invalidates all the cached verification results
+ *
+ * Cached results only depend on the signed data, the signature and the
+ * key (revocation status is never cached), applications can flush the
+ * cache when the set of trust anchors or CRLs is replaced to force all
+ * the signatures to be checked again.
+ */
+
+void PKI_VERIFY_CACHE_flush ( void ) {
+
+	pthread_mutex_lock(&__verify_cache.lock);
+
+	if (++__verify_cache.gen == 0) {
+		// Wrapped around, old entries could look valid again
+		if (__verify_cache.entries) memset(__verify_cache.entries, 0,
+			sizeof(VERIFY_CACHE_ENTRY) * (size_t) __verify_cache.size);
+		__verify_cache.gen = 1;
+	}
+
+	pthread_mutex_unlock(&__verify_cache.lock);
+}
+
+/*!
+ * \brief Invalidates the cached results verified with a key (e.g., the
+ *        key of a revoked or removed issuer)
+ */
+
+int PKI_VERIFY_CACHE_invalidate_key ( const PKI_X509_KEYPAIR *key ) {
+
+	unsigned char key_id[VERIFY_CACHE_ID_SIZE];
+	int i = 0;
+
+	if (!key) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	if (__verify_cache_key_id(key, key_id) != PKI_OK) return PKI_ERR;
+
+	pthread_mutex_lock(&__verify_cache.lock);
+
+	for (i = 0; __verify_cache.entries && i < __verify_cache.size; i++) {
+		if (memcmp(__verify_cache.entries[i].key_id, key_id,
+						VERIFY_CACHE_ID_SIZE) == 0)
+			__verify_cache.entries[i].gen = 0;
+	}
+
+	pthread_mutex_unlock(&__verify_cache.lock);
+
+	return PKI_OK;
+}
+
+/*!
+ * \brief Returns the number of cache hits and misses and the number of
+ *        valid entries
+ */
+
+int PKI_VERIFY_CACHE_get_stats ( unsigned long *hits,
+				 unsigned long *misses,
+				 int *entries ) {
+
+	time_t now = time(NULL);
+	int i = 0;
+
+	pthread_mutex_lock(&__verify_cache.lock);
+
+	if (hits) *hits = __verify_cache.hits;
+	if (misses) *misses = __verify_cache.misses;
+
+	if (entries) {
+		*entries = 0;
+		for (i = 0; __verify_cache.entries && i < __verify_cache.size; i++)
+			if (__verify_cache.entries[i].gen == __verify_cache.gen &&
+				__verify_cache.entries[i].expires > now)
+				(*entries)++;
+	}
+
+	pthread_mutex_unlock(&__verify_cache.lock);
+
+	return PKI_OK;
+}
+
 /* ------------------------ General PKI Signing ---------------------------- */
 
-/*! \brief Signs a PKI_X509 object */
+/* Sets the algorithm identifiers and returns the DER of the data to be signed */
 
-int PKI_X509_sign(PKI_X509           * x, 
-		          const PKI_DIGEST_ALG   * digest,
-		          const PKI_X509_KEYPAIR * key) {
+static PKI_MEM * __x509_sign_prepare(PKI_X509               * x,
+                                     const PKI_DIGEST_ALG   * digest,
+                                     const PKI_X509_KEYPAIR * key) {
 
 	PKI_MEM *der = NULL;
-	PKI_MEM *sig = NULL;
-	  // Data structure for the signature
+	  // Data structure for the data to be signed
 
 	PKI_X509_ALGOR_VALUE *a_pnt = NULL;
 	  // Pointer to the Algorithm Structure
 
-	PKI_STRING * sigPtr = NULL;
-	  // Pointer for the Signature in the PKIX data
-
-	// Input Checks
-	if (!x || !x->value || !key || !key->value ) 
-		return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
-
-	// Sets the default Algorithm if none is provided
-	if (!digest) digest = PKI_DIGEST_ALG_DEFAULT;
-
 	// Gets the Internal (if any) Algorithm Identifier and sets the details
 	if ((a_pnt = PKI_X509_get_data(x, PKI_X509_DATA_SIGNATURE_ALG1)) != NULL) {
 		// Set the algorithm and parameter
-		if (PKI_OK != __set_algIdentifier(a_pnt, digest, key))
-			return PKI_ERROR(PKI_ERR_SIGNATURE_CREATE, "Can not set the Internal Algorithm.");
+		if (PKI_OK != __set_algIdentifier(a_pnt, digest, key)) {
+			PKI_ERROR(PKI_ERR_SIGNATURE_CREATE, "Can not set the Internal Algorithm.");
+			return NULL;
+		}
 	}
 
 	// Set the algorithm and parameter
 	if ((a_pnt = PKI_X509_get_data(x, PKI_X509_DATA_SIGNATURE_ALG2)) != NULL) {
 		// Sets the Algorithm's details
-		if (PKI_OK != __set_algIdentifier(a_pnt, digest, key))
-			return PKI_ERROR(PKI_ERR_SIGNATURE_CREATE, "Can not set the External Algorithm.");
+		if (PKI_OK != __set_algIdentifier(a_pnt, digest, key)) {
+			PKI_ERROR(PKI_ERR_SIGNATURE_CREATE, "Can not set the External Algorithm.");
+			return NULL;
+		}
 	}
 
 	// Retrieves the DER representation of the data to be signed
@@ -470,21 +747,20 @@ int PKI_X509_sign(PKI_X509           * x,
 			// Logs the issue
 			PKI_DEBUG("Can not get the DER representation directly, aborting.");
 			// Can not encode into DER
-			return PKI_ERROR(PKI_ERR_DATA_ASN1_ENCODING, NULL);
+			PKI_ERROR(PKI_ERR_DATA_ASN1_ENCODING, NULL);
+			return NULL;
 		}
 	}
 
-	// Generates the Signature
-	if ((sig = PKI_sign(der, digest, key)) == NULL) {
-		// Error while creating the signature, aborting
-		if (der) PKI_MEM_free(der);
-		// Report the issue
-		return PKI_ERROR(PKI_ERR_SIGNATURE_CREATE, NULL);
-	}
+	return der;
+}
 
-	// der work is finished, let's free the memory
-	if (der) PKI_MEM_free(der);
-	der = NULL;
+/* Transfers the ownership of the signature data (sig) to the PKI_X509 object */
+
+static int __x509_sign_set(PKI_X509 * x, PKI_MEM * sig) {
+
+	PKI_STRING * sigPtr = NULL;
+	  // Pointer for the Signature in the PKIX data
 
 	// Gets the reference to the X509 signature field
 	if ((sigPtr = PKI_X509_get_data(x,
@@ -517,7 +793,100 @@ int PKI_X509_sign(PKI_X509           * x,
 	PKI_MEM_free(sig);
 
 	return PKI_OK;
+}
+
+/*! \brief Signs a PKI_X509 object */
+
+int PKI_X509_sign(PKI_X509           * x, 
+		          const PKI_DIGEST_ALG   * digest,
+		          const PKI_X509_KEYPAIR * key) {
+
+	PKI_MEM *der = NULL;
+	PKI_MEM *sig = NULL;
+	  // Data structure for the signature
+
+	// Input Checks
+	if (!x || !x->value || !key || !key->value ) 
+		return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	// Sets the default Algorithm if none is provided
+	if (!digest) digest = PKI_DIGEST_ALG_DEFAULT;
+
+	// Sets the algorithms and gets the data to be signed
+	if ((der = __x509_sign_prepare(x, digest, key)) == NULL)
+		return PKI_ERR;
+
+	// Generates the Signature
+	if ((sig = PKI_sign(der, digest, key)) == NULL) {
+		// Error while creating the signature, aborting
+		if (der) PKI_MEM_free(der);
+		// Report the issue
+		return PKI_ERROR(PKI_ERR_SIGNATURE_CREATE, NULL);
+	}
+
+	// der work is finished, let's free the memory
+	if (der) PKI_MEM_free(der);
+	der = NULL;
+
+	// Transfers the signature to the object
+	return __x509_sign_set(x, sig);
+}
+
+/*! \brief Signs an array of PKI_X509 objects with the same key
+ *
+ * The data to be signed is prepared for all the objects and then the
+ * signatures are requested to the key's HSM in one batch. Returns PKI_OK
+ * if all the objects have been signed, PKI_ERR otherwise (objects that
+ * could not be signed are left untouched).
+ */
+
+int PKI_X509_sign_batch(PKI_X509              ** x,
+		                int                      num,
+		                const PKI_DIGEST_ALG   * digest,
+		                const PKI_X509_KEYPAIR * key) {
+
+	PKI_MEM **der = NULL;
+	PKI_MEM **sig = NULL;
+	  // Data to be signed and generated signatures
+
+	int ret = PKI_OK;
+	int i = 0;
+
+	// Input Checks
+	if (!x || num <= 0 || !key || !key->value)
+		return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	// Sets the default Algorithm if none is provided
+	if (!digest) digest = PKI_DIGEST_ALG_DEFAULT;
+
+	if ((der = PKI_Malloc(sizeof(PKI_MEM *) * (size_t) num)) == NULL ||
+			(sig = PKI_Malloc(sizeof(PKI_MEM *) * (size_t) num)) == NULL) {
+		if (der) PKI_Free(der);
+		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+	}
+
+	// Prepares the data to be signed for all the objects
+	for (i = 0; i < num; i++) {
+		if (!x[i] || !x[i]->value ||
+				(der[i] = __x509_sign_prepare(x[i], digest, key)) == NULL) {
+			ret = PKI_ERR;
+		}
+	}
+
+	// Generates the signatures in one batch
+	if (PKI_sign_batch((const PKI_MEM **) der, sig, num, digest, key) != PKI_OK)
+		ret = PKI_ERROR(PKI_ERR_SIGNATURE_CREATE, NULL);
+
+	// Transfers the signatures to the objects
+	for (i = 0; i < num; i++) {
+		if (der[i]) PKI_MEM_free(der[i]);
+		if (sig[i] && __x509_sign_set(x[i], sig[i]) != PKI_OK) ret = PKI_ERR;
+	}
+
+	PKI_Free(der);
+	PKI_Free(sig);
 
+	return ret;
 }
 
 /*! \brief General signature function on data */
@@ -572,6 +941,54 @@ PKI_MEM *PKI_sign(const PKI_MEM          * der,
 	return sig;
 }
 
+/*! \brief Signs an array of data blobs with the same key
+ *
+ * Uses the batch signing callback of the key's HSM, if any, and falls
+ * back to the single signing one otherwise. NULL entries in der are
+ * skipped. On return, sig[i] holds the signature for der[i] (or NULL
+ * on error). Returns PKI_OK if all the signatures have been generated.
+ */
+
+int PKI_sign_batch(const PKI_MEM         ** der,
+		           PKI_MEM              ** sig,
+		           int                     num,
+		           const PKI_DIGEST_ALG  * alg,
+		           const PKI_X509_KEYPAIR * key ) {
+
+	const HSM *hsm = NULL;
+	int ret = PKI_OK;
+	int i = 0;
+
+	// Input check
+	if (!der || !sig || num <= 0 || !key || !key->value)
+		return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	// Uses the default algorithm if none was provided
+	if (!alg) alg = (const PKI_DIGEST_ALG *)PKI_DIGEST_ALG_DEFAULT;
+
+	// If no HSM is provided, let's get the default one
+	hsm = (key->hsm != NULL ? key->hsm : HSM_get_default());
+
+	// Uses the batch callback, if the HSM provides one
+	if (hsm && hsm->callbacks && hsm->callbacks->sign_batch) {
+		return hsm->callbacks->sign_batch(
+			           (PKI_MEM **)der,
+			           sig,
+			           num,
+			           (PKI_DIGEST_ALG *)alg,
+			           (PKI_X509_KEYPAIR *)key);
+	}
+
+	// Falls back to signing one blob at a time
+	for (i = 0; i < num; i++) {
+		sig[i] = NULL;
+		if (der[i] == NULL) continue;
+		if ((sig[i] = PKI_sign(der[i], alg, key)) == NULL) ret = PKI_ERR;
+	}
+
+	return ret;
+}
+
 /*!
  * \brief Verifies a PKI_X509 by using a key from a certificate
  */
@@ -614,11 +1031,10 @@ int PKI_X509_verify_cert(const PKI_X509 *x, const PKI_X509_CERT *cert) {
 	return ret;
 }
 
-/*!
- * \brief Verifies a signature on a PKI_X509 object (not for PKCS7 ones)
- */
-
-int PKI_X509_verify(const PKI_X509 *x, const PKI_X509_KEYPAIR *key ) {
+/* Verifies the signature on a PKI_X509. If use_cache is set, the result
+ * is looked up in (and added to) the verification cache. */
+static int __x509_verify(const PKI_X509 *x, const PKI_X509_KEYPAIR *key,
+			 int use_cache) {
 
 	int ret = PKI_ERR;
 	const HSM *hsm = NULL;
@@ -629,6 +1045,10 @@ int PKI_X509_verify(const PKI_X509 *x, const PKI_X509_KEYPAIR *key ) {
 	PKI_STRING *sig_value = NULL;
 	PKI_X509_ALGOR_VALUE *alg = NULL;
 
+	unsigned char key_id[VERIFY_CACHE_ID_SIZE];
+	unsigned char id[VERIFY_CACHE_ID_SIZE];
+	int cached = 0;
+
 	// Make sure the library is initialized
 	PKI_init_all();
 
@@ -688,6 +1108,20 @@ int PKI_X509_verify(const PKI_X509 *x, const PKI_X509_KEYPAIR *key ) {
 		return PKI_ERR;
 	}
 
+	// Looks up the result of a previous verification (if any)
+	if (use_cache && __verify_cache.size > 0 &&
+			__verify_cache_key_id(key, key_id) == PKI_OK &&
+			__verify_cache_id(key_id, alg, data, sig, id) == PKI_OK) {
+
+		cached = 1;
+
+		if (__verify_cache_lookup(id) == PKI_OK) {
+			PKI_MEM_free(data);
+			PKI_MEM_free(sig);
+			return PKI_OK;
+		}
+	}
+
 	// Uses the callback to verify the signature that was copied
 	// in the sig (PKI_MEM) structure
 	if (hsm && hsm->callbacks && hsm->callbacks->verify) {
@@ -708,6 +1142,9 @@ int PKI_X509_verify(const PKI_X509 *x, const PKI_X509_KEYPAIR *key ) {
 
 	}
 
+	// Only positive results are cached
+	if (ret == PKI_OK && cached) __verify_cache_add(id, key_id);
+
 	// Free the allocated memory
 	if ( data ) PKI_MEM_free ( data );
 	if ( sig  ) PKI_MEM_free ( sig  );
@@ -722,16 +1159,173 @@ int PKI_X509_verify(const PKI_X509 *x, const PKI_X509_KEYPAIR *key ) {
 	return (ret);
 }
 
-/*! \brief Verifies a signature */
+/*!
+ * \brief Verifies a signature on a PKI_X509 object (not for PKCS7 ones)
+ */
+
+int PKI_X509_verify(const PKI_X509 *x, const PKI_X509_KEYPAIR *key ) {
+
+	return __x509_verify(x, key, 1);
+}
+
+/* ------------------------ Batch Verification ---------------------------- */
+
+/* Max number of threads used for verifying a batch */
+#define PKI_VERIFY_BATCH_MAX_THREADS	64
+
+/* Number of objects taken by a worker at a time */
+#define PKI_VERIFY_BATCH_CHUNK		32
+
+typedef struct pki_verify_batch_st {
+	const PKI_X509 **x;
+	const PKI_X509_KEYPAIR **keys;
+	int *status;
+	int num;
+	// Next object to be verified (protected by the lock)
+	int next;
+	int failed;
+	pthread_mutex_t lock;
+} PKI_VERIFY_BATCH;
+
+static void * __verify_batch_thread(void *arg) {
+
+	PKI_VERIFY_BATCH *b = (PKI_VERIFY_BATCH *) arg;
+	int failed = 0;
+	int first = 0;
+	int last = 0;
+	int i = 0;
+
+	// The crypto contexts are reused across the worker's objects by
+	// the per-thread pools (see PKI_DIGEST_CTX_get())
+	for (;;) {
+
+		// Takes the next chunk of objects
+		pthread_mutex_lock(&b->lock);
+		first = b->next;
+		b->next += PKI_VERIFY_BATCH_CHUNK;
+		pthread_mutex_unlock(&b->lock);
+
+		if (first >= b->num) break;
+
+		last = first + PKI_VERIFY_BATCH_CHUNK;
+		if (last > b->num) last = b->num;
+
+		for (i = first; i < last; i++) {
+			int rv = PKI_ERR;
+
+			if (b->x[i] && b->keys[i])
+				rv = __x509_verify(b->x[i], b->keys[i], 0);
+
+			if (rv != PKI_OK) failed++;
+			if (b->status) b->status[i] = rv;
+		}
+	}
+
+	if (failed) {
+		pthread_mutex_lock(&b->lock);
+		b->failed += failed;
+		pthread_mutex_unlock(&b->lock);
+	}
+
+	return NULL;
+}
+
+/*!
+ * \brief Verifies the signatures on an array of PKI_X509 objects
+ *
+ * The objects are verified in parallel by a pool of threads (one per CPU
+ * when threads is 0), the i-th object is verified with keys[i]. If status
+ * is not NULL, status[i] is set to PKI_OK or PKI_ERR for each object.
+ * Returns PKI_OK if all the signatures are valid, PKI_ERR otherwise.
+ *
+ * All the signatures are actually checked (the verification cache is
+ * neither consulted nor filled), as expected when auditing objects.
+ */
+
+int PKI_X509_verify_batch(const PKI_X509 **x,
+			  const PKI_X509_KEYPAIR **keys,
+			  int num,
+			  int *status,
+			  int threads) {
+
+	PKI_VERIFY_BATCH b;
+	PKI_THREAD **th = NULL;
+	long cpus = 1;
+	int i = 0;
+
+	if (!x || !keys || num <= 0) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	// Make sure the library is initialized
+	PKI_init_all();
+
+	if (threads <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+		if ((cpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1) cpus = 1;
+#endif
+		threads = (int) cpus;
+	}
+
+	// No more threads than chunks of work
+	if (threads > (num + PKI_VERIFY_BATCH_CHUNK - 1) / PKI_VERIFY_BATCH_CHUNK)
+		threads = (num + PKI_VERIFY_BATCH_CHUNK - 1) / PKI_VERIFY_BATCH_CHUNK;
+	if (threads > PKI_VERIFY_BATCH_MAX_THREADS)
+		threads = PKI_VERIFY_BATCH_MAX_THREADS;
+
+	memset(&b, 0, sizeof(b));
+	b.x = x;
+	b.keys = keys;
+	b.status = status;
+	b.num = num;
+
+	if (pthread_mutex_init(&b.lock, NULL) != 0)
+		return PKI_ERROR(PKI_ERR_GENERAL, "Can not initialize the mutex");
+
+	if (threads > 1 &&
+		(th = PKI_Malloc(sizeof(PKI_THREAD *) * (size_t) threads)) == NULL) {
+		pthread_mutex_destroy(&b.lock);
+		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+	}
+
+	// The calling thread works as well
+	for (i = 1; i < threads; i++) {
+		if ((th[i] = PKI_THREAD_new(__verify_batch_thread, &b)) == NULL)
+			PKI_log_debug("Can not spawn verify thread (%d)", i);
+	}
+
+	__verify_batch_thread(&b);
+
+	for (i = 1; i < threads; i++) {
+		if (th[i] == NULL) continue;
+		PKI_THREAD_join(th[i], NULL);
+		PKI_Free(th[i]);
+	}
+
+	if (th) PKI_Free(th);
+
+	pthread_mutex_destroy(&b.lock);
+
+	return b.failed ? PKI_ERR : PKI_OK;
+}
+
+/*! \brief Verifies a signature
+ *
+ * The digest and public key contexts are taken from the calling thread's
+ * pools (see PKI_DIGEST_CTX_get()) and reused across calls.
+ */
 
 int PKI_verify_signature(const PKI_MEM              * data,
                          const PKI_MEM              * sig,
                          const PKI_X509_ALGOR_VALUE * alg,
                          const PKI_X509_KEYPAIR     * key ) {
 	int v_code = 0;
-	EVP_MD_CTX *ctx = NULL;
 	PKI_DIGEST_ALG *dgst = NULL;
 
+	EVP_MD_CTX *ctx = NULL;
+	EVP_PKEY_CTX *pctx = NULL;
+
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_len = 0;
+
 	// Input Checks
 	if( !data || !data->data || !sig || !sig->data ||
 			 !alg || !key || !key->value )  {
@@ -747,18 +1341,8 @@ int PKI_verify_signature(const PKI_MEM              * data,
 		return PKI_ERROR(PKI_ERR_ALGOR_UNKNOWN,  NULL);
 	}
 
-	// Creates and Initializes a new crypto context (CTX)
-	if ((ctx = EVP_MD_CTX_new()) == NULL) {
-
-		// Can not alloc memory, let's report the error
-		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
-	}
-
-	// Initializes the new CTX
-	EVP_MD_CTX_init(ctx);
-
-	// Initializes the Verify Function
-	if ((EVP_VerifyInit_ex(ctx,dgst, NULL)) == 0) {
+	// Gets the (initialized) digest context for the algorithm
+	if ((ctx = PKI_DIGEST_CTX_get(dgst)) == NULL) {
 
 		// Error in initializing the signature verification function
 		PKI_log_err("Signature Verify Initialization (Crypto Layer Error): %s (%d)", 
@@ -766,7 +1350,7 @@ int PKI_verify_signature(const PKI_MEM              * data,
 			HSM_get_errno(NULL));
 
 		// Done working
-		goto err;
+		return PKI_ERR;
 	}
 
 	// Updates the Verify function
@@ -779,12 +1363,25 @@ int PKI_verify_signature(const PKI_MEM              * data,
 			HSM_get_errno(NULL));
 
 		// Done working
-		goto err;
+		return PKI_ERR;
+	}
+
+	// Finalizes the Verify function, the key context is reused when the
+	// key supports raw digest verification (this is what EVP_VerifyFinal
+	// does internally, with a new context every time)
+	if ((pctx = PKI_DIGEST_PKEY_CTX_get(key->value, dgst, 0)) != NULL) {
+
+		if ((v_code = EVP_DigestFinal_ex(ctx, md, &md_len)) > 0)
+			v_code = EVP_PKEY_verify(pctx, (unsigned char *)sig->data,
+				sig->size, md, md_len);
+
+	} else {
+
+		v_code = EVP_VerifyFinal(ctx, (unsigned char *)sig->data,
+			(unsigned int)sig->size, key->value);
 	}
 
-	// Finalizes the Verify function
-	if ((v_code = EVP_VerifyFinal(ctx, (unsigned char *)sig->data,
-                        (unsigned int)sig->size, key->value )) <= 0 ) {
+	if (v_code <= 0) {
 
 		// Reports the error
 		PKI_log_err("Signature Verify Final Failed (Crypto Layer Error): %s (%d - %d)", 
@@ -792,33 +1389,11 @@ int PKI_verify_signature(const PKI_MEM              * data,
 			HSM_get_errno(NULL));
 
 		// Done working
-		goto err;
+		return PKI_ERR;
 	}
 
-	// Free the memory
-#if OPENSSL_VERSION_NUMBER < 0x1010000fL
-	EVP_MD_CTX_cleanup(ctx);
-#else
-	EVP_MD_CTX_reset(ctx);
-#endif
-	EVP_MD_CTX_free(ctx);
-
 	// All Done
 	return PKI_OK;
-
-err:
-	// Free Memory
-	if (ctx) {
-#if OPENSSL_VERSION_NUMBER < 0x1010000fL
-		EVP_MD_CTX_cleanup(ctx);
-#else
-		EVP_MD_CTX_reset(ctx);
-#endif
-		EVP_MD_CTX_free(ctx);
-	}
-
-	// Returns the error
-	return PKI_ERR;
 }
 
 /* ----------------------- General Obj Management ------------------------ */
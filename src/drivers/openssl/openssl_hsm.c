@@ -26,6 +26,8 @@ const HSM_CALLBACKS openssl_hsm_callbacks = {
 		HSM_OPENSSL_is_fips_mode, 
 		/* General Sign */
 		HSM_OPENSSL_sign,
+		/* Batch Sign */
+		HSM_OPENSSL_sign_batch,
 		/* General Verify */
 		NULL, /* HSM_OPENSSL_verify, */
 		/* Key Generation */
@@ -270,6 +272,7 @@ PKI_MEM * HSM_OPENSSL_sign(PKI_MEM *der, PKI_DIGEST_ALG *digest, PKI_X509_KEYPAI
 {
 
 	EVP_MD_CTX *ctx = NULL;
+	EVP_PKEY_CTX *pctx = NULL;
 	size_t out_size = 0;
 	size_t ossl_ret = 0;
 
@@ -294,23 +297,40 @@ PKI_MEM * HSM_OPENSSL_sign(PKI_MEM *der, PKI_DIGEST_ALG *digest, PKI_X509_KEYPAI
 		return NULL;
 	}
 
-	// Creates the context
-	if ((ctx = EVP_MD_CTX_create()) == NULL) {
-		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+	// Gets the calling thread's context for the digest (already
+	// initialized), it is reused across calls and must not be freed
+	if ((ctx = PKI_DIGEST_CTX_get(digest)) == NULL) {
+		PKI_ERROR(PKI_ERR_SIGNATURE_CREATE, "Cannot initialize the digest");
 		if (out_mem) PKI_MEM_free(out_mem);
 		return NULL;
 	}
 
-	// Initializes the Context
-	EVP_MD_CTX_init(ctx);
-	// EVP_MD_CTX_cleanup(ctx);
-
-	// Initializes the Signature
-	EVP_SignInit_ex(ctx, digest, NULL);
+	// Updates the Signature
 	EVP_SignUpdate (ctx, der->data, der->size);
 
-	// Finalizes the signature
-	if (!EVP_SignFinal(ctx, out_mem->data, (unsigned int *) &ossl_ret, pkey))
+	// Finalizes the signature, the key context is reused when the key
+	// supports raw digest signing (this is what EVP_SignFinal does
+	// internally, with a new context every time)
+	if ((pctx = PKI_DIGEST_PKEY_CTX_get(pkey, digest, 1)) != NULL) {
+
+		unsigned char md[EVP_MAX_MD_SIZE];
+		unsigned int md_len = 0;
+
+		if (EVP_DigestFinal_ex(ctx, md, &md_len) <= 0 ||
+				EVP_PKEY_sign(pctx, out_mem->data, &ossl_ret, md, md_len) <= 0)
+			ossl_ret = 0;
+
+	} else {
+
+		unsigned int sig_len = 0;
+
+		if (EVP_SignFinal(ctx, out_mem->data, &sig_len, pkey))
+			ossl_ret = (size_t) sig_len;
+		else
+			ossl_ret = 0;
+	}
+
+	if (ossl_ret == 0)
 	{
 		PKI_ERROR(PKI_ERR_SIGNATURE_CREATE, "Cannot finalize signature (%s)", 
 			HSM_OPENSSL_get_errdesc(HSM_OPENSSL_get_errno(), NULL, 0));
@@ -323,17 +343,103 @@ PKI_MEM * HSM_OPENSSL_sign(PKI_MEM *der, PKI_DIGEST_ALG *digest, PKI_X509_KEYPAI
 	// PKI_DEBUG("[Signature Generated: %d bytes (estimated: %d bytes)]", 
 	//	ossl_ret, out_size);
 
-	// Cleanup the context
-#if OPENSSL_VERSION_NUMBER <= 0x1010000f
-	EVP_MD_CTX_cleanup(ctx);
-#else
-	EVP_MD_CTX_reset(ctx);
+	return out_mem;
+}
+
+/* ------------------------ Batch Signing function --------------------- */
+
+/* Max number of threads used for signing a batch */
+#define HSM_OPENSSL_SIGN_BATCH_MAX_THREADS	32
+
+typedef struct hsm_openssl_batch_st {
+	PKI_MEM **der;
+	PKI_MEM **sig;
+	int num;
+	int first;
+	int step;
+	PKI_DIGEST_ALG *digest;
+	PKI_X509_KEYPAIR *key;
+} HSM_OPENSSL_BATCH;
+
+static void * __sign_batch_thread(void *arg) {
+
+	HSM_OPENSSL_BATCH *b = (HSM_OPENSSL_BATCH *) arg;
+	int i = 0;
+
+	// Each thread signs the blobs at first, first + step, ...
+	for (i = b->first; i < b->num; i += b->step) {
+		if (b->der[i]) b->sig[i] = HSM_OPENSSL_sign(b->der[i], b->digest, b->key);
+	}
+
+	return NULL;
+}
+
+int HSM_OPENSSL_sign_batch(PKI_MEM **der, PKI_MEM **sig, int num,
+			PKI_DIGEST_ALG *digest, PKI_X509_KEYPAIR *key)
+{
+	HSM_OPENSSL_BATCH *jobs = NULL;
+	PKI_THREAD **th = NULL;
+
+	long cpus = 1;
+	int threads = 0;
+	int i = 0;
+
+	if (!der || !sig || num <= 0 || !key || !key->value)
+		return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	for (i = 0; i < num; i++) sig[i] = NULL;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	if ((cpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1) cpus = 1;
 #endif
 
-	EVP_MD_CTX_destroy(ctx);
+	// Uses one thread per CPU, up to one per blob
+	threads = cpus < num ? (int) cpus : num;
+	if (threads > HSM_OPENSSL_SIGN_BATCH_MAX_THREADS)
+		threads = HSM_OPENSSL_SIGN_BATCH_MAX_THREADS;
 
-	return out_mem;
+	if ((jobs = PKI_Malloc(sizeof(HSM_OPENSSL_BATCH) * (size_t) threads)) == NULL ||
+			(th = PKI_Malloc(sizeof(PKI_THREAD *) * (size_t) threads)) == NULL) {
+		if (jobs) PKI_Free(jobs);
+		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+	}
+
+	for (i = 0; i < threads; i++) {
+		jobs[i].der = der;
+		jobs[i].sig = sig;
+		jobs[i].num = num;
+		jobs[i].first = i;
+		jobs[i].step = threads;
+		jobs[i].digest = digest;
+		jobs[i].key = key;
+	}
+
+	// The calling thread takes the first share of the work
+	for (i = 1; i < threads; i++) {
+		if ((th[i] = PKI_THREAD_new(__sign_batch_thread, &jobs[i])) == NULL) {
+			PKI_log_debug("Can not spawn signing thread, signing inline");
+			__sign_batch_thread(&jobs[i]);
+		}
+	}
+
+	__sign_batch_thread(&jobs[0]);
+
+	for (i = 1; i < threads; i++) {
+		if (th[i] == NULL) continue;
+		PKI_THREAD_join(th[i], NULL);
+		PKI_Free(th[i]);
+	}
+
+	PKI_Free(th);
+	PKI_Free(jobs);
+
+	for (i = 0; i < num; i++) {
+		if (der[i] && sig[i] == NULL) return PKI_ERR;
+	}
+
+	return PKI_OK;
 }
+
 /* ---------------------- OPENSSL Slot Management Functions ---------------- */
 
 HSM_SLOT_INFO * HSM_OPENSSL_SLOT_INFO_get (unsigned long num, HSM *hsm) {
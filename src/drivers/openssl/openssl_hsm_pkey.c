@@ -1,7 +1,16 @@
 /* openssl/pki_pkey.c */
 
+// Needed for SCHED_IDLE
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <libpki/pki.h>
 
+#ifdef LIBPKI_TARGET_LINUX
+#include <sched.h>
+#endif
+
 /* Internal usage only - we want to keep the lib abstract */
 #ifndef _LIBPKI_HSM_OPENSSL_PKEY_H
 #define _LIBPKI_HSM_OPENSSL_PKEY_H
@@ -321,8 +330,8 @@ void * _pki_ecdsakey_new( PKI_KEYPARAMS *kp ) {
 #endif
 
 
-PKI_X509_KEYPAIR *HSM_OPENSSL_X509_KEYPAIR_new( PKI_KEYPARAMS *kp, 
-        URL *url, PKI_CRED *cred, HSM *driver ) {
+/* Generates a new software keypair in the calling thread */
+static PKI_X509_KEYPAIR * __keypair_generate( PKI_KEYPARAMS *kp ) {
 
     PKI_X509_KEYPAIR *ret = NULL;
     PKI_RSA_KEY *rsa = NULL;
@@ -410,6 +419,504 @@ PKI_X509_KEYPAIR *HSM_OPENSSL_X509_KEYPAIR_new( PKI_KEYPARAMS *kp,
     return ( ret );
 }
 
+/* ------------------------- Background Key Pool ------------------------- */
+
+/* Software keys for the configured parameters are generated in advance by
+ * background (idle priority) threads and kept in per-pool ring buffers,
+ * HSM_OPENSSL_X509_KEYPAIR_new() takes a key from the matching pool when
+ * one is available and wakes up the workers to refill it.
+ *
+ * After a fork() the child discards the inherited keys (they would also be
+ * handed out by the parent) and restarts the workers on the next request. */
+
+typedef struct keypair_pool_st {
+    unsigned long id;
+    PKI_KEYPARAMS kp;
+    int watermark;
+    PKI_X509_KEYPAIR **keys;
+    int head;
+    int depth;
+    int pending;
+    int failed;
+    unsigned long hits;
+    unsigned long misses;
+} KEYPAIR_POOL;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    KEYPAIR_POOL *pools[PKI_X509_KEYPAIR_POOL_MAX];
+    int num_pools;
+    unsigned long next_id;
+    PKI_THREAD *threads[PKI_X509_KEYPAIR_POOL_MAX_THREADS];
+    int num_threads;
+    int threads_target;
+    int stop;
+} __keypair_pool = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    { NULL }, 0, 1, { NULL }, 0, 1, 0 };
+
+static pthread_once_t __keypair_pool_once = PTHREAD_ONCE_INIT;
+
+/* Fills in the parameters used for matching (and generating) pooled keys */
+static void __keypair_pool_params(PKI_KEYPARAMS *dst, PKI_SCHEME_ID scheme,
+            int bits, int curve, int form) {
+
+    memset(dst, 0, sizeof(PKI_KEYPARAMS));
+
+    dst->scheme = scheme != PKI_SCHEME_UNKNOWN ? scheme : PKI_SCHEME_DEFAULT;
+    dst->bits = bits > 0 ? bits : 0;
+    dst->rsa.exponent = -1;
+
+#ifdef ENABLE_ECDSA
+    dst->ec.curve = curve > 0 ? curve : -1;
+    dst->ec.form = form;
+    dst->ec.asn1flags = -1;
+#endif
+}
+
+/* Returns the RSA exponent of the parameters, -1 for the default one */
+static int __keypair_pool_exponent(const PKI_KEYPARAMS *kp) {
+
+    // Keys are generated with RSA_F4 unless specified
+    if (!kp || kp->rsa.exponent <= 0 || kp->rsa.exponent == RSA_F4)
+        return -1;
+
+    return kp->rsa.exponent;
+}
+
+/* Returns the pool for the parameters (lock must be held) */
+static KEYPAIR_POOL * __keypair_pool_find(const PKI_KEYPARAMS *kp) {
+
+    int i = 0;
+
+    for (i = 0; i < __keypair_pool.num_pools; i++) {
+
+        KEYPAIR_POOL *p = __keypair_pool.pools[i];
+
+        if (p->kp.scheme != kp->scheme || p->kp.bits != kp->bits) continue;
+
+        if (kp->scheme == PKI_SCHEME_RSA &&
+                p->kp.rsa.exponent != kp->rsa.exponent)
+            continue;
+
+#ifdef ENABLE_ECDSA
+        if (kp->scheme == PKI_SCHEME_ECDSA &&
+                (p->kp.ec.curve != kp->ec.curve ||
+                 p->kp.ec.form != kp->ec.form ||
+                 p->kp.ec.asn1flags != kp->ec.asn1flags))
+            continue;
+#endif
+        return p;
+    }
+
+    return NULL;
+}
+
+/* Returns the pool with the passed id (lock must be held) */
+static KEYPAIR_POOL * __keypair_pool_find_id(unsigned long id) {
+
+    int i = 0;
+
+    for (i = 0; i < __keypair_pool.num_pools; i++) {
+        if (__keypair_pool.pools[i]->id == id) return __keypair_pool.pools[i];
+    }
+
+    return NULL;
+}
+
+static void __keypair_pool_free(KEYPAIR_POOL *p) {
+
+    int i = 0;
+
+    if (!p) return;
+
+    for (i = 0; i < p->depth; i++)
+        HSM_OPENSSL_X509_KEYPAIR_free(p->keys[(p->head + i) % p->watermark]);
+
+    if (p->keys) PKI_Free(p->keys);
+    PKI_Free(p);
+}
+
+/* Returns the pool that needs a key the most (lock must be held) */
+static KEYPAIR_POOL * __keypair_pool_next(void) {
+
+    KEYPAIR_POOL *ret = NULL;
+    int i = 0;
+
+    for (i = 0; i < __keypair_pool.num_pools; i++) {
+
+        KEYPAIR_POOL *p = __keypair_pool.pools[i];
+
+        if (p->failed || p->depth + p->pending >= p->watermark) continue;
+
+        // Lowest fill ratio first
+        if (!ret || (p->depth + p->pending) * ret->watermark <
+                (ret->depth + ret->pending) * p->watermark)
+            ret = p;
+    }
+
+    return ret;
+}
+
+static void * __keypair_pool_thread(void *arg) {
+
+    KEYPAIR_POOL *p = NULL;
+    PKI_X509_KEYPAIR *k = NULL;
+    PKI_KEYPARAMS kp;
+    unsigned long id = 0;
+
+#if defined(LIBPKI_TARGET_LINUX) && defined(SCHED_IDLE)
+    struct sched_param param;
+
+    // Keys are generated only when the cores are otherwise idle
+    memset(&param, 0, sizeof(param));
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+    pthread_mutex_lock(&__keypair_pool.lock);
+
+    while (!__keypair_pool.stop) {
+
+        if ((p = __keypair_pool_next()) == NULL) {
+            pthread_cond_wait(&__keypair_pool.cond, &__keypair_pool.lock);
+            continue;
+        }
+
+        p->pending++;
+        id = p->id;
+        kp = p->kp;
+
+        pthread_mutex_unlock(&__keypair_pool.lock);
+
+        k = __keypair_generate(&kp);
+
+        pthread_mutex_lock(&__keypair_pool.lock);
+
+        // The pool might have been removed (or resized) meanwhile
+        if ((p = __keypair_pool_find_id(id)) != NULL) {
+
+            p->pending--;
+
+            if (!k) {
+                // Stops refilling a pool whose keys can not be generated
+                PKI_log_err("Can not generate keys for the pool, disabled");
+                p->failed = 1;
+            } else if (p->depth < p->watermark) {
+                p->keys[(p->head + p->depth) % p->watermark] = k;
+                p->depth++;
+                k = NULL;
+            }
+        }
+
+        if (k) {
+            pthread_mutex_unlock(&__keypair_pool.lock);
+            HSM_OPENSSL_X509_KEYPAIR_free(k);
+            k = NULL;
+            pthread_mutex_lock(&__keypair_pool.lock);
+        }
+    }
+
+    pthread_mutex_unlock(&__keypair_pool.lock);
+
+    return NULL;
+}
+
+/* Stops and joins the workers */
+static void __keypair_pool_stop(void) {
+
+    PKI_THREAD *th[PKI_X509_KEYPAIR_POOL_MAX_THREADS];
+    int num = 0;
+    int i = 0;
+
+    pthread_mutex_lock(&__keypair_pool.lock);
+    __keypair_pool.stop = 1;
+    pthread_cond_broadcast(&__keypair_pool.cond);
+    num = __keypair_pool.num_threads;
+    for (i = 0; i < num; i++) th[i] = __keypair_pool.threads[i];
+    __keypair_pool.num_threads = 0;
+    pthread_mutex_unlock(&__keypair_pool.lock);
+
+    for (i = 0; i < num; i++) {
+        PKI_THREAD_join(th[i], NULL);
+        PKI_Free(th[i]);
+    }
+
+    pthread_mutex_lock(&__keypair_pool.lock);
+    __keypair_pool.stop = 0;
+    pthread_mutex_unlock(&__keypair_pool.lock);
+}
+
+/* The lock is held across fork(), so the child gets consistent pools */
+static void __keypair_pool_atfork_prepare(void) {
+    pthread_mutex_lock(&__keypair_pool.lock);
+}
+
+static void __keypair_pool_atfork_parent(void) {
+    pthread_mutex_unlock(&__keypair_pool.lock);
+}
+
+/* The workers do not exist in the child and the keys are shared with the
+ * parent: frees the keys and resets the workers state */
+static void __keypair_pool_atfork_child(void) {
+
+    KEYPAIR_POOL *p = NULL;
+    int i = 0;
+    int j = 0;
+
+    pthread_mutex_init(&__keypair_pool.lock, NULL);
+    pthread_cond_init(&__keypair_pool.cond, NULL);
+
+    for (i = 0; i < __keypair_pool.num_threads; i++)
+        PKI_Free(__keypair_pool.threads[i]);
+
+    __keypair_pool.num_threads = 0;
+    __keypair_pool.stop = 0;
+
+    for (i = 0; i < __keypair_pool.num_pools; i++) {
+
+        p = __keypair_pool.pools[i];
+
+        for (j = 0; j < p->depth; j++) {
+            HSM_OPENSSL_X509_KEYPAIR_free(p->keys[(p->head + j) % p->watermark]);
+            p->keys[(p->head + j) % p->watermark] = NULL;
+        }
+
+        p->head = 0;
+        p->depth = 0;
+        p->pending = 0;
+    }
+}
+
+static void __keypair_pool_atfork_init(void) {
+
+    pthread_atfork(__keypair_pool_atfork_prepare,
+        __keypair_pool_atfork_parent, __keypair_pool_atfork_child);
+}
+
+/* Starts the missing workers (lock must be held) */
+static void __keypair_pool_start(void) {
+
+    PKI_THREAD *th = NULL;
+
+    pthread_once(&__keypair_pool_once, __keypair_pool_atfork_init);
+
+    while (__keypair_pool.num_threads < __keypair_pool.threads_target) {
+
+        if ((th = PKI_THREAD_new(__keypair_pool_thread, NULL)) == NULL) {
+            PKI_log_err("Can not start the key pool workers");
+            break;
+        }
+
+        __keypair_pool.threads[__keypair_pool.num_threads++] = th;
+    }
+}
+
+/* Takes a key from the matching pool, if any */
+static PKI_X509_KEYPAIR * __keypair_pool_get(const PKI_KEYPARAMS *kp) {
+
+    PKI_X509_KEYPAIR *ret = NULL;
+    KEYPAIR_POOL *p = NULL;
+    PKI_KEYPARAMS match;
+
+#ifdef ENABLE_ECDSA
+    __keypair_pool_params(&match, kp ? kp->scheme : PKI_SCHEME_UNKNOWN,
+        kp ? kp->bits : 0, kp ? kp->ec.curve : -1,
+        kp ? kp->ec.form : PKI_EC_KEY_FORM_UNKNOWN);
+    if (kp) match.ec.asn1flags = kp->ec.asn1flags > -1 ? kp->ec.asn1flags : -1;
+#else
+    __keypair_pool_params(&match, kp ? kp->scheme : PKI_SCHEME_UNKNOWN,
+        kp ? kp->bits : 0, -1, 0);
+#endif
+    match.rsa.exponent = __keypair_pool_exponent(kp);
+
+    pthread_mutex_lock(&__keypair_pool.lock);
+
+    if (__keypair_pool.num_pools > 0 &&
+            (p = __keypair_pool_find(&match)) != NULL) {
+
+        // Restarts the workers (e.g., in a forked child)
+        if (__keypair_pool.num_threads < __keypair_pool.threads_target)
+            __keypair_pool_start();
+
+        if (p->depth > 0) {
+            ret = p->keys[p->head];
+            p->keys[p->head] = NULL;
+            p->head = (p->head + 1) % p->watermark;
+            p->depth--;
+            p->hits++;
+        } else {
+            p->misses++;
+        }
+
+        pthread_cond_signal(&__keypair_pool.cond);
+    }
+
+    pthread_mutex_unlock(&__keypair_pool.lock);
+
+    return ret;
+}
+
+/*! \brief Configures a pool of pre-generated (software) keys
+ *
+ * Up to watermark keys for the scheme, bits and curve (for ECDSA, use -1
+ * to select the curve from the bits) are generated in the background
+ * and handed out by PKI_X509_KEYPAIR_new() and HSM_X509_KEYPAIR_new() for
+ * matching parameters. A watermark of 0 removes the pool. The pool is
+ * refilled as keys are taken.
+ */
+
+int PKI_X509_KEYPAIR_POOL_set(PKI_SCHEME_ID scheme, int bits, int curve,
+            int watermark) {
+
+    KEYPAIR_POOL *p = NULL;
+    KEYPAIR_POOL *old = NULL;
+    PKI_KEYPARAMS kp;
+    int i = 0;
+
+    if (watermark < 0) return PKI_ERROR(PKI_ERR_PARAM_TYPE, NULL);
+
+#ifdef ENABLE_ECDSA
+    __keypair_pool_params(&kp, scheme, bits, curve, PKI_EC_KEY_FORM_UNKNOWN);
+#else
+    __keypair_pool_params(&kp, scheme, bits, curve, 0);
+#endif
+
+    if (watermark > 0) {
+
+        if ((p = PKI_Malloc(sizeof(KEYPAIR_POOL))) == NULL ||
+                (p->keys = PKI_Malloc(sizeof(PKI_X509_KEYPAIR *) *
+                        (size_t) watermark)) == NULL) {
+            if (p) PKI_Free(p);
+            return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+        }
+
+        p->kp = kp;
+        p->watermark = watermark;
+    }
+
+    pthread_mutex_lock(&__keypair_pool.lock);
+
+    if ((old = __keypair_pool_find(&kp)) != NULL) {
+
+        // Moves the existing keys (up to the new watermark) and the
+        // statistics into the new pool
+        if (p) {
+            while (old->depth > 0 && p->depth < p->watermark) {
+                p->keys[p->depth++] = old->keys[old->head];
+                old->head = (old->head + 1) % old->watermark;
+                old->depth--;
+            }
+            p->hits = old->hits;
+            p->misses = old->misses;
+        }
+
+        for (i = 0; i < __keypair_pool.num_pools; i++) {
+            if (__keypair_pool.pools[i] == old) break;
+        }
+        __keypair_pool.pools[i] = __keypair_pool.pools[--__keypair_pool.num_pools];
+
+    } else if (p && __keypair_pool.num_pools >= PKI_X509_KEYPAIR_POOL_MAX) {
+
+        pthread_mutex_unlock(&__keypair_pool.lock);
+        __keypair_pool_free(p);
+        return PKI_ERROR(PKI_ERR_GENERAL, "Too many key pools");
+    }
+
+    if (p) {
+        p->id = __keypair_pool.next_id++;
+        __keypair_pool.pools[__keypair_pool.num_pools++] = p;
+        __keypair_pool_start();
+        pthread_cond_broadcast(&__keypair_pool.cond);
+    }
+
+    pthread_mutex_unlock(&__keypair_pool.lock);
+
+    // Frees the remaining keys outside the lock
+    __keypair_pool_free(old);
+
+    return PKI_OK;
+}
+
+/*! \brief Sets the number of background threads generating keys for the
+ *         pools (default: 1) */
+
+int PKI_X509_KEYPAIR_POOL_set_threads(int threads) {
+
+    if (threads < 1 || threads > PKI_X509_KEYPAIR_POOL_MAX_THREADS)
+        return PKI_ERROR(PKI_ERR_PARAM_TYPE, NULL);
+
+    // Restarts the workers with the new number of threads
+    __keypair_pool_stop();
+
+    pthread_mutex_lock(&__keypair_pool.lock);
+    __keypair_pool.threads_target = threads;
+    if (__keypair_pool.num_pools > 0) __keypair_pool_start();
+    pthread_mutex_unlock(&__keypair_pool.lock);
+
+    return PKI_OK;
+}
+
+/*! \brief Returns the number of keys available in the pool and the number
+ *         of requests served from (hits) and missed by (misses) the pool */
+
+int PKI_X509_KEYPAIR_POOL_get_stats(PKI_SCHEME_ID scheme, int bits, int curve,
+            int *depth, unsigned long *hits, unsigned long *misses) {
+
+    KEYPAIR_POOL *p = NULL;
+    PKI_KEYPARAMS kp;
+
+#ifdef ENABLE_ECDSA
+    __keypair_pool_params(&kp, scheme, bits, curve, PKI_EC_KEY_FORM_UNKNOWN);
+#else
+    __keypair_pool_params(&kp, scheme, bits, curve, 0);
+#endif
+
+    pthread_mutex_lock(&__keypair_pool.lock);
+
+    if ((p = __keypair_pool_find(&kp)) != NULL) {
+        if (depth) *depth = p->depth;
+        if (hits) *hits = p->hits;
+        if (misses) *misses = p->misses;
+    }
+
+    pthread_mutex_unlock(&__keypair_pool.lock);
+
+    return p ? PKI_OK : PKI_ERR;
+}
+
+/*! \brief Stops the background workers and frees all the pools */
+
+void PKI_X509_KEYPAIR_POOL_cleanup(void) {
+
+    KEYPAIR_POOL *pools[PKI_X509_KEYPAIR_POOL_MAX];
+    int num = 0;
+    int i = 0;
+
+    __keypair_pool_stop();
+
+    pthread_mutex_lock(&__keypair_pool.lock);
+    num = __keypair_pool.num_pools;
+    for (i = 0; i < num; i++) pools[i] = __keypair_pool.pools[i];
+    __keypair_pool.num_pools = 0;
+    pthread_mutex_unlock(&__keypair_pool.lock);
+
+    for (i = 0; i < num; i++) __keypair_pool_free(pools[i]);
+}
+
+/* ------------------------- Keypair Generation -------------------------- */
+
+PKI_X509_KEYPAIR *HSM_OPENSSL_X509_KEYPAIR_new( PKI_KEYPARAMS *kp, 
+        URL *url, PKI_CRED *cred, HSM *driver ) {
+
+    PKI_X509_KEYPAIR *ret = NULL;
+
+    // Pre-generated keys are used first (if a pool is configured)
+    if ((ret = __keypair_pool_get(kp)) != NULL) return ret;
+
+    return __keypair_generate(kp);
+}
+
 /* Key Free function */
 void HSM_OPENSSL_X509_KEYPAIR_free ( PKI_X509_KEYPAIR *pkey ) {
 
@@ -27,6 +27,8 @@ HSM_CALLBACKS pkcs11_hsm_callbacks = {
 		HSM_PKCS11_is_fips_mode, 
 		/* General Sign */
 		NULL, /* HSM_PKCS11_sign, */
+		/* Batch Sign - spread over the sessions pool */
+		HSM_PKCS11_sign_batch,
 		/* General Verify */
 		NULL, /* HSM_PKCS11_verify */
 		/* Key Generation */
@@ -98,6 +100,7 @@ HSM *HSM_PKCS11_new ( PKI_CONFIG *conf ) {
 
 	HSM *hsm = NULL;
 	char *cryptoki_id = NULL;
+	char *sessions = NULL;
 
 	if ((hsm = (HSM *) PKI_Malloc ( sizeof( HSM ))) == NULL)
 		return NULL;
@@ -137,6 +140,12 @@ HSM *HSM_PKCS11_new ( PKI_CONFIG *conf ) {
 		goto err;
 	};
 
+	/* Max number of sessions for concurrent operations (optional) */
+	if((sessions = PKI_CONFIG_get_value( conf, "/hsm/sessions" )) != NULL ) {
+		((PKCS11_HANDLER *)hsm->driver)->pool_max = atoi( sessions );
+		PKI_Free ( sessions );
+	}
+
 	if((hsm->session = (void *) PKI_Malloc ( sizeof (CK_SESSION_HANDLE)))
 								== NULL ) {
 		PKI_log_err("HSM_PKCS11_new()::Memory Allocation error for"
@@ -171,6 +180,9 @@ int HSM_PKCS11_free ( HSM *hsm, PKI_CONFIG *conf ) {
 
 	if((handle = _hsm_get_pkcs11_handler(hsm)) != NULL ) {
 
+		// Close the sessions in the pool
+		HSM_PKCS11_session_pool_clear(handle);
+
 		// Check if the Finalize function is available
 		if (handle->callbacks && handle->callbacks->C_Finalize)
 		{
@@ -209,8 +221,8 @@ int HSM_PKCS11_free ( HSM *hsm, PKI_CONFIG *conf ) {
 	// pthread_mutex_destroy ( &handle->pkcs11_mutex );
 	// pthread_cond_destroy ( &handle->pkcs11_cond );
 
-	// Free the Memory
-	PKI_Free(handle);
+	// Free the Memory (the handler was freed as hsm->driver)
+	PKI_Free(hsm);
 	
 	// All Done
 	return (PKI_OK);
@@ -332,6 +344,12 @@ int HSM_PKCS11_init( HSM *hsm, PKI_CONFIG *conf ) {
 		return PKI_ERROR(PKI_ERR_HSM_INIT, "Error while initializing cond variable");
 	}
 
+	// Initialize MUTEX and COND variable for the sessions pool
+	if (pthread_mutex_init( &handle->pool_mutex, NULL ) != 0 ||
+			pthread_cond_init( &handle->pool_cond, NULL ) != 0 ) {
+		return PKI_ERROR(PKI_ERR_HSM_INIT, "Error while initializing session pool");
+	}
+
 	rv = (handle->callbacks->C_Initialize)(NULL_PTR);
 	if ((rv != CKR_OK) && (rv != CKR_CRYPTOKI_ALREADY_INITIALIZED)) {
 		return PKI_ERROR(PKI_ERR_HSM_INIT, "C_Initialize failed with 0x%8.8X", rv);
@@ -945,6 +963,13 @@ int HSM_PKCS11_SLOT_select (unsigned long num, PKI_CRED *cred, HSM *hsm) {
 	/* Sets the Slot ID */
 	lib->slot_id = num;
 
+	/* Sessions for concurrent operations are opened on the new slot */
+	if( HSM_PKCS11_session_pool_init( lib ) != PKI_OK ) {
+		PKI_log_debug("%s()::Can not initialize the session pool",
+				__PRETTY_FUNCTION__);
+		return ( PKI_ERR );
+	}
+
 	/* Get the Mechanism List */
 	if((rv = lib->callbacks->C_GetMechanismList( lib->slot_id, NULL_PTR, 
 						&lib->mech_num )) != CKR_OK ) {
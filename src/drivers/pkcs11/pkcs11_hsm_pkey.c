@@ -133,6 +133,8 @@ PKI_RSA_KEY * _pki_pkcs11_rsakey_new( PKI_KEYPARAMS *kp, URL *url,
 
 	BIGNUM *bn = NULL;
 	BIGNUM *id_num = NULL;
+	BIGNUM *n_bn = NULL;
+	BIGNUM *e_bn = NULL;
 
 	char *id     = NULL;
 	int   id_len = 8; 
@@ -311,26 +313,32 @@ PKI_DEBUG("BITS FOR KEY GENERATION %lu (def: %lu)", bits, PKI_RSA_KEY_DEFAULT_SI
 		goto err;
 	};
 
-#if OPENSSL_VERSION_NUMBER >= 0x1010000fL
-	RSA_set0_key(ret, NULL, BN_bin2bn( data, (int) size, NULL), NULL);
-#else
-	ret->e = BN_bin2bn( data, (int) size, NULL );
-#endif
+	e_bn = BN_bin2bn( data, (int) size, NULL );
 	PKI_Free ( data );
 	data = NULL;
 
 	if( HSM_PKCS11_get_attribute ( handler_pubkey, &lib->session,
 			CKA_MODULUS, (void **) &data, &size, lib ) != PKI_OK ) {
+		if ( e_bn ) BN_free ( e_bn );
 		goto err;
 	};
 
+	n_bn = BN_bin2bn( data, (int) size, NULL );
+	PKI_Free ( data );
+	data = NULL;
+
 #if OPENSSL_VERSION_NUMBER >= 0x1010000fL
-	RSA_set0_key(ret, BN_bin2bn(data, (int) size, NULL), NULL, NULL);
+	// The modulus and the exponent have to be set together (n and e
+	// can not be NULL in the key after the call)
+	if (!n_bn || !e_bn || !RSA_set0_key(ret, n_bn, e_bn, NULL)) {
+		if ( n_bn ) BN_free ( n_bn );
+		if ( e_bn ) BN_free ( e_bn );
+		goto err;
+	}
 #else
-	ret->n = BN_bin2bn( data, (int) size, NULL );
+	ret->n = n_bn;
+	ret->e = e_bn;
 #endif
-	PKI_Free ( data );
-	data = NULL;
 
 	/* Let's get the Attributes from the Keypair and store into the
 	   key's pointer */
@@ -991,6 +999,7 @@ int HSM_PKCS11_rsa_sign ( int type, const unsigned char *m, unsigned int m_len,
 
 	PKCS11_HANDLER *lib = NULL;
 	CK_OBJECT_HANDLE *pHandle = NULL;
+	CK_SESSION_HANDLE hSession;
 	HSM *driver = NULL;
 
 	CK_MECHANISM RSA_MECH = { CKM_RSA_PKCS, NULL_PTR, 0 };
@@ -1007,7 +1016,9 @@ int HSM_PKCS11_rsa_sign ( int type, const unsigned char *m, unsigned int m_len,
 #endif
 
 	
-	int i, j, rc;
+	int i, j;
+	int pooled = 0;
+	unsigned long pool_gen = 0;
 
 	int keysize = 0;
 	CK_ULONG ck_sigsize = 0;
@@ -1038,12 +1049,6 @@ int HSM_PKCS11_rsa_sign ( int type, const unsigned char *m, unsigned int m_len,
         goto err;
     }
 
-	if(( HSM_PKCS11_session_new( lib->slot_id, &lib->session,
-				CKF_SERIAL_SESSION, lib )) == PKI_ERR ) {
-		PKI_log_debug("Failed to open a new session (R/W) with the token");
-		goto err;
-	}
-
 	/* Now we need to check the real encoding */
 #if OPENSSL_VERSION_NUMBER < 0x1010000fL
 	ASN1_OCTET_STRING digest;
@@ -1112,23 +1117,18 @@ int HSM_PKCS11_rsa_sign ( int type, const unsigned char *m, unsigned int m_len,
 	i2d_X509_SIG(sig_pnt, &p);
 	s = tmps;
 
-	rc = pthread_mutex_lock( &lib->pkcs11_mutex );
-	PKI_log_debug( "pthread_mutex_lock()::RC=%d", rc );
-
-	while(( rv = lib->callbacks->C_SignInit(lib->session, 
-			&RSA_MECH, *pHandle)) == CKR_OPERATION_ACTIVE ) {
-		int rc = 0;
-
-		rc = pthread_cond_wait( &lib->pkcs11_cond, &lib->pkcs11_mutex );
-		PKI_log_debug( "pthread_cond_wait()::RC=%d", rc );
+	/* Each signer gets its own session, so no operation is active */
+	if( HSM_PKCS11_session_pool_get( lib, &hSession, &pool_gen ) != PKI_OK ) {
+		PKI_log_debug("HSM_PKCS11_rsa_sign()::Can not get a session "
+					"from the pool");
+		goto err;
 	}
+	pooled = 1;
 
-	if( rv != CKR_OK ) {
+	if(( rv = lib->callbacks->C_SignInit(hSession, 
+			&RSA_MECH, *pHandle)) != CKR_OK ) {
 		PKI_log_debug("HSM_PKCS11_rsa_sign()::SignInit "
 					"(2) failed with code 0x%8.8X", rv );
-		pthread_cond_signal( &lib->pkcs11_cond );
-		pthread_mutex_unlock( &lib->pkcs11_mutex );
-
 		goto err;
 	}
 
@@ -1145,7 +1145,7 @@ int HSM_PKCS11_rsa_sign ( int type, const unsigned char *m, unsigned int m_len,
 	PKI_log_debug("HSM_PKCS11_rsa_sign():: DEBUG %d", __LINE__ );
 	// if((rv = lib->callbacks->C_Sign( lib->session, (CK_BYTE *) m, 
 	// 			m_len, sigret, &ck_sigsize)) != CKR_OK ) {
-	if((rv = lib->callbacks->C_Sign( lib->session, (CK_BYTE *) s, 
+	if((rv = lib->callbacks->C_Sign( hSession, (CK_BYTE *) s, 
 				(CK_ULONG) i, buf, &ck_sigsize)) != CKR_OK ) {
 		PKI_log_err("HSM_PKCS11_rsa_sign()::Sign failed with 0x%8.8X",
 									rv);
@@ -1156,16 +1156,13 @@ int HSM_PKCS11_rsa_sign ( int type, const unsigned char *m, unsigned int m_len,
 				"small (%s:%d)", __FILE__, __LINE__ );
 		}
 
-		pthread_cond_signal( &lib->pkcs11_cond );
-		pthread_mutex_unlock( &lib->pkcs11_mutex );
-
 		PKI_log_debug("HSM_PKCS11_rsa_sign():: DEBUG %d", __LINE__ );
 
 		goto err;
 	}
 
-	pthread_cond_signal( &lib->pkcs11_cond );
-	pthread_mutex_unlock( &lib->pkcs11_mutex );
+	/* Returns the session to the pool */
+	HSM_PKCS11_session_pool_put( lib, hSession, pool_gen, rv );
 
 	PKI_log_debug("HSM_PKCS11_rsa_sign():: DEBUG %d", __LINE__ );
 	*siglen = (unsigned int) ck_sigsize;
@@ -1187,6 +1184,10 @@ int HSM_PKCS11_rsa_sign ( int type, const unsigned char *m, unsigned int m_len,
 	return 1;
 
 err:
+	// Drops the session (it might still have an active operation)
+	if (pooled) HSM_PKCS11_session_pool_put( lib, hSession, pool_gen,
+				rv != CKR_OK ? rv : CKR_FUNCTION_FAILED );
+
 	// Frees associated memory
 	if (tmps) PKI_Free(tmps);
 	if (buf) PKI_Free(buf);
@@ -1201,6 +1202,153 @@ err:
 	return 0;
 }
 
+/* ------------------------ Batch Signing function --------------------- */
+
+/* Max number of threads used for signing a batch */
+#define HSM_PKCS11_SIGN_BATCH_MAX_THREADS	32
+
+typedef struct hsm_pkcs11_batch_st {
+	PKI_MEM **der;
+	PKI_MEM **sig;
+	int num;
+	int first;
+	int step;
+	const PKI_DIGEST_ALG *digest;
+	const RSA *rsa;
+} HSM_PKCS11_BATCH;
+
+static void * __pkcs11_sign_batch_thread(void *arg) {
+
+	HSM_PKCS11_BATCH *b = (HSM_PKCS11_BATCH *) arg;
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_len = 0;
+	unsigned int sig_len = 0;
+	PKI_MEM *sig = NULL;
+	int i = 0;
+
+	// Each thread signs the blobs at first, first + step, ... and every
+	// signature checks out its own session from the pool
+	for (i = b->first; i < b->num; i += b->step) {
+
+		if (!b->der[i]) continue;
+
+		if (!EVP_Digest(b->der[i]->data, b->der[i]->size, md, &md_len,
+				b->digest, NULL)) {
+			PKI_DEBUG("Can not digest the data to be signed [%d]", i);
+			continue;
+		}
+
+		if ((sig = PKI_MEM_new((size_t) RSA_size(b->rsa))) == NULL) continue;
+
+		sig_len = (unsigned int) sig->size;
+		if (HSM_PKCS11_rsa_sign(EVP_MD_type(b->digest), md, md_len,
+				sig->data, &sig_len, b->rsa) != 1) {
+			PKI_MEM_free(sig);
+			continue;
+		}
+
+		sig->size = sig_len;
+		b->sig[i] = sig;
+	}
+
+	return NULL;
+}
+
+/*! \brief Signs an array of data blobs with a PKCS#11 (RSA) key
+ *
+ * The blobs are signed by up to one thread per session of the slot's
+ * session pool, each signature is a C_SignInit/C_Sign pair on a pooled
+ * session. On return, sig[i] holds the signature for der[i] (or NULL on
+ * error). Returns PKI_OK if all the signatures have been generated.
+ */
+
+int HSM_PKCS11_sign_batch(PKI_MEM **der, PKI_MEM **sig, int num,
+			PKI_DIGEST_ALG *digest, PKI_X509_KEYPAIR *key)
+{
+	HSM_PKCS11_BATCH *jobs = NULL;
+	PKI_THREAD **th = NULL;
+	PKCS11_HANDLER *lib = NULL;
+	HSM *driver = NULL;
+	RSA *rsa = NULL;
+
+	int threads = 0;
+	int ret = PKI_OK;
+	int i = 0;
+
+	if (!der || !sig || num <= 0 || !key || !key->value)
+		return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	for (i = 0; i < num; i++) sig[i] = NULL;
+
+	if (!digest) digest = (PKI_DIGEST_ALG *) PKI_DIGEST_ALG_DEFAULT;
+
+	// Only RSA signing is implemented by the driver
+	if ((rsa = EVP_PKEY_get1_RSA((EVP_PKEY *) key->value)) == NULL)
+		return PKI_ERROR(PKI_ERR_NOT_IMPLEMENTED,
+			"Batch signing supports PKCS#11 RSA keys only");
+
+	if ((driver = (HSM *) RSA_get_ex_data(rsa,
+				KEYPAIR_DRIVER_HANDLER_IDX)) == NULL ||
+			(lib = _hsm_get_pkcs11_handler(driver)) == NULL) {
+		RSA_free(rsa);
+		return PKI_ERROR(PKI_ERR_POINTER_NULL,
+			"Can not get PKCS#11 Library handler");
+	}
+
+	// One thread per pooled session, up to one per blob
+	pthread_mutex_lock(&lib->pool_mutex);
+	threads = lib->pool_len;
+	pthread_mutex_unlock(&lib->pool_mutex);
+
+	if (threads < 1) threads = 1;
+	if (threads > num) threads = num;
+	if (threads > HSM_PKCS11_SIGN_BATCH_MAX_THREADS)
+		threads = HSM_PKCS11_SIGN_BATCH_MAX_THREADS;
+
+	if ((jobs = PKI_Malloc(sizeof(HSM_PKCS11_BATCH) * (size_t) threads)) == NULL ||
+			(th = PKI_Malloc(sizeof(PKI_THREAD *) * (size_t) threads)) == NULL) {
+		if (jobs) PKI_Free(jobs);
+		RSA_free(rsa);
+		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+	}
+
+	for (i = 0; i < threads; i++) {
+		jobs[i].der = der;
+		jobs[i].sig = sig;
+		jobs[i].num = num;
+		jobs[i].first = i;
+		jobs[i].step = threads;
+		jobs[i].digest = digest;
+		jobs[i].rsa = rsa;
+	}
+
+	// The calling thread takes the first share of the work
+	for (i = 1; i < threads; i++) {
+		if ((th[i] = PKI_THREAD_new(__pkcs11_sign_batch_thread, &jobs[i])) == NULL) {
+			PKI_log_debug("Can not spawn signing thread, signing inline");
+			__pkcs11_sign_batch_thread(&jobs[i]);
+		}
+	}
+
+	__pkcs11_sign_batch_thread(&jobs[0]);
+
+	for (i = 1; i < threads; i++) {
+		if (th[i] == NULL) continue;
+		PKI_THREAD_join(th[i], NULL);
+		PKI_Free(th[i]);
+	}
+
+	PKI_Free(th);
+	PKI_Free(jobs);
+	RSA_free(rsa);
+
+	for (i = 0; i < num; i++) {
+		if (der[i] && sig[i] == NULL) ret = PKI_ERR;
+	}
+
+	return ret;
+}
+
 #if OPENSSL_VERSION_NUMBER < 0x1010000fL
 
 ECDSA_SIG *HSM_PKCS11_ecdsa_sign(const unsigned char *dgst, int dgst_len,
@@ -626,6 +626,182 @@ int HSM_PKCS11_session_close( CK_SESSION_HANDLE *hSession, PKCS11_HANDLER *lib){
 }
 
 
+/* ------------------------ Session Pool Functions ------------------------ */
+
+/*
+ * The pool keeps a set of sessions on the currently selected slot that
+ * are checked out (one per thread) for the duration of an operation and
+ * put back when done. Sessions are opened on demand, up to pool_len. As
+ * the PKCS#11 login state is shared among all the sessions of the same
+ * application, sessions in the pool inherit the login from lib->session.
+ * Every checkout records the pool generation: sessions checked out before
+ * the pool was cleared (e.g., on slot change) are closed when put back
+ * instead of ending up in the new pool.
+ */
+
+int HSM_PKCS11_session_pool_init( PKCS11_HANDLER *lib ) {
+
+	HSM_TOKEN_INFO tk_info;
+	int size = 0;
+
+	if (!lib) return PKI_ERR;
+
+	// Closes the sessions from a previously selected slot (if any)
+	HSM_PKCS11_session_pool_clear ( lib );
+
+	// Gets the size from the config, if any
+	if ((size = lib->pool_max) <= 0)
+		size = HSM_PKCS11_SESSION_POOL_DEFAULT_SIZE;
+
+	// Leaves room for lib->session within the token's limits
+	memset(&tk_info, 0, sizeof(HSM_TOKEN_INFO));
+	if (_hsm_pkcs11_get_token_info(lib->slot_id, &tk_info, lib) == PKI_OK &&
+			tk_info.max_sessions != CK_EFFECTIVELY_INFINITE &&
+			tk_info.max_sessions != CK_UNAVAILABLE_INFORMATION &&
+			tk_info.max_sessions <= (unsigned long) size) {
+		size = tk_info.max_sessions > 1 ? (int) tk_info.max_sessions - 1 : 1;
+	}
+
+	pthread_mutex_lock( &lib->pool_mutex );
+
+	if ((lib->pool = PKI_Malloc(sizeof(CK_SESSION_HANDLE) *
+						(size_t) size)) == NULL) {
+		pthread_mutex_unlock( &lib->pool_mutex );
+		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+	}
+
+	lib->pool_len = size;
+	lib->pool_size = 0;
+	lib->pool_free = 0;
+
+	pthread_mutex_unlock( &lib->pool_mutex );
+
+	PKI_log_debug("%s()::Session pool size is %d (slot=%lu)",
+			__PRETTY_FUNCTION__, size, lib->slot_id);
+
+	return PKI_OK;
+}
+
+int HSM_PKCS11_session_pool_get( PKCS11_HANDLER *lib,
+			CK_SESSION_HANDLE *hSession, unsigned long *gen ) {
+
+	CK_RV rv = CKR_OK;
+	unsigned long cur_gen = 0;
+
+	if (!lib || !hSession || !gen) return PKI_ERR;
+
+	pthread_mutex_lock( &lib->pool_mutex );
+
+	// Waits for a session to be returned if we can not open new ones
+	while (lib->pool && lib->pool_free == 0 &&
+				lib->pool_size >= lib->pool_len) {
+		pthread_cond_wait( &lib->pool_cond, &lib->pool_mutex );
+	}
+
+	if (!lib->pool) {
+		pthread_mutex_unlock( &lib->pool_mutex );
+		PKI_log_debug("%s()::No session pool (no slot selected)",
+				__PRETTY_FUNCTION__);
+		return PKI_ERR;
+	}
+
+	*gen = lib->pool_gen;
+
+	if (lib->pool_free > 0) {
+		*hSession = lib->pool[--lib->pool_free];
+		pthread_mutex_unlock( &lib->pool_mutex );
+		return PKI_OK;
+	}
+
+	// Reserves the place in the pool and opens the session unlocked
+	lib->pool_size++;
+	cur_gen = lib->pool_gen;
+	pthread_mutex_unlock( &lib->pool_mutex );
+
+	if ((rv = lib->callbacks->C_OpenSession(lib->slot_id,
+			CKF_SERIAL_SESSION, NULL, NULL, hSession)) != CKR_OK) {
+
+		PKI_log_debug("%s()::Failed opening a new pool session "
+			"(slot=%lu) Error: [0x%8.8X]", __PRETTY_FUNCTION__,
+			lib->slot_id, rv);
+
+		pthread_mutex_lock( &lib->pool_mutex );
+		// The reservation was already dropped if the pool was cleared
+		if (lib->pool_gen == cur_gen && lib->pool_size > 0)
+			lib->pool_size--;
+		pthread_cond_signal( &lib->pool_cond );
+		pthread_mutex_unlock( &lib->pool_mutex );
+
+		return PKI_ERR;
+	}
+
+	return PKI_OK;
+}
+
+int HSM_PKCS11_session_pool_put( PKCS11_HANDLER *lib,
+			CK_SESSION_HANDLE hSession, unsigned long gen, CK_RV rv ) {
+
+	int keep = 0;
+
+	if (!lib) return PKI_ERR;
+
+	pthread_mutex_lock( &lib->pool_mutex );
+
+	// Sessions checked out before the pool was cleared belong to the
+	// old pool (possibly another slot): they are closed and they do
+	// not count against the current pool
+	if (gen != lib->pool_gen) {
+		pthread_mutex_unlock( &lib->pool_mutex );
+		lib->callbacks->C_CloseSession( hSession );
+		return PKI_OK;
+	}
+
+	// Sessions that saw an error might still have an active
+	// operation (or be invalid), therefore they are not recycled
+	if (rv == CKR_OK && lib->pool && lib->pool_free < lib->pool_len) {
+		lib->pool[lib->pool_free++] = hSession;
+		keep = 1;
+	} else if (lib->pool_size > 0) {
+		lib->pool_size--;
+	}
+
+	pthread_cond_signal( &lib->pool_cond );
+	pthread_mutex_unlock( &lib->pool_mutex );
+
+	if (!keep) lib->callbacks->C_CloseSession( hSession );
+
+	return PKI_OK;
+}
+
+void HSM_PKCS11_session_pool_clear( PKCS11_HANDLER *lib ) {
+
+	int i = 0;
+
+	if (!lib) return;
+
+	pthread_mutex_lock( &lib->pool_mutex );
+
+	for (i = 0; i < lib->pool_free; i++) {
+		lib->callbacks->C_CloseSession( lib->pool[i] );
+	}
+
+	if (lib->pool) PKI_Free(lib->pool);
+
+	lib->pool = NULL;
+	lib->pool_len = 0;
+	lib->pool_size = 0;
+	lib->pool_free = 0;
+
+	// Sessions still checked out are closed when put back
+	lib->pool_gen++;
+
+	pthread_cond_broadcast( &lib->pool_cond );
+	pthread_mutex_unlock( &lib->pool_mutex );
+
+	return;
+}
+
+
 int HSM_PKCS11_check_mechanism ( PKCS11_HANDLER *lib, CK_MECHANISM_TYPE mech ) {
 
 	int ret = PKI_ERR;
@@ -72,6 +72,10 @@ int PKI_X509_EXTENSIONS_req_add_profile(const PKI_X509_PROFILE *conf,
 
 /*!
  * \brief Adds extensions to a CRL according to the profile passed as argument
+ *
+ * The CRL number and the deltaCRLIndicator are set when the CRL is generated
+ * (the latter carries the number of the base CRL), the corresponding profile
+ * extensions are skipped when the CRL already carries them.
  */
 
 int PKI_X509_EXTENSIONS_crl_add_profile ( const PKI_X509_PROFILE *conf, 
@@ -90,7 +94,15 @@ int PKI_X509_EXTENSIONS_crl_add_profile ( const PKI_X509_PROFILE *conf,
 
 	for ( i = 0; i < ext_num; i++ ) {
 		if (( ext = PKI_X509_PROFILE_get_ext_by_num ( conf, i, tk )) != NULL ) {
-			PKI_X509_CRL_add_extension ( crl, ext );
+			int nid = OBJ_obj2nid(ext->oid);
+
+			if ((nid == NID_crl_number || nid == NID_delta_crl) &&
+					X509_CRL_get_ext_by_NID(crl->value, nid, -1) >= 0) {
+				PKI_log_debug("Extension %d already present, skipped", i);
+			} else {
+				PKI_X509_CRL_add_extension ( crl, ext );
+			}
+			PKI_X509_EXTENSION_free ( ext );
 		} else {
 			PKI_log_debug ("Can not create EXTENSION number %d", i);
 		}
@@ -158,6 +158,9 @@ PKI_X509_STACK *PKI_X509_STACK_get_url ( URL *url, PKI_DATATYPE type,
 	PKI_MEM_STACK *mem_sk = NULL;
 	PKI_MEM * tmp_mem = NULL;
 
+	PKI_URL_CACHE_REF *cache_ref = NULL;
+		// Reference to the (shared) cached data, if any
+
 	PKI_X509_CERT *x = NULL;
 
 	PKI_SSL *ssl = NULL;
@@ -221,8 +224,16 @@ PKI_X509_STACK *PKI_X509_STACK_get_url ( URL *url, PKI_DATATYPE type,
 
 	}
 
-	// Gets the Stack of PKI_MEM structure from the URL
-	if ((mem_sk = URL_get_data_url(url, 60, 0, ssl)) == NULL) {
+	// Gets the Stack of PKI_MEM structure from the URL, cached objects
+	// (certificates and CRLs) are parsed directly from the cache without
+	// copies
+	if (PKI_URL_CACHE_supported(url, type, 0) == PKI_OK)
+		mem_sk = (PKI_MEM_STACK *) PKI_URL_CACHE_get_data(url, 60, 0,
+							ssl, &cache_ref);
+	else
+		mem_sk = URL_get_data_url(url, 60, 0, ssl);
+
+	if (mem_sk == NULL) {
 
 		// Reports the Error
 		PKI_ERROR(PKI_ERR_POINTER_NULL, 
@@ -240,7 +251,8 @@ PKI_X509_STACK *PKI_X509_STACK_get_url ( URL *url, PKI_DATATYPE type,
 			"Can not allocate PKI_STACK_X509");
 
 		// Free all memory
-		PKI_STACK_MEM_free_all(mem_sk);
+		if (cache_ref) PKI_URL_CACHE_release(cache_ref);
+		else PKI_STACK_MEM_free_all(mem_sk);
 
 		// Nothing more to do
 		return NULL;
@@ -362,6 +374,12 @@ PKI_X509_STACK *PKI_X509_STACK_get_url ( URL *url, PKI_DATATYPE type,
 		}
 	}
 	
+	// The cached data is shared, we just release our reference
+	if (cache_ref) {
+		PKI_URL_CACHE_release(cache_ref);
+		mem_sk = NULL;
+	}
+
 	// Checks if we have memory to free
 	if (mem_sk) {
 
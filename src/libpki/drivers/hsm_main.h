@@ -48,21 +48,53 @@ int PKI_X509_sign (PKI_X509 *x,
 		   const PKI_DIGEST_ALG *alg,
 		   const PKI_X509_KEYPAIR *key );
 
+int PKI_X509_sign_batch (PKI_X509 **x,
+		   int num,
+		   const PKI_DIGEST_ALG *alg,
+		   const PKI_X509_KEYPAIR *key );
+
 PKI_MEM *PKI_sign (const PKI_MEM *der,
 		   const PKI_DIGEST_ALG *alg,
 		   const PKI_X509_KEYPAIR *key );
 
+int PKI_sign_batch (const PKI_MEM **der,
+		   PKI_MEM **sig,
+		   int num,
+		   const PKI_DIGEST_ALG *alg,
+		   const PKI_X509_KEYPAIR *key );
+
 int PKI_X509_verify(const PKI_X509 *x, 
 		    const PKI_X509_KEYPAIR *key );
 
 int PKI_X509_verify_cert(const PKI_X509 *x,
 			 const PKI_X509_CERT *cert );
 
+int PKI_X509_verify_batch(const PKI_X509 **x,
+			  const PKI_X509_KEYPAIR **keys,
+			  int num,
+			  int *status,
+			  int threads );
+
 int PKI_verify_signature(const PKI_MEM *data,
 			 const PKI_MEM *sig,
 			 const PKI_X509_ALGOR_VALUE *alg,
 			 const PKI_X509_KEYPAIR *key );
 
+/* ------------------ Verification Results Cache --------------------- */
+
+#define PKI_VERIFY_CACHE_DEFAULT_SIZE	4096
+#define PKI_VERIFY_CACHE_DEFAULT_TTL	3600
+
+int PKI_VERIFY_CACHE_set_size ( int entries );
+int PKI_VERIFY_CACHE_set_ttl ( int secs );
+
+void PKI_VERIFY_CACHE_flush ( void );
+int PKI_VERIFY_CACHE_invalidate_key ( const PKI_X509_KEYPAIR *key );
+
+int PKI_VERIFY_CACHE_get_stats ( unsigned long *hits,
+				 unsigned long *misses,
+				 int *entries );
+
 /* ------------------- PKI Object Retrieval ( Get ) ----------------------- */
 
 PKI_X509_STACK *HSM_X509_STACK_get_url ( PKI_DATATYPE type, URL *url,
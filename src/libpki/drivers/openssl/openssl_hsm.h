@@ -25,6 +25,9 @@ int HSM_OPENSSL_is_fips_mode(const HSM *driver);
 PKI_MEM * HSM_OPENSSL_sign ( PKI_MEM *der, PKI_DIGEST_ALG *digest,
 					PKI_X509_KEYPAIR *key );
 
+int HSM_OPENSSL_sign_batch ( PKI_MEM **der, PKI_MEM **sig, int num,
+			PKI_DIGEST_ALG *digest, PKI_X509_KEYPAIR *key );
+
 /*
 int HSM_OPENSSL_verify ( PKI_X509 *x, PKI_X509_KEYPAIR *key );
 */
@@ -45,8 +45,33 @@ typedef struct pkcs11_handler {
 	pthread_mutex_t pkcs11_mutex;
 	pthread_cond_t pkcs11_cond;
 
+	/* Pool of Sessions for concurrent (e.g., Sign) operations */
+	CK_SESSION_HANDLE *pool;
+
+	/* Max number of sessions in the pool from config (0 for default) */
+	int pool_max;
+
+	/* Size of the pool (capped by the token's ulMaxSessionCount) */
+	int pool_len;
+
+	/* Number of sessions opened by the pool (free or checked out) */
+	int pool_size;
+
+	/* Number of sessions available for checkout (top of pool) */
+	int pool_free;
+
+	/* Generation of the pool (bumped every time the pool is cleared) */
+	unsigned long pool_gen;
+
+	/* Pool Mutex and Condition (waiting for a free session) */
+	pthread_mutex_t pool_mutex;
+	pthread_cond_t pool_cond;
+
 } PKCS11_HANDLER;
 
+/* Default max number of sessions in the pool when not configured */
+#define HSM_PKCS11_SESSION_POOL_DEFAULT_SIZE	8
+
 HSM * HSM_PKCS11_new( PKI_CONFIG *conf );
 int HSM_PKCS11_free ( HSM *driver, PKI_CONFIG *conf );
 
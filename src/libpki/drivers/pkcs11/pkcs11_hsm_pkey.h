@@ -24,6 +24,9 @@ const EC_KEY_METHOD * HSM_PKCS11_get_ecdsa_method ( void );
 int HSM_PKCS11_rsa_sign ( int type, const unsigned char *m, unsigned int m_len,
 	unsigned char *sigret, unsigned int *siglen, const RSA *rsa );
 
+int HSM_PKCS11_sign_batch ( PKI_MEM **der, PKI_MEM **sig, int num,
+	PKI_DIGEST_ALG *digest, PKI_X509_KEYPAIR *key );
+
 #if OPENSSL_VERSION_NUMBER < 0x1010000fL
 
 ECDSA_SIG *HSM_PKCS11_ecdsa_sign(const unsigned char *dgst, int dgst_len,
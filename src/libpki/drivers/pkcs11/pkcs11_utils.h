@@ -22,6 +22,14 @@ int HSM_PKCS11_session_new( unsigned long slot_id, CK_SESSION_HANDLE *hSession,
 					int flags, PKCS11_HANDLER *lib );
 int HSM_PKCS11_session_close( CK_SESSION_HANDLE *hSession, PKCS11_HANDLER *lib);
 
+/* Session Pool Handling */
+int HSM_PKCS11_session_pool_init( PKCS11_HANDLER *lib );
+int HSM_PKCS11_session_pool_get( PKCS11_HANDLER *lib,
+			CK_SESSION_HANDLE *hSession, unsigned long *gen );
+int HSM_PKCS11_session_pool_put( PKCS11_HANDLER *lib,
+			CK_SESSION_HANDLE hSession, unsigned long gen, CK_RV rv );
+void HSM_PKCS11_session_pool_clear( PKCS11_HANDLER *lib );
+
 /* Finds the first occurrence of an object */
 CK_OBJECT_HANDLE * HSM_PKCS11_get_obj( CK_ATTRIBUTE *templ,
 			int size, PKCS11_HANDLER *lib, CK_SESSION_HANDLE *s);
@@ -230,6 +230,10 @@ typedef struct callbacks_st {
   /* General Signing function */
   PKI_MEM * (*sign) (PKI_MEM *, PKI_DIGEST_ALG *, PKI_X509_KEYPAIR *);
 
+  /* Batch Signing function (signs num blobs, sig[i] is NULL on error) */
+  int (*sign_batch) (PKI_MEM **, PKI_MEM **, int, PKI_DIGEST_ALG *,
+              PKI_X509_KEYPAIR *);
+
   /* General Verify Function */
   int    (*verify)(PKI_MEM *, PKI_MEM *, PKI_X509_ALGOR_VALUE *,
               PKI_X509_KEYPAIR * );
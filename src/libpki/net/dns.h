@@ -31,6 +31,40 @@ enum pki_dns {
 #define T_CERT	36
 #endif
 
+/* Resolver cache defaults */
+#define PKI_DNS_CACHE_MAX_ENTRIES	1024
+#define PKI_DNS_CACHE_MAX_TTL		3600
+
+/* Time (secs) negative answers (no such name or records) are cached for */
+#define PKI_DNS_CACHE_NEGATIVE_TTL	30
+
+/* Time (secs) the addresses of hosts (getaddrinfo) are cached for */
+#define PKI_DNS_CACHE_HOST_TTL		60
+
+/* Used entries are refreshed when this % of their TTL is left */
+#define PKI_DNS_CACHE_REFRESH_PCT	10
+
+/* Same as res_search() for the C_IN class */
+typedef int (*PKI_DNS_RESOLVER)(const char *name, int type,
+				unsigned char *answer, int anslen);
+
+int PKI_DNS_CACHE_getaddrinfo(const char *host, int port,
+			      struct addrinfo **res);
+
+void PKI_DNS_CACHE_freeaddrinfo(struct addrinfo *res);
+
+int PKI_DNS_CACHE_set_limits(int max_entries, int max_ttl);
+
+int PKI_DNS_CACHE_set_resolver(PKI_DNS_RESOLVER resolver);
+
+int PKI_DNS_CACHE_get_stats(unsigned long *hits, unsigned long *misses,
+			    unsigned long *refreshes, double *rate,
+			    double *latency);
+
+void PKI_DNS_CACHE_flush(void);
+
+void PKI_DNS_CACHE_cleanup(void);
+
 PKI_MEM_STACK *URL_get_data_dns_url(const URL * url,
 		                            ssize_t     size);
 
@@ -26,6 +26,38 @@
 #define LIBPKI_HTTP_BUF_SIZE		8192
 #define LIBPKI_HTTPS_BUF_SIZE		8192
 
+/* Default limits for the pool of persistent client connections */
+#define PKI_HTTP_POOL_MAX_IDLE		32
+#define PKI_HTTP_POOL_IDLE_TIMEOUT	30
+
+typedef enum {
+	PKI_HTTP_BODY_NONE	= 0,
+	PKI_HTTP_BODY_LENGTH,
+	PKI_HTTP_BODY_CHUNKED,
+	PKI_HTTP_BODY_CLOSE,
+} PKI_HTTP_BODY_MODE;
+
+/*! \brief Incremental HTTP/1.1 parser, it keeps the state of a connection
+ *         across (pipelined) messages */
+typedef struct pki_http_parser_st {
+	// Received and not yet consumed data
+	PKI_MEM buf;
+	// Max size of the header and of the body (0 for no limit)
+	size_t max_size;
+	// The end of header has been searched up to here
+	size_t scan;
+	// Parsing position in the current message
+	size_t pos;
+	// Message whose header has been parsed
+	PKI_HTTP *msg;
+	PKI_HTTP_BODY_MODE mode;
+	// Body (or chunk) bytes still expected
+	unsigned long long left;
+	int chunk_state;
+	// Bytes read over the lifetime of the parser
+	unsigned long long received;
+} PKI_HTTP_PARSER;
+
 
 /* ----------------------------- HTTP HELP Functions -------------------- */
 
@@ -43,6 +75,32 @@ PKI_HTTP *PKI_HTTP_get_message(const PKI_SOCKET * sock,
 		                       int                timeout,
 							   size_t             max_size);
 
+/* ------------------------ HTTP Incremental Parser --------------------- */
+
+PKI_HTTP_PARSER *PKI_HTTP_PARSER_new(size_t max_size);
+
+void PKI_HTTP_PARSER_free(PKI_HTTP_PARSER *p);
+
+int PKI_HTTP_PARSER_add(PKI_HTTP_PARSER *p,
+		        const void      *data,
+			size_t           size);
+
+int PKI_HTTP_PARSER_get_message(PKI_HTTP_PARSER  *p,
+		                int               eof,
+				PKI_HTTP        **msg);
+
+size_t PKI_HTTP_PARSER_pending(const PKI_HTTP_PARSER *p);
+
+PKI_HTTP *PKI_HTTP_PARSER_read_message(PKI_HTTP_PARSER  * p,
+		                       const PKI_SOCKET * sock,
+				       int                timeout);
+
+/* ------------------------- HTTP Connection Pool ----------------------- */
+
+int PKI_HTTP_POOL_set_limits(int max_idle, int idle_timeout);
+
+void PKI_HTTP_POOL_flush(void);
+
 /* --------------------- HTTP Generic GET/POST Functions ---------------- */
 
 int PKI_HTTP_get_url (const URL      * url,
@@ -78,6 +136,15 @@ int PKI_HTTP_GET_data_url(const URL      * url,
 					      PKI_MEM_STACK ** ret,
 					      PKI_SSL  * ssl);
 
+int PKI_HTTP_GET_data_url_cond(const URL      * url,
+			       const char     * etag,
+			       const char     * last_modified,
+			       int              timeout,
+			       size_t           max_size,
+			       PKI_MEM_STACK ** ret,
+			       PKI_HTTP      ** resp,
+			       PKI_SSL        * ssl);
+
 int PKI_HTTP_GET_data_socket(const PKI_SOCKET * url,
 		                     int                timeout,
 							 size_t             max_size,
@@ -20,9 +20,25 @@
 	defined(LDAP_VENDOR_MICROSOFT)
 #include <ldap.h>
 
+/* Session pool defaults */
+#define PKI_LDAP_POOL_MAX_IDLE		8
+#define PKI_LDAP_POOL_IDLE_TIMEOUT	60
+
+/* Max number of outstanding searches on a session (batch searches) */
+#define PKI_LDAP_BATCH_WINDOW		64
+
 LDAP *URL_LDAP_connect(const URL *url, int timeout );
 PKI_MEM_STACK *URL_get_data_ldap_url(const URL *url, int timeout, ssize_t size);
 
+int URL_get_data_ldap_batch(const URL *url, const char **dn, int num,
+			    PKI_MEM_STACK **results, int timeout,
+			    ssize_t size);
+
+int PKI_LDAP_POOL_set_limits(int max_idle, int idle_timeout);
+int PKI_LDAP_POOL_get_stats(unsigned long *opened, unsigned long *reused,
+			    unsigned long *retried);
+void PKI_LDAP_POOL_flush(void);
+
 #endif
 
 #endif
@@ -0,0 +1,131 @@
+/*
+ * LIBPKI - Easy PKI Library
+ * by Massimiliano Pala (madwolf@openca.org)
+ *
+ * Copyright (c) 2007-2012 by Massimiliano Pala and OpenCA Labs.
+ * All rights reserved.
+ *
+ * ====================================================================
+ *
+ */
+
+/* PKI_NET_LOOP - event driven (epoll) server loop for PKI_SOCKET */
+
+#ifndef _LIBPKI_NET_LOOP_H
+#define _LIBPKI_NET_LOOP_H
+
+#define PKI_NET_LOOP_MAX_LISTENERS	16
+#define PKI_NET_LOOP_DEFAULT_CONNS	16384
+
+typedef enum {
+	PKI_NET_EVENT_ACCEPT	= 0,
+	PKI_NET_EVENT_READ	= 1,
+	PKI_NET_EVENT_WRITE	= 2,
+	PKI_NET_EVENT_TIMEOUT	= 3,
+	PKI_NET_EVENT_CLOSE	= 4,
+} PKI_NET_EVENT;
+
+typedef enum {
+	PKI_NET_CONN_FREE	= 0,
+	PKI_NET_CONN_HANDSHAKE	= 1,
+	PKI_NET_CONN_OPEN	= 2,
+	PKI_NET_CONN_CLOSING	= 3,
+} PKI_NET_CONN_STATE;
+
+struct pki_net_conn_st;
+struct pki_net_loop_st;
+
+/*! \brief Connection callback. Returning PKI_ERR closes the connection
+ *         (after the pending output has been flushed). The return value
+ *         is ignored for PKI_NET_EVENT_CLOSE. */
+typedef int (*PKI_NET_LOOP_CB)(struct pki_net_conn_st *conn,
+				PKI_NET_EVENT event, void *arg);
+
+typedef struct pki_net_listener_st {
+	int fd;
+	// Server side (initialized) PKI_SSL, NULL for plain connections
+	PKI_SSL *ssl;
+	PKI_NET_LOOP_CB cb;
+	void *arg;
+	// Idle timeout (secs) for accepted connections, 0 for none
+	int timeout;
+} PKI_NET_LISTENER;
+
+typedef struct pki_net_conn_st {
+	// Slot index and generation (guards against stale events)
+	unsigned int id;
+	unsigned int gen;
+	PKI_NET_CONN_STATE state;
+
+	// Set once ACCEPT has been delivered (CLOSE is delivered only then)
+	int accepted;
+
+	PKI_SOCKET *sock;
+	PKI_NET_LISTENER *listener;
+	struct pki_net_loop_st *loop;
+
+	// Output not yet accepted by the socket
+	PKI_MEM out;
+
+	// Owned by a worker, events received meanwhile are in 'events'
+	int busy;
+	unsigned int events;
+	int registered;
+	int want_write;
+	int eof;
+
+	int timeout;
+	time_t deadline;
+
+	void *data;
+	struct pki_net_conn_st *next;
+} PKI_NET_CONN;
+
+typedef struct pki_net_loop_st {
+	int epfd;
+	int evfd;
+	volatile int stop;
+
+	PKI_NET_CONN *conns;
+	int max_conns;
+	int num_conns;
+	PKI_NET_CONN *free_list;
+
+	PKI_NET_LISTENER listeners[PKI_NET_LOOP_MAX_LISTENERS];
+	int num_listeners;
+
+	PKI_THREAD **workers;
+	int num_workers;
+
+	// Queue of connections with events to process
+	PKI_NET_CONN *queue_head;
+	PKI_NET_CONN *queue_tail;
+
+	PKI_MUTEX mutex;
+	PKI_COND cond;
+} PKI_NET_LOOP;
+
+/* PKI_NET_LOOP management */
+PKI_NET_LOOP *PKI_NET_LOOP_new(int workers, int max_conns);
+void PKI_NET_LOOP_free(PKI_NET_LOOP *loop);
+
+int PKI_NET_LOOP_add_listener(PKI_NET_LOOP *loop, int fd, PKI_SSL *ssl,
+		PKI_NET_LOOP_CB cb, void *arg, int timeout);
+
+int PKI_NET_LOOP_run(PKI_NET_LOOP *loop);
+int PKI_NET_LOOP_stop(PKI_NET_LOOP *loop);
+
+/* Connection functions - to be used from within the callbacks */
+ssize_t PKI_NET_CONN_read(PKI_NET_CONN *conn, void *buf, size_t size);
+ssize_t PKI_NET_CONN_write(PKI_NET_CONN *conn, const void *buf, size_t size);
+
+int PKI_NET_CONN_set_timeout(PKI_NET_CONN *conn, int timeout);
+int PKI_NET_CONN_close(PKI_NET_CONN *conn);
+
+int PKI_NET_CONN_get_fd(const PKI_NET_CONN *conn);
+PKI_SOCKET *PKI_NET_CONN_get_socket(const PKI_NET_CONN *conn);
+
+void PKI_NET_CONN_set_data(PKI_NET_CONN *conn, void *data);
+void *PKI_NET_CONN_get_data(const PKI_NET_CONN *conn);
+
+#endif
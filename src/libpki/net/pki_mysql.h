@@ -3,6 +3,16 @@
 #ifndef _LIBPKI_URL_MYSQL_H
 #define _LIBPKI_URL_MYSQL_H
 
+/* Connection pool defaults */
+#define PKI_MYSQL_POOL_MAX_IDLE		16
+#define PKI_MYSQL_POOL_IDLE_TIMEOUT	60
+
+/* Idle connections are checked (ping) before reuse after this time (secs) */
+#define PKI_MYSQL_POOL_PING_INTERVAL	5
+
+/* Max number of prepared statements kept on a pooled connection */
+#define PKI_MYSQL_POOL_MAX_STMTS	32
+
 #ifdef HAVE_MYSQL
 
 #include <mysql.h>
@@ -21,4 +31,9 @@ PKI_MEM_STACK *URL_get_data_mysql_url ( const URL *url, ssize_t size );
 int URL_put_data_mysql ( const char *url_s, const PKI_MEM *data );
 int URL_put_data_mysql_url ( const URL *url, const PKI_MEM *data );
 
+int PKI_MYSQL_POOL_set_limits(int max_idle, int idle_timeout);
+int PKI_MYSQL_POOL_get_stats(unsigned long *opened, unsigned long *reused,
+			 unsigned long *retried);
+void PKI_MYSQL_POOL_flush(void);
+
 #endif /* _LIBPKI_URL_MYSQL_H */
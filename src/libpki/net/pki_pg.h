@@ -3,6 +3,13 @@
 #ifndef _LIBPKI_URL_PG_H
 #define _LIBPKI_URL_PG_H
 
+/* Connection pool defaults */
+#define PKI_PG_POOL_MAX_IDLE		16
+#define PKI_PG_POOL_IDLE_TIMEOUT	60
+
+/* Max number of prepared statements kept on a pooled connection */
+#define PKI_PG_POOL_MAX_STMTS		32
+
 #ifdef HAVE_PG
 
 #include <libpq-fe.h>
@@ -21,4 +28,9 @@ PKI_MEM_STACK *URL_get_data_pg_url ( const URL *url, ssize_t size );
 int URL_put_data_pg ( const char *url_s, const PKI_MEM *data );
 int URL_put_data_pg_url ( const URL *url, const PKI_MEM *data );
 
+int PKI_PG_POOL_set_limits(int max_idle, int idle_timeout);
+int PKI_PG_POOL_get_stats(unsigned long *opened, unsigned long *reused,
+			 unsigned long *retried);
+void PKI_PG_POOL_flush(void);
+
 #endif /* _LIBPKI_URL_PG_H */
@@ -224,6 +224,42 @@ typedef enum {
 #define PKI_SSL_CIPHERS_DEFAULT \
 	PKI_SSL_CIPHERS_TLS1_2
 
+/* Size of the digests used to identify SSL_CTX configurations */
+#define PKI_SSL_CACHE_KEY_SIZE		32
+
+/* Limits for the (client side) SSL_CTX and sessions cache */
+#define PKI_SSL_CACHE_MAX_CTX		64
+#define PKI_SSL_CACHE_MAX_SESSIONS	256
+
+/*! \brief Read-only index of trusted certificates, can be shared across
+ *         PKI_SSL objects (see PKI_SSL_set_trust_store) */
+
+typedef struct pki_trust_store_st {
+
+	/* Trusted certificates (a reference is held on each one) */
+	X509 **certs;
+	int size;
+
+	/* Hash tables by subject name and by subjectKeyIdentifier, buckets
+	 * and chains are indexes in the certs array (-1 terminated) */
+	int num_buckets;
+	int *subject_buckets;
+	int *subject_next;
+	int *ski_buckets;
+	int *ski_next;
+
+	/* OpenSSL store with the same certificates (for SSL_CTX) */
+	X509_STORE *store;
+
+	/* Digest of the trusted certificates (identifies the trust set) */
+	unsigned char digest[PKI_SSL_CACHE_KEY_SIZE];
+
+	/* Reference counting */
+	int references;
+	PKI_MUTEX lock;
+
+} PKI_TRUST_STORE;
+
 /*! \brief PKI_SSL data structure for SSL/TLS */
 
 typedef struct  pki_ssl_t {
@@ -238,6 +274,10 @@ typedef struct  pki_ssl_t {
 	SSL *ssl;
 	SSL_CTX *ssl_ctx;
 	char *cipher;
+
+	/* Set to 1 when ssl_ctx is shared via the SSL_CTX cache */
+	int ctx_cached;
+
 	const PKI_SSL_ALGOR *algor;
 
 	/* Pointer to the PKI_TOKEN to be used for the communication */
@@ -246,6 +286,10 @@ typedef struct  pki_ssl_t {
 	/* PKI_X509_CERT_STACK of trusted certificates */
 	PKI_X509_CERT_STACK *trusted_certs;
 
+	/* Index of the trusted certificates (built from trusted_certs when
+	 * not explicitly set via PKI_SSL_set_trust_store) */
+	PKI_TRUST_STORE *trust_store;
+
 	/* PKI_X509_CERT_STACK of other certificates (e.g., SubCAs to facilitate
 	 * the certificate's chain building) */
 	PKI_X509_CERT_STACK *other_certs;
@@ -256,7 +300,7 @@ typedef struct  pki_ssl_t {
 	/* Server name - used to set the TLS extension */
 	char *servername;
 
-	/* Not Used, yet */
+	/* Key for the sessions cache (server name and peer address) */
 	char *session;
 
 	/* After authentication, if set to 1 we continue */
@@ -296,6 +340,8 @@ int PKI_SSL_set_token ( PKI_SSL *ssl, struct pki_token_st *tk );
 
 int PKI_SSL_set_trusted ( PKI_SSL *ssl, PKI_X509_CERT_STACK *sk );
 int PKI_SSL_add_trusted ( PKI_SSL *ssl, PKI_X509_CERT *cert );
+int PKI_SSL_set_trust_store ( PKI_SSL *ssl, PKI_TRUST_STORE *ts );
+PKI_TRUST_STORE * PKI_SSL_get_trust_store ( PKI_SSL *ssl );
 int PKI_SSL_set_others ( PKI_SSL *ssl, PKI_X509_CERT_STACK *sk );
 int PKI_SSL_add_other ( PKI_SSL *ssl, PKI_X509_CERT *cert );
 
@@ -311,6 +357,9 @@ int PKI_SSL_connect_url ( PKI_SSL *ssl, URL *url, int timeout );
 int PKI_SSL_connect ( PKI_SSL *ssl, char *url_s, int timeout );
 
 int PKI_SSL_start_ssl ( PKI_SSL *ssl, int fd );
+
+int PKI_SSL_init_ctx ( PKI_SSL *ssl );
+PKI_SSL * PKI_SSL_new_accept ( PKI_SSL *ssl, int fd );
 int PKI_SSL_close ( PKI_SSL *ssl );
 
 ssize_t PKI_SSL_write(const PKI_SSL * ssl,
@@ -326,4 +375,30 @@ PKI_X509_CERT_STACK * PKI_SSL_get_peer_chain ( PKI_SSL *ssl );
 
 const char *PKI_SSL_get_servername ( PKI_SSL *ssl );
 
+int PKI_SSL_session_reused ( PKI_SSL *ssl );
+
+/* SSL_CTX and Sessions Cache (client side) */
+int PKI_SSL_CACHE_set_enabled ( int enabled );
+void PKI_SSL_CACHE_flush ( void );
+int PKI_SSL_CACHE_get_stats ( unsigned long *ctx_hits,
+			      unsigned long *ctx_misses,
+			      unsigned long *resumed,
+			      unsigned long *full,
+			      double *ratio );
+
+/* Trust Store */
+PKI_TRUST_STORE * PKI_TRUST_STORE_new ( PKI_X509_CERT_STACK *sk );
+PKI_TRUST_STORE * PKI_TRUST_STORE_dup ( PKI_TRUST_STORE *ts );
+void PKI_TRUST_STORE_free ( PKI_TRUST_STORE *ts );
+
+int PKI_TRUST_STORE_elements ( const PKI_TRUST_STORE *ts );
+
+int PKI_TRUST_STORE_find ( const PKI_TRUST_STORE *ts,
+			   PKI_X509_CERT_VALUE *x );
+const PKI_X509_CERT_VALUE * PKI_TRUST_STORE_find_issuer (
+			   const PKI_TRUST_STORE *ts,
+			   PKI_X509_CERT_VALUE *x );
+int PKI_TRUST_STORE_check ( const PKI_TRUST_STORE *ts,
+			    PKI_X509_CERT_VALUE *x );
+
 #endif
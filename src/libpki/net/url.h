@@ -110,10 +110,25 @@ typedef struct http_headers {
     /* HTTP body data */
     PKI_MEM *body;
 
+    /* Set if the connection can carry other messages */
+    int keep_alive;
+
 } PKI_HTTP;
 
 #define LIBPKI_URL_BUF_SIZE    8192
 
+/* URL cache defaults */
+#define PKI_URL_CACHE_MAX_ENTRIES	64
+/* Max time (secs) an object is used without revalidation (CRL nextUpdate) */
+#define PKI_URL_CACHE_MAX_AGE		86400
+
+/* Default limits for parallel retrievals (URL_get_data_multi) */
+#define PKI_URL_MULTI_MAX_PARALLEL	16
+#define PKI_URL_MULTI_MAX_PER_HOST	4
+
+/* Shared (read-only) reference to the data of a cached URL */
+typedef struct pki_url_cache_entry_st PKI_URL_CACHE_REF;
+
 #include <libpki/pki_mem.h>
 #include <libpki/net/pki_socket.h>
 
@@ -145,6 +160,24 @@ PKI_MEM_STACK * URL_get_data_socket(const PKI_SOCKET *sock,
                                     int timeout,
                                     ssize_t size);
 
+int URL_get_data_multi(const char    ** urls,
+                       int               num,
+                       int               timeout,
+                       ssize_t           max_size,
+                       PKI_SSL         * ssl,
+                       PKI_MEM_STACK  ** results,
+                       int             * errors);
+
+int URL_get_data_multi_url(const URL     ** urls,
+                           int               num,
+                           int               timeout,
+                           ssize_t           max_size,
+                           PKI_SSL         * ssl,
+                           PKI_MEM_STACK  ** results,
+                           int             * errors);
+
+int PKI_URL_MULTI_set_limits(int max_parallel, int max_per_host);
+
 int URL_put_data(const char     * url_s,
                  const PKI_MEM  * data,
                  const char     * contType,
@@ -191,6 +224,34 @@ int URL_put_data_fd(const URL     * url,
 int URL_put_data_file(const URL     * url,
                       const PKI_MEM * data);
 
+/* ------------------------------ URL cache ----------------------------- */
+
+int PKI_URL_CACHE_supported(const URL    * url,
+                            PKI_DATATYPE   type,
+                            ssize_t        max_size);
+
+const PKI_MEM_STACK * PKI_URL_CACHE_get_data(const URL          * url,
+                                             int                  timeout,
+                                             ssize_t              max_size,
+                                             PKI_SSL            * ssl,
+                                             PKI_URL_CACHE_REF ** ref);
+
+void PKI_URL_CACHE_release(PKI_URL_CACHE_REF *ref);
+
+int PKI_URL_CACHE_set_limits(int max_entries, int max_age);
+
+void PKI_URL_CACHE_set_file_urls(int enabled);
+
+int PKI_URL_CACHE_set_dir(const char *dir);
+
+int PKI_URL_CACHE_get_stats(unsigned long *hits,
+                            unsigned long *revalidated,
+                            unsigned long *misses);
+
+void PKI_URL_CACHE_flush(void);
+
+void PKI_URL_CACHE_cleanup(void);
+
 /* ---------------------------- URL macros ------------------------------ */
 
 #define getParsedUrl(a) URL_new(a)
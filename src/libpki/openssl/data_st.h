@@ -562,6 +562,92 @@ typedef struct pki_keyparams_st {
 
 typedef X509_REVOKED	PKI_X509_CRL_ENTRY;
 
+/* Immutable (sorted) index of the revoked serials of a CRL */
+typedef struct pki_x509_crl_index_st {
+	/* Number of (unique) indexed serials */
+	int size;
+	/* Sorted serials, each one is [sign byte][big-endian magnitude] */
+	unsigned char *serials;
+	/* Offsets of the serials in the buffer (size + 1 elements) */
+	size_t *offsets;
+	/* Revocation reasons side table (-1 when not present) */
+	int *reasons;
+	/* Revocation dates side table (references into the CRL) */
+	const PKI_TIME **dates;
+	/* CRL entries side table (references into the CRL) */
+	const PKI_X509_CRL_ENTRY **entries;
+	/* Referenced CRL value, keeps the side tables valid */
+	X509_CRL *crl;
+	/* Referenced delta CRL value (base + delta indexes only) */
+	X509_CRL *delta;
+} PKI_X509_CRL_INDEX;
+
+/* Incremental CRL builder, entries are kept in columnar buffers */
+typedef struct pki_x509_crl_builder_st {
+	/* Number of appended entries */
+	int size;
+	/* Allocated elements in the side tables */
+	int capacity;
+	/* Appended serials, each one is [big-endian magnitude] */
+	PKI_MEM serials;
+	/* Offsets of the serials in the buffer (size + 1 elements) */
+	size_t *offsets;
+	/* Revocation dates side table (seconds since the epoch) */
+	time_t *dates;
+	/* Revocation reasons side table */
+	int *reasons;
+	/* Non-zero while the entries are appended in ascending order */
+	int sorted;
+	/* Statistics about the last generated CRL */
+	int last_entries;
+	double last_secs;
+} PKI_X509_CRL_BUILDER;
+
+/* Iterator used to feed a PKI_X509_CRL_BUILDER (e.g., from a DB cursor),
+ * returns 1 when an entry is returned, 0 at the end and -1 on error */
+typedef int (*PKI_X509_CRL_BUILDER_ITER)(void *arg, const char **serial,
+					time_t *revDate, int *reason);
+
+/* Extension of a compiled certificate profile */
+typedef struct pki_x509_profile_template_ext_st {
+	/* Resolved extension identifier (NID_undef if not known) */
+	int nid;
+	/* Extension name, as found in the profile */
+	char *name;
+	/* Extension value (in X509V3 configuration syntax) */
+	char *value;
+	/* Pre-encoded extension, NULL when it depends on the issued cert */
+	X509_EXTENSION *ext;
+} PKI_X509_PROFILE_TEMPLATE_EXT;
+
+/* Immutable, pre-parsed certificate profile used at issuance time */
+typedef struct pki_x509_profile_template_st {
+	/* Compiled profile and OIDs (identity only, never dereferenced) */
+	const void *profile;
+	const void *oids;
+	/* Modification stamps of the profile and OIDs when compiled */
+	unsigned long profile_stamp;
+	unsigned long oids_stamp;
+	/* Certificate version (as encoded, i.e. 2 for v3) */
+	int version;
+	/* Subject from /profile/subject/dn (NULL if not present) */
+	X509_NAME *subject;
+	/* notBefore offset and validity period, in seconds */
+	int64_t notBefore;
+	uint64_t validity;
+	/* Signing algorithm from /profile/keyParams/algorithm */
+	X509_ALGOR *algor;
+	const EVP_MD *digest;
+	/* Encoding of EC public keys (-1 to keep the key's own) */
+	int ec_form;
+	int ec_asn1flags;
+	/* Extensions, in profile order */
+	int exts_num;
+	PKI_X509_PROFILE_TEMPLATE_EXT *exts;
+	/* Reference count (the only mutable field) */
+	int references;
+} PKI_X509_PROFILE_TEMPLATE;
+
 typedef struct pki_digest_data {
 	const PKI_DIGEST_ALG *algor;
 	unsigned char *digest;
@@ -608,6 +694,32 @@ typedef struct pki_ocsp_resp_st {
 	OCSP_BASICRESP *bs;
 } PKI_OCSP_RESP;
 
+/* Signed and DER encoded OCSP response for a single CertID */
+typedef struct pki_ocsp_resp_cache_entry_st {
+	/* DER of the response - first, as callers get a pointer to it */
+	PKI_MEM der;
+	/* Lookup key (issuerNameHash, issuerKeyHash, serial) */
+	unsigned char *key;
+	size_t key_size;
+	unsigned long hash;
+	/* The response is served until its nextUpdate */
+	time_t expires;
+	/* References held by the cache and by the callers */
+	int refs;
+	struct pki_ocsp_resp_cache_entry_st *next;
+} PKI_OCSP_RESP_CACHE_ENTRY;
+
+/* Cache of pre-encoded OCSP responses keyed by CertID */
+typedef struct pki_ocsp_resp_cache_st {
+	PKI_OCSP_RESP_CACHE_ENTRY **buckets;
+	int size;
+	int max_entries;
+	int entries;
+	unsigned long hits;
+	unsigned long misses;
+	PKI_MUTEX mutex;
+} PKI_OCSP_RESP_CACHE;
+
 typedef enum {
 	PKI_X509_OCSP_RESPID_NOT_SET       = -1,
 	PKI_X509_OCSP_RESPID_TYPE_BY_NAME  =  0,
@@ -311,6 +311,7 @@ typedef enum {
 #include <libpki/net/http_s.h>
 #include <libpki/net/ldap.h>
 #include <libpki/net/dns.h>
+#include <libpki/net/net_loop.h>
 
 /* General X509 object */
 #include <libpki/pki_x509_data_st.h>
@@ -4,8 +4,27 @@
 #define _LIBPKI_DIGEST_H
 
 
+/* Number of contexts of each type cached by every thread */
+#define PKI_DIGEST_CTX_POOL_SIZE	8
+
+EVP_MD_CTX * PKI_DIGEST_CTX_get(const PKI_DIGEST_ALG *alg);
+
+EVP_PKEY_CTX * PKI_DIGEST_PKEY_CTX_get(const PKI_X509_KEYPAIR_VALUE *pkey,
+                                       const PKI_DIGEST_ALG *alg,
+                                       int sign);
+
+void PKI_DIGEST_PKEY_CTX_invalidate(void);
+
+void PKI_DIGEST_CTX_flush(void);
+
 void PKI_DIGEST_free(PKI_DIGEST *data);
 
+int PKI_DIGEST_calculate(const PKI_DIGEST_ALG * alg,
+                         const unsigned char  * data,
+                         size_t                 size,
+                         unsigned char        * out,
+                         size_t                 out_size);
+
 PKI_DIGEST *PKI_DIGEST_new(const PKI_DIGEST_ALG * alg, 
                            const unsigned char  * data,
                            size_t                 size);
@@ -49,6 +49,27 @@ PKI_X509_KEYPAIR *PKI_X509_KEYPAIR_new_url_kp(PKI_KEYPARAMS * kp,
                                               PKI_CRED      * cred,
                                               HSM           * hsm);
 
+/* ------------------------ Background Key Pool --------------------- */
+
+#define PKI_X509_KEYPAIR_POOL_MAX		16
+#define PKI_X509_KEYPAIR_POOL_MAX_THREADS	16
+
+int PKI_X509_KEYPAIR_POOL_set(PKI_SCHEME_ID scheme,
+                              int           bits,
+                              int           curve,
+                              int           watermark);
+
+int PKI_X509_KEYPAIR_POOL_set_threads(int threads);
+
+int PKI_X509_KEYPAIR_POOL_get_stats(PKI_SCHEME_ID   scheme,
+                                    int             bits,
+                                    int             curve,
+                                    int           * depth,
+                                    unsigned long * hits,
+                                    unsigned long * misses);
+
+void PKI_X509_KEYPAIR_POOL_cleanup(void);
+
 /* ------------------------ General Functions ----------------------- */
 
 char *PKI_X509_KEYPAIR_get_parsed(const PKI_X509_KEYPAIR *pkey );
@@ -25,6 +25,7 @@ typedef enum {
 	PKI_LOG_FLAGS_NONE 				= 0,
 	PKI_LOG_FLAGS_ENABLE_DEBUG   	= 0x01,
 	PKI_LOG_FLAGS_ENABLE_SIGNATURE 	= 0x02,
+	PKI_LOG_FLAGS_ASYNC		= 0x04,
 } PKI_LOG_FLAGS;
 
 
@@ -74,6 +75,8 @@ void PKI_log_err_simple( const char *fmt, ... );
 
 int PKI_log_end( void );
 
+unsigned long PKI_log_dropped( void );
+
 // ------------------------- Useful Macros ---------==---------------- //
 
 /* Macro To Automatically add [__FILE__:__LINE__] to the message */
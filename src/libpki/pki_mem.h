@@ -17,10 +17,19 @@
 #ifndef _LIBPKI_PKI_MEM_H
 #define _LIBPKI_PKI_MEM_H
 
+/* Minimum capacity allocated when a PKI_MEM grows */
+#define PKI_MEM_MIN_CAPACITY		64
+
+/* The data is owned by the caller and it is never freed or reallocated */
+#define PKI_MEM_FLAGS_STATIC		0x01
+
 typedef struct pki_mem_st {
 	unsigned char * data;
-	// size_t current;
+	// Length of the data
 	size_t size;
+	// Allocated bytes (a value lower than size means size)
+	size_t capacity;
+	int flags;
 } PKI_MEM;
 
 /* Function prototypes */
@@ -35,16 +44,24 @@ PKI_MEM *PKI_MEM_new_data ( size_t size, unsigned char *data );
 PKI_MEM *PKI_MEM_new_null ( void );
 PKI_MEM *PKI_MEM_dup ( PKI_MEM *mem );
 
+PKI_MEM *PKI_MEM_new_static ( unsigned char *data, size_t size );
+int PKI_MEM_init_static ( PKI_MEM *buf, unsigned char *data, size_t capacity );
+
 PKI_MEM *PKI_MEM_new_func ( void *obj, int (*func)() );
 PKI_MEM *PKI_MEM_new_func_bio (void *obj, int (*func)());
 
 int PKI_MEM_free ( PKI_MEM *buf );
+void PKI_MEM_cleanup ( PKI_MEM *buf );
 
 int PKI_MEM_grow( PKI_MEM *buf, size_t new_size );
+int PKI_MEM_reserve( PKI_MEM *buf, size_t capacity );
+int PKI_MEM_shrink( PKI_MEM *buf );
+int PKI_MEM_reset( PKI_MEM *buf );
 int PKI_MEM_add( PKI_MEM *buf, char *data, size_t data_size );
 unsigned char * PKI_MEM_get_data( PKI_MEM *buf );
 char * PKI_MEM_get_parsed(PKI_MEM *buf);
 size_t PKI_MEM_get_size( PKI_MEM *buf );
+size_t PKI_MEM_get_capacity( PKI_MEM *buf );
 
 ssize_t PKI_MEM_printf( PKI_MEM * buf );
 ssize_t PKI_MEM_fprintf( FILE *file, PKI_MEM *buf );
@@ -46,6 +46,9 @@ PKI_STRING * PKI_OCSP_CERTID_get_issuerNameHash(PKI_OCSP_CERTID * c_id);
 
 PKI_STRING * PKI_OCSP_CERTID_get_issuerKeyHash(PKI_OCSP_CERTID * c_id);
 
+int PKI_OCSP_CERTID_match_issuer(PKI_OCSP_CERTID * c_id,
+				 const PKI_X509_CERT * issuer);
+
 PKI_INTEGER * PKI_X509_OCSP_REQ_get_serial ( PKI_X509_OCSP_REQ *req, int num);
 
 void * PKI_X509_OCSP_REQ_get_data ( PKI_X509_OCSP_REQ *req, PKI_X509_DATA type );
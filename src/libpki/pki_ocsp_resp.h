@@ -61,6 +61,27 @@ char * PKI_X509_OCSP_RESP_get_parsed ( PKI_X509_OCSP_RESP *r, PKI_X509_DATA type
 int PKI_X509_OCSP_RESP_print_parsed ( PKI_X509_OCSP_RESP *r, 
 				PKI_X509_DATA type, int fd );
 
+/* ------------------------------ Response Cache ------------------------- */
+
+PKI_OCSP_RESP_CACHE * PKI_OCSP_RESP_CACHE_new ( int max_entries );
+void PKI_OCSP_RESP_CACHE_free ( PKI_OCSP_RESP_CACHE *c );
+
+int PKI_OCSP_RESP_CACHE_put ( PKI_OCSP_RESP_CACHE *c, PKI_OCSP_CERTID *cid,
+				PKI_X509_OCSP_RESP *resp );
+
+const PKI_MEM * PKI_OCSP_RESP_CACHE_get ( PKI_OCSP_RESP_CACHE *c,
+				PKI_X509_OCSP_REQ *req );
+const PKI_MEM * PKI_OCSP_RESP_CACHE_get_cid ( PKI_OCSP_RESP_CACHE *c,
+				PKI_OCSP_CERTID *cid );
+void PKI_OCSP_RESP_CACHE_release ( PKI_OCSP_RESP_CACHE *c,
+				const PKI_MEM *der );
+
+int PKI_OCSP_RESP_CACHE_expire ( PKI_OCSP_RESP_CACHE *c );
+int PKI_OCSP_RESP_CACHE_flush ( PKI_OCSP_RESP_CACHE *c );
+
+void PKI_OCSP_RESP_CACHE_stats ( PKI_OCSP_RESP_CACHE *c,
+		unsigned long *hits, unsigned long *misses, int *entries );
+
 /* ----------------------------- Basic I/O ------------------------------- */
 
 PKI_OCSP_RESP *PEM_read_bio_PKI_OCSP_RESP( PKI_IO *bp, void *a,
@@ -19,6 +19,30 @@ PKI_X509_CERT * PKI_X509_CERT_new (const PKI_X509_CERT *ca_cert,
 				   const PKI_CONFIG *oids,
 				   HSM *hsm );
 
+PKI_X509_CERT * PKI_X509_CERT_new_template (const PKI_X509_CERT *ca_cert,
+				   const PKI_X509_KEYPAIR *pkey,
+				   const PKI_X509_REQ *req,
+				   const char *subj_s,
+				   const char *serial,
+				   uint64_t validity,
+				   const PKI_X509_PROFILE_TEMPLATE *tmpl,
+				   const PKI_X509_ALGOR_VALUE * algor,
+				   HSM *hsm );
+
+/* Compiled profiles (templates) for certificate issuance */
+PKI_X509_PROFILE_TEMPLATE * PKI_X509_PROFILE_TEMPLATE_new(
+				   const PKI_X509_PROFILE *conf,
+				   const PKI_CONFIG *oids);
+
+int PKI_X509_PROFILE_TEMPLATE_up_ref(PKI_X509_PROFILE_TEMPLATE *tmpl);
+
+void PKI_X509_PROFILE_TEMPLATE_free(PKI_X509_PROFILE_TEMPLATE *tmpl);
+
+int PKI_X509_PROFILE_TEMPLATE_is_current(
+				   const PKI_X509_PROFILE_TEMPLATE *tmpl,
+				   const PKI_X509_PROFILE *conf,
+				   const PKI_CONFIG *oids);
+
 PKI_X509_CERT *PKI_X509_CERT_dup (const PKI_X509_CERT *x );
 
 /* Signature Specific Functions */
@@ -59,12 +83,20 @@ PKI_DIGEST *PKI_X509_CERT_fingerprint(const PKI_X509_CERT *x,
 				      const PKI_DIGEST_ALG *alg );
 PKI_DIGEST *PKI_X509_CERT_fingerprint_by_name(const PKI_X509_CERT *x,
 					      const char *alg );
+int PKI_X509_CERT_fingerprint_buf(const PKI_X509_CERT *x,
+				  const PKI_DIGEST_ALG *alg,
+				  unsigned char *buf,
+				  size_t size );
 
 /* Key Hash functions */
 PKI_DIGEST *PKI_X509_CERT_key_hash(const PKI_X509_CERT *x, 
 				   const PKI_DIGEST_ALG *alg );
 PKI_DIGEST *PKI_X509_CERT_key_hash_by_name(const PKI_X509_CERT *x, 
 					   const char *alg );
+int PKI_X509_CERT_key_hash_buf(const PKI_X509_CERT *x,
+			       const PKI_DIGEST_ALG *alg,
+			       unsigned char *buf,
+			       size_t size );
 
 /* Get Certificate type - look for PKI_X509_CERT_TYPE */
 PKI_X509_CERT_TYPE PKI_X509_CERT_get_type(const PKI_X509_CERT *x );
@@ -30,6 +30,102 @@ const PKI_X509_CRL_ENTRY * PKI_X509_CRL_lookup_cert(const PKI_X509_CRL *x,
 const PKI_X509_CRL_ENTRY * PKI_X509_CRL_lookup_long(const PKI_X509_CRL *x,
 						    long long s );
 
+const PKI_X509_CRL_ENTRY * PKI_X509_CRL_lookup_delta(const PKI_X509_CRL *base,
+						     const PKI_X509_CRL *delta,
+						     const PKI_INTEGER *s);
+
+/* PKI CRL Revocation Index */
+PKI_X509_CRL_INDEX * PKI_X509_CRL_INDEX_new(const PKI_X509_CRL *x);
+PKI_X509_CRL_INDEX * PKI_X509_CRL_INDEX_new_delta(const PKI_X509_CRL *base,
+						  const PKI_X509_CRL *delta);
+void PKI_X509_CRL_INDEX_free(PKI_X509_CRL_INDEX *idx);
+
+int PKI_X509_CRL_INDEX_elements(const PKI_X509_CRL_INDEX *idx);
+
+int PKI_X509_CRL_INDEX_find(const PKI_X509_CRL_INDEX *idx,
+			    const unsigned char *serial,
+			    size_t size,
+			    int negative);
+
+const PKI_X509_CRL_ENTRY * PKI_X509_CRL_INDEX_get_num(
+					const PKI_X509_CRL_INDEX *idx,
+					int num,
+					int *reason,
+					const PKI_TIME **revDate);
+
+const PKI_X509_CRL_ENTRY * PKI_X509_CRL_INDEX_lookup(
+					const PKI_X509_CRL_INDEX *idx,
+					const PKI_INTEGER *s,
+					int *reason,
+					const PKI_TIME **revDate);
+
+const PKI_X509_CRL_ENTRY * PKI_X509_CRL_INDEX_lookup_bin(
+					const PKI_X509_CRL_INDEX *idx,
+					const unsigned char *serial,
+					size_t size,
+					int *reason,
+					const PKI_TIME **revDate);
+
+const PKI_X509_CRL_ENTRY * PKI_X509_CRL_INDEX_lookup_serial(
+					const PKI_X509_CRL_INDEX *idx,
+					const char *serial,
+					int *reason,
+					const PKI_TIME **revDate);
+
+const PKI_X509_CRL_ENTRY * PKI_X509_CRL_INDEX_lookup_long(
+					const PKI_X509_CRL_INDEX *idx,
+					long long s,
+					int *reason,
+					const PKI_TIME **revDate);
+
+/* PKI CRL Builder */
+PKI_X509_CRL_BUILDER * PKI_X509_CRL_BUILDER_new(int hint);
+void PKI_X509_CRL_BUILDER_free(PKI_X509_CRL_BUILDER *b);
+
+int PKI_X509_CRL_BUILDER_elements(const PKI_X509_CRL_BUILDER *b);
+
+int PKI_X509_CRL_BUILDER_add(PKI_X509_CRL_BUILDER *b,
+			     const unsigned char *serial,
+			     size_t size,
+			     time_t revDate,
+			     PKI_X509_CRL_REASON reason);
+
+int PKI_X509_CRL_BUILDER_add_serial(PKI_X509_CRL_BUILDER *b,
+				    const char *serial,
+				    time_t revDate,
+				    PKI_X509_CRL_REASON reason);
+
+int PKI_X509_CRL_BUILDER_add_iter(PKI_X509_CRL_BUILDER *b,
+				  PKI_X509_CRL_BUILDER_ITER next,
+				  void *arg);
+
+int PKI_X509_CRL_BUILDER_add_file(PKI_X509_CRL_BUILDER *b,
+				  const char *file);
+
+PKI_X509_CRL * PKI_X509_CRL_BUILDER_get_crl(PKI_X509_CRL_BUILDER *b,
+				const PKI_X509_KEYPAIR *pkey,
+				const PKI_X509_CERT *cert,
+				const char * crlNum_s,
+				unsigned long validity,
+				const PKI_X509_PROFILE *profile,
+				const PKI_CONFIG *oids,
+				HSM *hsm);
+
+PKI_X509_CRL * PKI_X509_CRL_BUILDER_get_delta(PKI_X509_CRL_BUILDER *b,
+				const PKI_X509_CRL *base,
+				const PKI_X509_KEYPAIR *pkey,
+				const PKI_X509_CERT *cert,
+				const char * crlNum_s,
+				unsigned long validity,
+				const PKI_X509_PROFILE *profile,
+				const PKI_CONFIG *oids,
+				HSM *hsm);
+
+int PKI_X509_CRL_BUILDER_get_stats(const PKI_X509_CRL_BUILDER *b,
+				   int *entries,
+				   double *secs,
+				   double *rate);
+
 /* PKI CRL Reason Codes */
 int PKI_X509_CRL_REASON_CODE_num ( void );
 int PKI_X509_CRL_REASON_CODE_get ( const char * st );
@@ -50,6 +146,12 @@ PKI_X509_CRL *PKI_X509_CRL_new (const PKI_X509_KEYPAIR *pkey,
 				HSM *hsm);
 
 int PKI_X509_CRL_free ( PKI_X509_CRL * x );
+
+/* PKI Delta CRL */
+int PKI_X509_CRL_is_delta(const PKI_X509_CRL *x);
+int PKI_X509_CRL_check_delta(const PKI_X509_CRL *base,
+			     const PKI_X509_CRL *delta);
+
 int PKI_X509_CRL_add_extension(PKI_X509_CRL *x, PKI_X509_EXTENSION *ext);
 
 PKI_MEM * PKI_X509_CRL_tbs_asn1(PKI_X509_CRL *x);
@@ -7,6 +7,20 @@ PKI_X509_EXTENSION *PKI_X509_EXTENSION_new( void );
 
 void PKI_X509_EXTENSION_free ( PKI_X509_EXTENSION *ext );
 
+char * PKI_X509_EXTENSION_get_profile_conf(
+						const PKI_X509_PROFILE   * profile,
+						const PKI_CONFIG         * oids,
+						const PKI_CONFIG_ELEMENT * extNode,
+						char                    ** name);
+
+PKI_X509_EXTENSION_VALUE * PKI_X509_EXTENSION_VALUE_new_conf(
+					int                         nid,
+					const char                * name,
+					const char                * value,
+					const PKI_X509_CERT_VALUE * issuer,
+					const PKI_X509_CERT_VALUE * subject,
+					const PKI_X509_REQ_VALUE  * req);
+
 PKI_X509_EXTENSION *PKI_X509_EXTENSION_value_new_profile(
 						const PKI_X509_PROFILE   * profile,
 						const PKI_CONFIG         * oids,
@@ -19,16 +19,6 @@
 #ifndef _LIBPKI_STACK_H
 #define _LIBPKI_STACK_H
 
-/*!
- * \brief Data structure for PKI_STACK nodes (INTERNAL ONLY)
- */
-typedef struct pki_stack_node_st {
-	struct pki_stack_node_st *next;
-	struct pki_stack_node_st *prev;
-
-	void *data;
-} PKI_STACK_NODE;
-
 /*!
  * \brief Data structure for PKI_STACK
  *
@@ -36,15 +26,19 @@ typedef struct pki_stack_node_st {
  * elements. Fields SHOULD NOT be accessed directly, instead specific
  * PKI_STACK_new(), PKI_STACK_free(), etc... functions exist that take
  * care about details and initialization of the structure.
+ *
+ * Elements are stored in a contiguous (growable) array of pointers,
+ * therefore indexed access via PKI_STACK_get_num() is O(1).
  */
 typedef struct pki_stack_st {
 	/*!  \brief Number of elements in the PKI_STACK */
 	int elements;
 
-	/*! \brief Pointer to the first node of the PKI_STACK */
-	PKI_STACK_NODE *head;
-	/*! \brief Pointer to the last node of the PKI_STACK */
-	PKI_STACK_NODE *tail;
+	/*! \brief Number of allocated slots in the data array */
+	int size;
+
+	/*! \brief Array of pointers to the data objects */
+	void **data;
 
 	/*! \brief Pointer to the function called to free the data object */
 	void (*free)( void *);
@@ -59,6 +53,7 @@ int     PKI_STACK_free ( PKI_STACK * st );
 int     PKI_STACK_free_all ( PKI_STACK * st );
 
 int     PKI_STACK_elements ( PKI_STACK *st );
+int     PKI_STACK_reserve ( PKI_STACK *st, int num );
 
 int     PKI_STACK_push ( PKI_STACK *st, void *obj );
 
@@ -69,6 +64,11 @@ void  * PKI_STACK_get_num ( PKI_STACK *st, int num );
 void  * PKI_STACK_del_num ( PKI_STACK *st, int num );
 int     PKI_STACK_ins_num ( PKI_STACK *st, int num, void *obj );
 
+int     PKI_STACK_sort ( PKI_STACK *st,
+			int (*cmp)(const void *, const void *) );
+int     PKI_STACK_find ( PKI_STACK *st, const void *obj,
+			int (*cmp)(const void *, const void *) );
+
 #define PKI_STACK_ERR		PKI_ERR
 #define PKI_STACK_OK		PKI_OK
 
@@ -52,6 +52,8 @@ int PKI_TOKEN_load_keypair( PKI_TOKEN *tk, char *url_string );
 int PKI_TOKEN_load_otherCerts( PKI_TOKEN *tk, char *url_string );
 int PKI_TOKEN_load_trustedCerts( PKI_TOKEN *tk, char *url_string );
 int PKI_TOKEN_load_crls( PKI_TOKEN *tk, char *url_string );
+int PKI_TOKEN_load_crls_multi(PKI_TOKEN *tk, const char **urls, int num);
+int PKI_TOKEN_load_trustedCerts_multi(PKI_TOKEN *tk, const char **urls, int num);
 
 /* Retrieve pointers to PKI_TOKEN data */
 PKI_X509_KEYPAIR *PKI_TOKEN_get_keypair ( PKI_TOKEN *tk );
@@ -97,6 +99,11 @@ PKI_X509_CERT* PKI_TOKEN_issue_cert(PKI_TOKEN *tk, char *subject, char *serial,
 		unsigned long validity, PKI_X509_REQ *req, char *profile_s);
 PKI_X509_CRL * PKI_TOKEN_issue_crl ( PKI_TOKEN *tk, char *serial,
 	unsigned long validity, PKI_X509_CRL_ENTRY_STACK *sk, char *profile_s );
+PKI_X509_CRL * PKI_TOKEN_issue_crl_builder ( PKI_TOKEN *tk, char *serial,
+	unsigned long validity, PKI_X509_CRL_BUILDER *b, char *profile_s );
+PKI_X509_CRL * PKI_TOKEN_issue_delta_crl ( PKI_TOKEN *tk, char *serial,
+	unsigned long validity, const PKI_X509_CRL *base,
+	PKI_X509_CRL_BUILDER *b, char *profile_s );
 PKI_TOKEN *PKI_TOKEN_issue_proxy (PKI_TOKEN *tk, char *subject, 
 		char *serial, unsigned long validity, 
 			char *profile_s, PKI_TOKEN *px_tk );
@@ -106,6 +113,8 @@ int PKI_TOKEN_load_profiles(PKI_TOKEN *tk, char *urlStr);
 int PKI_TOKEN_clear_profiles(PKI_TOKEN * tk);
 int PKI_TOKEN_add_profile( PKI_TOKEN *tk, PKI_X509_PROFILE *profile );
 PKI_X509_PROFILE *PKI_TOKEN_search_profile( PKI_TOKEN *tk, char *profile_s );
+PKI_X509_PROFILE_TEMPLATE * PKI_TOKEN_get_profile_template(PKI_TOKEN *tk,
+					const PKI_X509_PROFILE *profile);
 
 /* TOKEN Slot */
 int PKI_TOKEN_use_slot(PKI_TOKEN *tk, long num);
@@ -56,6 +56,9 @@ typedef struct pki_token_st {
 	    a certificate */
 	PKI_X509_PROFILE_STACK * profiles;
 
+	/*! Compiled profiles (see PKI_TOKEN_get_profile_template) */
+	PKI_STACK * profile_templates;
+
 	/*! Pointer to OIDs configuration profile */
 	PKI_CONFIG * oids;
 
@@ -8,6 +8,7 @@
  */
 
 #include <libpki/pki.h>
+#include <limits.h>
 
 #ifdef HAVE_LIBRESOLV
 #include <netinet/in.h>
@@ -20,6 +21,780 @@
 #include <resolv.h>
 #endif
 
+/* ------------------------------ Resolver Cache ------------------------------ */
+
+// Type of the entries that carry the addresses of a host (getaddrinfo)
+#define DNS_CACHE_T_ADDR	-1
+
+#define DNS_CACHE_BUCKETS	256
+
+// Largest DNS message (TCP)
+#define DNS_MAX_MSG		65535
+
+typedef struct dns_cache_entry_st {
+	char *name;
+	int type;
+	unsigned long hash;
+
+	// Raw response (record entries) or addresses (host entries)
+	unsigned char *data;
+	int len;
+	struct addrinfo *addrs;
+
+	// Resolver error for negative entries (h_errno or EAI_*), 0 otherwise
+	int error;
+
+	int ttl;
+	time_t expires;
+
+	// Set when the entry is queued for a background refresh
+	int refresh;
+
+	struct dns_cache_entry_st *next;
+} DNS_CACHE_ENTRY;
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	DNS_CACHE_ENTRY *buckets[DNS_CACHE_BUCKETS];
+	int size;
+	int max_entries;
+	int max_ttl;
+	PKI_DNS_RESOLVER resolver;
+	PKI_THREAD *refresher;
+	int queued;
+	int stop;
+
+	// Statistics
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long refreshes;
+	unsigned long lookups;
+	double latency;
+} __dns_cache = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+		{ NULL }, 0, PKI_DNS_CACHE_MAX_ENTRIES, PKI_DNS_CACHE_MAX_TTL,
+		NULL, NULL, 0, 0, 0, 0, 0, 0, 0 };
+
+static unsigned long __dns_hash(const char *name, int type)
+{
+	unsigned long h = 2166136261UL;
+
+	// FNV-1a over the (case insensitive) name and the type
+	for ( ; *name; name++)
+	{
+		h ^= (unsigned long) tolower((unsigned char) *name);
+		h *= 16777619UL;
+	}
+
+	h ^= (unsigned long) type;
+	h *= 16777619UL;
+
+	return h;
+}
+
+static double __dns_elapsed(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (double) (end.tv_sec - start->tv_sec) +
+		(double) (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void __dns_addrinfo_free(struct addrinfo *ai)
+{
+	struct addrinfo *next = NULL;
+
+	for ( ; ai != NULL; ai = next)
+	{
+		next = ai->ai_next;
+		if (ai->ai_addr) PKI_Free(ai->ai_addr);
+		PKI_Free(ai);
+	}
+}
+
+/*
+ * Copies an address list (the canonical names are not copied), the port
+ * of the copied addresses is set to port if port > 0
+ */
+static struct addrinfo *__dns_addrinfo_dup(const struct addrinfo *ai, int port)
+{
+	struct addrinfo *ret = NULL;
+	struct addrinfo **pnt = &ret;
+	struct addrinfo *cp = NULL;
+
+	for ( ; ai != NULL; ai = ai->ai_next)
+	{
+		if ((cp = PKI_Malloc(sizeof(struct addrinfo))) == NULL ||
+				(cp->ai_addr = PKI_Malloc(ai->ai_addrlen)) == NULL)
+		{
+			if (cp) PKI_Free(cp);
+			__dns_addrinfo_free(ret);
+			return NULL;
+		}
+
+		cp->ai_flags = ai->ai_flags;
+		cp->ai_family = ai->ai_family;
+		cp->ai_socktype = ai->ai_socktype;
+		cp->ai_protocol = ai->ai_protocol;
+		cp->ai_addrlen = ai->ai_addrlen;
+		memcpy(cp->ai_addr, ai->ai_addr, ai->ai_addrlen);
+
+		if (port > 0 && cp->ai_family == AF_INET)
+			((struct sockaddr_in *) cp->ai_addr)->sin_port =
+				htons((unsigned short) port);
+		else if (port > 0 && cp->ai_family == AF_INET6)
+			((struct sockaddr_in6 *) cp->ai_addr)->sin6_port =
+				htons((unsigned short) port);
+
+		*pnt = cp;
+		pnt = &cp->ai_next;
+	}
+
+	return ret;
+}
+
+static void __dns_cache_entry_free(DNS_CACHE_ENTRY *e)
+{
+	if (!e) return;
+
+	if (e->name) PKI_Free(e->name);
+	if (e->data) PKI_Free(e->data);
+	if (e->addrs) __dns_addrinfo_free(e->addrs);
+
+	PKI_Free(e);
+}
+
+/* Returns the entry for the name and type (lock must be held) */
+static DNS_CACHE_ENTRY *__dns_cache_find(const char *name, int type,
+					 unsigned long hash)
+{
+	DNS_CACHE_ENTRY *e = NULL;
+
+	for (e = __dns_cache.buckets[hash % DNS_CACHE_BUCKETS]; e; e = e->next)
+	{
+		if (e->hash == hash && e->type == type &&
+				strcasecmp(e->name, name) == 0)
+			return e;
+	}
+
+	return NULL;
+}
+
+/* Unlinks and frees the entry (lock must be held) */
+static void __dns_cache_remove(DNS_CACHE_ENTRY *e)
+{
+	DNS_CACHE_ENTRY **pnt = NULL;
+
+	for (pnt = &__dns_cache.buckets[e->hash % DNS_CACHE_BUCKETS];
+			*pnt != NULL; pnt = &(*pnt)->next)
+	{
+		if (*pnt != e) continue;
+
+		*pnt = e->next;
+		if (e->refresh) __dns_cache.queued--;
+		__dns_cache.size--;
+		__dns_cache_entry_free(e);
+		return;
+	}
+}
+
+/*
+ * Makes room for a new entry by removing the expired entries or, if
+ * there are none, the entry that expires first (lock must be held)
+ */
+static void __dns_cache_evict(time_t now)
+{
+	DNS_CACHE_ENTRY *e = NULL;
+	DNS_CACHE_ENTRY *next = NULL;
+	DNS_CACHE_ENTRY *first = NULL;
+	int i = 0;
+
+	for (i = 0; i < DNS_CACHE_BUCKETS; i++)
+	{
+		for (e = __dns_cache.buckets[i]; e != NULL; e = next)
+		{
+			next = e->next;
+
+			if (e->expires <= now) __dns_cache_remove(e);
+			else if (!first || e->expires < first->expires) first = e;
+		}
+	}
+
+	if (__dns_cache.size >= __dns_cache.max_entries && first)
+		__dns_cache_remove(first);
+}
+
+/*
+ * Stores the result of a lookup, data and addrs are owned by the cache
+ * afterwards (lock must be held)
+ */
+static void __dns_cache_store(const char *name, int type,
+			      unsigned char *data, int len,
+			      struct addrinfo *addrs, int error, int ttl)
+{
+	DNS_CACHE_ENTRY *e = NULL;
+	unsigned long hash = __dns_hash(name, type);
+	time_t now = time(NULL);
+
+	if (ttl > __dns_cache.max_ttl) ttl = __dns_cache.max_ttl;
+
+	if ((e = __dns_cache_find(name, type, hash)) != NULL)
+	{
+		if (e->refresh) __dns_cache.queued--;
+
+		if (e->data) PKI_Free(e->data);
+		if (e->addrs) __dns_addrinfo_free(e->addrs);
+
+		e->data = NULL;
+		e->addrs = NULL;
+		e->refresh = 0;
+
+		// Entries that can not be cached anymore are removed
+		if (ttl <= 0)
+		{
+			__dns_cache_remove(e);
+			e = NULL;
+		}
+	}
+	else if (ttl > 0 && __dns_cache.max_entries > 0)
+	{
+		if (__dns_cache.size >= __dns_cache.max_entries)
+			__dns_cache_evict(now);
+
+		if ((e = PKI_Malloc(sizeof(DNS_CACHE_ENTRY))) != NULL &&
+				(e->name = strdup(name)) == NULL)
+		{
+			PKI_Free(e);
+			e = NULL;
+		}
+
+		if (e)
+		{
+			e->type = type;
+			e->hash = hash;
+			e->next = __dns_cache.buckets[hash % DNS_CACHE_BUCKETS];
+			__dns_cache.buckets[hash % DNS_CACHE_BUCKETS] = e;
+			__dns_cache.size++;
+		}
+	}
+
+	if (!e)
+	{
+		if (data) PKI_Free(data);
+		if (addrs) __dns_addrinfo_free(addrs);
+		return;
+	}
+
+	e->data = data;
+	e->len = len;
+	e->addrs = addrs;
+	e->error = error;
+	e->ttl = ttl;
+	e->expires = now + ttl;
+}
+
+#ifdef HAVE_LIBRESOLV
+
+/*
+ * Returns the TTL of a response, i.e. the min TTL of the records in the
+ * answer section, or -1 if there are no records
+ */
+static int __dns_response_ttl(const unsigned char *response, int len)
+{
+	ns_msg msg;
+	ns_rr rr;
+	long ttl = -1;
+	int num = 0;
+	int i = 0;
+
+	if (ns_initparse(response, len, &msg) < 0) return -1;
+
+	num = ns_msg_count(msg, ns_s_an);
+
+	for (i = 0; i < num; i++)
+	{
+		if (ns_parserr(&msg, ns_s_an, i, &rr) < 0) continue;
+
+		if (ttl < 0 || (long) ns_rr_ttl(rr) < ttl)
+			ttl = (long) ns_rr_ttl(rr);
+	}
+
+	if (ttl > INT_MAX) ttl = INT_MAX;
+
+	return (int) ttl;
+}
+
+static int __dns_res_search(const char *name, int type,
+			    unsigned char *answer, int anslen)
+{
+	return res_search(name, C_IN, type, answer, anslen);
+}
+
+#endif
+
+/*
+ * Queries the resolver for the records of the name. Returns 0 on success
+ * (the response is returned in data and len), the resolver error (h_errno)
+ * otherwise. The TTL to use for caching the result is returned in ttl.
+ */
+static int __dns_resolve_records(const char *name, int type,
+				 unsigned char **data, int *len, int *ttl)
+{
+#ifdef HAVE_LIBRESOLV
+	PKI_DNS_RESOLVER resolver = NULL;
+	unsigned char *response = NULL;
+	struct timespec start;
+	int error = 0;
+	int n = 0;
+
+	*data = NULL;
+	*len = 0;
+	*ttl = 0;
+
+	pthread_mutex_lock(&__dns_cache.lock);
+	resolver = __dns_cache.resolver ? __dns_cache.resolver : __dns_res_search;
+	pthread_mutex_unlock(&__dns_cache.lock);
+
+	if ((response = PKI_Malloc(DNS_MAX_MSG)) == NULL) return NO_RECOVERY;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	h_errno = 0;
+	n = resolver(name, type, response, DNS_MAX_MSG);
+	error = h_errno;
+
+	pthread_mutex_lock(&__dns_cache.lock);
+	__dns_cache.lookups++;
+	__dns_cache.latency += __dns_elapsed(&start);
+	pthread_mutex_unlock(&__dns_cache.lock);
+
+	if (n < 0 || n > DNS_MAX_MSG)
+	{
+		PKI_Free(response);
+
+		// Only authoritative answers are cached
+		if (error == HOST_NOT_FOUND || error == NO_DATA)
+			*ttl = PKI_DNS_CACHE_NEGATIVE_TTL;
+
+		return error ? error : NO_RECOVERY;
+	}
+
+	// Responses without records are cached as negative answers
+	if ((*ttl = __dns_response_ttl(response, n)) < 0)
+		*ttl = PKI_DNS_CACHE_NEGATIVE_TTL;
+
+	*data = response;
+	*len = n;
+
+	return 0;
+#else
+	*data = NULL;
+	*len = 0;
+	*ttl = 0;
+
+	return NO_RECOVERY;
+#endif
+}
+
+/*
+ * Resolves the addresses of a host. Returns 0 on success (the addresses
+ * are returned in addrs), the getaddrinfo error otherwise. getaddrinfo()
+ * does not report the TTL of the records, the addresses are cached for
+ * PKI_DNS_CACHE_HOST_TTL (no further queries are sent on the connect path).
+ */
+static int __dns_resolve_addrs(const char *name, struct addrinfo **addrs,
+			       int *ttl)
+{
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	struct timespec start;
+	int error = 0;
+
+	*addrs = NULL;
+	*ttl = 0;
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	error = getaddrinfo(name, NULL, &hints, &res);
+
+	pthread_mutex_lock(&__dns_cache.lock);
+	__dns_cache.lookups++;
+	__dns_cache.latency += __dns_elapsed(&start);
+	pthread_mutex_unlock(&__dns_cache.lock);
+
+	if (error != 0)
+	{
+		if (error == EAI_NONAME) *ttl = PKI_DNS_CACHE_NEGATIVE_TTL;
+		return error;
+	}
+
+	*addrs = __dns_addrinfo_dup(res, 0);
+	freeaddrinfo(res);
+
+	if (*addrs == NULL) return EAI_MEMORY;
+
+	*ttl = PKI_DNS_CACHE_HOST_TTL;
+
+	return 0;
+}
+
+static void * __dns_cache_refresher(void *arg)
+{
+	DNS_CACHE_ENTRY *e = NULL;
+	struct addrinfo *addrs = NULL;
+	unsigned char *data = NULL;
+	char *name = NULL;
+	int type = 0;
+	int error = 0;
+	int len = 0;
+	int ttl = 0;
+	int i = 0;
+
+	pthread_mutex_lock(&__dns_cache.lock);
+
+	while (!__dns_cache.stop)
+	{
+		if (__dns_cache.queued <= 0)
+		{
+			pthread_cond_wait(&__dns_cache.cond, &__dns_cache.lock);
+			continue;
+		}
+
+		for (i = 0, e = NULL; i < DNS_CACHE_BUCKETS && !e; i++)
+		{
+			for (e = __dns_cache.buckets[i]; e && !e->refresh; e = e->next);
+		}
+
+		if (!e || (name = strdup(e->name)) == NULL)
+		{
+			__dns_cache.queued = 0;
+			continue;
+		}
+		type = e->type;
+
+		// The entry stays queued (and it is served) until the new
+		// result is stored
+		pthread_mutex_unlock(&__dns_cache.lock);
+
+		if (type == DNS_CACHE_T_ADDR)
+			error = __dns_resolve_addrs(name, &addrs, &ttl);
+		else
+			error = __dns_resolve_records(name, type, &data, &len, &ttl);
+
+		pthread_mutex_lock(&__dns_cache.lock);
+
+		__dns_cache.refreshes++;
+
+		// Transient errors keep the current (still valid) entry
+		if (error != 0 && ttl <= 0)
+		{
+			e = __dns_cache_find(name, type, __dns_hash(name, type));
+			if (e && e->refresh)
+			{
+				e->refresh = 0;
+				__dns_cache.queued--;
+			}
+		}
+		else
+		{
+			__dns_cache_store(name, type, data, len, addrs, error, ttl);
+		}
+
+		data = NULL;
+		addrs = NULL;
+		PKI_Free(name);
+		name = NULL;
+	}
+
+	pthread_mutex_unlock(&__dns_cache.lock);
+
+	return arg;
+}
+
+/*
+ * Looks up the name in the cache, the lookup is resolved (and cached) on
+ * a miss. Returns 0 on success (a copy of the response or of the
+ * addresses is returned), the resolver error otherwise.
+ */
+static int __dns_cache_lookup(const char *name, int type, int port,
+			      unsigned char **data, int *len,
+			      struct addrinfo **addrs)
+{
+	DNS_CACHE_ENTRY *e = NULL;
+	struct addrinfo *res_addrs = NULL;
+	unsigned char *res_data = NULL;
+	unsigned long hash = __dns_hash(name, type);
+	time_t now = time(NULL);
+	int res_len = 0;
+	int error = 0;
+	int ttl = 0;
+	int hit = 0;
+
+	if (data) *data = NULL;
+	if (len) *len = 0;
+	if (addrs) *addrs = NULL;
+
+	pthread_mutex_lock(&__dns_cache.lock);
+
+	if ((e = __dns_cache_find(name, type, hash)) != NULL && e->expires > now)
+	{
+		hit = 1;
+		__dns_cache.hits++;
+
+		if ((error = e->error) == 0)
+		{
+			if (type == DNS_CACHE_T_ADDR)
+			{
+				if ((*addrs = __dns_addrinfo_dup(e->addrs, port)) == NULL)
+					error = EAI_MEMORY;
+			}
+			else if ((*data = PKI_Malloc((size_t) e->len)) == NULL)
+			{
+				error = NO_RECOVERY;
+			}
+			else
+			{
+				memcpy(*data, e->data, (size_t) e->len);
+				*len = e->len;
+			}
+
+			// Entries that are used are refreshed in the background
+			// before they expire
+			if (!e->refresh && e->expires - now <= (e->ttl *
+					PKI_DNS_CACHE_REFRESH_PCT) / 100 + 1)
+			{
+				e->refresh = 1;
+				__dns_cache.queued++;
+
+				if (!__dns_cache.refresher && (__dns_cache.refresher =
+						PKI_THREAD_new(__dns_cache_refresher, NULL)) == NULL)
+					PKI_log_err("Can not start the DNS cache refresher");
+
+				pthread_cond_signal(&__dns_cache.cond);
+			}
+		}
+	}
+	else
+	{
+		__dns_cache.misses++;
+	}
+
+	pthread_mutex_unlock(&__dns_cache.lock);
+
+	if (hit) return error;
+
+	if (type == DNS_CACHE_T_ADDR)
+		error = __dns_resolve_addrs(name, &res_addrs, &ttl);
+	else
+		error = __dns_resolve_records(name, type, &res_data, &res_len, &ttl);
+
+	if (error == 0)
+	{
+		if (type == DNS_CACHE_T_ADDR)
+		{
+			if ((*addrs = __dns_addrinfo_dup(res_addrs, port)) == NULL)
+				error = EAI_MEMORY;
+		}
+		else if ((*data = PKI_Malloc((size_t) res_len)) == NULL)
+		{
+			error = NO_RECOVERY;
+		}
+		else
+		{
+			memcpy(*data, res_data, (size_t) res_len);
+			*len = res_len;
+		}
+	}
+
+	pthread_mutex_lock(&__dns_cache.lock);
+	__dns_cache_store(name, type, res_data, res_len, res_addrs,
+		error, ttl);
+	pthread_mutex_unlock(&__dns_cache.lock);
+
+	return error;
+}
+
+/*! \brief Resolves the addresses of a host (by using the resolver cache)
+ *
+ * Works as getaddrinfo() for TCP connections to the port of the host,
+ * numeric addresses are not cached. The returned list must be freed
+ * with PKI_DNS_CACHE_freeaddrinfo(). Returns 0 on success, one of the
+ * getaddrinfo() error codes otherwise.
+ */
+
+int PKI_DNS_CACHE_getaddrinfo(const char *host, int port,
+			      struct addrinfo **res)
+{
+	struct addrinfo hints;
+	struct addrinfo *ai = NULL;
+	char service[10];
+	int ret = 0;
+
+	if (!host || !res) return EAI_FAIL;
+
+	*res = NULL;
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = AI_NUMERICHOST;
+
+	snprintf(service, sizeof(service), "%d", port);
+
+	// Numeric addresses do not require a lookup
+	if (getaddrinfo(host, service, &hints, &ai) == 0)
+	{
+		*res = __dns_addrinfo_dup(ai, 0);
+		freeaddrinfo(ai);
+
+		return *res ? 0 : EAI_MEMORY;
+	}
+
+	ret = __dns_cache_lookup(host, DNS_CACHE_T_ADDR, port, NULL, NULL, res);
+
+	return ret;
+}
+
+/*! \brief Frees a list returned by PKI_DNS_CACHE_getaddrinfo() */
+
+void PKI_DNS_CACHE_freeaddrinfo(struct addrinfo *res)
+{
+	__dns_addrinfo_free(res);
+}
+
+/*! \brief Sets the max number of cached lookups (0 disables the cache) and
+ *         the max time (secs) a lookup is cached for, regardless of the
+ *         TTL of the records */
+
+int PKI_DNS_CACHE_set_limits(int max_entries, int max_ttl)
+{
+	if (max_entries < 0 || max_ttl <= 0)
+		return PKI_ERROR(PKI_ERR_PARAM_TYPE, NULL);
+
+	pthread_mutex_lock(&__dns_cache.lock);
+	__dns_cache.max_entries = max_entries;
+	__dns_cache.max_ttl = max_ttl;
+	pthread_mutex_unlock(&__dns_cache.lock);
+
+	PKI_DNS_CACHE_flush();
+
+	return PKI_OK;
+}
+
+/*! \brief Sets the function used to query the DNS (NULL restores the
+ *         default, i.e. res_search()), mainly useful for testing. The
+ *         cache is flushed. */
+
+int PKI_DNS_CACHE_set_resolver(PKI_DNS_RESOLVER resolver)
+{
+	pthread_mutex_lock(&__dns_cache.lock);
+	__dns_cache.resolver = resolver;
+	pthread_mutex_unlock(&__dns_cache.lock);
+
+	PKI_DNS_CACHE_flush();
+
+	return PKI_OK;
+}
+
+/*! \brief Removes all the cached lookups (the statistics are reset) */
+
+void PKI_DNS_CACHE_flush(void)
+{
+	DNS_CACHE_ENTRY *e = NULL;
+	DNS_CACHE_ENTRY *list = NULL;
+	int i = 0;
+
+	pthread_mutex_lock(&__dns_cache.lock);
+
+	for (i = 0; i < DNS_CACHE_BUCKETS; i++)
+	{
+		while ((e = __dns_cache.buckets[i]) != NULL)
+		{
+			__dns_cache.buckets[i] = e->next;
+			e->next = list;
+			list = e;
+		}
+	}
+
+	__dns_cache.size = 0;
+	__dns_cache.queued = 0;
+	__dns_cache.hits = 0;
+	__dns_cache.misses = 0;
+	__dns_cache.refreshes = 0;
+	__dns_cache.lookups = 0;
+	__dns_cache.latency = 0;
+
+	pthread_mutex_unlock(&__dns_cache.lock);
+
+	while ((e = list) != NULL)
+	{
+		list = e->next;
+		__dns_cache_entry_free(e);
+	}
+}
+
+/*! \brief Returns the statistics of the resolver cache
+ *
+ * hits and misses count the lookups served from (or missing from) the
+ * cache, refreshes the lookups resolved in the background before the
+ * entries expired, rate is the hit rate (0..1) and latency the average
+ * time (secs) spent in the resolver per query.
+ */
+
+int PKI_DNS_CACHE_get_stats(unsigned long *hits, unsigned long *misses,
+			    unsigned long *refreshes, double *rate,
+			    double *latency)
+{
+	pthread_mutex_lock(&__dns_cache.lock);
+
+	if (hits) *hits = __dns_cache.hits;
+	if (misses) *misses = __dns_cache.misses;
+	if (refreshes) *refreshes = __dns_cache.refreshes;
+	if (rate) *rate = __dns_cache.hits + __dns_cache.misses > 0 ?
+		(double) __dns_cache.hits /
+			(double) (__dns_cache.hits + __dns_cache.misses) : 0;
+	if (latency) *latency = __dns_cache.lookups > 0 ?
+		__dns_cache.latency / (double) __dns_cache.lookups : 0;
+
+	pthread_mutex_unlock(&__dns_cache.lock);
+
+	return PKI_OK;
+}
+
+/*! \brief Stops the background refresh and frees the cache */
+
+void PKI_DNS_CACHE_cleanup(void)
+{
+	PKI_THREAD *th = NULL;
+
+	pthread_mutex_lock(&__dns_cache.lock);
+	__dns_cache.stop = 1;
+	th = __dns_cache.refresher;
+	__dns_cache.refresher = NULL;
+	pthread_cond_broadcast(&__dns_cache.cond);
+	pthread_mutex_unlock(&__dns_cache.lock);
+
+	if (th)
+	{
+		PKI_THREAD_join(th, NULL);
+		PKI_Free(th);
+	}
+
+	pthread_mutex_lock(&__dns_cache.lock);
+	__dns_cache.stop = 0;
+	pthread_mutex_unlock(&__dns_cache.lock);
+
+	PKI_DNS_CACHE_flush();
+}
+
 // get_dnsRecords() - Returns an array of char * of requested records
 // @name - requested domain name
 // @type - Type of records. Supported types are:
@@ -49,7 +824,7 @@ PKI_MEM_STACK *URL_get_data_dns_url(const URL * url,
 		return NULL;
 	}
 
-	unsigned char response[NS_PACKETSZ];
+	unsigned char *response = NULL;
 
 	ns_msg dnsMessage;
 	ns_rr dnsRecord;
@@ -64,7 +839,8 @@ PKI_MEM_STACK *URL_get_data_dns_url(const URL * url,
 	PKI_log_debug("DNS URI: Searching for %s (%s/%d)",
 		url->addr, url->attrs, type);
 
-	if ((len = res_search(url->addr, C_IN, type, response, sizeof(response))) < 0)
+	// Responses are served from the resolver cache when possible
+	if (__dns_cache_lookup(url->addr, type, 0, &response, &len, NULL) != 0)
 	{
 		// An Error Occurred
 		PKI_log_err("DNS URI: search failed\n");
@@ -75,16 +851,17 @@ PKI_MEM_STACK *URL_get_data_dns_url(const URL * url,
 	{
 		// This should not happen if the record is correct
 		PKI_log_err("DNS URI: can not init DNS parsing of the dnsMessage\n");
+		PKI_Free(response);
 		return NULL;
 	}
 
 	len = ns_msg_count(dnsMessage, dnsRecordSection);
 	PKI_log_debug("DNS_URI: msg count ==> %d\n", len);
 
-	if (len <= 0) return NULL;
-
-	if((ret = PKI_STACK_MEM_new()) == NULL ) {
-		PKI_log_debug ("DNS URI: Memory Failure");
+	if (len <= 0 || (ret = PKI_STACK_MEM_new()) == NULL)
+	{
+		if (len > 0) PKI_log_debug ("DNS URI: Memory Failure");
+		PKI_Free(response);
 		return NULL;
 	}
 
@@ -175,10 +952,23 @@ PKI_MEM_STACK *URL_get_data_dns_url(const URL * url,
 		}
 		else if (ns_rr_type(dnsRecord) == T_TXT)
 		{
-			// Special handling required. Format is [BYTE][DATA]
-			unsigned char *p = (unsigned char *)ns_rr_rdata(dnsRecord);
+			// Special handling required. Format is [BYTE][DATA], the
+			// data is not NUL terminated
+			const unsigned char *p = ns_rr_rdata(dnsRecord);
+			size_t len = 0;
 
-			snprintf(dnsRecordName, (size_t) *p+1, "%s", &ns_rr_rdata(dnsRecord)[1]);
+			if (ns_rr_rdlen(dnsRecord) < 1 ||
+					(size_t) *p > (size_t) ns_rr_rdlen(dnsRecord) - 1)
+			{
+				PKI_log_debug("DNS URI: malformed TXT record");
+				continue;
+			}
+
+			len = (size_t) *p;
+			if (len > sizeof(dnsRecordName) - 1) len = sizeof(dnsRecordName) - 1;
+
+			memcpy(dnsRecordName, &p[1], len);
+			dnsRecordName[len] = '\0';
 		}
 		else
 		{
@@ -233,6 +1023,8 @@ PKI_MEM_STACK *URL_get_data_dns_url(const URL * url,
 		// PKI_log_debug("DNS URI: Added object #%d to stack", PKI_STACK_MEM_elements(ret));
 	}
 
+	PKI_Free(response);
+
 #endif
 
 	return ret;
@@ -7,12 +7,39 @@
 */
 
 #include <libpki/pki.h>
+#include <poll.h>
 
-#define HTTP_BUF_SIZE	65535
 
 /* ----------------------------- AUXILLARY FUNCS ------------------------------ */
 
 
+/*
+ * Returns the offset of the first CRLF (or CRLFCRLF if dbl is set) at or
+ * after the provided offset, -1 if not found
+ */
+static ssize_t __find_crlf(const PKI_MEM *m, size_t offset, int dbl)
+{
+	size_t len = dbl ? 4 : 2;
+	const unsigned char *pnt = NULL;
+	size_t idx = 0;
+
+	if (!m || !m->data || m->size < len) return -1;
+
+	for (idx = offset; idx + len <= m->size; idx++)
+	{
+		// Jumps to the next '\r' that can start a match
+		if ((pnt = memchr(&m->data[idx], '\r', m->size - len + 1 - idx)) == NULL)
+			return -1;
+
+		idx = (size_t) (pnt - m->data);
+
+		if (pnt[1] == '\n' && (!dbl || (pnt[2] == '\r' && pnt[3] == '\n')))
+			return (ssize_t) idx;
+	}
+
+	return -1;
+}
+
 /*
  * Returns the pointer to the end of the header, if found. Starts searching
  * from the provided offset or from the beginning if offset is < 0
@@ -20,39 +47,39 @@
 char * __find_end_of_header(PKI_MEM *m, ssize_t offset)
 {
 	ssize_t idx = 0;
-	ssize_t size = 0;
-	char * ret = NULL;
-	static char bytes[4] = { '\r', '\n', '\r', '\n' };
 
 	// Input check
-	if (!m || offset >= m->size) return NULL;
-
-	if (m->size <= 4) return NULL;
-
-	size = (ssize_t)m->size;
+	if (!m || offset >= (ssize_t) m->size) return NULL;
 
 	// Fix the offset if it is < 0
 	if (offset < 0) offset = 0;
 
 	// Looks for the eoh
-	for (idx = size - 4; idx >= offset; idx--)
-	{
-		int i, found;
+	if ((idx = __find_crlf(m, (size_t) offset, 1)) < 0) return NULL;
 
-		// Searches for the "bytes" starting from the offset
-		for (i = 0, found = 0; i < sizeof(bytes); i++)
-		{
-			if (m->data[idx + i] != bytes[i]) break;
-		}
+	return (char *) &(m->data[idx + 3]);
+}
+
+/*
+ * Returns 1 if the (comma separated) value of the header contains the
+ * token (case insensitive), 0 otherwise
+ */
+static int __header_has_token(const PKI_HTTP *msg, const char *header,
+						const char *token)
+{
+	char *val = NULL;
+	char *pnt = NULL;
+	int found = 0;
 
-		// If i is 4 then we have a match on the whole string
-		if (i == 4) found = 1;
+	if ((val = PKI_HTTP_get_header(msg, header)) == NULL) return 0;
 
-		// If we found the End Of Header we return that
-		if (found == 1) ret = (char *) &(m->data[idx + 3]);
-	}
+	for (pnt = val; *pnt; pnt++) *pnt = (char) tolower(*pnt);
 
-	return ret;
+	found = (strstr(val, token) != NULL);
+
+	PKI_Free(val);
+
+	return found;
 }
 
 /*
@@ -222,6 +249,9 @@ PKI_HTTP * PKI_HTTP_new ( void )
 	ret->head = NULL;
 	ret->path = NULL;
 
+	/* Connection */
+	ret->keep_alive = 0;
+
 	return ( ret );
 }
 
@@ -294,302 +324,755 @@ char * PKI_HTTP_get_header ( const PKI_HTTP * http,
 	return PKI_HTTP_get_header_txt ( (char *)http->head->data, header);
 }
 
-/* Internal version, can handle both HTTP and HTTPS */
+/* ----------------------------- HTTP PARSER ---------------------------------- */
 
-PKI_HTTP *PKI_HTTP_get_message (const PKI_SOCKET * sock,
-		                        int                timeout,
-								size_t             max_size) {
+#define HTTP_CHUNK_SIZE		0
+#define HTTP_CHUNK_DATA		1
+#define HTTP_CHUNK_TRAILER	2
+
+// Max length of a chunk size line (size and extensions)
+#define HTTP_CHUNK_LINE_MAX	1024
+
+/*
+ * Parses the header of the next message in the parser's buffer (if
+ * complete) and sets up the body framing. Returns PKI_ERR if the header
+ * is malformed or too large.
+ */
+static int __parser_head(PKI_HTTP_PARSER *p)
+{
+	PKI_HTTP *msg = NULL;
+	char *val = NULL;
+	char *end = NULL;
+	ssize_t eoh = -1;
+
+	// Only the last bytes of the previous search can start the eoh
+	if ((eoh = __find_crlf(&p->buf, p->scan > 3 ? p->scan - 3 : 0, 1)) < 0)
+	{
+		p->scan = p->buf.size;
+
+		if (p->max_size > 0 && p->buf.size > p->max_size)
+		{
+			PKI_log_err("HTTP header exceeds the max size (%lu)",
+				(unsigned long) p->max_size);
+			return PKI_ERR;
+		}
+
+		return PKI_OK;
+	}
+
+	if ((msg = PKI_HTTP_new()) == NULL) return PKI_ERR;
+	msg->method = PKI_HTTP_METHOD_UNKNOWN;
+
+	// The header keeps the first '\r\n' of the eoh and is zero terminated
+	if ((msg->head = PKI_MEM_new_data((size_t) eoh + 3, p->buf.data)) == NULL ||
+			(msg->body = PKI_MEM_new_null()) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		goto err;
+	}
+	msg->head->data[eoh + 2] = '\x0';
+
+	if (PKI_ERR == __parse_http_header(msg)) goto err;
+
+	// Sets some HTTP specific data
+	msg->location = PKI_HTTP_get_header(msg, "Location");
+	msg->type     = PKI_HTTP_get_header(msg, "Content-Type");
+
+	// Body framing (RFC 7230, Section 3.3.3)
+	if (msg->method == PKI_HTTP_METHOD_HTTP &&
+			((msg->code >= 100 && msg->code < 200) ||
+				msg->code == 204 || msg->code == 304))
+	{
+		p->mode = PKI_HTTP_BODY_NONE;
+	}
+	else if (__header_has_token(msg, "Transfer-Encoding", "chunked"))
+	{
+		p->mode = PKI_HTTP_BODY_CHUNKED;
+		p->chunk_state = HTTP_CHUNK_SIZE;
+	}
+	else if ((val = PKI_HTTP_get_header(msg, "Content-Length")) != NULL)
+	{
+		p->left = strtoull(val, &end, 10);
+		if (end == val || *val == '-')
+		{
+			PKI_log_err("Invalid HTTP Content-Length (%s)", val);
+			PKI_Free(val);
+			goto err;
+		}
+		PKI_Free(val);
 
-  PKI_HTTP * ret = NULL;
+		p->mode = p->left > 0 ? PKI_HTTP_BODY_LENGTH : PKI_HTTP_BODY_NONE;
 
-  char * eoh = NULL;
-  char * body = NULL;
+		if (p->max_size > 0 && p->left > p->max_size)
+		{
+			PKI_log_err("HTTP body exceeds the max size (%lu)",
+				(unsigned long) p->max_size);
+			goto err;
+		}
+	}
+	else if (msg->method == PKI_HTTP_METHOD_HTTP)
+	{
+		// Responses without framing end when the server closes
+		p->mode = PKI_HTTP_BODY_CLOSE;
+	}
+	else
+	{
+		p->mode = PKI_HTTP_BODY_NONE;
+	}
 
-  ssize_t read = 0; // Keeps track of the single reading
-  ssize_t free = 0; // Keeps track of the remaining buffer space
-  ssize_t idx = 0; // Keeps track of how much data we poured into MEM
-  ssize_t size = 0; // Keeps track of the read data from socket
+	// Persistent by default in HTTP/1.1, only on request in HTTP/1.0
+	if (msg->version >= 1.1f)
+		msg->keep_alive = !__header_has_token(msg, "Connection", "close");
+	else
+		msg->keep_alive = __header_has_token(msg, "Connection", "keep-alive");
 
-  // Let's initialize some useful variables (code readability)
-  long long content_length = -1;
+	if (p->mode == PKI_HTTP_BODY_CLOSE) msg->keep_alive = 0;
 
-  // Buffer where to keep the data
-  PKI_MEM *m = NULL;
+	p->msg = msg;
+	p->pos = (size_t) eoh + 4;
 
-  // Allocates the HTTP message container
-  if ((ret = PKI_HTTP_new()) == NULL)
-  {
-      PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL );
-      goto err;
-  }
-  ret->method = PKI_HTTP_METHOD_UNKNOWN;
+	return PKI_OK;
 
-  if (max_size > 0)
-  {
-	  // Allocates a new MEM object
-	  m = PKI_MEM_new(max_size + 1);
-  }
-  else
-  {
-	  // Allocates the default buffer for HTTP messages
-	  m = PKI_MEM_new(HTTP_BUF_SIZE + 1);
-  }
+err:
+	PKI_HTTP_free(msg);
+	return PKI_ERR;
+}
 
-	if (m == NULL)
+/*
+ * Collects the body of the current message. Returns 1 when the body is
+ * complete, 0 if more data is needed and -1 on error
+ */
+static int __parser_body(PKI_HTTP_PARSER *p, int eof)
+{
+	PKI_MEM *body = p->msg->body;
+	unsigned long long size = 0;
+	char *start = NULL;
+	char *end = NULL;
+	size_t avail = 0;
+	ssize_t eol = -1;
+
+	switch (p->mode)
+	{
+		case PKI_HTTP_BODY_NONE:
+			return 1;
+
+		case PKI_HTTP_BODY_LENGTH:
+			if (p->buf.size - p->pos < p->left) return eof ? -1 : 0;
+
+			if (PKI_MEM_add(body, (char *) &p->buf.data[p->pos],
+						(size_t) p->left) != PKI_OK)
+				return -1;
+
+			p->pos += (size_t) p->left;
+			p->left = 0;
+			return 1;
+
+		case PKI_HTTP_BODY_CLOSE:
+			if (p->max_size > 0 && p->buf.size - p->pos > p->max_size)
+				return -1;
+
+			if (!eof) return 0;
+
+			if (p->buf.size > p->pos && PKI_MEM_add(body,
+					(char *) &p->buf.data[p->pos],
+					p->buf.size - p->pos) != PKI_OK)
+				return -1;
+
+			p->pos = p->buf.size;
+			return 1;
+
+		case PKI_HTTP_BODY_CHUNKED:
+			break;
+
+		default:
+			return -1;
+	}
+
+	for (;;)
+	{
+		avail = p->buf.size - p->pos;
+
+		if (p->chunk_state == HTTP_CHUNK_DATA)
+		{
+			// Chunk data is followed by a CRLF
+			if (avail < p->left + 2) return eof ? -1 : 0;
+
+			if (p->buf.data[p->pos + p->left] != '\r' ||
+					p->buf.data[p->pos + p->left + 1] != '\n')
+				return -1;
+
+			if (PKI_MEM_add(body, (char *) &p->buf.data[p->pos],
+						(size_t) p->left) != PKI_OK)
+				return -1;
+
+			p->pos += (size_t) p->left + 2;
+			p->left = 0;
+			p->chunk_state = HTTP_CHUNK_SIZE;
+		}
+		else if (p->chunk_state == HTTP_CHUNK_SIZE)
+		{
+			if ((eol = __find_crlf(&p->buf, p->pos, 0)) < 0)
+			{
+				if (avail > HTTP_CHUNK_LINE_MAX) return -1;
+				return eof ? -1 : 0;
+			}
+
+			// The line ends with '\r', extensions are ignored
+			start = (char *) &p->buf.data[p->pos];
+			if (!isxdigit((unsigned char) *start)) return -1;
+
+			size = strtoull(start, &end, 16);
+			if (size > SIZE_MAX / 2 || (p->max_size > 0 &&
+					body->size + size > p->max_size))
+				return -1;
+
+			p->pos = (size_t) eol + 2;
+
+			if (size > 0)
+			{
+				p->left = size;
+				p->chunk_state = HTTP_CHUNK_DATA;
+			}
+			else p->chunk_state = HTTP_CHUNK_TRAILER;
+		}
+		else
+		{
+			// The trailer is either empty or a list of headers
+			if (avail >= 2 && p->buf.data[p->pos] == '\r' &&
+					p->buf.data[p->pos + 1] == '\n')
+			{
+				p->pos += 2;
+				return 1;
+			}
+
+			if ((eol = __find_crlf(&p->buf, p->pos, 1)) < 0)
+				return eof ? -1 : 0;
+
+			p->pos = (size_t) eol + 4;
+			return 1;
+		}
+	}
+}
+
+/*! \brief Allocates a new incremental HTTP parser. Header and body larger
+ *         than max_size (if > 0) are rejected */
+
+PKI_HTTP_PARSER *PKI_HTTP_PARSER_new(size_t max_size)
+{
+	PKI_HTTP_PARSER *ret = NULL;
+
+	if ((ret = PKI_Malloc(sizeof(PKI_HTTP_PARSER))) == NULL)
 	{
 		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
 		return NULL;
 	}
 
-	// Sets the free space in the buffer
-	free = (ssize_t) m->size - 1;
-
-  // Let's retrieve the data from the socket. Note that this for
-  // always read at most 'free' bytes which carries the amount of
-  // free space in the buffer -> safe
-  for (read = PKI_SOCKET_read(sock, (char *)(&(m->data[idx])), (size_t) free, timeout);
-       read > 0;
-       read = PKI_SOCKET_read(sock, (char *)(&(m->data[idx])), (size_t) free, timeout))
-  {
-      // If read is negative, there was an error on the socket
-      // let's just report it as an error and move on
-      if (read < 0)
-      {
-    	  if (!eoh)
-    	  {
-    		  PKI_log_err("Error while reading from socket");
-    		  goto err;
-    	  }
-    	  else
-    	  {
-    		  // Nothing to read anymore - let's break
-    		  PKI_log_err("Nothing to read anymore (read = %d)", read);
-    		  break;
-    	  }
-      }
-      else if (read == 0 && eoh)
-      {
-    	  // No data was read, let's assume the stream is complete and
-    	  // break from the for loop
-    	  break;
-      }
-
-      // Let's be sure there is a NULL-bound limit to the read data
-      size += read;
-      free -= read;
-      m->data[size] = '\x0';
-
-      // If we don't have a header yet, let's look for it
-      if (!eoh && ((eoh = __find_end_of_header(m, idx)) != NULL))
-      {
-    	  // We want the header to finish with just one '\r\n' - since the
-    	  // pointer we receive is at the end of the '\r\n\r\n' sequence,
-    	  // we need to shrink by 2 bytes
-    	  size_t header_size = (size_t) (eoh - (char *) m->data - 2);
-    	  ret->head = PKI_MEM_new_data(header_size + 1, m->data);
-    	  ret->head->data[header_size] = '\x0';
-
-    	  // If we can not parse the header - we have to return error
-    	  if (PKI_ERR == __parse_http_header(ret)) goto err;
-
-    	  // Let's get the pointer to the start of the body
-    	  body = eoh + 1;
-
-    	  // Checks for the content-length is in the header - if we have not found it, yet
-    	  if (ret->method != PKI_HTTP_METHOD_GET && content_length < 0)
-    	  {
-    		  char *cnt_len_s = NULL;
-    		  if ((cnt_len_s = PKI_HTTP_get_header(ret, "Content-Length" )) != NULL)
-    		  {
-    			  content_length = atoll(cnt_len_s);
-    			  PKI_Free(cnt_len_s);
-    			  // PKI_log_debug ( "HTTP Content-Length: %d bytes", content_length);
-    		  }
-    	  }
-      } // End of if (!eoh) ...
-
-      // Updates the start pointer for the next read operation
-      idx += read;
-
-      // Let's check if we need to expand the buffer
-      if (max_size <= 0)
-      {
-    	  // We expand the mem if the buffer has less than 2K free
-    	  if (free < 2048)
-    	  {
-    			ssize_t ofs = 0;
-
-    		  if(body)
-    		  {
-    		    ofs = (ssize_t)(body - (char *)m->data);
-          
-    		    if(ofs < 0)
-    		    {
-    		      PKI_log_debug ( "Invalid offset for HTTP body: Start: %p - Body: %p", m->data, body);
-    		      PKI_ERROR(PKI_ERR_URI_READ, NULL);
-    		      goto err;
-    		    }
-    		  }
-
-    		  // Grow the memory for the HTTP message
-    		  if(content_length > 0 && body && m->size < (size_t)(content_length + ofs))
-    		  {
-           size_t len = ((size_t)(content_length + ofs) - m->size);
-
-    		    if (PKI_MEM_grow(m, len + 1) == PKI_ERR)
-    		    {
-    		      PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
-    		      goto err;
-    		    }
-    		    free += (ssize_t)len;
-    		  }
-    		  else
-    		  {
-    		    if (PKI_MEM_grow(m, HTTP_BUF_SIZE) == PKI_ERR)
-    		    {
-    		      PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
-    		      goto err;
-    		    }
-    		    free += HTTP_BUF_SIZE;
-    		  }
-
-    		  // Let's update the pointer to the body
-    		  if(body) body = (char *)m->data + ofs;
-    	  }
-      }
-
-      // Let's check if we need to perform the next read or not
-      if (eoh && ret->method == PKI_HTTP_METHOD_GET)
-      {
-    	  // We do not need to wait for any other read as GETs do not have
-    	  // a full body
-    	  break;
-      }
-      else if ((content_length >= 0) && (&m->data[size] - (unsigned char *)body >= content_length))
-      {
-    	  // Here we have received the full body (since the size of the body corresponds or exceeds the
-    	  // contents of the Content-Length: header line), therefore we can safely get out of the cycle
-    	  break;
-      }
-
-  } /* End of for..loop */
-
-  // Here we should have both the eoh and the body - if not, there was
-  // an error and we return the malformed request message
-  if (!eoh)
-  {
-	  // PKI_log_err ( "Read data (so far): %d bytes - Last read: %d bytes", idx, read);
-	  PKI_ERROR(PKI_ERR_URI_READ, NULL);
-	  goto err;
-  }
-
-  // Sets some HTTP specific data
-  ret->location = PKI_HTTP_get_header ( ret, "Location" );
-  ret->type     = PKI_HTTP_get_header ( ret, "Content-Type" );
-
-  if (ret->method != PKI_HTTP_METHOD_GET && content_length > 0 && body)
-  {
-	  ssize_t body_start = (ssize_t)(body - (char *)m->data);
-	  ssize_t body_size = idx - body_start;
-
-	  if (body_start < 0 || body_size < 0)
-	  {
-		  PKI_log_err ( "Invalid offset for HTTP body - body_start: %d bytes - body_size: %d bytes", body_start, body_size);
-		  PKI_ERROR(PKI_ERR_URI_READ, NULL);
-		  goto err;
-	  }
- 
-	  //Check if Content-Length > 0 but body_size is 0
-	  if (body_size == 0) goto err; 
-
-	  // Let's allocate the body for the HTTP message (if any)
-	  ret->body = PKI_MEM_new_data((size_t)body_size+1, (unsigned char *)body);
-	  if(ret->body == NULL)
-	  {
-		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
-		goto err;
-	  }
-	  ret->body->size = (size_t) body_size;
-  }
-  else
-  {
-	  ret->body = PKI_MEM_new_null();
-  }
+	ret->max_size = max_size;
+	ret->mode = PKI_HTTP_BODY_NONE;
+
+	return ret;
+}
+
+/*! \brief Frees a PKI_HTTP_PARSER (and the partially parsed message) */
 
-  // Let's free the buffer memory
-  if (m) PKI_MEM_free(m);
+void PKI_HTTP_PARSER_free(PKI_HTTP_PARSER *p)
+{
+	if (!p) return;
 
-  // Now we can return the HTTP message
-  return ret;
+	if (p->msg) PKI_HTTP_free(p->msg);
+	PKI_MEM_cleanup(&p->buf);
 
-err:
+	PKI_Free(p);
+}
+
+/*! \brief Adds received data to the parser */
+
+int PKI_HTTP_PARSER_add(PKI_HTTP_PARSER *p, const void *data, size_t size)
+{
+	if (!p || (!data && size > 0)) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	if (size == 0) return PKI_OK;
 
-	// First we free the return message
-	if (ret) PKI_HTTP_free(ret);
+	if (PKI_MEM_add(&p->buf, (char *) data, size) != PKI_OK)
+		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
 
-	// We then free the buffer memory object
-	if (m) PKI_MEM_free(m);
+	p->received += size;
 
-	return NULL;
+	return PKI_OK;
 }
 
-/*! \brief Sends a HTTP message to a URL and retrieve the response
+/*! \brief Returns the next complete message from the parser
  *
- * Sends (POST/GET) data to a url and (if a pointer to a mem stack
- * is provided) returns the received response. PKI_ERR is returned
- * in case of error, otherwise PKI_OK is returned.
+ * On success PKI_OK is returned and *msg is set to the next message (to be
+ * freed by the caller) or to NULL if more data is needed. The data that
+ * follows the message (pipelined requests) is kept for the next call. If
+ * eof is set the peer has closed the connection, which completes the
+ * messages delimited by the close. PKI_ERR is returned for malformed or
+ * truncated messages, after which the parser is reset.
  */
 
-int PKI_HTTP_get_url (const URL      * url,
-		      const char     * data,
-		      size_t           data_size,
-		      const char     * content_type,
-		      int              method,
-		      int              timeout,
-		      size_t           max_size,
-		      PKI_MEM_STACK ** sk,
-		      PKI_SSL        * ssl) {
+int PKI_HTTP_PARSER_get_message(PKI_HTTP_PARSER *p, int eof, PKI_HTTP **msg)
+{
+	int rv = 0;
 
-	PKI_SOCKET *sock = NULL;
-	int ret = 0;
+	if (!p || !msg) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
 
-	if (!url) return PKI_ERR;
+	*msg = NULL;
+
+	if (!p->msg)
+	{
+		// Nothing received after the last message
+		if (p->buf.size == 0) return PKI_OK;
 
-	sock = PKI_SOCKET_new();
-	if (ssl) PKI_SOCKET_set_ssl(sock, ssl);
+		if (__parser_head(p) != PKI_OK) goto err;
 
-	if (PKI_SOCKET_open_url(sock, url, timeout) == PKI_ERR)
+		if (!p->msg) return eof ? PKI_ERROR(PKI_ERR_URI_READ, NULL) : PKI_OK;
+	}
+
+	if ((rv = __parser_body(p, eof)) < 0) goto err;
+
+	if (rv == 0) return PKI_OK;
+
+	// The body is zero terminated for callers that use it as a string
+	if (p->msg->body->size > 0)
 	{
-		PKI_SOCKET_free ( sock );
-		return PKI_ERR;
+		if (PKI_MEM_reserve(p->msg->body, p->msg->body->size + 1) != PKI_OK)
+			goto err;
+		p->msg->body->data[p->msg->body->size] = '\x0';
 	}
 
-	ret = PKI_HTTP_get_socket ( sock, data, data_size, content_type,
-				method, timeout, max_size, sk );
+	// Keeps the data of the next (pipelined) message
+	if (p->pos < p->buf.size)
+		memmove(p->buf.data, &p->buf.data[p->pos], p->buf.size - p->pos);
+	p->buf.size -= p->pos;
+
+	*msg = p->msg;
+
+	p->msg = NULL;
+	p->pos = 0;
+	p->scan = 0;
+	p->left = 0;
+	p->mode = PKI_HTTP_BODY_NONE;
+
+	return PKI_OK;
+
+err:
+	// The stream can not be resynchronized
+	if (p->msg) PKI_HTTP_free(p->msg);
+	p->msg = NULL;
+	p->pos = 0;
+	p->scan = 0;
+	p->left = 0;
+	p->mode = PKI_HTTP_BODY_NONE;
+	PKI_MEM_reset(&p->buf);
+
+	return PKI_ERROR(PKI_ERR_URI_READ, NULL);
+}
 
-	PKI_SOCKET_close ( sock );
-	PKI_SOCKET_free ( sock );
+/*! \brief Returns the amount of buffered data not yet returned as message */
+
+size_t PKI_HTTP_PARSER_pending(const PKI_HTTP_PARSER *p)
+{
+	if (!p) return 0;
+
+	return p->buf.size;
+}
+
+/*! \brief Reads from the socket until the parser has a complete message.
+ *         Data already buffered (e.g., pipelined requests) is used first */
+
+PKI_HTTP *PKI_HTTP_PARSER_read_message(PKI_HTTP_PARSER  * p,
+				       const PKI_SOCKET * sock,
+				       int                timeout)
+{
+	PKI_HTTP *msg = NULL;
+	ssize_t rd = 0;
+
+	if (!p || !sock)
+	{
+		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+		return NULL;
+	}
+
+	for (;;)
+	{
+		if (PKI_HTTP_PARSER_get_message(p, 0, &msg) != PKI_OK) return NULL;
+
+		if (msg) return msg;
+
+		// Reads directly into the spare space of the buffer
+		if (PKI_MEM_reserve(&p->buf, p->buf.size + LIBPKI_HTTP_BUF_SIZE) != PKI_OK)
+		{
+			PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+			return NULL;
+		}
+
+		rd = PKI_SOCKET_read(sock, (char *) &p->buf.data[p->buf.size],
+				PKI_MEM_get_capacity(&p->buf) - p->buf.size, timeout);
+
+		if (rd <= 0)
+		{
+			// Closed connection (or timeout): completes the messages
+			// that are delimited by the close
+			if (PKI_HTTP_PARSER_get_message(p, 1, &msg) != PKI_OK) return NULL;
+
+			if (!msg) PKI_ERROR(PKI_ERR_URI_READ, NULL);
+
+			return msg;
+		}
+
+		p->buf.size += (size_t) rd;
+		p->received += (unsigned long long) rd;
+	}
+}
+
+/*! \brief Reads an HTTP message (request or response) from a socket. Data
+ *         following the message is discarded, use a PKI_HTTP_PARSER for
+ *         persistent connections */
+
+PKI_HTTP *PKI_HTTP_get_message (const PKI_SOCKET * sock,
+		                        int                timeout,
+								size_t             max_size) {
+
+	PKI_HTTP_PARSER *p = NULL;
+	PKI_HTTP *ret = NULL;
+
+	if ((p = PKI_HTTP_PARSER_new(max_size)) == NULL) return NULL;
+
+	ret = PKI_HTTP_PARSER_read_message(p, sock, timeout);
+
+	PKI_HTTP_PARSER_free(p);
 
 	return ret;
 }
 
-/*! \brief Reads a data from an HTTP server */
+/* --------------------------- CONNECTION POOL -------------------------------- */
 
-int PKI_HTTP_get_socket (const PKI_SOCKET * sock,
-	                 const char       * data,
-			 size_t             data_size,
-		         const char       * content_type,
-			 int                method,
-			 int                timeout,
-	                 size_t             max_size,
-			 PKI_MEM_STACK   ** sk ) {
+typedef struct http_pool_conn_st {
+	char *addr;
+	int port;
+	int ssl;
+
+	// Set if the TLS context was provided by the caller
+	int custom_ssl;
+
+	PKI_SOCKET *sock;
+	PKI_HTTP_PARSER *parser;
+
+	time_t last_used;
+	struct http_pool_conn_st *next;
+} HTTP_POOL_CONN;
+
+static struct {
+	pthread_mutex_t lock;
+	HTTP_POOL_CONN *idle;
+	int num_idle;
+	int max_idle;
+	int idle_timeout;
+} __http_pool = { PTHREAD_MUTEX_INITIALIZER, NULL, 0,
+		PKI_HTTP_POOL_MAX_IDLE, PKI_HTTP_POOL_IDLE_TIMEOUT };
+
+static void __pool_conn_free(HTTP_POOL_CONN *c)
+{
+	if (!c) return;
+
+	if (c->sock)
+	{
+		if (c->sock->type != PKI_SOCKET_TYPE_UNKNOWN)
+			PKI_SOCKET_close(c->sock);
+		PKI_SOCKET_free(c->sock);
+	}
+
+	if (c->parser) PKI_HTTP_PARSER_free(c->parser);
+	if (c->addr) PKI_Free(c->addr);
+
+	PKI_Free(c);
+}
+
+/*
+ * Returns 1 if the two PKI_SSL carry the same TLS configuration (client
+ * identity, protocol, verification and trusted certificates)
+ */
+static int __pool_ssl_match(const PKI_SSL *a, const PKI_SSL *b)
+{
+	PKI_X509_CERT *x = NULL;
+	PKI_X509_CERT *y = NULL;
+	int i = 0;
+	int num = 0;
+
+	if (!a || !b) return 0;
+
+	if (a->tk != b->tk || a->algor != b->algor || a->flags != b->flags ||
+			a->auth != b->auth || a->verify_flags != b->verify_flags)
+		return 0;
+
+	if ((a->cipher == NULL) != (b->cipher == NULL) ||
+			(a->cipher && strcmp(a->cipher, b->cipher) != 0))
+		return 0;
+
+	num = PKI_STACK_X509_CERT_elements(a->trusted_certs);
+	if (num != PKI_STACK_X509_CERT_elements(b->trusted_certs)) return 0;
+
+	for (i = 0; i < num; i++)
+	{
+		x = PKI_STACK_X509_CERT_get_num(a->trusted_certs, i);
+		y = PKI_STACK_X509_CERT_get_num(b->trusted_certs, i);
+
+		if (X509_cmp(PKI_X509_get_value(x), PKI_X509_get_value(y)) != 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Returns 1 if an idle connection has been closed by the server (or has
+ * unexpected data to read), 0 if it can be reused
+ */
+static int __pool_conn_stale(const HTTP_POOL_CONN *c)
+{
+	struct pollfd pfd;
+
+	if (PKI_HTTP_PARSER_pending(c->parser) > 0) return 1;
+
+	if (c->sock->type == PKI_SOCKET_SSL && c->sock->ssl &&
+			SSL_pending(c->sock->ssl->ssl) > 0)
+		return 1;
+
+	pfd.fd = c->sock->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	return poll(&pfd, 1, 0) != 0;
+}
+
+/*
+ * Returns 1 if the server closed (or reset) the connection, 0 if it is
+ * still open (e.g., the server did not answer in time)
+ */
+static int __pool_conn_closed(const HTTP_POOL_CONN *c)
+{
+	struct pollfd pfd;
+	ssize_t n = 0;
+	char b = 0;
+
+	if (c->sock->fd < 0) return 0;
+
+	pfd.fd = c->sock->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	if (poll(&pfd, 1, 0) <= 0) return 0;
+
+	if (pfd.revents & (POLLHUP | POLLERR)) return 1;
+
+	// Nothing was received, readable means EOF (or an error)
+	n = recv(c->sock->fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+
+	return n == 0 || (n < 0 && errno != EAGAIN &&
+				errno != EWOULDBLOCK && errno != EINTR);
+}
+
+/*
+ * Returns the max number of idle connections, 0 if keep-alive is disabled
+ */
+static int __pool_max_idle(void)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&__http_pool.lock);
+	ret = __http_pool.max_idle;
+	pthread_mutex_unlock(&__http_pool.lock);
+
+	return ret;
+}
+
+/*
+ * Returns an idle connection to the server of the URL that uses the same
+ * TLS configuration (if any)
+ */
+static HTTP_POOL_CONN *__pool_get(const URL *url, const PKI_SSL *ssl)
+{
+	HTTP_POOL_CONN *c = NULL;
+	HTTP_POOL_CONN **pnt = NULL;
+	HTTP_POOL_CONN *expired = NULL;
+	time_t now = time(NULL);
+
+	for (;;)
+	{
+		pthread_mutex_lock(&__http_pool.lock);
+
+		for (pnt = &__http_pool.idle; (c = *pnt) != NULL; )
+		{
+			if (now - c->last_used >= __http_pool.idle_timeout)
+			{
+				*pnt = c->next;
+				__http_pool.num_idle--;
+				c->next = expired;
+				expired = c;
+				continue;
+			}
+
+			if (c->port == url->port && c->ssl == url->ssl &&
+					strcmp(c->addr, url->addr) == 0 &&
+					(!url->ssl || (ssl ? (c->custom_ssl &&
+						__pool_ssl_match(c->sock->ssl, ssl)) :
+							!c->custom_ssl)))
+			{
+				*pnt = c->next;
+				__http_pool.num_idle--;
+				break;
+			}
+
+			pnt = &c->next;
+		}
+
+		pthread_mutex_unlock(&__http_pool.lock);
+
+		while (expired != NULL)
+		{
+			HTTP_POOL_CONN *next = expired->next;
+			__pool_conn_free(expired);
+			expired = next;
+		}
+
+		if (!c || !__pool_conn_stale(c)) return c;
+
+		__pool_conn_free(c);
+	}
+}
+
+/*
+ * Returns a connection to the pool, or closes it if the pool is full
+ */
+static void __pool_put(HTTP_POOL_CONN *c)
+{
+	pthread_mutex_lock(&__http_pool.lock);
+
+	if (__http_pool.num_idle < __http_pool.max_idle)
+	{
+		c->last_used = time(NULL);
+		c->next = __http_pool.idle;
+		__http_pool.idle = c;
+		__http_pool.num_idle++;
+		c = NULL;
+	}
+
+	pthread_mutex_unlock(&__http_pool.lock);
+
+	if (c) __pool_conn_free(c);
+}
+
+/*
+ * Opens a new connection to the server of the URL. The PKI_SSL (if any) is
+ * owned by the connection
+ */
+static HTTP_POOL_CONN *__pool_conn_new(const URL *url, PKI_SSL *ssl, int timeout)
+{
+	HTTP_POOL_CONN *c = NULL;
+
+	if ((c = PKI_Malloc(sizeof(HTTP_POOL_CONN))) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		if (ssl) PKI_SSL_free(ssl);
+		return NULL;
+	}
+
+	c->port = url->port;
+	c->ssl = url->ssl;
+	c->custom_ssl = (ssl != NULL);
+
+	if ((c->sock = PKI_SOCKET_new()) == NULL ||
+			(c->parser = PKI_HTTP_PARSER_new(0)) == NULL ||
+			(c->addr = strdup(url->addr)) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		if (ssl) PKI_SSL_free(ssl);
+		__pool_conn_free(c);
+		return NULL;
+	}
+
+	if (ssl) PKI_SOCKET_set_ssl(c->sock, ssl);
+
+	if (PKI_SOCKET_open_url(c->sock, url, timeout) == PKI_ERR)
+	{
+		__pool_conn_free(c);
+		return NULL;
+	}
+
+	return c;
+}
+
+/*! \brief Sets the max number of idle connections kept for reuse (0
+ *         disables persistent connections) and the time (secs) after
+ *         which an idle connection is closed */
+
+int PKI_HTTP_POOL_set_limits(int max_idle, int idle_timeout)
+{
+	if (max_idle < 0 || idle_timeout <= 0)
+		return PKI_ERROR(PKI_ERR_PARAM_TYPE, NULL);
+
+	pthread_mutex_lock(&__http_pool.lock);
+	__http_pool.max_idle = max_idle;
+	__http_pool.idle_timeout = idle_timeout;
+	pthread_mutex_unlock(&__http_pool.lock);
+
+	if (max_idle == 0) PKI_HTTP_POOL_flush();
+
+	return PKI_OK;
+}
+
+/*! \brief Closes all the idle connections */
+
+void PKI_HTTP_POOL_flush(void)
+{
+	HTTP_POOL_CONN *c = NULL;
+	HTTP_POOL_CONN *idle = NULL;
+
+	pthread_mutex_lock(&__http_pool.lock);
+	idle = __http_pool.idle;
+	__http_pool.idle = NULL;
+	__http_pool.num_idle = 0;
+	pthread_mutex_unlock(&__http_pool.lock);
+
+	while ((c = idle) != NULL)
+	{
+		idle = c->next;
+		__pool_conn_free(c);
+	}
+}
+
+/*
+ * Sends a request on a connected socket and reads the response with the
+ * connection's parser. If persist is provided it is set when the
+ * connection can carry other requests, replied is set if the server sent
+ * any data (i.e., a failure on a reused connection can not be retried)
+ */
+static int __http_exchange(const PKI_SOCKET * sock,
+			   const URL        * url,
+			   PKI_HTTP_PARSER  * parser,
+			   const char       * data,
+			   size_t             data_size,
+			   const char       * content_type,
+			   int                method,
+			   int                timeout,
+			   size_t             max_size,
+			   PKI_MEM_STACK   ** sk,
+			   const char       * extra,
+			   PKI_HTTP        ** resp,
+			   int                keep_alive,
+			   int              * persist,
+			   int              * replied ) {
 
 	size_t len = 0;
 
 	const char *my_cont_type = "application/unknown";
+	const char *connection = keep_alive ? "keep-alive" : "close";
 
 	PKI_HTTP *http_rv	 = NULL;
 
+	unsigned long long received = 0;
+
 	int rv   = -1;
 	int ret  = PKI_OK;
 
@@ -598,38 +1081,46 @@ int PKI_HTTP_get_socket (const PKI_SOCKET * sock,
 
 	char *tmp  = NULL;
 	char *auth_tmp = NULL;
+	char *auth_buf = NULL;
     
 	char *head_get =
 			"GET %s HTTP/1.1\r\n"
 			"Host: %s\r\n"
 			"User-Agent: LibPKI\r\n"
-			"Connection: close\r\n"
-			"%s";
+			"Connection: %s\r\n"
+			"%s%s";
 
 	char *head_post = 
 			"POST %s HTTP/1.1\r\n"
 			"Host: %s\r\n"
 			"User-Agent: LibPKI\r\n"
-			"Connection: close\r\n"
+			"Connection: %s\r\n"
 			"Content-type: %s\r\n"
-			"Content-Length: %d\r\n"
+			"Content-Length: %lu\r\n"
 			"%s";
 
 	char *head = NULL;
 
+	if (persist) *persist = 0;
+	if (replied) *replied = 0;
+	if (resp) *resp = NULL;
+
 	if ( timeout < 0 ) timeout = 0;
 
-	if ( !sock || !sock->url ) return PKI_ERR;
+	if (!extra) extra = "";
+
+	if ( !sock || !url || !parser ) return PKI_ERR;
 
 	// Process the authentication information if provided by the caller
-	if (sock->url && sock->url->usr && sock->url->pwd)
+	if (url->usr && url->pwd)
 	{
 		// Rough estimate for the auth string
-		max_len = strlen(sock->url->usr) + strlen(sock->url->pwd) + 100;
+		max_len = strlen(url->usr) + strlen(url->pwd) + 100;
 
 		// Special case for when a usr/pwd was specified in the URL
-		auth_tmp = PKI_Malloc(len);
-		auth_len = (size_t)snprintf(auth_tmp, len, "Authentication: user %s:%s\r\n\r\n", sock->url->usr, sock->url->pwd);
+		if ((auth_buf = PKI_Malloc(max_len)) == NULL) return PKI_ERR;
+		auth_len = (size_t)snprintf(auth_buf, max_len, "Authentication: user %s:%s\r\n\r\n", url->usr, url->pwd);
+		auth_tmp = auth_buf;
 	}
 	else
 	{
@@ -646,15 +1137,16 @@ int PKI_HTTP_get_socket (const PKI_SOCKET * sock,
 		// Estimate the header's final size
 		max_len =
 				strlen(head) +
-				strlen(sock->url->path) +
-				strlen(sock->url->addr) +
+				strlen(url->path) +
+				strlen(url->addr) +
+				strlen(extra) +
 				101;
 
 		// Allocates enough space for the header
 		tmp = PKI_Malloc ( max_len + auth_len );
 
 		// Prints the header into the tmp container
-		len = (size_t) snprintf(tmp, max_len, head, sock->url->path, sock->url->addr, auth_tmp);
+		len = (size_t) snprintf(tmp, max_len + auth_len, head, url->path, url->addr, connection, extra, auth_tmp);
 	}
 	else if (method == PKI_HTTP_METHOD_POST)
 	{
@@ -668,8 +1160,8 @@ int PKI_HTTP_get_socket (const PKI_SOCKET * sock,
 		// Checks the max len for the allocated header
 		max_len =
 				strlen(head) +
-				strlen(sock->url->path) +
-				strlen(sock->url->addr) +
+				strlen(url->path) +
+				strlen(url->addr) +
 				strlen(my_cont_type) +
 				101;
 
@@ -677,18 +1169,17 @@ int PKI_HTTP_get_socket (const PKI_SOCKET * sock,
 		tmp = PKI_Malloc ( max_len + auth_len );
 
 		// Prints the header into the tmp container
-		len = (size_t) snprintf(tmp, max_len, head, sock->url->path, sock->url->addr, 
-					my_cont_type, data_size, auth_tmp );
+		len = (size_t) snprintf(tmp, max_len + auth_len, head, url->path, url->addr, 
+					connection, my_cont_type, (unsigned long) data_size, auth_tmp );
 	}
 	else
 	{
 		PKI_log_err ( "Method (%d) not supported!", method );
+		if (auth_buf) PKI_Free(auth_buf);
 		return PKI_ERR;
 	}
 
-	// PKI_MEM *r = PKI_MEM_new_data(len, tmp);
-	// URL_put_data("file://http_req.txt", r, NULL, NULL, 0, 0, NULL);
-	// PKI_MEM_free(r);
+	if (auth_buf) PKI_Free(auth_buf);
 
 	if ((rv = (int) PKI_SOCKET_write(sock, tmp, len)) < 0)
 	{
@@ -703,7 +1194,7 @@ int PKI_HTTP_get_socket (const PKI_SOCKET * sock,
 	// If we were using a POST method, we need to actually send the data
 	if(data != NULL)
 	{
-		PKI_log_err("{DEBUG} Writing Data -> data_size = %d, data = %p", data_size, data);
+		PKI_log_debug("Writing Data -> data_size = %d, data = %p", data_size, data);
 
 		if ((PKI_SOCKET_write(sock, data, data_size)) < 0)
 		{
@@ -713,17 +1204,39 @@ int PKI_HTTP_get_socket (const PKI_SOCKET * sock,
 	}
 	
 	// Let's now wait for the response from the server
-	if ((http_rv = PKI_HTTP_get_message(sock, timeout, max_size)) == NULL)
+	parser->max_size = max_size;
+	received = parser->received;
+
+	do {
+		if (http_rv) PKI_HTTP_free(http_rv);
+
+		http_rv = PKI_HTTP_PARSER_read_message(parser, sock, timeout);
+
+		// Interim (1xx) responses are followed by the final one
+	} while (http_rv && http_rv->code >= 100 && http_rv->code < 200);
+
+	if (replied) *replied = (parser->received > received);
+
+	if (http_rv == NULL)
 	{
 		PKI_log_err ("HTTP retrieval error\n");
 		goto err;
 	}
 
+	// The response has been fully read, the connection is in sync
+	if (persist) *persist = keep_alive && http_rv->keep_alive;
+
 	// We shall now check for the return code
 	if (http_rv->code >= 400 )
 	{
 		goto err;
 	}
+	else if (http_rv->code == 304 && resp)
+	{
+		// Not Modified (conditional request), there is no body
+		*resp = http_rv;
+		return PKI_OK;
+	}
 	else if (http_rv->code >= 300)
 	{
 		/* Redirection - let's try that */
@@ -739,7 +1252,7 @@ int PKI_HTTP_get_socket (const PKI_SOCKET * sock,
 		{
 			URL *url_tmp = NULL;
 
-			if( strncmp_nocase( http_rv->location, sock->url->url_s, 
+			if( strncmp_nocase( http_rv->location, url->url_s, 
 					(int) strlen(http_rv->location)) == 0)
 			{
 				PKI_log_debug( "HTTP cyclic redirection!");
@@ -752,7 +1265,7 @@ int PKI_HTTP_get_socket (const PKI_SOCKET * sock,
 				goto err;
 			}
 
-			if ( sock->url->ssl == 0 )
+			if ( url->ssl == 0 )
 			{
 				ret = PKI_HTTP_get_url ( url_tmp, data, 
 					data_size, content_type, method, timeout, 
@@ -777,25 +1290,27 @@ int PKI_HTTP_get_socket (const PKI_SOCKET * sock,
 			const char *prot_s = NULL;
 			char new_url[2048];
 			URL *my_new_url = NULL;
-			PKI_SSL *ssl2 = PKI_SSL_dup ( sock->ssl );
 
-			prot_s = URL_proto_to_string ( sock->url->proto );
+			prot_s = URL_proto_to_string ( url->proto );
 			if( !prot_s ) goto err;
 
-			snprintf(new_url, sizeof(new_url),"%s://%s%s", prot_s, sock->url->addr, http_rv->location );
+			snprintf(new_url, sizeof(new_url),"%s://%s%s", prot_s, url->addr, http_rv->location );
 
-			if( strncmp_nocase( new_url, sock->url->url_s, (int) strlen ( new_url )) == 0 )
+			if( strncmp_nocase( new_url, url->url_s, (int) strlen ( new_url )) == 0 )
 			{
 				PKI_log_debug( "HTTP cyclic redirection!");
 				goto err;
 			}
 
-			my_new_url = URL_new ( new_url );
+			if ((my_new_url = URL_new ( new_url )) == NULL) goto err;
 
+			// The (duplicated) PKI_SSL is owned by the new connection
 			ret = PKI_HTTP_get_url ( my_new_url, data, data_size, content_type, method,
-						timeout, max_size, sk, ssl2 );
+						timeout, max_size, sk, url->ssl ? PKI_SSL_dup ( sock->ssl ) : NULL );
 
-			if (ssl2) PKI_SSL_free ( ssl2 );
+			URL_free ( my_new_url );
+
+			goto end;
 		}
 	}
 	else if (http_rv->code != 200)
@@ -804,13 +1319,6 @@ int PKI_HTTP_get_socket (const PKI_SOCKET * sock,
 		goto err;
 	}
 
-	/*
-	PKI_log_err("{DEBUG} method = %d, header->size = %d, body = %p, body_size = %d",
-			  http_rv->method, http_rv->head->size, http_rv->body, http_rv->body->size);
-	URL_put_data("file://http-resp-header.txt", http_rv->head, NULL, NULL, 0, 0, NULL);
-	URL_put_data("file://http-resp-data.txt", http_rv->body, NULL, NULL, 0, 0, NULL);
-	*/
-
 	// If a Pointer was provided, we want the data back
 	if (sk) {
 
@@ -839,6 +1347,13 @@ int PKI_HTTP_get_socket (const PKI_SOCKET * sock,
 		http_rv->body = NULL;
 	}
 
+	// The caller wants the response headers (e.g., the validators)
+	if (resp)
+	{
+		*resp = http_rv;
+		http_rv = NULL;
+	}
+
 end:
 	// Finally free the HTTP message memory
 	if (http_rv) PKI_HTTP_free(http_rv);
@@ -851,12 +1366,125 @@ err:
 	if (http_rv) PKI_HTTP_free ( http_rv );
 
 	// Free the locally allocated memory
-	if (*sk) PKI_STACK_MEM_free_all(*sk);
-	*sk = NULL;
+	if (sk && *sk) PKI_STACK_MEM_free_all(*sk);
+	if (sk) *sk = NULL;
 
 	return PKI_ERR;
 }
 
+/*
+ * Sends a request on a pooled (or new) connection to the server of the URL,
+ * extra request headers and the response message are optional
+ */
+static int __http_get_url(const URL      * url,
+			  const char     * data,
+			  size_t           data_size,
+			  const char     * content_type,
+			  int              method,
+			  int              timeout,
+			  size_t           max_size,
+			  PKI_MEM_STACK ** sk,
+			  const char     * extra,
+			  PKI_HTTP      ** resp,
+			  PKI_SSL        * ssl) {
+
+	HTTP_POOL_CONN *c = NULL;
+	int keep_alive = (__pool_max_idle() > 0);
+	int persist = 0;
+	int replied = 0;
+	int ret = PKI_ERR;
+
+	if (!url) return PKI_ERR;
+
+	// Reuses an idle connection to the same server, if any
+	if (keep_alive && (c = __pool_get(url, ssl)) != NULL)
+	{
+		ret = __http_exchange(c->sock, url, c->parser, data, data_size,
+				content_type, method, timeout, max_size, sk,
+				extra, resp, keep_alive, &persist, &replied);
+
+		// Only a GET that failed because the server closed (or
+		// reset) the idle connection before sending any byte is
+		// safe to send again. POSTs and timeouts are not retried
+		if (ret == PKI_OK || replied || method != PKI_HTTP_METHOD_GET ||
+				!__pool_conn_closed(c))
+		{
+			// The pooled connection has its own PKI_SSL
+			if (ssl) PKI_SSL_free(ssl);
+			goto end;
+		}
+
+		// The request is sent again on a new connection
+		PKI_log_debug("HTTP persistent connection closed, reconnecting");
+		__pool_conn_free(c);
+	}
+
+	if ((c = __pool_conn_new(url, ssl, timeout)) == NULL) return PKI_ERR;
+
+	ret = __http_exchange(c->sock, url, c->parser, data, data_size,
+			content_type, method, timeout, max_size, sk,
+			extra, resp, keep_alive, &persist, &replied);
+
+end:
+	if (persist) __pool_put(c);
+	else __pool_conn_free(c);
+
+	return ret;
+}
+
+/*! \brief Sends a HTTP message to a URL and retrieve the response
+ *
+ * Sends (POST/GET) data to a url and (if a pointer to a mem stack
+ * is provided) returns the received response. PKI_ERR is returned
+ * in case of error, otherwise PKI_OK is returned.
+ *
+ * Connections are kept open (HTTP/1.1 keep-alive) and reused for the
+ * following requests to the same server with the same TLS configuration.
+ * As before, the passed PKI_SSL (if any) is owned by the function.
+ */
+
+int PKI_HTTP_get_url (const URL      * url,
+		      const char     * data,
+		      size_t           data_size,
+		      const char     * content_type,
+		      int              method,
+		      int              timeout,
+		      size_t           max_size,
+		      PKI_MEM_STACK ** sk,
+		      PKI_SSL        * ssl) {
+
+	return __http_get_url(url, data, data_size, content_type, method,
+			timeout, max_size, sk, NULL, NULL, ssl);
+}
+
+/*! \brief Reads a data from an HTTP server. The connection is closed by
+ *         the server after the response */
+
+int PKI_HTTP_get_socket (const PKI_SOCKET * sock,
+	                 const char       * data,
+			 size_t             data_size,
+		         const char       * content_type,
+			 int                method,
+			 int                timeout,
+	                 size_t             max_size,
+			 PKI_MEM_STACK   ** sk ) {
+
+	PKI_HTTP_PARSER *parser = NULL;
+	int ret = PKI_ERR;
+
+	if ( !sock || !sock->url ) return PKI_ERR;
+
+	if ((parser = PKI_HTTP_PARSER_new(max_size)) == NULL) return PKI_ERR;
+
+	ret = __http_exchange(sock, sock->url, parser, data, data_size,
+			content_type, method, timeout, max_size, sk, NULL,
+			NULL, 0, NULL, NULL);
+
+	PKI_HTTP_PARSER_free(parser);
+
+	return ret;
+}
+
 /* ------------------------------- HTTP GET --------------------------- */
 
 /*! \brief Returns the data from an HTTP source by using the GET command */
@@ -897,6 +1525,65 @@ int PKI_HTTP_GET_data_url (const URL      * url,
 			PKI_HTTP_METHOD_GET, timeout, max_size, ret, ssl );
 }
 
+/*! \brief Conditional GET of an HTTP URL
+ *
+ * The request carries If-None-Match and/or If-Modified-Since when the
+ * (previously returned) etag and last_modified validators are provided.
+ * On success the response message is returned in resp: its code is 304
+ * when the object was not modified (and ret is left untouched), otherwise
+ * the body is returned in ret and the new validators can be read from the
+ * response headers (e.g., PKI_HTTP_get_header(*resp, "ETag")).
+ */
+
+int PKI_HTTP_GET_data_url_cond (const URL      * url,
+				const char     * etag,
+				const char     * last_modified,
+				int              timeout,
+				size_t           max_size,
+				PKI_MEM_STACK ** ret,
+				PKI_HTTP      ** resp,
+				PKI_SSL        * ssl ) {
+
+	char *extra = NULL;
+	size_t len = 0;
+	int rv = PKI_ERR;
+
+	if (!url || !resp) {
+		if (ssl) PKI_SSL_free(ssl);
+		return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+	}
+
+	// Validators are echoed back, no header injection
+	if (etag && (strpbrk(etag, "\r\n") || !*etag)) etag = NULL;
+	if (last_modified && (strpbrk(last_modified, "\r\n") || !*last_modified))
+		last_modified = NULL;
+
+	if (etag || last_modified) {
+
+		len = (etag ? strlen(etag) : 0) +
+			(last_modified ? strlen(last_modified) : 0) + 64;
+
+		if ((extra = PKI_Malloc(len)) == NULL) {
+			if (ssl) PKI_SSL_free(ssl);
+			return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		}
+
+		snprintf(extra, len, "%s%s%s%s%s%s",
+			etag ? "If-None-Match: " : "", etag ? etag : "",
+			etag ? "\r\n" : "",
+			last_modified ? "If-Modified-Since: " : "",
+			last_modified ? last_modified : "",
+			last_modified ? "\r\n" : "");
+	}
+
+	rv = __http_get_url(url, NULL, 0, NULL, PKI_HTTP_METHOD_GET, timeout,
+			max_size, ret, extra, resp, ssl);
+
+	if (extra) PKI_Free(extra);
+
+	return rv;
+}
+
 /*! \brief Returns HTTP data from a PKI_SOCKET by using the GET command */
 
 int PKI_HTTP_GET_data_socket (const PKI_SOCKET * sock,
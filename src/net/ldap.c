@@ -17,6 +17,13 @@
 
 #ifdef HAVE_LDAP
 
+#if (LIBPKI_OS_CLASS == LIBPKI_OS_POSIX)
+#include <poll.h>
+#endif
+
+/*! \brief Connects to the LDAP server of the URL and binds (simple bind)
+ *         with the user and password of the URL, anonymously if the URL
+ *         carries no user */
 
 LDAP *URL_LDAP_connect(const URL *url, int tout ) {
 
@@ -28,8 +35,9 @@ LDAP *URL_LDAP_connect(const URL *url, int tout ) {
 	struct berval cred;
 	int			rc = 0;
 
-    cred.bv_val = NULL;
-    cred.bv_len = 0;
+    // Anonymous bind unless the URL carries the bind identity
+    cred.bv_val = url && url->usr ? url->pwd : NULL;
+    cred.bv_len = cred.bv_val ? strlen(cred.bv_val) : 0;
 
 #if (LIBPKI_OS_CLASS == LIBPKI_OS_POSIX)
 	(void) signal( SIGPIPE, SIG_IGN );
@@ -86,7 +94,7 @@ LDAP *URL_LDAP_connect(const URL *url, int tout ) {
 #  endif
 	PKI_log_debug("LDAP: SASL bind_s");
 
-	if(( rc = ldap_sasl_bind_s( ld, NULL, LDAP_SASL_SIMPLE, &cred,
+	if(( rc = ldap_sasl_bind_s( ld, url->usr, LDAP_SASL_SIMPLE, &cred,
                     NULL, NULL, NULL )) != LDAP_SUCCESS ) {
 
         switch ( rc ) {
@@ -118,115 +126,577 @@ err:
 
 PKI_MEM_STACK *URL_get_data_ldap_url(const URL *url, int timeout, ssize_t size ) {
 
-#ifdef _WINDOWS
-	struct l_timeval	zerotime;
-	struct l_timeval	*time;
+	PKI_MEM_STACK *ret = NULL;
+	const char *dn[1];
+
+	if( (!url) || (!url->addr) || (!url->path)) {
+		return NULL;
+	}
+
+	/* We search for the exact match, so LDAP_SCOPE_BASE is used here */
+	dn[0] = url->path;
+
+	if (URL_get_data_ldap_batch(url, dn, 1, &ret, timeout, size) != PKI_OK)
+		return NULL;
+
+	return (ret);
+}
+
+/* --------------------------- CONNECTION POOL -------------------------------- */
+
+typedef struct ldap_pool_conn_st {
+	// Server and bind identity of the session
+	char *key;
+
+	LDAP *ld;
+
+	time_t last_used;
+	struct ldap_pool_conn_st *next;
+} LDAP_POOL_CONN;
+
+static struct {
+	pthread_mutex_t lock;
+	LDAP_POOL_CONN *idle;
+	int num_idle;
+	int max_idle;
+	int idle_timeout;
+
+	// Statistics
+	unsigned long opened;
+	unsigned long reused;
+	unsigned long retried;
+} __ldap_pool = { PTHREAD_MUTEX_INITIALIZER, NULL, 0,
+		PKI_LDAP_POOL_MAX_IDLE, PKI_LDAP_POOL_IDLE_TIMEOUT, 0, 0, 0 };
+
+static void __ldap_close(LDAP *ld)
+{
+	if (!ld) return;
+
+#if defined(LDAP_VENDOR_OPENLDAP)
+	ldap_unbind_ext( ld, NULL, NULL );
 #else
-	struct timeval		zerotime;
-	struct timeval		*time;
+	ldap_unbind( ld );
 #endif
+}
 
-	LDAP	*ld = NULL;
-	int  	i,rc;
-	char	*attrs[] = { url->attrs, NULL } ;
-	char    *filter = "objectclass=*";
-	struct berval **vals = NULL;
-#if defined(LDAP_VENDOR_OPENLDAP) || defined(LDAP_VENDOR_MICROSOFT)
-	// int		msgid = 0;
+static char *__ldap_pool_key(const URL *url)
+{
+	char *ret = NULL;
+	size_t len = 0;
+
+	len = strlen(url->addr) + 32 +
+		(url->usr ? strlen(url->usr) : 0) +
+		(url->pwd ? strlen(url->pwd) : 0);
+
+	if ((ret = PKI_Malloc(len)) != NULL)
+	{
+		snprintf(ret, len, "%s:%s@%s:%d",
+			url->usr ? url->usr : "", url->pwd ? url->pwd : "",
+			url->addr, url->port);
+	}
+
+	return ret;
+}
+
+static void __ldap_pool_conn_free(LDAP_POOL_CONN *c)
+{
+	if (!c) return;
+
+	if (c->ld) __ldap_close(c->ld);
+	if (c->key) PKI_Free(c->key);
+
+	PKI_Free(c);
+}
+
+/*
+ * Returns 1 if an idle session has been closed by the server (or has
+ * unexpected data to read, e.g. a notice of disconnection), 0 if it can
+ * be reused
+ */
+static int __ldap_pool_conn_stale(const LDAP_POOL_CONN *c)
+{
+#if defined(LDAP_OPT_DESC) && (LIBPKI_OS_CLASS == LIBPKI_OS_POSIX)
+	struct pollfd pfd;
+	int fd = -1;
+
+	if (ldap_get_option(c->ld, LDAP_OPT_DESC, &fd) != LDAP_SUCCESS ||
+			fd < 0)
+		return 1;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	return poll(&pfd, 1, 0) != 0;
+#else
+	return 0;
 #endif
-	LDAPMessage *res = NULL;
-	PKI_MEM_STACK *ret = NULL;
-	PKI_MEM *obj = NULL;
+}
 
-	if( (!url) || (!url->addr) || (!url->path)) {
+/*
+ * Returns an idle session to the server of the URL bound with the same
+ * identity, or a new one
+ */
+static LDAP_POOL_CONN *__ldap_pool_get(const URL *url, int timeout, int *reused)
+{
+	LDAP_POOL_CONN *c = NULL;
+	LDAP_POOL_CONN **pnt = NULL;
+	LDAP_POOL_CONN *expired = NULL;
+	char *key = NULL;
+	time_t now = time(NULL);
+
+	if ((key = __ldap_pool_key(url)) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
 		return NULL;
 	}
 
-	/* We search for the exact match, so LDAP_SCOPE_BASE is used here */
-	if ( timeout > 0 ) {
-		zerotime.tv_sec = timeout;
-		zerotime.tv_usec = 0L;
-		time = &zerotime;
-	} else {
-		time = NULL;
-		timeout = 0;
-		zerotime.tv_sec =  0L;
-		zerotime.tv_usec = 0L;
+	for (;;)
+	{
+		pthread_mutex_lock(&__ldap_pool.lock);
+
+		for (pnt = &__ldap_pool.idle; (c = *pnt) != NULL; )
+		{
+			if (now - c->last_used >= __ldap_pool.idle_timeout)
+			{
+				*pnt = c->next;
+				__ldap_pool.num_idle--;
+				c->next = expired;
+				expired = c;
+				continue;
+			}
+
+			if (strcmp(c->key, key) == 0)
+			{
+				*pnt = c->next;
+				__ldap_pool.num_idle--;
+				break;
+			}
+
+			pnt = &c->next;
+		}
+
+		pthread_mutex_unlock(&__ldap_pool.lock);
+
+		while (expired != NULL)
+		{
+			LDAP_POOL_CONN *next = expired->next;
+			__ldap_pool_conn_free(expired);
+			expired = next;
+		}
+
+		if (!c || !__ldap_pool_conn_stale(c)) break;
+
+		__ldap_pool_conn_free(c);
 	}
 
-	PKI_log_debug("LDAP: Search Timeout is %d", timeout );
+	if (reused) *reused = (c != NULL);
+
+	if (c)
+	{
+		pthread_mutex_lock(&__ldap_pool.lock);
+		__ldap_pool.reused++;
+		pthread_mutex_unlock(&__ldap_pool.lock);
+
+		PKI_Free(key);
+		return c;
+	}
 
-	if((ld = URL_LDAP_connect ( url, timeout )) == NULL ) {
+	if ((c = PKI_Malloc(sizeof(LDAP_POOL_CONN))) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		PKI_Free(key);
+		return NULL;
+	}
+	c->key = key;
+
+	if ((c->ld = URL_LDAP_connect(url, timeout)) == NULL)
+	{
 		PKI_log_debug("LDAP: can not connect to server (%s)",
 						url->url_s );
+		__ldap_pool_conn_free(c);
 		return NULL;
-	};
+	}
 
+	pthread_mutex_lock(&__ldap_pool.lock);
+	__ldap_pool.opened++;
+	pthread_mutex_unlock(&__ldap_pool.lock);
 
-#if defined(LDAP_VENDOR_OPENLDAP) || defined(LDAP_VENDOR_MICROSOFT)
-	if ((rc = ldap_search_ext_s(ld, url->path, LDAP_SCOPE_BASE,
-			filter, attrs, 0, NULL, NULL, time, (int) size, &res )) != LDAP_SUCCESS)
+	return c;
+}
+
+/*
+ * Returns a session to the pool, or closes it if the pool is full
+ */
+static void __ldap_pool_put(LDAP_POOL_CONN *c)
+{
+	pthread_mutex_lock(&__ldap_pool.lock);
+
+	if (__ldap_pool.num_idle < __ldap_pool.max_idle)
 	{
-		PKI_log_err("LDAP: Search Error (0x%8.8x)", rc);
-		goto end;
+		c->last_used = time(NULL);
+		c->next = __ldap_pool.idle;
+		__ldap_pool.idle = c;
+		__ldap_pool.num_idle++;
+		c = NULL;
 	}
 
-	/*
-	if (( rc = ldap_result (ld, msgid, LDAP_MSG_ONE,
-                       				&zerotime, &res)) <= 0 ) {
-		PKI_log_err("LDAP: [%s] object not found (0x%8.8x)", 
-			url->path, rc);
-		goto end;
+	pthread_mutex_unlock(&__ldap_pool.lock);
+
+	if (c) __ldap_pool_conn_free(c);
+}
+
+/*! \brief Sets the max number of idle LDAP sessions kept for reuse (0
+ *         disables the pool) and the time (secs) after which an idle
+ *         session is closed */
+
+int PKI_LDAP_POOL_set_limits(int max_idle, int idle_timeout)
+{
+	if (max_idle < 0 || idle_timeout <= 0)
+		return PKI_ERROR(PKI_ERR_PARAM_TYPE, NULL);
+
+	pthread_mutex_lock(&__ldap_pool.lock);
+	__ldap_pool.max_idle = max_idle;
+	__ldap_pool.idle_timeout = idle_timeout;
+	pthread_mutex_unlock(&__ldap_pool.lock);
+
+	if (max_idle == 0) PKI_LDAP_POOL_flush();
+
+	return PKI_OK;
+}
+
+/*! \brief Returns the number of sessions opened, the number of idle
+ *         sessions reused and the number of batches sent again on a new
+ *         session (the reused one was closed by the server) */
+
+int PKI_LDAP_POOL_get_stats(unsigned long *opened, unsigned long *reused,
+			    unsigned long *retried)
+{
+	pthread_mutex_lock(&__ldap_pool.lock);
+	if (opened) *opened = __ldap_pool.opened;
+	if (reused) *reused = __ldap_pool.reused;
+	if (retried) *retried = __ldap_pool.retried;
+	pthread_mutex_unlock(&__ldap_pool.lock);
+
+	return PKI_OK;
+}
+
+/*! \brief Closes all the idle LDAP sessions */
+
+void PKI_LDAP_POOL_flush(void)
+{
+	LDAP_POOL_CONN *c = NULL;
+	LDAP_POOL_CONN *idle = NULL;
+
+	pthread_mutex_lock(&__ldap_pool.lock);
+	idle = __ldap_pool.idle;
+	__ldap_pool.idle = NULL;
+	__ldap_pool.num_idle = 0;
+	pthread_mutex_unlock(&__ldap_pool.lock);
+
+	while ((c = idle) != NULL)
+	{
+		idle = c->next;
+		__ldap_pool_conn_free(c);
 	}
-	*/
+}
 
-#else
-	if (( rc = ldap_search_s( ld, url->path, LDAP_SCOPE_BASE,
-			filter, attrs, 0, &res )) != LDAP_SUCCESS ) {
+/* ------------------------------ BATCH SEARCH -------------------------------- */
+
+/*
+ * Returns the values of the attribute from all the entries of a search
+ * result (NULL if there are none), values larger than size (if size > 0)
+ * are skipped
+ */
+static PKI_MEM_STACK *__ldap_get_values(LDAP *ld, LDAPMessage *res,
+					char *attr, ssize_t size)
+{
+	LDAPMessage *entry = NULL;
+	struct berval **vals = NULL;
+	PKI_MEM_STACK *ret = NULL;
+	PKI_MEM *obj = NULL;
+	int i = 0;
+
+	for (entry = ldap_first_entry(ld, res); entry != NULL;
+			entry = ldap_next_entry(ld, entry))
+	{
+		if ((vals = ldap_get_values_len(ld, entry, attr)) == NULL)
+			continue;
 
-		PKI_log_err("LDAP: [%s] object not found (0x%8.8x)", url->path, rc);
+		for (i = 0; vals[i] != NULL; i++)
+		{
+			if (size > 0 && (ssize_t) vals[i]->bv_len >= size) continue;
 
-		goto end;
+			if (!ret && (ret = PKI_STACK_MEM_new()) == NULL) break;
+
+			if ((obj = PKI_MEM_new_null()) == NULL) break;
+
+			if (PKI_MEM_add(obj, (char *) vals[i]->bv_val,
+					(size_t) vals[i]->bv_len) == PKI_ERR) {
+				/* ERROR in memory growth */;
+				PKI_MEM_free(obj);
+				break;
+			}
+			PKI_STACK_MEM_push(ret, obj);
+		}
+
+		ldap_value_free_len(vals);
 	}
+
+	return ret;
+}
+
+#define LDAP_BATCH_QUEUED	0
+#define LDAP_BATCH_SENT		1
+#define LDAP_BATCH_DONE		2
+
+/*
+ * Runs the searches on the session. With OpenLDAP the searches are sent
+ * asynchronously and up to PKI_LDAP_BATCH_WINDOW of them are outstanding
+ * at any time, other vendors run them one at the time. Searches in the
+ * SENT state are moved back to QUEUED if the session is lost (and lost is
+ * set), so that they can be sent on a new session.
+ */
+static int __ldap_batch_run(LDAP *ld, const char **dn, int num, int *state,
+			    PKI_MEM_STACK **results, char **attrs,
+			    int timeout, ssize_t size, int *lost)
+{
+#ifdef _WINDOWS
+	struct l_timeval	zerotime;
+	struct l_timeval	*time = NULL;
+#else
+	struct timeval		zerotime;
+	struct timeval		*time = NULL;
 #endif
+	char *filter = "objectclass=*";
+	LDAPMessage *res = NULL;
+	int rc = 0;
+	int i = 0;
 
-	if (( i = ldap_count_entries( ld, res )) <= 0 ) {
-		PKI_log_err("No Returned Entries (%s)", i);
-	}
+#if defined(LDAP_VENDOR_OPENLDAP)
+	int slot_msgid[PKI_LDAP_BATCH_WINDOW];
+	int slot_idx[PKI_LDAP_BATCH_WINDOW];
+	int pending = 0;
+	int next = 0;
+	int err = 0;
+	int msgid = 0;
+	int code = 0;
+	int j = 0;
+#endif
+
+	*lost = 0;
 
-	if((ret = PKI_STACK_MEM_new()) == NULL ) {
-		/* ERROR: Allocating memory */
-		goto end;
+	if (timeout > 0) {
+		zerotime.tv_sec = timeout;
+		zerotime.tv_usec = 0L;
+		time = &zerotime;
 	}
-	if((vals = ldap_get_values_len (ld, res, attrs[0])) != NULL ) {
 
-		for( i=0; vals[i] != NULL; i++ ) {
-			if((obj = PKI_MEM_new_null()) == NULL ) {
-				goto end;
+#if defined(LDAP_VENDOR_OPENLDAP)
+
+	for (j = 0; j < PKI_LDAP_BATCH_WINDOW; j++) slot_msgid[j] = -1;
+
+	for (;;)
+	{
+		// Fills the window with new searches
+		while (pending < PKI_LDAP_BATCH_WINDOW && next < num)
+		{
+			if (state[next] != LDAP_BATCH_QUEUED)
+			{
+				next++;
+				continue;
 			}
-			if(PKI_MEM_add( obj, (char *) vals[i]->bv_val, 
-					vals[i]->bv_len) == PKI_ERR) {
-				/* ERROR in memory growth */;
-				break;
+
+			if ((rc = ldap_search_ext(ld, dn[next], LDAP_SCOPE_BASE,
+					filter, attrs, 0, NULL, NULL, time, 0,
+					&msgid)) != LDAP_SUCCESS)
+			{
+				if (rc == LDAP_SERVER_DOWN ||
+						rc == LDAP_CONNECT_ERROR)
+				{
+					*lost = 1;
+					break;
+				}
+
+				PKI_log_debug("LDAP: [%s] search error (0x%8.8x)",
+					dn[next], rc);
+				state[next++] = LDAP_BATCH_DONE;
+				continue;
 			}
-			PKI_STACK_MEM_push( ret, obj );
+
+			for (j = 0; slot_msgid[j] >= 0; j++);
+			slot_msgid[j] = msgid;
+			slot_idx[j] = next;
+			state[next++] = LDAP_BATCH_SENT;
+			pending++;
 		}
 
-		ldap_value_free_len( vals );
-		vals = NULL;
-	} else {
-		return NULL;
+		if (*lost || pending == 0) break;
+
+		// Waits for the next complete result (entries and final
+		// result message) of any of the outstanding searches
+		if ((rc = ldap_result(ld, LDAP_RES_ANY, LDAP_MSG_ALL,
+						time, &res)) <= 0)
+		{
+			if (rc == 0) PKI_log_err("LDAP: search timed out");
+			else *lost = 1;
+			err = 1;
+			break;
+		}
+
+		msgid = ldap_msgid(res);
+		for (j = 0; j < PKI_LDAP_BATCH_WINDOW &&
+				slot_msgid[j] != msgid; j++);
+
+		if (j >= PKI_LDAP_BATCH_WINDOW)
+		{
+			// Not one of ours (e.g., unsolicited notification)
+			ldap_msgfree(res);
+			continue;
+		}
+
+		i = slot_idx[j];
+		slot_msgid[j] = -1;
+		pending--;
+
+		if (ldap_parse_result(ld, res, &code, NULL, NULL, NULL,
+					NULL, 0) != LDAP_SUCCESS)
+			code = LDAP_OTHER;
+
+		if (code == LDAP_SUCCESS)
+			results[i] = __ldap_get_values(ld, res, attrs[0], size);
+		else
+			PKI_log_debug("LDAP: [%s] object not found (0x%8.8x)",
+				dn[i], code);
+
+		state[i] = LDAP_BATCH_DONE;
+		ldap_msgfree(res);
+		res = NULL;
+	}
+
+	if (*lost || err)
+	{
+		for (j = 0; j < PKI_LDAP_BATCH_WINDOW; j++)
+		{
+			if (slot_msgid[j] < 0) continue;
+
+			if (!*lost) ldap_abandon_ext(ld, slot_msgid[j], NULL, NULL);
+			state[slot_idx[j]] = LDAP_BATCH_QUEUED;
+		}
+
+		return PKI_ERR;
 	}
 
-end:
-	if(res) ldap_msgfree( res );
-#if defined(LDAP_VENDOR_OPENLDAP)
-	if(ld) ldap_unbind_ext( ld, NULL, NULL );
 #else
-	if(ld) ldap_unbind( ld );
+
+	for (i = 0; i < num; i++)
+	{
+		if (state[i] != LDAP_BATCH_QUEUED) continue;
+
+#if defined(LDAP_VENDOR_MICROSOFT)
+		rc = ldap_search_ext_s(ld, (char *) dn[i], LDAP_SCOPE_BASE,
+				filter, attrs, 0, NULL, NULL, time, 0, &res );
+#else
+		rc = ldap_search_s( ld, (char *) dn[i], LDAP_SCOPE_BASE,
+				filter, attrs, 0, &res );
 #endif
+		if (rc == LDAP_SERVER_DOWN)
+		{
+			if (res) ldap_msgfree(res);
+			*lost = 1;
+			return PKI_ERR;
+		}
 
-	return (ret);
+		if (rc == LDAP_SUCCESS)
+			results[i] = __ldap_get_values(ld, res, attrs[0], size);
+		else
+			PKI_log_debug("LDAP: [%s] object not found (0x%8.8x)",
+				dn[i], rc);
+
+		state[i] = LDAP_BATCH_DONE;
+
+		if (res) ldap_msgfree(res);
+		res = NULL;
+	}
+
+#endif
+
+	return PKI_OK;
+}
+
+/*! \brief Retrieves the attribute of the URL from many entries at once
+ *
+ * The server, the bind identity and the attribute are taken from the URL
+ * (its path is ignored), dn is the list of the num entries to retrieve.
+ * The session binds with the credentials of the URL (e.g., ldap://
+ * cn=reader,dc=example,dc=com:secret@host/...) and anonymously only if
+ * the URL carries none.
+ * The searches are pipelined over one (pooled) session, results[i] is set
+ * to the values retrieved for dn[i] or to NULL if the entry (or the
+ * attribute) could not be found. Values larger than size (if size > 0)
+ * are skipped.
+ *
+ * Returns PKI_OK if all the searches completed, PKI_ERR otherwise (e.g.,
+ * the server can not be reached or a search timed out), in which case
+ * the results array can still carry the values retrieved so far.
+ */
+
+int URL_get_data_ldap_batch(const URL *url, const char **dn, int num,
+			    PKI_MEM_STACK **results, int timeout,
+			    ssize_t size)
+{
+	LDAP_POOL_CONN *c = NULL;
+	char *attrs[] = { NULL, NULL };
+	int *state = NULL;
+	int reused = 0;
+	int lost = 0;
+	int ret = PKI_ERR;
+	int i = 0;
+
+	if (!url || !url->addr || !url->attrs || !dn || num <= 0 || !results)
+		return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	attrs[0] = url->attrs;
+
+	for (i = 0; i < num; i++) results[i] = NULL;
+
+	if ((state = PKI_Malloc(sizeof(int) * (size_t) num)) == NULL)
+		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+
+	for (i = 0; i < num; i++)
+		state[i] = dn[i] ? LDAP_BATCH_QUEUED : LDAP_BATCH_DONE;
+
+	PKI_log_debug("LDAP: Search Timeout is %d", timeout );
+
+	if ((c = __ldap_pool_get(url, timeout, &reused)) == NULL) goto end;
+
+	ret = __ldap_batch_run(c->ld, dn, num, state, results, attrs,
+				timeout, size, &lost);
+
+	// The session might have been closed by the server while idle, the
+	// searches not yet completed are sent once more on a new session
+	if (ret != PKI_OK && lost && reused)
+	{
+		__ldap_pool_conn_free(c);
+
+		pthread_mutex_lock(&__ldap_pool.lock);
+		__ldap_pool.retried++;
+		pthread_mutex_unlock(&__ldap_pool.lock);
+
+		if ((c = __ldap_pool_get(url, timeout, NULL)) == NULL) goto end;
+
+		ret = __ldap_batch_run(c->ld, dn, num, state, results, attrs,
+					timeout, size, &lost);
+	}
+
+	// Sessions with searches left outstanding are not reused
+	if (ret == PKI_OK) __ldap_pool_put(c);
+	else __ldap_pool_conn_free(c);
+
+end:
+	PKI_Free(state);
+
+	return ret;
 }
 
 #endif /* LDAP */
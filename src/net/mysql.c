@@ -267,10 +267,11 @@ char *parse_url_dbname ( const URL *url ) {
 
 #ifdef HAVE_MYSQL
 
+#include <errmsg.h>
+
 MYSQL *db_connect ( const URL *url ) {
 
 	MYSQL *sql = NULL;
-	char * table = NULL;
 	char * dbname = NULL;
 
 	if( (sql = mysql_init( NULL )) == NULL ) {
@@ -278,19 +279,19 @@ MYSQL *db_connect ( const URL *url ) {
 	}
 
 	dbname = parse_url_dbname ( url );
-	table = parse_url_table ( url );
 
 	/* The old mysql_connect is no more supported, it seems! */
 	/* mysql_connect( sql, url->addr, url->usr, url->pwd ); */
 	if((mysql_real_connect(sql, url->addr, url->usr, url->pwd,
 			dbname, (unsigned int) url->port, NULL, 0 )) == NULL ) {
+		PKI_log_err("Can not connect to %s (%s)", url->addr,
+			mysql_error(sql));
 		if( dbname ) PKI_Free ( dbname );
 		db_close( sql );
 		return( NULL );
 	}
 
 	if( dbname ) PKI_Free (dbname);
-	if( table ) PKI_Free (table);
 
 	return( sql );
 
@@ -305,8 +306,645 @@ int db_close ( MYSQL *sql ) {
 	return (PKI_OK);
 }
 
+/* ------------------------- PARAMETRIZED STATEMENTS -------------------------- */
+
+typedef struct mysql_url_stmt_st {
+	// Statement text, the values are referenced as '?'
+	char *query;
+
+	char **values;
+	unsigned long *lengths;
+	int num;
+} MYSQL_URL_STMT;
+
+static void __mysql_url_stmt_free(MYSQL_URL_STMT *st)
+{
+	int i = 0;
+
+	if (!st) return;
+
+	for (i = 0; i < st->num; i++) PKI_Free(st->values[i]);
+
+	if (st->values) PKI_Free(st->values);
+	if (st->lengths) PKI_Free(st->lengths);
+	if (st->query) PKI_Free(st->query);
+
+	PKI_Free(st);
+}
+
+static void __mysql_mem_puts(PKI_MEM *buf, const char *s)
+{
+	PKI_MEM_add(buf, (char *) s, strlen(s));
+}
+
+static int __mysql_url_stmt_add(MYSQL_URL_STMT *st, const char *val, size_t len)
+{
+	// Values are always allocated, an empty value is a valid one
+	if ((st->values[st->num] = PKI_Malloc(len + 1)) == NULL) return PKI_ERR;
+	if (len > 0) memcpy(st->values[st->num], val, len);
+
+	st->lengths[st->num] = (unsigned long) len;
+	st->num++;
+
+	return PKI_OK;
+}
+
+/*
+ * Returns PKI_OK if the len bytes at s are a plain identifier (letters,
+ * digits, '_' and '.') or, when list is set, a comma separated list of
+ * identifiers. Identifiers from the URL are part of the statement text
+ * (they can not be passed as parameters), therefore nothing else is
+ * accepted.
+ */
+static int __mysql_check_ident(const char *s, size_t len, int list)
+{
+	size_t i = 0;
+	size_t start = 0;
+
+	if (!s || len == 0) return PKI_ERR;
+
+	for (i = 0; i <= len; i++)
+	{
+		if (i == len || (list && s[i] == ','))
+		{
+			// Empty elements are not allowed
+			if (i == start) return PKI_ERR;
+			start = i + 1;
+		}
+		else if (!isalnum((unsigned char) s[i]) && s[i] != '_' && s[i] != '.')
+			return PKI_ERR;
+	}
+
+	return PKI_OK;
+}
+
+/*
+ * Builds the statement for the URL. The table, the attributes and the
+ * columns of the (col=val) filters are part of the statement text (i.e.,
+ * URLs that differ only in the values share the same prepared statement),
+ * the data (if any) and the filter values are passed as parameters. A
+ * SELECT is built when data is NULL, an INSERT (or an UPDATE when there
+ * are filters) otherwise.
+ */
+static MYSQL_URL_STMT *__mysql_url_stmt_new(const URL *url, const PKI_MEM *data)
+{
+	MYSQL_URL_STMT *st = NULL;
+	PKI_MEM *buf = NULL;
+	PKI_MEM *where = NULL;
+
+	char *table = NULL;
+	char *filters = NULL;
+	char *p = NULL;
+	char *end = NULL;
+	char *eq = NULL;
+	char *val = NULL;
+
+	size_t len = 0;
+	int max = 1;
+
+	if (!url || !url->path || !url->attrs)
+	{
+		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+		return NULL;
+	}
+
+	if ((table = parse_url_table(url)) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_URI_PARSE, NULL);
+		return NULL;
+	}
+
+	// Only a list of columns can be selected, a single one is stored
+	if (__mysql_check_ident(table, strlen(table), 0) != PKI_OK ||
+			__mysql_check_ident(url->attrs, strlen(url->attrs),
+				data == NULL) != PKI_OK)
+	{
+		PKI_ERROR(PKI_ERR_URI_PARSE, "Invalid table or column name");
+		PKI_Free(table);
+		return NULL;
+	}
+
+	// The filters are in the last element of the path
+	if ((filters = strrchr(url->path, '/')) != NULL) filters++;
+	if (filters && *filters != '(') filters = NULL;
+
+	for (p = filters; p && *p; p++) if (*p == '(') max++;
+
+	if ((st = PKI_Malloc(sizeof(MYSQL_URL_STMT))) == NULL ||
+			(st->values = PKI_Malloc(sizeof(char *) * (size_t) max)) == NULL ||
+			(st->lengths = PKI_Malloc(sizeof(unsigned long) * (size_t) max)) == NULL ||
+			(buf = PKI_MEM_new_null()) == NULL ||
+			(where = PKI_MEM_new_null()) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		goto err;
+	}
+
+	// The data to store is always the first parameter
+	if (data && __mysql_url_stmt_add(st, (const char *) data->data,
+						data->size) != PKI_OK)
+		goto err;
+
+	for (p = filters; p && *p == '('; p = end + 1)
+	{
+		if ((end = strchr(p, ')')) == NULL ||
+				(eq = memchr(p, '=', (size_t) (end - p))) == NULL ||
+				__mysql_check_ident(p + 1, (size_t) (eq - p - 1), 0) != PKI_OK)
+		{
+			PKI_ERROR(PKI_ERR_URI_PARSE, NULL);
+			goto err;
+		}
+
+		// Quoted values are accepted as well
+		val = eq + 1;
+		len = (size_t) (end - val);
+		if (len >= 2 && val[0] == '"' && val[len-1] == '"')
+		{
+			val++;
+			len -= 2;
+		}
+
+		if (where->size == 0) __mysql_mem_puts(where, " WHERE ");
+		else __mysql_mem_puts(where, " AND ");
+
+		PKI_MEM_add(where, p + 1, (size_t) (eq - p - 1));
+		__mysql_mem_puts(where, "=?");
+
+		if (__mysql_url_stmt_add(st, val, len) != PKI_OK) goto err;
+	}
+
+	if (data == NULL)
+	{
+		__mysql_mem_puts(buf, "SELECT ");
+		__mysql_mem_puts(buf, url->attrs);
+		__mysql_mem_puts(buf, " FROM ");
+		__mysql_mem_puts(buf, table);
+	}
+	else if (where->size == 0)
+	{
+		__mysql_mem_puts(buf, "INSERT INTO ");
+		__mysql_mem_puts(buf, table);
+		__mysql_mem_puts(buf, " (");
+		__mysql_mem_puts(buf, url->attrs);
+		__mysql_mem_puts(buf, ") VALUES (?)");
+	}
+	else
+	{
+		__mysql_mem_puts(buf, "UPDATE ");
+		__mysql_mem_puts(buf, table);
+		__mysql_mem_puts(buf, " SET ");
+		__mysql_mem_puts(buf, url->attrs);
+		__mysql_mem_puts(buf, "=?");
+	}
+
+	PKI_MEM_add(buf, (char *) where->data, where->size);
+
+	if ((st->query = PKI_Malloc(buf->size + 1)) == NULL) goto err;
+	memcpy(st->query, buf->data, buf->size);
+
+	PKI_MEM_free(where);
+	PKI_MEM_free(buf);
+	PKI_Free(table);
+
+	return st;
+
+err:
+	if (where) PKI_MEM_free(where);
+	if (buf) PKI_MEM_free(buf);
+	if (table) PKI_Free(table);
+	__mysql_url_stmt_free(st);
+
+	return NULL;
+}
+
+/* --------------------------- CONNECTION POOL -------------------------------- */
+
+typedef struct mysql_pool_stmt_st {
+	char *query;
+	MYSQL_STMT *stmt;
+	struct mysql_pool_stmt_st *next;
+} MYSQL_POOL_STMT;
+
+typedef struct mysql_pool_conn_st {
+	// Server, credentials and database of the connection
+	char *key;
+
+	MYSQL *sql;
+
+	// Statements prepared on this connection
+	MYSQL_POOL_STMT *stmts;
+	int num_stmts;
+
+	time_t last_used;
+	struct mysql_pool_conn_st *next;
+} MYSQL_POOL_CONN;
+
+static struct {
+	pthread_mutex_t lock;
+	MYSQL_POOL_CONN *idle;
+	int num_idle;
+	int max_idle;
+	int idle_timeout;
+
+	// Statistics
+	unsigned long opened;
+	unsigned long reused;
+	unsigned long retried;
+} __mysql_pool = { PTHREAD_MUTEX_INITIALIZER, NULL, 0,
+		PKI_MYSQL_POOL_MAX_IDLE, PKI_MYSQL_POOL_IDLE_TIMEOUT, 0, 0, 0 };
+
+static char *__mysql_pool_key(const URL *url)
+{
+	char *dbname = NULL;
+	char *ret = NULL;
+	size_t len = 0;
+
+	dbname = parse_url_dbname(url);
+
+	len = strlen(url->addr) + 32 +
+		(url->usr ? strlen(url->usr) : 0) +
+		(url->pwd ? strlen(url->pwd) : 0) +
+		(dbname ? strlen(dbname) : 0);
+
+	if ((ret = PKI_Malloc(len)) != NULL)
+	{
+		snprintf(ret, len, "%s:%s@%s:%d/%s",
+			url->usr ? url->usr : "", url->pwd ? url->pwd : "",
+			url->addr, url->port, dbname ? dbname : "");
+	}
+
+	if (dbname) PKI_Free(dbname);
+
+	return ret;
+}
+
+static void __mysql_pool_conn_free(MYSQL_POOL_CONN *c)
+{
+	MYSQL_POOL_STMT *s = NULL;
+
+	if (!c) return;
+
+	while ((s = c->stmts) != NULL)
+	{
+		c->stmts = s->next;
+		mysql_stmt_close(s->stmt);
+		PKI_Free(s->query);
+		PKI_Free(s);
+	}
+
+	if (c->sql) db_close(c->sql);
+	if (c->key) PKI_Free(c->key);
+
+	PKI_Free(c);
+}
+
+/*
+ * Returns a healthy idle connection for the URL or a new one. Connections
+ * that have been idle for more than PKI_MYSQL_POOL_PING_INTERVAL secs are
+ * checked with a round-trip to the server before being reused
+ */
+static MYSQL_POOL_CONN *__mysql_pool_get(const URL *url, int *reused)
+{
+	MYSQL_POOL_CONN *c = NULL;
+	MYSQL_POOL_CONN **pnt = NULL;
+	MYSQL_POOL_CONN *expired = NULL;
+	char *key = NULL;
+	time_t now = time(NULL);
+
+	if ((key = __mysql_pool_key(url)) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		return NULL;
+	}
+
+	for (;;)
+	{
+		pthread_mutex_lock(&__mysql_pool.lock);
+
+		for (pnt = &__mysql_pool.idle; (c = *pnt) != NULL; )
+		{
+			if (now - c->last_used >= __mysql_pool.idle_timeout)
+			{
+				*pnt = c->next;
+				__mysql_pool.num_idle--;
+				c->next = expired;
+				expired = c;
+				continue;
+			}
+
+			if (strcmp(c->key, key) == 0)
+			{
+				*pnt = c->next;
+				__mysql_pool.num_idle--;
+				break;
+			}
+
+			pnt = &c->next;
+		}
+
+		pthread_mutex_unlock(&__mysql_pool.lock);
+
+		while (expired != NULL)
+		{
+			MYSQL_POOL_CONN *next = expired->next;
+			__mysql_pool_conn_free(expired);
+			expired = next;
+		}
+
+		if (!c || now - c->last_used < PKI_MYSQL_POOL_PING_INTERVAL ||
+				mysql_ping(c->sql) == 0)
+			break;
+
+		__mysql_pool_conn_free(c);
+	}
+
+	if (reused) *reused = (c != NULL);
+
+	if (c)
+	{
+		pthread_mutex_lock(&__mysql_pool.lock);
+		__mysql_pool.reused++;
+		pthread_mutex_unlock(&__mysql_pool.lock);
+
+		PKI_Free(key);
+		return c;
+	}
+
+	if ((c = PKI_Malloc(sizeof(MYSQL_POOL_CONN))) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		PKI_Free(key);
+		return NULL;
+	}
+	c->key = key;
+
+	if ((c->sql = db_connect(url)) == NULL)
+	{
+		__mysql_pool_conn_free(c);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&__mysql_pool.lock);
+	__mysql_pool.opened++;
+	pthread_mutex_unlock(&__mysql_pool.lock);
+
+	return c;
+}
+
+/*
+ * Returns a connection to the pool, or closes it if the pool is full
+ */
+static void __mysql_pool_put(MYSQL_POOL_CONN *c)
+{
+	pthread_mutex_lock(&__mysql_pool.lock);
+
+	if (__mysql_pool.num_idle < __mysql_pool.max_idle)
+	{
+		c->last_used = time(NULL);
+		c->next = __mysql_pool.idle;
+		__mysql_pool.idle = c;
+		__mysql_pool.num_idle++;
+		c = NULL;
+	}
+
+	pthread_mutex_unlock(&__mysql_pool.lock);
+
+	if (c) __mysql_pool_conn_free(c);
+}
+
+/*
+ * Returns 1 if the last error on the statement is due to a lost
+ * connection to the server
+ */
+static int __mysql_conn_lost(MYSQL_STMT *stmt)
+{
+	unsigned int err = mysql_stmt_errno(stmt);
+
+	return (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST);
+}
+
+/*
+ * Returns the server-side prepared statement for the query, the statement
+ * is prepared on first use and it is kept on the connection (up to
+ * PKI_MYSQL_POOL_MAX_STMTS statements). If cached is set to 0, the caller
+ * shall close the statement after use. Sets lost if the statement could
+ * not be prepared because the connection to the server was lost.
+ */
+static MYSQL_STMT *__mysql_pool_prepare(MYSQL_POOL_CONN *c,
+					const MYSQL_URL_STMT *st,
+					int *cached, int *lost)
+{
+	MYSQL_POOL_STMT *s = NULL;
+	MYSQL_STMT *stmt = NULL;
+
+	*cached = 0;
+	*lost = 0;
+
+	for (s = c->stmts; s != NULL; s = s->next)
+	{
+		if (strcmp(s->query, st->query) == 0)
+		{
+			*cached = 1;
+			return s->stmt;
+		}
+	}
+
+	if ((stmt = mysql_stmt_init(c->sql)) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		return NULL;
+	}
+
+	if (mysql_stmt_prepare(stmt, st->query, strlen(st->query)) != 0 ||
+			mysql_stmt_param_count(stmt) != (unsigned long) st->num)
+	{
+		PKI_log_err("Can not prepare SQL statement (%s)",
+			mysql_stmt_error(stmt));
+		*lost = __mysql_conn_lost(stmt);
+		mysql_stmt_close(stmt);
+		return NULL;
+	}
+
+	if (c->num_stmts >= PKI_MYSQL_POOL_MAX_STMTS) return stmt;
+
+	if ((s = PKI_Malloc(sizeof(MYSQL_POOL_STMT))) == NULL ||
+			(s->query = strdup(st->query)) == NULL)
+	{
+		if (s) PKI_Free(s);
+		return stmt;
+	}
+
+	s->stmt = stmt;
+	s->next = c->stmts;
+	c->stmts = s;
+	c->num_stmts++;
+
+	*cached = 1;
+
+	return stmt;
+}
+
+/*
+ * Prepares (if needed) and executes the statement on the connection
+ */
+static MYSQL_STMT *__mysql_pool_send(MYSQL_POOL_CONN *c,
+				     const MYSQL_URL_STMT *st,
+				     int *cached, int *lost)
+{
+	MYSQL_STMT *stmt = NULL;
+	MYSQL_BIND *bind = NULL;
+	int i = 0;
+
+	if ((stmt = __mysql_pool_prepare(c, st, cached, lost)) == NULL)
+		return NULL;
+
+	if (st->num > 0 && (bind = PKI_Malloc(sizeof(MYSQL_BIND) *
+					(size_t) st->num)) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		goto err;
+	}
+
+	for (i = 0; i < st->num; i++)
+	{
+		bind[i].buffer_type = MYSQL_TYPE_STRING;
+		bind[i].buffer = st->values[i];
+		bind[i].buffer_length = st->lengths[i];
+		bind[i].length = &st->lengths[i];
+	}
+
+	if ((bind && mysql_stmt_bind_param(stmt, bind) != 0) ||
+			mysql_stmt_execute(stmt) != 0)
+	{
+		PKI_log_err("Can not execute SQL statement (%s)",
+			mysql_stmt_error(stmt));
+		*lost = __mysql_conn_lost(stmt);
+		goto err;
+	}
+
+	if (bind) PKI_Free(bind);
+
+	return stmt;
+
+err:
+	if (bind) PKI_Free(bind);
+	if (!*cached) mysql_stmt_close(stmt);
+
+	return NULL;
+}
+
+/*
+ * Executes the statement, a statement that fails on a reused connection
+ * because the connection was lost (e.g., closed by the server meanwhile)
+ * is executed once more on a new connection if retry is set
+ */
+static MYSQL_STMT *__mysql_pool_exec(const URL *url, const MYSQL_URL_STMT *st,
+				     int retry, MYSQL_POOL_CONN **conn,
+				     int *cached)
+{
+	MYSQL_POOL_CONN *c = NULL;
+	MYSQL_STMT *stmt = NULL;
+	int reused = 0;
+	int lost = 0;
+
+	*conn = NULL;
+
+	if ((c = __mysql_pool_get(url, &reused)) == NULL) return NULL;
+
+	if ((stmt = __mysql_pool_send(c, st, cached, &lost)) == NULL)
+	{
+		if (lost) __mysql_pool_conn_free(c);
+		else __mysql_pool_put(c);
+
+		if (!lost || !reused || !retry) return NULL;
+
+		pthread_mutex_lock(&__mysql_pool.lock);
+		__mysql_pool.retried++;
+		pthread_mutex_unlock(&__mysql_pool.lock);
+
+		if ((c = __mysql_pool_get(url, NULL)) == NULL) return NULL;
+
+		if ((stmt = __mysql_pool_send(c, st, cached, &lost)) == NULL)
+		{
+			if (lost) __mysql_pool_conn_free(c);
+			else __mysql_pool_put(c);
+
+			return NULL;
+		}
+	}
+
+	*conn = c;
+
+	return stmt;
+}
+
+#endif
+
+/*! \brief Sets the max number of idle MySQL connections kept for reuse
+ *         (0 disables the pool) and the time (secs) after which an idle
+ *         connection is closed */
+
+int PKI_MYSQL_POOL_set_limits(int max_idle, int idle_timeout)
+{
+	if (max_idle < 0 || idle_timeout <= 0)
+		return PKI_ERROR(PKI_ERR_PARAM_TYPE, NULL);
+
+#ifdef HAVE_MYSQL
+	pthread_mutex_lock(&__mysql_pool.lock);
+	__mysql_pool.max_idle = max_idle;
+	__mysql_pool.idle_timeout = idle_timeout;
+	pthread_mutex_unlock(&__mysql_pool.lock);
+
+	if (max_idle == 0) PKI_MYSQL_POOL_flush();
+#endif
+
+	return PKI_OK;
+}
+
+/*! \brief Returns the number of connections opened, the number of idle
+ *         connections reused and the number of statements sent again on
+ *         a new connection (the reused one was closed by the server) */
 
+int PKI_MYSQL_POOL_get_stats(unsigned long *opened, unsigned long *reused,
+			 unsigned long *retried)
+{
+#ifdef HAVE_MYSQL
+	pthread_mutex_lock(&__mysql_pool.lock);
+	if (opened) *opened = __mysql_pool.opened;
+	if (reused) *reused = __mysql_pool.reused;
+	if (retried) *retried = __mysql_pool.retried;
+	pthread_mutex_unlock(&__mysql_pool.lock);
+#else
+	if (opened) *opened = 0;
+	if (reused) *reused = 0;
+	if (retried) *retried = 0;
+#endif
+
+	return PKI_OK;
+}
+
+/*! \brief Closes all the idle MySQL connections */
+
+void PKI_MYSQL_POOL_flush(void)
+{
+#ifdef HAVE_MYSQL
+	MYSQL_POOL_CONN *c = NULL;
+	MYSQL_POOL_CONN *idle = NULL;
+
+	pthread_mutex_lock(&__mysql_pool.lock);
+	idle = __mysql_pool.idle;
+	__mysql_pool.idle = NULL;
+	__mysql_pool.num_idle = 0;
+	pthread_mutex_unlock(&__mysql_pool.lock);
+
+	while ((c = idle) != NULL)
+	{
+		idle = c->next;
+		__mysql_pool_conn_free(c);
+	}
 #endif
+}
+
 
 PKI_MEM_STACK *URL_get_data_mysql ( const char *url_s, ssize_t size )
 {
@@ -343,81 +981,146 @@ PKI_MEM_STACK *URL_get_data_mysql ( const char *url_s, ssize_t size )
 	return ret;
 }
 
+/*! \brief Retrieves the first field of each row selected by the URL
+ *
+ * The connection is taken from the pool and the query is executed as a
+ * prepared statement. Rows are fetched one at the time from the server
+ * (the whole result set is never buffered), values larger than size (if
+ * size > 0) are skipped.
+ */
+
 PKI_MEM_STACK *URL_get_data_mysql_url ( const URL *url, ssize_t size ) {
 
 #ifdef HAVE_MYSQL
-	MYSQL_ROW row;
-	MYSQL * sql = NULL;
-	MYSQL_FIELD *fields = NULL;
-	MYSQL_RES *res = NULL;
-
-	unsigned long *lengths = NULL;
-	long long n_rows = 0;
-	int n_fields = 0;
+	MYSQL_POOL_CONN *c = NULL;
+	MYSQL_URL_STMT *st = NULL;
+	MYSQL_STMT *stmt = NULL;
+	MYSQL_BIND *fields = NULL;
+	MYSQL_BIND col;
+
+	unsigned long len = 0;
+	unsigned int n_fields = 0;
+	unsigned int i = 0;
+	int cached = 0;
+	int error = 0;
+	int rc = 0;
 
 	PKI_MEM *tmp_mem = NULL;
 	PKI_MEM_STACK *sk = NULL;
 
-	char * query = NULL;
-
 	if( !url ) return (NULL);
 
-	if((sql = db_connect ( url )) == NULL )
+	if ((st = __mysql_url_stmt_new(url, NULL)) == NULL)
 	{
+		PKI_log_err("Can not parse URL query");
 		return NULL;
 	}
 
-	if ((query = parse_url_query(url)) == NULL)
+	if ((stmt = __mysql_pool_exec(url, st, 1, &c, &cached)) == NULL)
 	{
-		PKI_log_err("Can not parse URL query");
-		goto end;
+		__mysql_url_stmt_free(st);
+		return NULL;
 	}
-	else mysql_query(sql, query);
 
-	/* Get the Data */
-	if((res = mysql_store_result( sql )) == NULL)
+	// Only the length of the first field is retrieved at fetch time,
+	// the value is then copied directly in the returned PKI_MEM
+	if ((n_fields = mysql_stmt_field_count(stmt)) < 1 ||
+			(fields = PKI_Malloc(sizeof(MYSQL_BIND) * n_fields)) == NULL)
 	{
-		PKI_log_err("Can not retrieve SQL data");
+		PKI_log_err("No fields returned by the query");
+		error = 1;
 		goto end;
 	}
 
-	if( ((n_rows = (long long) mysql_num_rows( res )) < 1 ) || 
-			((sk = PKI_STACK_MEM_new()) == NULL))
+	fields[0].buffer_type = MYSQL_TYPE_BLOB;
+	fields[0].length = &len;
+
+	// The other columns are not retrieved at all
+	for (i = 1; i < n_fields; i++) fields[i].buffer_type = MYSQL_TYPE_NULL;
+
+	if (mysql_stmt_bind_result(stmt, fields) != 0)
 	{
-		PKI_log_err("No returned rows found");
+		PKI_log_err("Can not retrieve SQL data (%s)",
+			mysql_stmt_error(stmt));
+		error = 1;
 		goto end;
 	}
 
-	while((row = mysql_fetch_row(res)) != NULL )
+	// Rows are not stored on the client (no mysql_stmt_store_result),
+	// they are read from the server one at the time
+	while ((rc = mysql_stmt_fetch(stmt)) == 0 || rc == MYSQL_DATA_TRUNCATED)
 	{
-		/* Count the number of fields retrieved */
-		n_fields = (int) mysql_num_fields( res );
-		lengths = mysql_fetch_lengths( res );
-		fields = mysql_fetch_fields( res );
-		if (!fields)
+		if (size > 0 && len >= (unsigned long) size) continue;
+
+		if (!sk && (sk = PKI_STACK_MEM_new()) == NULL)
 		{
-			PKI_ERROR(PKI_ERR_GENERAL, "can not fetch query fields");
+			error = 1;
 			break;
 		}
 
-		if (n_fields > 0)
+		if (len == 0)
 		{
-			tmp_mem = PKI_MEM_new_null();
-			if (size == 0 || (( size > 0 ) && ( lengths[0] < size)))
+			// Empty values do not require a fetch
+			if ((tmp_mem = PKI_MEM_new_null()) == NULL)
 			{
-				PKI_MEM_add(tmp_mem,row[0],lengths[0]);
+				error = 1;
+				break;
+			}
+		}
+		else
+		{
+			if ((tmp_mem = PKI_MEM_new((size_t) len)) == NULL)
+			{
+				error = 1;
+				break;
+			}
 
-				/* For now, let's only deal with one 
-				   field at the time */
-				PKI_STACK_push( sk, tmp_mem );
+			memset(&col, 0, sizeof(col));
+			col.buffer_type = MYSQL_TYPE_BLOB;
+			col.buffer = tmp_mem->data;
+			col.buffer_length = len;
+			col.length = &len;
+
+			if (mysql_stmt_fetch_column(stmt, &col, 0, 0) != 0)
+			{
+				PKI_log_err("Can not retrieve SQL data (%s)",
+					mysql_stmt_error(stmt));
+				PKI_MEM_free(tmp_mem);
+				error = 1;
+				break;
 			}
 		}
+
+		/* For now, let's only deal with one 
+		   field at the time */
+		PKI_STACK_MEM_push(sk, tmp_mem);
+	}
+
+	if (rc == 1)
+	{
+		PKI_log_err("Can not retrieve SQL data (%s)",
+			mysql_stmt_error(stmt));
+		error = 1;
 	}
 
 end:
 
-	if (query) PKI_Free (query);
-	db_close ( sql );
+	mysql_stmt_free_result(stmt);
+	if (!cached) mysql_stmt_close(stmt);
+
+	// Rows might be left unread on the server after an error, the
+	// connection can not be used again
+	if (error) __mysql_pool_conn_free(c);
+	else __mysql_pool_put(c);
+
+	if (fields) PKI_Free(fields);
+	__mysql_url_stmt_free(st);
+
+	if (error && sk)
+	{
+		PKI_STACK_MEM_free_all(sk);
+		sk = NULL;
+	}
 
 	return ( sk );
 
@@ -463,33 +1166,32 @@ int URL_put_data_mysql ( const char *url_s, const PKI_MEM *data ) {
 	return ret;
 }
 
+/*! \brief Stores the data in the column selected by the URL (INSERT, or
+ *         UPDATE of the rows matching the URL filters) */
+
 int URL_put_data_mysql_url ( const URL *url, const PKI_MEM *data ) {
 
 #ifdef HAVE_MYSQL
-	MYSQL * sql = NULL;
+	MYSQL_POOL_CONN *c = NULL;
+	MYSQL_URL_STMT *st = NULL;
+	MYSQL_STMT *stmt = NULL;
+	int cached = 0;
 
-	char * query = NULL;
+	if( !url || !data ) return (PKI_ERR);
 
-	if( !url ) return (PKI_ERR);
+	if ((st = __mysql_url_stmt_new(url, data)) == NULL) return PKI_ERR;
 
-	if((query = parse_url_put_query( url, data )) == NULL ) {
-		return( PKI_ERR );
-	}
-
-	if((sql = db_connect ( url )) == NULL ) {
-		PKI_Free( query );
-		return(PKI_ERR);
+	// Statements that change the data are never retried
+	if ((stmt = __mysql_pool_exec(url, st, 0, &c, &cached)) == NULL)
+	{
+		__mysql_url_stmt_free(st);
+		return PKI_ERR;
 	}
 
-	if(mysql_query(sql, query ) != 0 ) {
-		PKI_Free ( query );
-		db_close( sql );
-
-		return( PKI_ERR );
-	}
+	if (!cached) mysql_stmt_close(stmt);
 
-	PKI_Free (query);
-	db_close ( sql );
+	__mysql_pool_put(c);
+	__mysql_url_stmt_free(st);
 
 	return ( PKI_OK );
 
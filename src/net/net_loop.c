@@ -0,0 +1,884 @@
+/* PKI_NET_LOOP - event driven (epoll) server loop for PKI_SOCKET
+ * (c) 2012 by Massimiliano Pala and OpenCA Labs
+ * OpenCA Licensed Software
+ *
+ * The thread calling PKI_NET_LOOP_run() waits on epoll and accepts new
+ * connections, the callbacks are executed by a pool of workers. Each
+ * connection is armed with EPOLLONESHOT so that it is owned by one
+ * worker at a time; events received meanwhile are accumulated and the
+ * connection is queued again when the worker is done with it.
+ */
+
+// Needed for accept4()
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <libpki/pki.h>
+
+#ifdef LIBPKI_TARGET_LINUX
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#endif
+
+#define PKI_NET_LOOP_MAX_EVENTS		256
+
+#define __EV(e)			(1U << (e))
+
+/* --------------------------- Static Functions -------------------------- */
+
+static SSL * __conn_ssl(const PKI_NET_CONN *conn) {
+
+	if (conn->sock->type != PKI_SOCKET_SSL || !conn->sock->ssl)
+		return NULL;
+
+	return conn->sock->ssl->ssl;
+}
+
+/*! \brief Sends data without blocking, returns the number of bytes accepted
+ *         by the socket (0 if it would block) or -1 on error */
+
+static ssize_t __conn_send(PKI_NET_CONN *conn, const void *buf, size_t size) {
+
+	SSL *ssl = NULL;
+	ssize_t n = 0;
+
+	if ((ssl = __conn_ssl(conn)) != NULL) {
+
+		if (size > INT_MAX) size = INT_MAX;
+
+		// SSL_get_error() also looks at this thread's error queue
+		ERR_clear_error();
+		if ((n = SSL_write(ssl, buf, (int) size)) > 0) return n;
+
+		switch (SSL_get_error(ssl, (int) n)) {
+			case SSL_ERROR_WANT_WRITE:
+			case SSL_ERROR_WANT_READ:
+				return 0;
+			default:
+				return -1;
+		}
+	}
+
+	for (;;) {
+		if ((n = send(conn->sock->fd, buf, size, MSG_NOSIGNAL)) >= 0)
+			return n;
+
+		if (errno == EINTR) continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+
+		return -1;
+	}
+}
+
+/*! \brief Writes out as much of the pending output as possible */
+
+static int __conn_flush(PKI_NET_CONN *conn) {
+
+	ssize_t n = 0;
+
+	while (conn->out.size > 0) {
+
+		if ((n = __conn_send(conn, conn->out.data, conn->out.size)) < 0)
+			return PKI_ERR;
+
+		if (n == 0) break;
+
+		memmove(conn->out.data, conn->out.data + n,
+			conn->out.size - (size_t) n);
+		conn->out.size -= (size_t) n;
+	}
+
+	return PKI_OK;
+}
+
+#ifdef LIBPKI_TARGET_LINUX
+
+/*! \brief Adds a connection to the work queue, must hold the loop mutex */
+
+static void __loop_enqueue(PKI_NET_LOOP *loop, PKI_NET_CONN *conn) {
+
+	conn->next = NULL;
+
+	if (loop->queue_tail) loop->queue_tail->next = conn;
+	else loop->queue_head = conn;
+
+	loop->queue_tail = conn;
+
+	PKI_COND_signal(&loop->cond);
+}
+
+/*! \brief (Re)Arms the connection in epoll, must hold the loop mutex */
+
+static int __conn_arm(PKI_NET_CONN *conn) {
+
+	struct epoll_event ev;
+	int op = conn->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+	memset(&ev, 0, sizeof(ev));
+
+	ev.events = EPOLLONESHOT | EPOLLRDHUP;
+	if (conn->state != PKI_NET_CONN_CLOSING) ev.events |= EPOLLIN;
+	if (conn->out.size > 0 || conn->want_write) ev.events |= EPOLLOUT;
+
+	ev.data.u64 = ((uint64_t) conn->gen << 32) | conn->id;
+
+	if (epoll_ctl(conn->loop->epfd, op, conn->sock->fd, &ev) < 0)
+		return PKI_ERR;
+
+	conn->registered = 1;
+
+	return PKI_OK;
+}
+
+/*! \brief Releases all the resources of a connection and returns its slot
+ *         to the free list. The caller must own the connection (busy) */
+
+static void __conn_close(PKI_NET_CONN *conn) {
+
+	PKI_NET_LOOP *loop = conn->loop;
+	SSL *ssl = NULL;
+
+	// CLOSE is delivered only if ACCEPT was, connections still waiting
+	// in the queue (e.g., at shutdown) are closed silently
+	if (conn->accepted)
+		conn->listener->cb(conn, PKI_NET_EVENT_CLOSE,
+					conn->listener->arg);
+
+	// Best effort close_notify, we do not wait for the peer's
+	if ((ssl = __conn_ssl(conn)) != NULL && !conn->eof &&
+			conn->state != PKI_NET_CONN_HANDSHAKE)
+		SSL_shutdown(ssl);
+
+	if (conn->registered)
+		epoll_ctl(loop->epfd, EPOLL_CTL_DEL, conn->sock->fd, NULL);
+
+	close(conn->sock->fd);
+	conn->sock->fd = -1;
+
+	PKI_SOCKET_free(conn->sock);
+	PKI_MEM_cleanup(&conn->out);
+
+	PKI_MUTEX_acquire(&loop->mutex);
+
+	conn->sock = NULL;
+	conn->listener = NULL;
+	conn->data = NULL;
+	conn->state = PKI_NET_CONN_FREE;
+	conn->accepted = 0;
+	conn->busy = 0;
+	conn->events = 0;
+
+	// Pending events for the old connection are now stale
+	if (++conn->gen == 0) conn->gen = 1;
+
+	conn->next = loop->free_list;
+	loop->free_list = conn;
+	loop->num_conns--;
+
+	PKI_MUTEX_release(&loop->mutex);
+}
+
+/*! \brief Drives the TLS handshake, returns 1 when completed, 0 if it has
+ *         to wait for the socket and -1 on error */
+
+static int __conn_handshake(PKI_NET_CONN *conn) {
+
+	SSL *ssl = __conn_ssl(conn);
+	int rv = 0;
+
+	conn->want_write = 0;
+
+	ERR_clear_error();
+	if ((rv = SSL_do_handshake(ssl)) == 1) {
+		conn->sock->ssl->connected = 1;
+		return 1;
+	}
+
+	switch (SSL_get_error(ssl, rv)) {
+		case SSL_ERROR_WANT_READ:
+			return 0;
+		case SSL_ERROR_WANT_WRITE:
+			conn->want_write = 1;
+			return 0;
+		default:
+			PKI_log_debug("PKI_NET_LOOP: TLS handshake failed "
+				"(fd %d)", conn->sock->fd);
+			return -1;
+	}
+}
+
+/*! \brief Processes the events of a connection owned by the worker */
+
+static void __conn_process(PKI_NET_CONN *conn, unsigned int ev) {
+
+	PKI_NET_LOOP *loop = conn->loop;
+	PKI_NET_LISTENER *l = conn->listener;
+	SSL *ssl = __conn_ssl(conn);
+	int close_it = 0;
+	int rv = 0;
+
+	if (conn->state == PKI_NET_CONN_HANDSHAKE) {
+
+		if (ev & __EV(PKI_NET_EVENT_TIMEOUT)) {
+			close_it = 1;
+		} else if ((rv = __conn_handshake(conn)) == 1) {
+			conn->state = PKI_NET_CONN_OPEN;
+			ev = __EV(PKI_NET_EVENT_ACCEPT);
+			if (SSL_pending(ssl) > 0) ev |= __EV(PKI_NET_EVENT_READ);
+		} else if (rv < 0) {
+			close_it = 1;
+		} else {
+			ev = 0;
+		}
+	}
+
+	if (!close_it && (ev & __EV(PKI_NET_EVENT_ACCEPT))) {
+		conn->accepted = 1;
+		if (l->cb(conn, PKI_NET_EVENT_ACCEPT, l->arg) != PKI_OK)
+			conn->state = PKI_NET_CONN_CLOSING;
+	}
+
+	if (!close_it && (ev & __EV(PKI_NET_EVENT_WRITE))) {
+
+		// A read that needed to write can now make progress
+		if (conn->want_write) {
+			conn->want_write = 0;
+			ev |= __EV(PKI_NET_EVENT_READ);
+		}
+
+		if (conn->out.size > 0) {
+			if (__conn_flush(conn) != PKI_OK) {
+				close_it = 1;
+			} else if (conn->out.size == 0 &&
+					conn->state == PKI_NET_CONN_OPEN &&
+					l->cb(conn, PKI_NET_EVENT_WRITE,
+						l->arg) != PKI_OK) {
+				conn->state = PKI_NET_CONN_CLOSING;
+			}
+		}
+	}
+
+	if (!close_it && (ev & __EV(PKI_NET_EVENT_READ)) &&
+			conn->state == PKI_NET_CONN_OPEN) {
+
+		if (conn->timeout > 0)
+			conn->deadline = time(NULL) + conn->timeout;
+
+		if (l->cb(conn, PKI_NET_EVENT_READ, l->arg) != PKI_OK)
+			conn->state = PKI_NET_CONN_CLOSING;
+	}
+
+	if (!close_it && (ev & __EV(PKI_NET_EVENT_TIMEOUT)) &&
+			conn->state != PKI_NET_CONN_FREE) {
+
+		if (conn->state == PKI_NET_CONN_CLOSING ||
+				l->cb(conn, PKI_NET_EVENT_TIMEOUT,
+						l->arg) != PKI_OK) {
+			close_it = 1;
+		} else if (conn->timeout > 0) {
+			conn->deadline = time(NULL) + conn->timeout;
+		}
+	}
+
+	if (conn->eof) close_it = 1;
+
+	if (conn->state == PKI_NET_CONN_CLOSING && conn->out.size == 0)
+		close_it = 1;
+
+	if (!close_it) {
+
+		PKI_MUTEX_acquire(&loop->mutex);
+
+		// Data already decrypted is not signalled by epoll
+		if (ssl && conn->state == PKI_NET_CONN_OPEN &&
+				SSL_pending(ssl) > 0)
+			conn->events |= __EV(PKI_NET_EVENT_READ);
+
+		if (conn->events) {
+			__loop_enqueue(loop, conn);
+		} else if (__conn_arm(conn) == PKI_OK) {
+			// Armed while holding the mutex so that the fd can
+			// not be closed by another owner in between
+			conn->busy = 0;
+		} else {
+			close_it = 1;
+		}
+
+		PKI_MUTEX_release(&loop->mutex);
+	}
+
+	if (close_it) __conn_close(conn);
+}
+
+static void * __loop_worker(void *arg) {
+
+	PKI_NET_LOOP *loop = (PKI_NET_LOOP *) arg;
+	PKI_NET_CONN *conn = NULL;
+	unsigned int ev = 0;
+
+	for (;;) {
+
+		PKI_MUTEX_acquire(&loop->mutex);
+
+		while (!loop->stop && !loop->queue_head)
+			PKI_COND_wait(&loop->cond, &loop->mutex);
+
+		if (loop->stop) {
+			PKI_MUTEX_release(&loop->mutex);
+			break;
+		}
+
+		conn = loop->queue_head;
+		if ((loop->queue_head = conn->next) == NULL)
+			loop->queue_tail = NULL;
+
+		conn->next = NULL;
+		ev = conn->events;
+		conn->events = 0;
+
+		PKI_MUTEX_release(&loop->mutex);
+
+		__conn_process(conn, ev);
+	}
+
+	return NULL;
+}
+
+/*! \brief Accepts all pending connections on a listener */
+
+static void __loop_accept(PKI_NET_LOOP *loop, PKI_NET_LISTENER *l) {
+
+	PKI_NET_CONN *conn = NULL;
+	PKI_SOCKET *sock = NULL;
+	PKI_SSL *ssl = NULL;
+	int one = 1;
+	int fd = -1;
+
+	for (;;) {
+
+		if ((fd = accept4(l->fd, NULL, NULL,
+				SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) {
+
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				PKI_log_err("PKI_NET_LOOP: accept() failed "
+					"(%s)", strerror(errno));
+			return;
+		}
+
+		// Responses are written in one go, no need to wait for ACKs
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		if ((sock = PKI_SOCKET_new()) == NULL) {
+			close(fd);
+			continue;
+		}
+
+		sock->fd = fd;
+		sock->status = PKI_SOCKET_CONNECTED;
+
+		if (l->ssl) {
+			if ((ssl = PKI_SSL_new_accept(l->ssl, fd)) == NULL) {
+				PKI_SOCKET_free(sock);
+				close(fd);
+				continue;
+			}
+			sock->type = PKI_SOCKET_SSL;
+			sock->ssl = ssl;
+		} else {
+			sock->type = PKI_SOCKET_FD;
+		}
+
+		PKI_MUTEX_acquire(&loop->mutex);
+
+		if ((conn = loop->free_list) == NULL) {
+			PKI_MUTEX_release(&loop->mutex);
+			PKI_log_err("PKI_NET_LOOP: max connections (%d) "
+				"reached", loop->max_conns);
+			PKI_SOCKET_free(sock);
+			close(fd);
+			continue;
+		}
+
+		loop->free_list = conn->next;
+		loop->num_conns++;
+
+		conn->state = l->ssl ? PKI_NET_CONN_HANDSHAKE :
+						PKI_NET_CONN_OPEN;
+		conn->sock = sock;
+		conn->listener = l;
+		conn->accepted = 0;
+		memset(&conn->out, 0, sizeof(conn->out));
+		conn->registered = 0;
+		conn->want_write = 0;
+		conn->eof = 0;
+		conn->timeout = l->timeout;
+		conn->deadline = l->timeout > 0 ? time(NULL) + l->timeout : 0;
+		conn->data = NULL;
+
+		// The first worker run delivers ACCEPT (or starts the
+		// handshake) and registers the fd in epoll
+		conn->busy = 1;
+		conn->events = __EV(PKI_NET_EVENT_ACCEPT);
+		__loop_enqueue(loop, conn);
+
+		PKI_MUTEX_release(&loop->mutex);
+	}
+}
+
+/*! \brief Hands the events of a connection to the workers */
+
+static void __loop_dispatch(PKI_NET_LOOP *loop, uint64_t data,
+						uint32_t events) {
+
+	PKI_NET_CONN *conn = NULL;
+	uint32_t idx = (uint32_t) (data & 0xFFFFFFFF);
+	uint32_t gen = (uint32_t) (data >> 32);
+	unsigned int ev = 0;
+
+	if (idx >= (uint32_t) loop->max_conns) return;
+
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+		ev |= __EV(PKI_NET_EVENT_READ);
+
+	if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+		ev |= __EV(PKI_NET_EVENT_WRITE);
+
+	conn = &loop->conns[idx];
+
+	PKI_MUTEX_acquire(&loop->mutex);
+
+	if (conn->gen == gen && conn->state != PKI_NET_CONN_FREE) {
+		conn->events |= ev;
+		if (!conn->busy) {
+			conn->busy = 1;
+			__loop_enqueue(loop, conn);
+		}
+	}
+
+	PKI_MUTEX_release(&loop->mutex);
+}
+
+/*! \brief Queues the idle connections past their deadline */
+
+static void __loop_timers(PKI_NET_LOOP *loop, time_t now) {
+
+	PKI_NET_CONN *conn = NULL;
+	int i = 0;
+
+	PKI_MUTEX_acquire(&loop->mutex);
+
+	for (i = 0; i < loop->max_conns; i++) {
+
+		conn = &loop->conns[i];
+
+		if (conn->state == PKI_NET_CONN_FREE || conn->busy ||
+				conn->deadline == 0 || conn->deadline > now)
+			continue;
+
+		conn->deadline = 0;
+		conn->busy = 1;
+		conn->events |= __EV(PKI_NET_EVENT_TIMEOUT);
+		__loop_enqueue(loop, conn);
+	}
+
+	PKI_MUTEX_release(&loop->mutex);
+}
+
+#endif /* LIBPKI_TARGET_LINUX */
+
+/* --------------------------- Public Functions -------------------------- */
+
+/*! \brief Returns a new PKI_NET_LOOP with the given number of worker
+ *         threads (0 for one per CPU) and maximum number of connections
+ *         (0 for PKI_NET_LOOP_DEFAULT_CONNS) */
+
+PKI_NET_LOOP *PKI_NET_LOOP_new(int workers, int max_conns) {
+
+#ifdef LIBPKI_TARGET_LINUX
+	PKI_NET_LOOP *ret = NULL;
+	struct epoll_event ev;
+	int i = 0;
+
+	if (workers <= 0 && (workers = (int) sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+		workers = 1;
+
+	if (max_conns <= 0) max_conns = PKI_NET_LOOP_DEFAULT_CONNS;
+
+	if ((ret = PKI_Malloc(sizeof(PKI_NET_LOOP))) == NULL) {
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		return NULL;
+	}
+
+	ret->epfd = -1;
+	ret->evfd = -1;
+	ret->num_workers = workers;
+	ret->max_conns = max_conns;
+
+	if ((ret->conns = PKI_Malloc(sizeof(PKI_NET_CONN) *
+					(size_t) max_conns)) == NULL ||
+			(ret->workers = PKI_Malloc(sizeof(PKI_THREAD *) *
+					(size_t) workers)) == NULL) {
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		goto err;
+	}
+
+	// Builds the free list so that low slots are used first
+	for (i = max_conns - 1; i >= 0; i--) {
+		ret->conns[i].id = (unsigned int) i;
+		ret->conns[i].gen = 1;
+		ret->conns[i].loop = ret;
+		ret->conns[i].next = ret->free_list;
+		ret->free_list = &ret->conns[i];
+	}
+
+	if ((ret->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+			(ret->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		PKI_ERROR(PKI_ERR_GENERAL, strerror(errno));
+		goto err;
+	}
+
+	// Generation 0 identifies listeners and the wakeup fd
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = 0xFFFFFFFF;
+
+	if (epoll_ctl(ret->epfd, EPOLL_CTL_ADD, ret->evfd, &ev) < 0) {
+		PKI_ERROR(PKI_ERR_GENERAL, strerror(errno));
+		goto err;
+	}
+
+	PKI_MUTEX_init(&ret->mutex);
+	PKI_COND_init(&ret->cond);
+
+	return ret;
+
+err:
+	if (ret->epfd >= 0) close(ret->epfd);
+	if (ret->evfd >= 0) close(ret->evfd);
+	if (ret->workers) PKI_Free(ret->workers);
+	if (ret->conns) PKI_Free(ret->conns);
+	PKI_Free(ret);
+
+	return NULL;
+#else
+	PKI_ERROR(PKI_ERR_NOT_IMPLEMENTED, NULL);
+	return NULL;
+#endif
+}
+
+/*! \brief Frees a PKI_NET_LOOP. Listening sockets are not closed and the
+ *         loop must not be running */
+
+void PKI_NET_LOOP_free(PKI_NET_LOOP *loop) {
+
+	if (!loop) return;
+
+	if (loop->epfd >= 0) close(loop->epfd);
+	if (loop->evfd >= 0) close(loop->evfd);
+
+	PKI_MUTEX_destroy(&loop->mutex);
+	PKI_COND_destroy(&loop->cond);
+
+	if (loop->workers) PKI_Free(loop->workers);
+	if (loop->conns) PKI_Free(loop->conns);
+
+	PKI_Free(loop);
+}
+
+/*! \brief Adds a listening socket to the loop. If ssl is not NULL the
+ *         accepted connections perform a TLS handshake (with the ssl
+ *         configuration) before the PKI_NET_EVENT_ACCEPT is delivered.
+ *         The ssl object must stay valid for the lifetime of the loop.
+ *         Accepted connections are closed after timeout seconds of
+ *         inactivity (0 disables the timeout) */
+
+int PKI_NET_LOOP_add_listener(PKI_NET_LOOP *loop, int fd, PKI_SSL *ssl,
+		PKI_NET_LOOP_CB cb, void *arg, int timeout) {
+
+#ifdef LIBPKI_TARGET_LINUX
+	PKI_NET_LISTENER *l = NULL;
+	struct epoll_event ev;
+	int flags = 0;
+
+	if (!loop || fd < 0 || !cb) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	if (loop->num_listeners >= PKI_NET_LOOP_MAX_LISTENERS)
+		return PKI_ERROR(PKI_ERR_PARAM_TYPE, "Too many listeners");
+
+	if (ssl && PKI_SSL_init_ctx(ssl) != PKI_OK)
+		return PKI_ERR;
+
+	if ((flags = fcntl(fd, F_GETFL, 0)) < 0 ||
+			fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		return PKI_ERROR(PKI_ERR_GENERAL, strerror(errno));
+
+	l = &loop->listeners[loop->num_listeners];
+	l->fd = fd;
+	l->ssl = ssl;
+	l->cb = cb;
+	l->arg = arg;
+	l->timeout = timeout > 0 ? timeout : 0;
+
+	// Level triggered, all pending connections are accepted at once
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = (uint64_t) loop->num_listeners;
+
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return PKI_ERROR(PKI_ERR_GENERAL, strerror(errno));
+
+	loop->num_listeners++;
+
+	return PKI_OK;
+#else
+	return PKI_ERROR(PKI_ERR_NOT_IMPLEMENTED, NULL);
+#endif
+}
+
+/*! \brief Runs the loop until PKI_NET_LOOP_stop() is called. The open
+ *         connections are closed before returning. If SIGPIPE has the
+ *         default disposition it is ignored, as TLS writes to a socket
+ *         reset by the peer would otherwise terminate the process */
+
+int PKI_NET_LOOP_run(PKI_NET_LOOP *loop) {
+
+#ifdef LIBPKI_TARGET_LINUX
+	struct epoll_event events[PKI_NET_LOOP_MAX_EVENTS];
+	PKI_NET_CONN *conn = NULL;
+	struct sigaction sa;
+	uint64_t data = 0;
+	time_t last = 0;
+	time_t now = 0;
+	int started = 0;
+	int ret = PKI_OK;
+	int i = 0;
+	int n = 0;
+
+	if (!loop) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	if (sigaction(SIGPIPE, NULL, &sa) == 0 && sa.sa_handler == SIG_DFL) {
+		sa.sa_handler = SIG_IGN;
+		sigaction(SIGPIPE, &sa, NULL);
+	}
+
+	for (started = 0; started < loop->num_workers; started++) {
+		if ((loop->workers[started] = PKI_THREAD_new(__loop_worker,
+							loop)) == NULL) {
+			PKI_ERROR(PKI_ERR_GENERAL, "Can not start workers");
+			loop->stop = 1;
+			ret = PKI_ERR;
+			break;
+		}
+	}
+
+	last = time(NULL);
+
+	while (!loop->stop) {
+
+		if ((n = epoll_wait(loop->epfd, events,
+				PKI_NET_LOOP_MAX_EVENTS, 1000)) < 0) {
+			if (errno == EINTR) continue;
+			PKI_ERROR(PKI_ERR_GENERAL, strerror(errno));
+			ret = PKI_ERR;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+
+			data = events[i].data.u64;
+
+			if ((data >> 32) != 0) {
+				__loop_dispatch(loop, data, events[i].events);
+			} else if (data < (uint64_t) loop->num_listeners) {
+				__loop_accept(loop, &loop->listeners[data]);
+			} else if (read(loop->evfd, &data, sizeof(data)) !=
+						sizeof(data)) {
+				PKI_log_debug("PKI_NET_LOOP: spurious wakeup");
+			}
+		}
+
+		// Timers have a resolution of one second
+		if ((now = time(NULL)) != last) {
+			__loop_timers(loop, now);
+			last = now;
+		}
+	}
+
+	PKI_MUTEX_acquire(&loop->mutex);
+	loop->stop = 1;
+	PKI_COND_broadcast(&loop->cond);
+	PKI_MUTEX_release(&loop->mutex);
+
+	for (i = 0; i < started; i++) {
+		PKI_THREAD_join(loop->workers[i], NULL);
+		PKI_Free(loop->workers[i]);
+		loop->workers[i] = NULL;
+	}
+
+	// Workers are gone, the remaining connections are closed here
+	loop->queue_head = loop->queue_tail = NULL;
+
+	for (i = 0; i < loop->max_conns; i++) {
+		conn = &loop->conns[i];
+		if (conn->state != PKI_NET_CONN_FREE) __conn_close(conn);
+	}
+
+	return ret;
+#else
+	return PKI_ERROR(PKI_ERR_NOT_IMPLEMENTED, NULL);
+#endif
+}
+
+/*! \brief Stops a running loop, can be called from any thread (including
+ *         the callbacks) */
+
+int PKI_NET_LOOP_stop(PKI_NET_LOOP *loop) {
+
+	uint64_t one = 1;
+
+	if (!loop) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	loop->stop = 1;
+
+	if (loop->evfd >= 0 && write(loop->evfd, &one, sizeof(one)) < 0)
+		return PKI_ERR;
+
+	return PKI_OK;
+}
+
+/*! \brief Reads up to size bytes from a connection without blocking.
+ *         Returns the number of bytes read, 0 if no data is available
+ *         (wait for the next PKI_NET_EVENT_READ) or -1 if the connection
+ *         has been closed by the peer or on error */
+
+ssize_t PKI_NET_CONN_read(PKI_NET_CONN *conn, void *buf, size_t size) {
+
+	SSL *ssl = NULL;
+	ssize_t n = 0;
+
+	if (!conn || !conn->sock || !buf || size == 0) return -1;
+
+	if (conn->eof) return -1;
+
+	if ((ssl = __conn_ssl(conn)) != NULL) {
+
+		if (size > INT_MAX) size = INT_MAX;
+
+		ERR_clear_error();
+		if ((n = SSL_read(ssl, buf, (int) size)) > 0) return n;
+
+		switch (SSL_get_error(ssl, (int) n)) {
+			case SSL_ERROR_WANT_READ:
+				return 0;
+			case SSL_ERROR_WANT_WRITE:
+				conn->want_write = 1;
+				return 0;
+			default:
+				conn->eof = 1;
+				return -1;
+		}
+	}
+
+	for (;;) {
+		if ((n = recv(conn->sock->fd, buf, size, 0)) > 0) return n;
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+
+		conn->eof = 1;
+		return -1;
+	}
+}
+
+/*! \brief Writes data to a connection. Whatever the socket does not
+ *         accept immediately is buffered and sent when the socket becomes
+ *         writable (PKI_NET_EVENT_WRITE is delivered when the buffer is
+ *         empty). Returns size or -1 on error */
+
+ssize_t PKI_NET_CONN_write(PKI_NET_CONN *conn, const void *buf, size_t size) {
+
+	ssize_t n = 0;
+
+	if (!conn || !conn->sock || !buf) return -1;
+
+	if (conn->eof) return -1;
+
+	if (size == 0) return 0;
+
+	// Keeps the ordering with already buffered data
+	if (conn->out.size == 0 && (n = __conn_send(conn, buf, size)) < 0) {
+		conn->eof = 1;
+		return -1;
+	}
+
+	if ((size_t) n < size && PKI_MEM_add(&conn->out,
+			(char *) buf + n, size - (size_t) n) != PKI_OK) {
+		return -1;
+	}
+
+	return (ssize_t) size;
+}
+
+/*! \brief Sets the idle timeout (secs) of a connection, 0 disables it */
+
+int PKI_NET_CONN_set_timeout(PKI_NET_CONN *conn, int timeout) {
+
+	if (!conn) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	conn->timeout = timeout > 0 ? timeout : 0;
+	conn->deadline = conn->timeout ? time(NULL) + conn->timeout : 0;
+
+	return PKI_OK;
+}
+
+/*! \brief Closes a connection once its pending output has been sent. The
+ *         same happens when a callback returns PKI_ERR */
+
+int PKI_NET_CONN_close(PKI_NET_CONN *conn) {
+
+	if (!conn) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	if (conn->state == PKI_NET_CONN_OPEN)
+		conn->state = PKI_NET_CONN_CLOSING;
+
+	return PKI_OK;
+}
+
+/*! \brief Returns the fd of a connection */
+
+int PKI_NET_CONN_get_fd(const PKI_NET_CONN *conn) {
+
+	if (!conn || !conn->sock) return -1;
+
+	return conn->sock->fd;
+}
+
+/*! \brief Returns the PKI_SOCKET of a connection (owned by the loop) */
+
+PKI_SOCKET *PKI_NET_CONN_get_socket(const PKI_NET_CONN *conn) {
+
+	if (!conn) return NULL;
+
+	return conn->sock;
+}
+
+/*! \brief Attaches application data to a connection */
+
+void PKI_NET_CONN_set_data(PKI_NET_CONN *conn, void *data) {
+
+	if (conn) conn->data = data;
+}
+
+/*! \brief Returns the application data attached to a connection */
+
+void *PKI_NET_CONN_get_data(const PKI_NET_CONN *conn) {
+
+	if (!conn) return NULL;
+
+	return conn->data;
+}
@@ -248,23 +248,30 @@ char *pg_parse_url_dbname ( const URL *url ) {
 
 #ifdef HAVE_PG
 
+#include <poll.h>
+
 PGconn *pg_db_connect ( const URL *url ) {
 
         PGconn *sql = NULL;
 	char * dbname = NULL;
+	char port[16];
 
 	dbname = pg_parse_url_dbname ( url );
 
-	sql = PQsetdbLogin( url->addr, NULL, NULL, NULL,
+	snprintf(port, sizeof(port), "%d", url->port);
+
+	sql = PQsetdbLogin( url->addr, url->port > 0 ? port : NULL, NULL, NULL,
        			                 dbname, url->usr, url->pwd );
 
+	if( dbname ) PKI_Free (dbname);
+
 	if(PQstatus(sql) == CONNECTION_BAD) {
-		if( dbname ) PKI_Free (dbname);
+		PKI_log_err("Can not connect to %s (%s)", url->addr,
+			sql ? PQerrorMessage(sql) : "out of memory");
 		pg_db_close( sql );
+		return ( NULL );
 	}
 
-	if( dbname ) PKI_Free (dbname);
-
 	return( sql );
 }
 
@@ -277,89 +284,727 @@ int pg_db_close ( PGconn *sql ) {
         return (PKI_OK);
 }
 
+/* ------------------------- PARAMETRIZED STATEMENTS -------------------------- */
+
+typedef struct pg_url_stmt_st {
+	// Statement text, the values are referenced as $1 .. $num
+	char *query;
+
+	char **values;
+	int num;
+} PG_URL_STMT;
+
+static void __pg_url_stmt_free(PG_URL_STMT *st)
+{
+	int i = 0;
+
+	if (!st) return;
+
+	for (i = 0; i < st->num; i++) PKI_Free(st->values[i]);
+
+	if (st->values) PKI_Free(st->values);
+	if (st->query) PKI_Free(st->query);
+
+	PKI_Free(st);
+}
+
+static char *__pg_strndup(const char *s, size_t len)
+{
+	char *ret = NULL;
+
+	if ((ret = PKI_Malloc(len + 1)) == NULL) return NULL;
+	if (len > 0) memcpy(ret, s, len);
+
+	return ret;
+}
+
+static void __pg_mem_puts(PKI_MEM *buf, const char *s)
+{
+	PKI_MEM_add(buf, (char *) s, strlen(s));
+}
+
+/*
+ * Returns PKI_OK if the len bytes at s are a plain identifier (letters,
+ * digits, '_' and '.') or, when list is set, a comma separated list of
+ * identifiers. Identifiers from the URL are part of the statement text
+ * (they can not be passed as parameters), therefore nothing else is
+ * accepted.
+ */
+static int __pg_check_ident(const char *s, size_t len, int list)
+{
+	size_t i = 0;
+	size_t start = 0;
+
+	if (!s || len == 0) return PKI_ERR;
+
+	for (i = 0; i <= len; i++)
+	{
+		if (i == len || (list && s[i] == ','))
+		{
+			// Empty elements are not allowed
+			if (i == start) return PKI_ERR;
+			start = i + 1;
+		}
+		else if (!isalnum((unsigned char) s[i]) && s[i] != '_' && s[i] != '.')
+			return PKI_ERR;
+	}
+
+	return PKI_OK;
+}
+
+/*
+ * Builds the statement for the URL. The table, the attributes and the
+ * columns of the (col=val) filters are part of the statement text (i.e.,
+ * URLs that differ only in the values share the same prepared statement),
+ * the data (if any) and the filter values are passed as parameters. A
+ * SELECT is built when data is NULL, an INSERT (or an UPDATE when there
+ * are filters) otherwise.
+ */
+static PG_URL_STMT *__pg_url_stmt_new(const URL *url, const PKI_MEM *data)
+{
+	PG_URL_STMT *st = NULL;
+	PKI_MEM *buf = NULL;
+	PKI_MEM *where = NULL;
+
+	char *table = NULL;
+	char *filters = NULL;
+	char *p = NULL;
+	char *end = NULL;
+	char *eq = NULL;
+	char *val = NULL;
+	char tmp[32];
+
+	size_t len = 0;
+	int max = 1;
+
+	if (!url || !url->path || !url->attrs)
+	{
+		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+		return NULL;
+	}
+
+	if ((table = pg_parse_url_table(url)) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_URI_PARSE, NULL);
+		return NULL;
+	}
+
+	// Only a list of columns can be selected, a single one is stored
+	if (__pg_check_ident(table, strlen(table), 0) != PKI_OK ||
+			__pg_check_ident(url->attrs, strlen(url->attrs),
+				data == NULL) != PKI_OK)
+	{
+		PKI_ERROR(PKI_ERR_URI_PARSE, "Invalid table or column name");
+		PKI_Free(table);
+		return NULL;
+	}
+
+	// The filters are in the last element of the path
+	if ((filters = strrchr(url->path, '/')) != NULL) filters++;
+	if (filters && *filters != '(') filters = NULL;
+
+	for (p = filters; p && *p; p++) if (*p == '(') max++;
+
+	if ((st = PKI_Malloc(sizeof(PG_URL_STMT))) == NULL ||
+			(st->values = PKI_Malloc(sizeof(char *) * (size_t) max)) == NULL ||
+			(buf = PKI_MEM_new_null()) == NULL ||
+			(where = PKI_MEM_new_null()) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		goto err;
+	}
+
+	// The data to store is always the first parameter
+	if (data)
+	{
+		if ((st->values[st->num] = __pg_strndup((const char *) data->data,
+							data->size)) == NULL) goto err;
+		st->num++;
+	}
+
+	for (p = filters; p && *p == '('; p = end + 1)
+	{
+		if ((end = strchr(p, ')')) == NULL ||
+				(eq = memchr(p, '=', (size_t) (end - p))) == NULL ||
+				__pg_check_ident(p + 1, (size_t) (eq - p - 1), 0) != PKI_OK)
+		{
+			PKI_ERROR(PKI_ERR_URI_PARSE, NULL);
+			goto err;
+		}
+
+		// Quoted values are accepted as well
+		val = eq + 1;
+		len = (size_t) (end - val);
+		if (len >= 2 && val[0] == '"' && val[len-1] == '"')
+		{
+			val++;
+			len -= 2;
+		}
+
+		if (where->size == 0) PKI_MEM_add(where, " WHERE ", 7);
+		else PKI_MEM_add(where, " AND ", 5);
+
+		PKI_MEM_add(where, p + 1, (size_t) (eq - p - 1));
+		snprintf(tmp, sizeof(tmp), "=$%d", st->num + 1);
+		PKI_MEM_add(where, tmp, strlen(tmp));
+
+		if ((st->values[st->num] = __pg_strndup(val, len)) == NULL) goto err;
+		st->num++;
+	}
+
+	if (data == NULL)
+	{
+		__pg_mem_puts(buf, "SELECT ");
+		__pg_mem_puts(buf, url->attrs);
+		__pg_mem_puts(buf, " FROM ");
+		__pg_mem_puts(buf, table);
+	}
+	else if (where->size == 0)
+	{
+		__pg_mem_puts(buf, "INSERT INTO ");
+		__pg_mem_puts(buf, table);
+		__pg_mem_puts(buf, " (");
+		__pg_mem_puts(buf, url->attrs);
+		__pg_mem_puts(buf, ") VALUES ($1)");
+	}
+	else
+	{
+		__pg_mem_puts(buf, "UPDATE ");
+		__pg_mem_puts(buf, table);
+		__pg_mem_puts(buf, " SET ");
+		__pg_mem_puts(buf, url->attrs);
+		__pg_mem_puts(buf, "=$1");
+	}
+
+	PKI_MEM_add(buf, (char *) where->data, where->size);
+
+	if ((st->query = __pg_strndup((const char *) buf->data, buf->size)) == NULL)
+		goto err;
+
+	PKI_MEM_free(where);
+	PKI_MEM_free(buf);
+	PKI_Free(table);
+
+	return st;
+
+err:
+	if (where) PKI_MEM_free(where);
+	if (buf) PKI_MEM_free(buf);
+	if (table) PKI_Free(table);
+	__pg_url_stmt_free(st);
+
+	return NULL;
+}
+
+/* --------------------------- CONNECTION POOL -------------------------------- */
+
+typedef struct pg_pool_stmt_st {
+	char *query;
+	char name[32];
+	struct pg_pool_stmt_st *next;
+} PG_POOL_STMT;
+
+typedef struct pg_pool_conn_st {
+	// Server, credentials and database of the connection
+	char *key;
+
+	PGconn *sql;
+
+	// Statements prepared on this connection
+	PG_POOL_STMT *stmts;
+	int num_stmts;
+
+	time_t last_used;
+	struct pg_pool_conn_st *next;
+} PG_POOL_CONN;
+
+static struct {
+	pthread_mutex_t lock;
+	PG_POOL_CONN *idle;
+	int num_idle;
+	int max_idle;
+	int idle_timeout;
+
+	// Statistics
+	unsigned long opened;
+	unsigned long reused;
+	unsigned long retried;
+} __pg_pool = { PTHREAD_MUTEX_INITIALIZER, NULL, 0,
+		PKI_PG_POOL_MAX_IDLE, PKI_PG_POOL_IDLE_TIMEOUT, 0, 0, 0 };
+
+static char *__pg_pool_key(const URL *url)
+{
+	char *dbname = NULL;
+	char *ret = NULL;
+	size_t len = 0;
+
+	dbname = pg_parse_url_dbname(url);
+
+	len = strlen(url->addr) + 32 +
+		(url->usr ? strlen(url->usr) : 0) +
+		(url->pwd ? strlen(url->pwd) : 0) +
+		(dbname ? strlen(dbname) : 0);
+
+	if ((ret = PKI_Malloc(len)) != NULL)
+	{
+		snprintf(ret, len, "%s:%s@%s:%d/%s",
+			url->usr ? url->usr : "", url->pwd ? url->pwd : "",
+			url->addr, url->port, dbname ? dbname : "");
+	}
+
+	if (dbname) PKI_Free(dbname);
+
+	return ret;
+}
+
+static void __pg_pool_conn_free(PG_POOL_CONN *c)
+{
+	PG_POOL_STMT *s = NULL;
+
+	if (!c) return;
+
+	while ((s = c->stmts) != NULL)
+	{
+		c->stmts = s->next;
+		PKI_Free(s->query);
+		PKI_Free(s);
+	}
+
+	if (c->sql) pg_db_close(c->sql);
+	if (c->key) PKI_Free(c->key);
+
+	PKI_Free(c);
+}
+
+/*
+ * Returns 1 if an idle connection can not be reused (closed by the server
+ * or left in the middle of a transaction), 0 otherwise
+ */
+static int __pg_pool_conn_stale(const PG_POOL_CONN *c)
+{
+	struct pollfd pfd;
+
+	if (PQstatus(c->sql) != CONNECTION_OK ||
+			PQtransactionStatus(c->sql) != PQTRANS_IDLE)
+		return 1;
+
+	// Asynchronous messages (e.g., notices or a server shutdown) are
+	// consumed here, a closed connection is detected by libpq
+	pfd.fd = PQsocket(c->sql);
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	if (pfd.fd < 0) return 1;
+
+	if (poll(&pfd, 1, 0) != 0)
+	{
+		if (!PQconsumeInput(c->sql) || PQisBusy(c->sql) ||
+				PQstatus(c->sql) != CONNECTION_OK)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns a healthy idle connection for the URL or a new one
+ */
+static PG_POOL_CONN *__pg_pool_get(const URL *url, int *reused)
+{
+	PG_POOL_CONN *c = NULL;
+	PG_POOL_CONN **pnt = NULL;
+	PG_POOL_CONN *expired = NULL;
+	char *key = NULL;
+	time_t now = time(NULL);
+
+	if ((key = __pg_pool_key(url)) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		return NULL;
+	}
+
+	for (;;)
+	{
+		pthread_mutex_lock(&__pg_pool.lock);
+
+		for (pnt = &__pg_pool.idle; (c = *pnt) != NULL; )
+		{
+			if (now - c->last_used >= __pg_pool.idle_timeout)
+			{
+				*pnt = c->next;
+				__pg_pool.num_idle--;
+				c->next = expired;
+				expired = c;
+				continue;
+			}
+
+			if (strcmp(c->key, key) == 0)
+			{
+				*pnt = c->next;
+				__pg_pool.num_idle--;
+				break;
+			}
+
+			pnt = &c->next;
+		}
+
+		pthread_mutex_unlock(&__pg_pool.lock);
+
+		while (expired != NULL)
+		{
+			PG_POOL_CONN *next = expired->next;
+			__pg_pool_conn_free(expired);
+			expired = next;
+		}
+
+		if (!c || !__pg_pool_conn_stale(c)) break;
+
+		__pg_pool_conn_free(c);
+	}
 
+	if (reused) *reused = (c != NULL);
+
+	if (c)
+	{
+		pthread_mutex_lock(&__pg_pool.lock);
+		__pg_pool.reused++;
+		pthread_mutex_unlock(&__pg_pool.lock);
+
+		PKI_Free(key);
+		return c;
+	}
+
+	if ((c = PKI_Malloc(sizeof(PG_POOL_CONN))) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		PKI_Free(key);
+		return NULL;
+	}
+	c->key = key;
+
+	if ((c->sql = pg_db_connect(url)) == NULL)
+	{
+		__pg_pool_conn_free(c);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&__pg_pool.lock);
+	__pg_pool.opened++;
+	pthread_mutex_unlock(&__pg_pool.lock);
+
+	return c;
+}
+
+/*
+ * Returns a connection to the pool, or closes it if the pool is full or
+ * the connection is not idle
+ */
+static void __pg_pool_put(PG_POOL_CONN *c)
+{
+	if (PQstatus(c->sql) != CONNECTION_OK ||
+			PQtransactionStatus(c->sql) != PQTRANS_IDLE)
+	{
+		__pg_pool_conn_free(c);
+		return;
+	}
+
+	pthread_mutex_lock(&__pg_pool.lock);
+
+	if (__pg_pool.num_idle < __pg_pool.max_idle)
+	{
+		c->last_used = time(NULL);
+		c->next = __pg_pool.idle;
+		__pg_pool.idle = c;
+		__pg_pool.num_idle++;
+		c = NULL;
+	}
+
+	pthread_mutex_unlock(&__pg_pool.lock);
+
+	if (c) __pg_pool_conn_free(c);
+}
+
+/*
+ * Returns the name of the server-side prepared statement for the query,
+ * the statement is prepared on first use. Returns NULL if the query can
+ * not be prepared (or too many statements are already prepared on the
+ * connection), the query shall then be executed as an unnamed statement.
+ */
+static const char *__pg_pool_prepare(PG_POOL_CONN *c, const PG_URL_STMT *st)
+{
+	PG_POOL_STMT *s = NULL;
+	PGresult *res = NULL;
+
+	for (s = c->stmts; s != NULL; s = s->next)
+	{
+		if (strcmp(s->query, st->query) == 0) return s->name;
+	}
+
+	if (c->num_stmts >= PKI_PG_POOL_MAX_STMTS) return NULL;
+
+	if ((s = PKI_Malloc(sizeof(PG_POOL_STMT))) == NULL ||
+			(s->query = strdup(st->query)) == NULL)
+	{
+		if (s) PKI_Free(s);
+		return NULL;
+	}
+
+	snprintf(s->name, sizeof(s->name), "libpki_%d", c->num_stmts);
+
+	res = PQprepare(c->sql, s->name, st->query, st->num, NULL);
+	if (!res || PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		PKI_log_debug("Can not prepare statement (%s)",
+			PQerrorMessage(c->sql));
+		if (res) PQclear(res);
+		PKI_Free(s->query);
+		PKI_Free(s);
+		return NULL;
+	}
+	PQclear(res);
+
+	s->next = c->stmts;
+	c->stmts = s;
+	c->num_stmts++;
+
+	return s->name;
+}
+
+/*
+ * Sends the statement on the connection, returns PKI_ERR if the statement
+ * could not be sent
+ */
+static int __pg_pool_send(PG_POOL_CONN *c, const PG_URL_STMT *st)
+{
+	const char *name = NULL;
+	int ok = 0;
+
+	if ((name = __pg_pool_prepare(c, st)) != NULL)
+	{
+		ok = PQsendQueryPrepared(c->sql, name, st->num,
+			(const char * const *) st->values, NULL, NULL, 0);
+	}
+	else if (PQstatus(c->sql) == CONNECTION_OK)
+	{
+		ok = PQsendQueryParams(c->sql, st->query, st->num, NULL,
+			(const char * const *) st->values, NULL, NULL, 0);
+	}
+
+	if (!ok)
+	{
+		PKI_log_err("Can not send SQL statement (%s)",
+			PQerrorMessage(c->sql));
+		return PKI_ERR;
+	}
+
+	return PKI_OK;
+}
+
+/*
+ * Sends the statement, a statement that can not be sent on a reused
+ * connection (e.g., closed by the server meanwhile) is sent once more on
+ * a new connection
+ */
+static PG_POOL_CONN *__pg_pool_exec(const URL *url, const PG_URL_STMT *st)
+{
+	PG_POOL_CONN *c = NULL;
+	int reused = 0;
+
+	if ((c = __pg_pool_get(url, &reused)) == NULL) return NULL;
+
+	if (__pg_pool_send(c, st) == PKI_OK) return c;
+
+	__pg_pool_conn_free(c);
+
+	if (!reused) return NULL;
+
+	pthread_mutex_lock(&__pg_pool.lock);
+	__pg_pool.retried++;
+	pthread_mutex_unlock(&__pg_pool.lock);
+
+	if ((c = __pg_pool_get(url, NULL)) == NULL) return NULL;
+
+	if (__pg_pool_send(c, st) == PKI_OK) return c;
+
+	__pg_pool_conn_free(c);
+
+	return NULL;
+}
+
+#endif
+
+/*! \brief Sets the max number of idle PostgreSQL connections kept for
+ *         reuse (0 disables the pool) and the time (secs) after which an
+ *         idle connection is closed */
+
+int PKI_PG_POOL_set_limits(int max_idle, int idle_timeout)
+{
+	if (max_idle < 0 || idle_timeout <= 0)
+		return PKI_ERROR(PKI_ERR_PARAM_TYPE, NULL);
+
+#ifdef HAVE_PG
+	pthread_mutex_lock(&__pg_pool.lock);
+	__pg_pool.max_idle = max_idle;
+	__pg_pool.idle_timeout = idle_timeout;
+	pthread_mutex_unlock(&__pg_pool.lock);
+
+	if (max_idle == 0) PKI_PG_POOL_flush();
+#endif
+
+	return PKI_OK;
+}
+
+/*! \brief Returns the number of connections opened, the number of idle
+ *         connections reused and the number of statements sent again on
+ *         a new connection (the reused one was closed by the server) */
+
+int PKI_PG_POOL_get_stats(unsigned long *opened, unsigned long *reused,
+			 unsigned long *retried)
+{
+#ifdef HAVE_PG
+	pthread_mutex_lock(&__pg_pool.lock);
+	if (opened) *opened = __pg_pool.opened;
+	if (reused) *reused = __pg_pool.reused;
+	if (retried) *retried = __pg_pool.retried;
+	pthread_mutex_unlock(&__pg_pool.lock);
+#else
+	if (opened) *opened = 0;
+	if (reused) *reused = 0;
+	if (retried) *retried = 0;
 #endif
 
+	return PKI_OK;
+}
+
+/*! \brief Closes all the idle PostgreSQL connections */
+
+void PKI_PG_POOL_flush(void)
+{
+#ifdef HAVE_PG
+	PG_POOL_CONN *c = NULL;
+	PG_POOL_CONN *idle = NULL;
+
+	pthread_mutex_lock(&__pg_pool.lock);
+	idle = __pg_pool.idle;
+	__pg_pool.idle = NULL;
+	__pg_pool.num_idle = 0;
+	pthread_mutex_unlock(&__pg_pool.lock);
+
+	while ((c = idle) != NULL)
+	{
+		idle = c->next;
+		__pg_pool_conn_free(c);
+	}
+#endif
+}
+
 PKI_MEM_STACK *URL_get_data_pg ( const char *url_s, ssize_t size ) {
+
+	PKI_MEM_STACK *ret = NULL;
 	URL *url = NULL;
 
 	if( !url_s ) return (NULL);
 
-	if(((url = URL_new( url_s )) == NULL) ||
-		url->proto != URI_PROTO_PG ) {
-		return (NULL);
-	}
+	if((url = URL_new( url_s )) == NULL) return (NULL);
+
+	if (url->proto == URI_PROTO_PG) ret = URL_get_data_pg_url( url, size );
+
+	URL_free ( url );
 
-	return ( URL_get_data_pg_url( url, size ));
+	return ( ret );
 }
 
+/*! \brief Retrieves the first field of each row selected by the URL
+ *
+ * The connection is taken from the pool and the query is executed as a
+ * prepared statement. Rows are fetched one at the time from the server
+ * (the whole result set is never buffered), values larger than size (if
+ * size > 0) are skipped.
+ */
+
 PKI_MEM_STACK *URL_get_data_pg_url ( const URL *url, ssize_t size ) {
 
 #ifdef HAVE_PG
-	PGconn *sql;
-        PGresult *res;
-
-	int n_rows = 0;
-	int i = 0;
-	int n_fields = 0;
+	PG_POOL_CONN *c = NULL;
+	PG_URL_STMT *st = NULL;
+	PGresult *res = NULL;
 
 	PKI_MEM *tmp_mem = NULL;
 	PKI_MEM_STACK *sk = NULL;
 
-	char * query = NULL;
+	int error = 0;
+	int len = 0;
+	int i = 0;
 
 	if( !url ) return (NULL);
 
-	query = pg_parse_url_query( url );
+	if ((st = __pg_url_stmt_new(url, NULL)) == NULL) return NULL;
 
-	if((sql = pg_db_connect ( url )) == NULL ) {
-		PKI_Free( query );
-		return(NULL);
-	}
-
-	/* Get the Data */
-	if(((res = PQexec( sql, query )) == NULL) || 
-			(PQresultStatus( res ) != PGRES_COMMAND_OK )) {
-
-		PQclear( res );
-		PKI_Free( query );
-                return(NULL);
-        }
-
-        if( ((n_rows = PQntuples(res)) < 1 ) || 
-			((sk = PKI_STACK_MEM_new()) == NULL)) {
-		PKI_Free( query );
-		return(NULL);
+	if ((c = __pg_pool_exec(url, st)) == NULL)
+	{
+		__pg_url_stmt_free(st);
+		return NULL;
 	}
 
-	/* Count the number of fields retrieved */
-	n_fields = PQnfields( res );
+	if (!PQsetSingleRowMode(c->sql))
+		PKI_log_debug("Can not fetch rows one at the time");
+
+	// All the results have to be consumed before the connection can
+	// be used again
+	while ((res = PQgetResult(c->sql)) != NULL)
+	{
+		switch (PQresultStatus(res))
+		{
+			case PGRES_SINGLE_TUPLE:
+			case PGRES_TUPLES_OK:
+				break;
+
+			default:
+				PKI_log_err("SQL query failed (%s)",
+					PQresultErrorMessage(res));
+				error = 1;
+				PQclear(res);
+				continue;
+		}
 
-	for(i = 0; i < n_rows; i++ ) {
+		for (i = 0; !error && i < PQntuples(res); i++)
+		{
+			/* For now, let's only deal with one
+			   field at the time */
+			if (PQnfields(res) < 1) break;
 
-		if( n_fields > 0 ) {
-			tmp_mem = PKI_MEM_new_null();
-			if( (size == 0 ) || 
-				    (( size > 0 ) && 
-					( PQgetlength(res, i, 0) < size)) ) {
+			len = PQgetlength(res, i, 0);
+			if (size > 0 && len >= size) continue;
 
-				PKI_MEM_add(tmp_mem,
-					PQgetvalue ( res, i, 0 ),
-					(size_t) PQgetlength( res, i, 0 )
-				);
+			if (!sk && (sk = PKI_STACK_MEM_new()) == NULL)
+			{
+				error = 1;
+				break;
+			}
 
-				/* For now, let's only deal with one 
-				   field at the time */
-				PKI_STACK_push( sk, tmp_mem );
+			if ((tmp_mem = PKI_MEM_new_null()) == NULL ||
+					PKI_MEM_add(tmp_mem, PQgetvalue(res, i, 0),
+						(size_t) len) == PKI_ERR)
+			{
+				if (tmp_mem) PKI_MEM_free(tmp_mem);
+				error = 1;
+				break;
 			}
-                }
 
-        }
+			PKI_STACK_MEM_push(sk, tmp_mem);
+		}
 
-	PQclear( res );
+		PQclear(res);
+	}
 
-	PKI_Free (query);
-	pg_db_close ( sql );
+	__pg_pool_put(c);
+	__pg_url_stmt_free(st);
+
+	if (error || (sk && PKI_STACK_MEM_elements(sk) < 1))
+	{
+		if (sk) PKI_STACK_MEM_free_all(sk);
+		return NULL;
+	}
 
 	return ( sk );
 
@@ -375,47 +1020,51 @@ int URL_put_data_pg ( const char *url_s, const PKI_MEM *data ) {
 
 	if( !url_s ) return (PKI_ERR);
 
-	if(((url = URL_new( url_s )) == NULL) ||
-		url->proto != URI_PROTO_PG ) {
-		return (PKI_ERR);
-	}
+	if((url = URL_new( url_s )) == NULL) return (PKI_ERR);
 
-	ret = URL_put_data_pg_url( url, data );
-	if( url ) URL_free ( url );
+	if (url->proto == URI_PROTO_PG) ret = URL_put_data_pg_url( url, data );
+	else ret = PKI_ERR;
+
+	URL_free ( url );
 
 	return ( ret );
 }
 
+/*! \brief Stores the data in the column selected by the URL (INSERT, or
+ *         UPDATE of the rows matching the URL filters) */
+
 int URL_put_data_pg_url ( const URL *url, const PKI_MEM *data ) {
 
 #ifdef HAVE_PG
-	PGconn * sql = NULL;
+	PG_POOL_CONN *c = NULL;
+	PG_URL_STMT *st = NULL;
         PGresult *res = NULL;
 
 	int ret = PKI_OK;
-	char * query = NULL;
 
-	if( !url ) return (PKI_ERR);
+	if( !url || !data ) return (PKI_ERR);
 
-	if((query = pg_parse_url_put_query( url, data )) == NULL ) {
-		return( PKI_ERR );
-	}
+	if ((st = __pg_url_stmt_new(url, data)) == NULL) return PKI_ERR;
 
-	if((sql = pg_db_connect ( url )) == NULL ) {
-		PKI_Free( query );
-		return(PKI_ERR);
+	if ((c = __pg_pool_exec(url, st)) == NULL)
+	{
+		__pg_url_stmt_free(st);
+		return PKI_ERR;
 	}
 
-	/* Get the Data */
-	if(((res = PQexec( sql, query )) == NULL) || 
-			(PQresultStatus( res ) != PGRES_COMMAND_OK )) {
-
-		// PQclear( res );
-		ret = PKI_ERR;
-        }
+	while ((res = PQgetResult(c->sql)) != NULL)
+	{
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		{
+			PKI_log_err("SQL statement failed (%s)",
+				PQresultErrorMessage(res));
+			ret = PKI_ERR;
+		}
+		PQclear(res);
+	}
 
-	if( res ) PQclear( res );
-	if( query ) PKI_Free (query);
+	__pg_pool_put(c);
+	__pg_url_stmt_free(st);
 
 	return ( ret );
 
@@ -200,6 +200,8 @@ int PKI_SOCKET_close(PKI_SOCKET * sock)
 		case PKI_SOCKET_SSL:
 			if ( !sock->ssl ) return PKI_ERR;
 			PKI_SSL_close ( sock->ssl );
+			// The SSL layer does not own the descriptor
+			if ( sock->fd >= 0 ) PKI_NET_close ( sock->fd );
 			break;
 
 		default:
@@ -210,6 +212,7 @@ int PKI_SOCKET_close(PKI_SOCKET * sock)
 	if ( sock->url ) URL_free ( sock->url );
 
 	sock->url = NULL;
+	sock->fd = -1;
 	sock->type = PKI_SOCKET_TYPE_UNKNOWN;
 
 	return PKI_OK;
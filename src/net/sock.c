@@ -222,26 +222,13 @@ struct hostent *Gethostbyname (const char *hostname) {
 #pragma GCC diagnostic ignored "-Wconversion" 
 int inet_connect (const URL *url) {
 
-	int sockfd;
+	int sockfd = -1;
 	int ret = 0;
 
 	struct addrinfo *res, *rp;
-	struct addrinfo hints;
-
-	char service[10];
 
-	/* create socket */
-	memset(&hints, 0, sizeof( struct addrinfo ));
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_flags = AI_PASSIVE;
-	hints.ai_protocol = IPPROTO_TCP;
-	hints.ai_canonname = NULL;
-	hints.ai_addr = NULL;
-	hints.ai_next = NULL;
-
-	snprintf( service, sizeof(service)-1, "%d", url->port );
-
-	if((ret = getaddrinfo( url->addr, service, &hints, &res)) != 0 ) {
+	// Addresses are resolved through the resolver cache
+	if((ret = PKI_DNS_CACHE_getaddrinfo( url->addr, url->port, &res)) != 0 ) {
 		PKI_log_err("Can not parse hostname (err: %d)", ret);
 		return ( -1 );
 	}
@@ -251,27 +238,24 @@ int inet_connect (const URL *url) {
 				rp->ai_protocol)) == -1 ) {
 			continue;
 		}
-		break;
-	}
 
-	if ( rp == NULL ) {
-		PKI_log_err ( "Can not create socket");
-		freeaddrinfo ( res );
-		return ( -1 );
+		/* try to connect, the next address is used on failure */
+		if(( ret = _Connect(sockfd, rp->ai_addr, rp->ai_addrlen )) == PKI_ERR ) {
+			_Close ( sockfd );
+			sockfd = -1;
+			continue;
+		}
+		break;
 	}
 
-	/* try to connect */
-	if(( ret = _Connect(sockfd, rp->ai_addr, rp->ai_addrlen )) == PKI_ERR ) {
-		PKI_log( PKI_LOG_ERR, "Socket _Connect failed (%s)",
-							hstrerror( h_errno ));
+	PKI_DNS_CACHE_freeaddrinfo( res );
 
-		_Close ( sockfd );
-		freeaddrinfo ( res );
-		return(-1);
+	if ( sockfd < 0 ) {
+		PKI_log( PKI_LOG_ERR, "Socket _Connect failed to %s:%d",
+						url->addr, url->port );
+		return ( -1 );
 	}
 
-	freeaddrinfo( res );
-
 	PKI_log_debug( "Connection Successful to %s:%d", 
 					url->addr, url->port );
 
@@ -507,8 +491,8 @@ PKI_MEM *PKI_NET_get_data ( int fd, int timeout, size_t max_size ) {
 
 	PKI_MEM *buf = NULL;
 
-	char tmp_buff[BUFF_MAX_SIZE];
-	ssize_t newsize  = 0;
+	size_t   toread   = 0;
+	ssize_t  newsize  = 0;
 
 	if( fd < 1 ) {
 		PKI_log_err("Attempted to retrieve data from sock %d", fd );
@@ -521,23 +505,31 @@ PKI_MEM *PKI_NET_get_data ( int fd, int timeout, size_t max_size ) {
 		return ( NULL );
 	}
 
-	while( (newsize = PKI_NET_read( fd, tmp_buff, sizeof(tmp_buff), 
-							timeout )) != 0 ) {
+	for (;;) {
 
-		if( newsize < 0 ) {
-			PKI_log_err("Network Error: %s", strerror(errno));
-			break;
+		toread = BUFF_MAX_SIZE;
+		if ( max_size > 0 ) {
+			if ( buf->size >= max_size ) break;
+			if ( buf->size + toread > max_size )
+				toread = max_size - buf->size;
 		}
 
-		if( (max_size > 0) && 
-				((ssize_t)(buf->size) + newsize > max_size) ) {
-			newsize = (ssize_t) (max_size - buf->size);
-			PKI_MEM_add( buf, tmp_buff, (size_t) newsize);
+		// Reads directly into the spare capacity of the buffer, which
+		// grows geometrically instead of once per read
+		if ( PKI_MEM_reserve( buf, buf->size + toread ) != PKI_OK ) {
+			PKI_log_err( "Memory Failure" );
 			break;
-		};
+		}
+
+		if ((newsize = PKI_NET_read( fd, buf->data + buf->size, toread,
+							timeout )) == 0 ) break;
 
-		PKI_MEM_add ( buf, tmp_buff, (size_t) newsize );
+		if( newsize < 0 ) {
+			PKI_log_err("Network Error: %s", strerror(errno));
+			break;
+		}
 
+		buf->size += (size_t) newsize;
 	};
 
 	if( buf->size <= 0 ) {
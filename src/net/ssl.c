@@ -13,19 +13,13 @@
 /* Static Function - used only internally */
 static int __ssl_find_trusted(X509_STORE_CTX      *ctx, 
 	                      PKI_X509_CERT_VALUE *x ) {
-	int i = 0;
 	int idx = 0;
-	int trusted_certs_num = 0;
-
-	int ctx_err = X509_V_OK;
 
 	int ret = PKI_ERR;
 
 	SSL *ssl = NULL;
 	PKI_SSL *pki_ssl = NULL;
 
-	PKI_X509_CERT *curr_cert = NULL;
-
 	// Retrieves the store CTX context
 	if((ssl = X509_STORE_CTX_get_ex_data(ctx, 
 			SSL_get_ex_data_X509_STORE_CTX_idx())) == 0 ) {
@@ -39,44 +33,13 @@ static int __ssl_find_trusted(X509_STORE_CTX      *ctx,
 		return PKI_ERR;
 	}
 
-	// Process current certificate
-	curr_cert = PKI_X509_new_dup_value(PKI_DATATYPE_X509_CERT, x, 0);
-	if (curr_cert == 0) return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, 0);
-
-	// Gets the number of trusted certificates
-	trusted_certs_num = PKI_STACK_X509_CERT_elements(pki_ssl->trusted_certs);
-
-	// Check if a certificate is among the trusted ones
-	for (i = 0; i < trusted_certs_num; i++){
-
-		PKI_X509_CERT *issuer = NULL;
-		PKI_X509_CERT_VALUE *issuer_val = NULL;
-
-		issuer = PKI_STACK_X509_CERT_get_num(pki_ssl->trusted_certs, i);
-		issuer_val = PKI_X509_get_value(issuer);
-		
-		// Checks if the peer certificate is the i-th trusted ones
-		if (X509_cmp(issuer_val, x) == 0) {
-			/* The certificate is present among the trusted ones */
-			PKI_log_debug("Same Certificate Found in Chain!");
-			ret = PKI_OK;
-			break;
-		}
-
-		// Checks if the peer certificate was issued by the i-th trusted one
-		if((ctx_err = X509_check_issued(issuer_val, x)) == X509_V_OK ) {
-			/* The cert has been issued by a trusted one */
-			PKI_log_debug("__ssl_find_trusted()-> Found Issuer");
-			ret = PKI_OK;
-			break;
-		}
-	}
+	// Checks if the certificate (or its issuer) is among the trusted
+	// ones, the lookup uses the hashed index (no copies, no linear scan)
+	ret = PKI_TRUST_STORE_check(pki_ssl->trust_store, x);
 
 	if ( ret == PKI_OK ) X509_STORE_CTX_set_error(ctx, X509_V_OK);
-	// ctx->error = X509_V_OK;
 
 	PKI_log_debug("__ssl_find_trusted()-> Return code is %d", ret );
-	PKI_X509_free ( curr_cert );
 
 	return ret;
 }
@@ -113,8 +76,11 @@ static int __ssl_verify_cb ( int code, X509_STORE_CTX *ctx) {
 		return 0;
 	}
 
-	if(( x = PKI_X509_new_dup_value ( PKI_DATATYPE_X509_CERT, 
+	// Wraps the certificate by taking a reference (no copy is made)
+	X509_up_ref(err_cert);
+	if(( x = PKI_X509_new_value ( PKI_DATATYPE_X509_CERT, 
 						err_cert, NULL )) == NULL ) {
+		X509_free(err_cert);
 		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, 0);
 		return 0;
 	}
@@ -399,9 +365,10 @@ static int __ssl_verify_cb ( int code, X509_STORE_CTX *ctx) {
 
 	if (ret == 1) {
 		// We add the certificate only if it was successfully validated
-		// to avoid malformed, expired, etc. certificates
-		PKI_STACK_X509_CERT_push(pki_ssl->peer_chain, 
-                             PKI_X509_dup(x));
+		// to avoid malformed, expired, etc. certificates. The chain
+		// takes over the wrapper (and its reference)
+		if (PKI_STACK_X509_CERT_push(pki_ssl->peer_chain, x) > 0)
+			x = NULL;
 	} 
 
 	/* Check for the verify_ok --- it should be OK in depth 0. We use
@@ -419,21 +386,11 @@ static int __ssl_verify_cb ( int code, X509_STORE_CTX *ctx) {
 
 		sk_x = pki_ssl->peer_chain;
 
-		// Certificate Details
-		fprintf(stderr, "\n ====== SERVER CERTIFICATE ==========\n");
-		PKI_X509_CERT_put(x, PKI_DATA_FORMAT_TXT, "stderr", NULL, NULL, NULL);
-		fprintf(stderr, "\n\n");
-
 		if (sk_x != 0) for (k = 0; k < PKI_STACK_X509_CERT_elements(sk_x); k++) {
 
 			// Gets the certificate from the stack
 			sk_cert = PKI_STACK_X509_CERT_get_num(sk_x, k);
 
-			// Certificate Details
-			fprintf(stderr, "\n ====== PEER CHAIN CERTIFICATE - num: %d ==========\n", k);
-			PKI_X509_CERT_put(sk_cert, PKI_DATA_FORMAT_TXT, "stderr", NULL, NULL, NULL);
-			fprintf(stderr, "\n");
-
 			// Checks if we can find the certificate in the list of
 			// trusted certificates for the SSL/TLS connection
 			ok = __ssl_find_trusted(ctx, (X509 *) sk_cert->value);
@@ -460,7 +417,479 @@ static int __ssl_verify_cb ( int code, X509_STORE_CTX *ctx) {
 	return ret;
 }
 
-static int __pki_ssl_init_ssl  ( PKI_SSL *ssl ) {
+/* Builds (once) the index of the trusted certificates of a PKI_SSL */
+static int __pki_ssl_build_trust_store ( PKI_SSL *ssl ) {
+
+	PKI_TOKEN *ssl_tk = ssl->tk;
+	PKI_X509_CERT_STACK *sk = NULL;
+	int i = 0;
+
+	// Nothing to do if already built (or set) or if not needed
+	if ( ssl->trust_store ) return PKI_OK;
+
+	if ( !ssl->trusted_certs && !(ssl_tk && ssl_tk->trustedCerts) )
+		return PKI_OK;
+
+	if ((sk = PKI_STACK_X509_CERT_new()) == NULL)
+		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+
+	// Adds the Token CA Cert to the Trusted Certs
+	if (ssl_tk && ssl_tk->cacert)
+		PKI_STACK_X509_CERT_push(sk, ssl_tk->cacert);
+
+	for (i=0; i < PKI_STACK_X509_CERT_elements(ssl->trusted_certs); i++) {
+		PKI_STACK_X509_CERT_push(sk,
+			PKI_STACK_X509_CERT_get_num(ssl->trusted_certs, i));
+	}
+
+	if ( ssl_tk ) {
+		for (i=0; i < PKI_STACK_X509_CERT_elements(
+					ssl_tk->trustedCerts); i++) {
+			PKI_STACK_X509_CERT_push(sk,
+				PKI_STACK_X509_CERT_get_num(
+					ssl_tk->trustedCerts, i));
+		}
+	}
+
+	ssl->trust_store = PKI_TRUST_STORE_new(sk);
+
+	// Only the stack is freed, the certificates are not ours
+	PKI_STACK_X509_CERT_free(sk);
+
+	if (!ssl->trust_store) return PKI_ERR;
+
+	return PKI_OK;
+}
+
+/* --------------------------- SSL_CTX / Session Cache ---------------------- */
+
+typedef struct ssl_cache_sess_st {
+	char *peer;
+	SSL_SESSION *sess;
+	time_t last_used;
+} SSL_CACHE_SESS;
+
+typedef struct ssl_cache_ctx_st {
+	unsigned char key[PKI_SSL_CACHE_KEY_SIZE];
+	SSL_CTX *ctx;
+	SSL_CACHE_SESS sessions[PKI_SSL_CACHE_MAX_SESSIONS];
+	int num_sessions;
+} SSL_CACHE_CTX;
+
+static struct {
+	pthread_mutex_t lock;
+	int enabled;
+	SSL_CACHE_CTX *entries[PKI_SSL_CACHE_MAX_CTX];
+	int num_entries;
+	unsigned long ctx_hits;
+	unsigned long ctx_misses;
+	unsigned long resumed;
+	unsigned long full;
+} __ssl_cache = { PTHREAD_MUTEX_INITIALIZER, 1, { NULL }, 0, 0, 0, 0, 0 };
+
+/*
+ * Calculates the digest that identifies the configuration of the SSL_CTX
+ * of a PKI_SSL (protocol, options, ciphers, verify flags, client identity
+ * and trust set). Returns PKI_ERR if the PKI_SSL can not use the cache.
+ */
+static int __ssl_cache_key(PKI_SSL *ssl, unsigned char *key)
+{
+	EVP_MD_CTX *md = NULL;
+	unsigned char fp[EVP_MAX_MD_SIZE];
+	unsigned int fp_len = 0;
+	PKI_TOKEN *tk = ssl->tk;
+	int ret = PKI_ERR;
+
+	// Extra chain certificates are not part of the key
+	if (ssl->other_certs || (tk && tk->otherCerts)) return PKI_ERR;
+
+	if (__pki_ssl_build_trust_store(ssl) != PKI_OK) return PKI_ERR;
+
+	if ((md = EVP_MD_CTX_new()) == NULL) return PKI_ERR;
+
+	if (!EVP_DigestInit_ex(md, EVP_sha256(), NULL)) goto end;
+
+	EVP_DigestUpdate(md, &ssl->algor, sizeof(ssl->algor));
+	EVP_DigestUpdate(md, &ssl->flags, sizeof(ssl->flags));
+	EVP_DigestUpdate(md, &ssl->auth, sizeof(ssl->auth));
+	EVP_DigestUpdate(md, &ssl->verify_flags, sizeof(ssl->verify_flags));
+
+	if (ssl->cipher) EVP_DigestUpdate(md, ssl->cipher, strlen(ssl->cipher));
+
+	// Client identity (certificate and key from the token)
+	if (tk && tk->cert && tk->keypair && tk->cert->value)
+	{
+		if (!X509_digest((X509 *) tk->cert->value, EVP_sha256(),
+							fp, &fp_len)) goto end;
+		EVP_DigestUpdate(md, fp, fp_len);
+	}
+
+	if (ssl->trust_store)
+		EVP_DigestUpdate(md, ssl->trust_store->digest,
+					sizeof(ssl->trust_store->digest));
+
+	if (EVP_DigestFinal_ex(md, key, NULL)) ret = PKI_OK;
+
+end:
+	EVP_MD_CTX_free(md);
+
+	return ret;
+}
+
+/* Returns the cache entry for the SSL_CTX, must be called with the lock */
+static SSL_CACHE_CTX *__ssl_cache_find_ctx(const SSL_CTX *ctx)
+{
+	int i = 0;
+
+	for (i = 0; i < __ssl_cache.num_entries; i++)
+		if (__ssl_cache.entries[i]->ctx == ctx)
+			return __ssl_cache.entries[i];
+
+	return NULL;
+}
+
+/* Returns the index of the peer's session, must be called with the lock */
+static int __ssl_cache_find_sess(const SSL_CACHE_CTX *e, const char *peer)
+{
+	int i = 0;
+
+	for (i = 0; i < e->num_sessions; i++)
+		if (strcmp(e->sessions[i].peer, peer) == 0) return i;
+
+	return -1;
+}
+
+static void __ssl_ctx_up_ref(SSL_CTX *ctx)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x1010000fL
+	SSL_CTX_up_ref(ctx);
+#else
+	CRYPTO_add(&ctx->references, 1, CRYPTO_LOCK_SSL_CTX);
+#endif
+}
+
+static void __ssl_cache_ctx_free(SSL_CACHE_CTX *e)
+{
+	int i = 0;
+
+	if (!e) return;
+
+	for (i = 0; i < e->num_sessions; i++)
+	{
+		PKI_Free(e->sessions[i].peer);
+		SSL_SESSION_free(e->sessions[i].sess);
+	}
+
+	if (e->ctx) SSL_CTX_free(e->ctx);
+
+	PKI_Free(e);
+}
+
+/*
+ * Callback for new client sessions (including TLS 1.3 tickets received
+ * after the handshake), the session is stored for the peer of the
+ * connection. Returns 1 when the reference to the session is kept.
+ */
+static int __ssl_cache_new_session(SSL *s, SSL_SESSION *sess)
+{
+	PKI_SSL *ssl = NULL;
+	SSL_CACHE_CTX *e = NULL;
+	int idx = -1;
+	int ret = 0;
+
+	if ((ssl = SSL_get_ex_data(s, 0)) == NULL || !ssl->session) return 0;
+
+	pthread_mutex_lock(&__ssl_cache.lock);
+
+	if ((e = __ssl_cache_find_ctx(SSL_get_SSL_CTX(s))) == NULL) goto end;
+
+	if ((idx = __ssl_cache_find_sess(e, ssl->session)) >= 0)
+	{
+		// Replaces the old session for the same peer
+		SSL_SESSION_free(e->sessions[idx].sess);
+	}
+	else if (e->num_sessions < PKI_SSL_CACHE_MAX_SESSIONS)
+	{
+		if ((e->sessions[e->num_sessions].peer = strdup(ssl->session))
+								== NULL) goto end;
+		idx = e->num_sessions++;
+	}
+	else
+	{
+		int i = 0;
+
+		// Evicts the least recently used session
+		for (idx = 0, i = 1; i < e->num_sessions; i++)
+			if (e->sessions[i].last_used < e->sessions[idx].last_used)
+				idx = i;
+
+		SSL_SESSION_free(e->sessions[idx].sess);
+		PKI_Free(e->sessions[idx].peer);
+		if ((e->sessions[idx].peer = strdup(ssl->session)) == NULL)
+		{
+			e->sessions[idx] = e->sessions[--e->num_sessions];
+			goto end;
+		}
+	}
+
+	e->sessions[idx].sess = sess;
+	e->sessions[idx].last_used = time(NULL);
+	ret = 1;
+
+end:
+	pthread_mutex_unlock(&__ssl_cache.lock);
+
+	return ret;
+}
+
+/* Replaces a cached (shared) SSL_CTX with a new private one */
+static int __ssl_ctx_detach(PKI_SSL *ssl)
+{
+	SSL_CTX *ctx = NULL;
+
+	if ((ctx = SSL_CTX_new(ssl->algor)) == NULL)
+	{
+		PKI_log_debug("Can not create a new SSL_CTX (%s)",
+				ERR_error_string(ERR_get_error(), NULL ));
+		return PKI_ERR;
+	}
+
+	if (ssl->cipher && !SSL_CTX_set_cipher_list(ctx, ssl->cipher))
+	{
+		PKI_log_err("Can not set ciphers (%s)",
+			ERR_error_string(ERR_get_error(),NULL));
+		SSL_CTX_free(ctx);
+		return PKI_ERR;
+	}
+
+	if (ssl->ssl_ctx) SSL_CTX_free(ssl->ssl_ctx);
+	ssl->ssl_ctx = ctx;
+	ssl->ctx_cached = 0;
+
+	return PKI_OK;
+}
+
+/*
+ * Looks up a configured SSL_CTX equivalent to the one of the PKI_SSL. On
+ * success the PKI_SSL uses the cached context and PKI_OK is returned,
+ * otherwise the PKI_SSL is left with a private context to be configured.
+ */
+static int __ssl_cache_get_ctx(PKI_SSL *ssl)
+{
+	unsigned char key[PKI_SSL_CACHE_KEY_SIZE];
+	SSL_CTX *ctx = NULL;
+	int i = 0;
+
+	if (!__ssl_cache.enabled || __ssl_cache_key(ssl, key) != PKI_OK)
+	{
+		// A cached context is shared and can not be modified
+		if (ssl->ctx_cached) __ssl_ctx_detach(ssl);
+		return PKI_ERR;
+	}
+
+	pthread_mutex_lock(&__ssl_cache.lock);
+
+	for (i = 0; i < __ssl_cache.num_entries; i++)
+	{
+		if (memcmp(__ssl_cache.entries[i]->key, key, sizeof(key)) == 0)
+		{
+			ctx = __ssl_cache.entries[i]->ctx;
+			__ssl_ctx_up_ref(ctx);
+			break;
+		}
+	}
+
+	if (ctx) __ssl_cache.ctx_hits++;
+	else __ssl_cache.ctx_misses++;
+
+	pthread_mutex_unlock(&__ssl_cache.lock);
+
+	if (!ctx)
+	{
+		// The configuration changed, a cached context can not be
+		// modified as it is shared with other PKI_SSL
+		if (ssl->ctx_cached) __ssl_ctx_detach(ssl);
+		return PKI_ERR;
+	}
+
+	if (ssl->ssl_ctx) SSL_CTX_free(ssl->ssl_ctx);
+	ssl->ssl_ctx = ctx;
+	ssl->ctx_cached = 1;
+
+	return PKI_OK;
+}
+
+/* Adds the (just configured) SSL_CTX of the PKI_SSL to the cache */
+static void __ssl_cache_add_ctx(PKI_SSL *ssl)
+{
+	SSL_CACHE_CTX *e = NULL;
+	int i = 0;
+
+	if (!__ssl_cache.enabled || ssl->ctx_cached) return;
+
+	if ((e = PKI_Malloc(sizeof(SSL_CACHE_CTX))) == NULL) return;
+
+	if (__ssl_cache_key(ssl, e->key) != PKI_OK)
+	{
+		PKI_Free(e);
+		return;
+	}
+
+	// Client sessions are stored by the cache (per peer)
+	SSL_CTX_set_session_cache_mode(ssl->ssl_ctx, SSL_SESS_CACHE_CLIENT |
+					SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ssl->ssl_ctx, __ssl_cache_new_session);
+
+	pthread_mutex_lock(&__ssl_cache.lock);
+
+	// Another thread might have added the same configuration
+	for (i = 0; i < __ssl_cache.num_entries; i++)
+		if (memcmp(__ssl_cache.entries[i]->key, e->key,
+						sizeof(e->key)) == 0) break;
+
+	if (i < __ssl_cache.num_entries ||
+			__ssl_cache.num_entries >= PKI_SSL_CACHE_MAX_CTX)
+	{
+		pthread_mutex_unlock(&__ssl_cache.lock);
+		PKI_Free(e);
+		return;
+	}
+
+	__ssl_ctx_up_ref(ssl->ssl_ctx);
+	e->ctx = ssl->ssl_ctx;
+	__ssl_cache.entries[__ssl_cache.num_entries++] = e;
+	ssl->ctx_cached = 1;
+
+	pthread_mutex_unlock(&__ssl_cache.lock);
+}
+
+/*
+ * Sets the session cache key for the connection (server name and peer
+ * address) and, if a session for the peer is available, the session to
+ * be resumed
+ */
+static void __ssl_cache_set_session(PKI_SSL *ssl)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	char host[INET6_ADDRSTRLEN];
+	char peer[1024];
+	SSL_CACHE_CTX *e = NULL;
+	SSL_SESSION *sess = NULL;
+	int port = 0;
+	int idx = -1;
+
+	if (ssl->session) PKI_Free(ssl->session);
+	ssl->session = NULL;
+
+	if (!ssl->ctx_cached) return;
+
+	if (getpeername(SSL_get_fd(ssl->ssl), (struct sockaddr *) &addr,
+							&addr_len) != 0) return;
+
+	if (addr.ss_family == AF_INET6)
+	{
+		struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) &addr;
+		inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+		port = ntohs(in6->sin6_port);
+	}
+	else if (addr.ss_family == AF_INET)
+	{
+		struct sockaddr_in *in = (struct sockaddr_in *) &addr;
+		inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+		port = ntohs(in->sin_port);
+	}
+	else return;
+
+	snprintf(peer, sizeof(peer), "%s@%s:%d",
+		ssl->servername ? ssl->servername : "", host, port);
+
+	if ((ssl->session = strdup(peer)) == NULL) return;
+
+	pthread_mutex_lock(&__ssl_cache.lock);
+
+	if ((e = __ssl_cache_find_ctx(ssl->ssl_ctx)) != NULL &&
+			(idx = __ssl_cache_find_sess(e, peer)) >= 0)
+	{
+		sess = e->sessions[idx].sess;
+
+		// Expired sessions are removed
+		if (SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess)
+							< (long) time(NULL))
+		{
+			SSL_SESSION_free(sess);
+			PKI_Free(e->sessions[idx].peer);
+			e->sessions[idx] = e->sessions[--e->num_sessions];
+		}
+		else
+		{
+			e->sessions[idx].last_used = time(NULL);
+			SSL_set_session(ssl->ssl, sess);
+		}
+	}
+
+	pthread_mutex_unlock(&__ssl_cache.lock);
+}
+
+/* Updates the resumption statistics after a successful handshake */
+static void __ssl_cache_update_stats(PKI_SSL *ssl)
+{
+	if (!ssl->ctx_cached) return;
+
+	pthread_mutex_lock(&__ssl_cache.lock);
+
+	if (SSL_session_reused(ssl->ssl)) __ssl_cache.resumed++;
+	else __ssl_cache.full++;
+
+	pthread_mutex_unlock(&__ssl_cache.lock);
+}
+
+/*
+ * Fills the peer chain after a resumed handshake. The verify callback is
+ * not invoked when a session is resumed, the chain is taken from the one
+ * stored in the session (in the same order as the callback, i.e. from the
+ * top of the chain down to the peer's certificate)
+ */
+static int __ssl_resumed_peer_chain(PKI_SSL *ssl)
+{
+	STACK_OF(X509) *sk = NULL;
+	PKI_X509_CERT *x = NULL;
+	X509 *val = NULL;
+	int i = 0;
+
+	if (PKI_STACK_X509_CERT_elements(ssl->peer_chain) > 0) return PKI_OK;
+
+	if ((sk = SSL_get_peer_cert_chain(ssl->ssl)) == NULL) return PKI_OK;
+
+	if (!ssl->peer_chain &&
+			(ssl->peer_chain = PKI_STACK_X509_CERT_new()) == NULL)
+		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+
+	for (i = sk_X509_num(sk) - 1; i >= 0; i--)
+	{
+		val = sk_X509_value(sk, i);
+
+		// The wrapper holds a reference, the certificate is not copied
+		X509_up_ref(val);
+		if ((x = PKI_X509_new_value(PKI_DATATYPE_X509_CERT, val,
+							NULL)) == NULL)
+		{
+			X509_free(val);
+			return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		}
+
+		if (PKI_STACK_X509_CERT_push(ssl->peer_chain, x) == PKI_ERR)
+		{
+			PKI_X509_CERT_free(x);
+			return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		}
+	}
+
+	return PKI_OK;
+}
+
+/* Configures the SSL_CTX of a PKI_SSL (token, trusted certs, verify) */
+static int __pki_ssl_init_ctx  ( PKI_SSL *ssl ) {
 
 	int	 ssl_verify_flags = 0;
 
@@ -468,8 +897,6 @@ static int __pki_ssl_init_ssl  ( PKI_SSL *ssl ) {
 
 	if ( !ssl || !ssl->ssl_ctx ) return PKI_ERR;
 
-	ssl->connected = 0;
-
 	SSL_CTX_set_options(ssl->ssl_ctx,(long unsigned int)ssl->flags );
 
 	ssl_tk = ssl->tk;
@@ -518,57 +945,34 @@ static int __pki_ssl_init_ssl  ( PKI_SSL *ssl ) {
 	}
 
 	/* Now sets the trusted certificates */
-	if( ssl->trusted_certs || (ssl_tk && ssl_tk->trustedCerts))
+	if( ssl->trust_store || ssl->trusted_certs ||
+				(ssl_tk && ssl_tk->trustedCerts))
 	{
-		X509_STORE *store = NULL;
+		X509_VERIFY_PARAM *param = NULL;
 		unsigned long vflags = 0;
 
-		if ((store = SSL_CTX_get_cert_store(ssl->ssl_ctx)) == NULL)
-		{
-			PKI_log_debug("Crypto Lib Error (%d::%s)", ERR_get_error(), 
-				ERR_error_string(ERR_get_error(), NULL));
-			return PKI_ERR;
-		}
+		// Builds the index of the trusted certificates only once, it
+		// is kept (and shared by PKI_SSL_dup) until the trusted list
+		// changes
+		if (__pki_ssl_build_trust_store(ssl) != PKI_OK) return PKI_ERR;
+
+		// Uses the prebuilt store instead of adding each certificate
+		// to the SSL_CTX store
+#if OPENSSL_VERSION_NUMBER >= 0x1010000fL
+		X509_STORE_up_ref(ssl->trust_store->store);
+#else
+		CRYPTO_add(&ssl->trust_store->store->references, 1,
+						CRYPTO_LOCK_X509_STORE);
+#endif
+		SSL_CTX_set_cert_store(ssl->ssl_ctx, ssl->trust_store->store);
 
 		//If we want CRL to be checked, enable this
 		if (ssl->flags & PKI_SSL_VERIFY_CRL)
 			vflags |= X509_V_FLAG_CRL_CHECK | X509_V_FLAG_CRL_CHECK_ALL;
 
-		X509_STORE_set_flags( store, vflags );
-
-		// Adds the Token CA Cert to the Trusted Certs
-		if(ssl_tk && ssl_tk->cacert) X509_STORE_add_cert ( store, 
-				PKI_X509_get_value(ssl_tk->cacert));
-
-		if ( ssl->trusted_certs ) {
-			int i = 0;
-
-			for (i=0; i < PKI_STACK_X509_CERT_elements(
-						ssl->trusted_certs); i++) {
-				PKI_X509_CERT_VALUE *val = NULL;
-				PKI_X509_CERT *x = NULL;
-
-				x = PKI_STACK_X509_CERT_get_num( 
-							ssl->trusted_certs,i);
-				val = PKI_X509_get_value ( x );
-				X509_STORE_add_cert ( store, val );
-			}
-		}
-
-		if ( ssl_tk && ssl_tk->trustedCerts ) {
-			int i = 0;
-
-			for (i=0; i < PKI_STACK_X509_CERT_elements(
-					ssl_tk->trustedCerts); i++) {
-				PKI_X509_CERT_VALUE *val = NULL;
-				PKI_X509_CERT *x = NULL;
-
-				x = PKI_STACK_X509_CERT_get_num( 
-						ssl_tk->trustedCerts,i);
-				val = PKI_X509_get_value ( x );
-				X509_STORE_add_cert ( store, val );
-			}
-		}
+		// The store is shared, the flags are set on the SSL_CTX params
+		if ((param = SSL_CTX_get0_param(ssl->ssl_ctx)) != NULL)
+			X509_VERIFY_PARAM_set_flags(param, vflags);
 	}
 
 	/* Clears the SSL_CTX chain certs */
@@ -611,6 +1015,28 @@ static int __pki_ssl_init_ssl  ( PKI_SSL *ssl ) {
 	/* Set the Verify parameters for SSL */
 	SSL_CTX_set_verify( ssl->ssl_ctx, ssl_verify_flags, __ssl_verify_cb );
 
+	return PKI_OK;
+}
+
+/* Prepares a new SSL object for a (client) connection, the SSL_CTX is
+ * taken from the cache when an equivalent one was already configured */
+static int __pki_ssl_init_ssl  ( PKI_SSL *ssl ) {
+
+	if ( !ssl || !ssl->ssl_ctx ) return PKI_ERR;
+
+	ssl->connected = 0;
+
+	if ( __ssl_cache_get_ctx ( ssl ) != PKI_OK ) {
+
+		// The shared context could not be replaced by a private one
+		if ( ssl->ctx_cached ) return PKI_ERR;
+
+		if ( __pki_ssl_init_ctx ( ssl ) != PKI_OK ) return PKI_ERR;
+
+		// Makes the configured context available to other PKI_SSL
+		__ssl_cache_add_ctx ( ssl );
+	}
+
 	/* If an old ref is present, let's remove it */
 	if( ssl->ssl ) SSL_free ( ssl->ssl );
 
@@ -639,17 +1065,20 @@ static int __pki_ssl_init_ssl  ( PKI_SSL *ssl ) {
 
 int __pki_ssl_start_ssl ( PKI_SSL *ssl ) {
 
-	int idx = -1;
+	X509 *peer = NULL;
 	int rv  = -1;
 
 	if (!ssl || !ssl->ssl ) 
 		return PKI_ERROR(PKI_ERR_PARAM_NULL, 0);
 
-	idx = SSL_get_ex_new_index(0, "pki_ssl index", NULL, NULL, NULL);
-	if((SSL_set_ex_data(ssl->ssl, idx, ssl)) == 0 ) {
+	// The verify callbacks retrieve the PKI_SSL from index 0
+	if((SSL_set_ex_data(ssl->ssl, 0, ssl)) == 0 ) {
 		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, 0);
 	}
 
+	// Resumes the last session with the same peer (if any)
+	__ssl_cache_set_session(ssl);
+
 	// Connect
 	if((rv = SSL_connect(ssl->ssl)) < 0 ) {
 		// Can not connect the SSL/TLS interface
@@ -660,8 +1089,18 @@ int __pki_ssl_start_ssl ( PKI_SSL *ssl ) {
 	// Sets the connected bit
 	ssl->connected = 1;
 
-	// Peer certificate processing
-	if (SSL_get_peer_certificate(ssl->ssl) != 0         && 
+	__ssl_cache_update_stats(ssl);
+
+	// Resumed sessions skip the verify callback that builds the chain
+	if (SSL_session_reused(ssl->ssl) &&
+			__ssl_resumed_peer_chain(ssl) != PKI_OK)
+		return PKI_ERR;
+
+	// Peer certificate processing (only its presence is checked, the
+	// reference returned by OpenSSL is released right away)
+	if ((peer = SSL_get_peer_certificate(ssl->ssl)) != 0) X509_free(peer);
+
+	if (peer != 0                                       && 
 			SSL_get_verify_result(ssl->ssl)    != X509_V_OK && 
 			                    ssl->verify_ok != PKI_OK) {
 
@@ -682,7 +1121,6 @@ int __pki_ssl_start_ssl ( PKI_SSL *ssl ) {
 PKI_SSL * PKI_SSL_new (const PKI_SSL_ALGOR *algor) {
 
 	PKI_SSL *ret       = 0;
-	PKI_SSL_ALGOR *al2 = 0;
 
 	SSL_library_init();
 
@@ -693,7 +1131,7 @@ PKI_SSL * PKI_SSL_new (const PKI_SSL_ALGOR *algor) {
 	}
 
 	if (algor != 0) {
-		ret->algor = al2;
+		ret->algor = algor;
 	} else {
 		ret->algor = PKI_SSL_CLIENT_ALGOR_DEFAULT;
 	}
@@ -738,6 +1176,9 @@ PKI_SSL *PKI_SSL_dup ( PKI_SSL *ssl ) {
 		}
 	}
 
+	// The trust store is read-only, it is shared by reference
+	ret->trust_store = PKI_TRUST_STORE_dup(ssl->trust_store);
+
 	ret->verify_flags = ssl->verify_flags;
 	ret->verify_ok = ssl->verify_ok;
 	ret->flags = ssl->flags;
@@ -755,6 +1196,15 @@ int PKI_SSL_set_algor(PKI_SSL *ssl, PKI_SSL_ALGOR *algor) {
 	if( !ssl || !ssl->ssl_ctx || !algor )
 		return PKI_ERROR(PKI_ERR_PARAM_NULL, 0);
 
+	ssl->algor = algor;
+
+	// A cached context is shared, a new one is created instead
+	if (ssl->ctx_cached) {
+		if (__ssl_ctx_detach(ssl) != PKI_OK)
+			return PKI_ERROR(PKI_ERR_NET_SSL_SET_CIPHER, 0);
+		return PKI_OK;
+	}
+
 	if(!SSL_CTX_set_ssl_version(ssl->ssl_ctx, algor))
 		return PKI_ERROR(PKI_ERR_NET_SSL_SET_CIPHER, 0);
 
@@ -784,6 +1234,9 @@ int PKI_SSL_set_cipher ( PKI_SSL *ssl, char *cipher ) {
 
 	ssl->cipher = strdup(cipher);
 
+	// A cached context is shared, a new one is created instead
+	if (ssl->ctx_cached) return __ssl_ctx_detach(ssl);
+
 	if (!SSL_CTX_set_cipher_list ( ssl->ssl_ctx, cipher )) {
 		PKI_log_err("Can not set ciphers (%s)",
 			ERR_error_string(ERR_get_error(),NULL));
@@ -865,12 +1318,8 @@ int PKI_SSL_connect_url(PKI_SSL *ssl, URL *url, int timeout) {
 		return PKI_ERROR(PKI_ERR_PARAM_NULL, 0);
 	}
 
-	if (( rv = __pki_ssl_init_ssl(ssl)) != PKI_OK) {
-		rv = PKI_ERROR(PKI_ERR_NET_SSL_INIT, 0);
-		goto err;
-	}
-
-	/* Connect the socket first */
+	/* Connect the socket first (the SSL object is initialized by
+	 * PKI_SSL_start_ssl, the SSL_CTX usually comes from the cache) */
 	if ((ssl_socket = PKI_NET_open(url, timeout)) < 0) {
 		/* Can not connect to the server */
 		rv = PKI_ERROR(PKI_ERR_NET_OPEN, "[url = %s]", url->url_s);
@@ -878,7 +1327,9 @@ int PKI_SSL_connect_url(PKI_SSL *ssl, URL *url, int timeout) {
 	}
 
 	// Starts the TLS/SSL protocol
-	return PKI_SSL_start_ssl(ssl, ssl_socket);
+	if ((rv = PKI_SSL_start_ssl(ssl, ssl_socket)) != PKI_OK) goto err;
+
+	return PKI_OK;
 
 	/*
 	// Sets the FD for the socket
@@ -927,6 +1378,77 @@ int PKI_SSL_start_ssl ( PKI_SSL *ssl, int fd ) {
 	return PKI_OK;
 }
 
+/*! \brief Prepares the SSL_CTX of a PKI_SSL (token, trusted certificates,
+ *         verify options) without starting a connection. Server-side
+ *         PKI_SSL objects must be initialized once before accepting. */
+
+int PKI_SSL_init_ctx ( PKI_SSL *ssl ) {
+
+	if (!ssl) return PKI_ERROR(PKI_ERR_PARAM_NULL, 0);
+
+	// Server contexts are never taken from (or added to) the cache
+	if ( ssl->ctx_cached && __ssl_ctx_detach ( ssl ) != PKI_OK ) {
+		return PKI_ERROR(PKI_ERR_NET_SSL_INIT, 0);
+	}
+
+	if ( __pki_ssl_init_ctx ( ssl ) != PKI_OK ) {
+		return PKI_ERROR(PKI_ERR_NET_SSL_INIT, 0);
+	}
+
+	return PKI_OK;
+}
+
+/*! \brief Returns a new PKI_SSL for an accepted (server side) connection on
+ *         fd. The SSL_CTX is shared with the passed (server) PKI_SSL that
+ *         must have been initialized with PKI_SSL_init_ctx(). The handshake
+ *         is not performed, which allows non-blocking sockets to drive it
+ *         with SSL_do_handshake().
+ */
+
+PKI_SSL * PKI_SSL_new_accept ( PKI_SSL *ssl, int fd ) {
+
+	PKI_SSL *ret = NULL;
+
+	if (!ssl || !ssl->ssl_ctx || fd < 0) {
+		PKI_ERROR(PKI_ERR_PARAM_NULL, 0);
+		return NULL;
+	}
+
+	if ((ret = PKI_Malloc(sizeof(PKI_SSL))) == NULL) {
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, 0);
+		return NULL;
+	}
+
+	// Shares the configured context
+#if OPENSSL_VERSION_NUMBER >= 0x1010000fL
+	SSL_CTX_up_ref(ssl->ssl_ctx);
+#else
+	CRYPTO_add(&ssl->ssl_ctx->references, 1, CRYPTO_LOCK_SSL_CTX);
+#endif
+	ret->ssl_ctx = ssl->ssl_ctx;
+	ret->algor = ssl->algor;
+	ret->flags = ssl->flags;
+	ret->auth = ssl->auth;
+	ret->verify_flags = ssl->verify_flags;
+	ret->verify_ok = ssl->verify_ok;
+
+	if ((ret->ssl = SSL_new(ret->ssl_ctx)) == NULL ||
+			!SSL_set_fd(ret->ssl, fd)) {
+		PKI_ERROR(PKI_ERR_NET_SSL_SET_SOCKET, 0);
+		PKI_SSL_free(ret);
+		return NULL;
+	}
+
+	// Needed for non-blocking writes from growing buffers
+	SSL_set_mode(ret->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+			SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	SSL_set_ex_data(ret->ssl, 0, ret);
+	SSL_set_accept_state(ret->ssl);
+
+	return ret;
+}
+
 /*! \brief Initiates an SSL connection to a URL passed as a string */
 
 int PKI_SSL_connect ( PKI_SSL *ssl, char *url_s, int timeout ) {
@@ -1032,6 +1554,81 @@ const char *PKI_SSL_get_servername ( PKI_SSL *ssl ) {
 #endif
 }
 
+/*! \brief Returns 1 if the connection resumed a previous session (i.e., it
+ *         used an abbreviated handshake), 0 otherwise */
+
+int PKI_SSL_session_reused ( PKI_SSL *ssl ) {
+
+	if ( !ssl || !ssl->ssl || !ssl->connected ) return 0;
+
+	return SSL_session_reused ( ssl->ssl ) ? 1 : 0;
+}
+
+/*! \brief Enables (default) or disables the SSL_CTX and sessions cache
+ *
+ * When enabled, client PKI_SSL objects with the same configuration
+ * (protocol, flags, ciphers, verify flags, token certificate and trusted
+ * certificates) share one configured SSL_CTX, and the last session with
+ * each peer (server name and address) is resumed on new connections.
+ * Disabling the cache flushes it.
+ */
+
+int PKI_SSL_CACHE_set_enabled ( int enabled ) {
+
+	pthread_mutex_lock(&__ssl_cache.lock);
+	__ssl_cache.enabled = enabled ? 1 : 0;
+	pthread_mutex_unlock(&__ssl_cache.lock);
+
+	if (!enabled) PKI_SSL_CACHE_flush();
+
+	return PKI_OK;
+}
+
+/*! \brief Removes all the cached SSL_CTX and sessions (contexts in use by
+ *         PKI_SSL objects are freed when released) */
+
+void PKI_SSL_CACHE_flush ( void ) {
+
+	int i = 0;
+
+	pthread_mutex_lock(&__ssl_cache.lock);
+
+	for (i = 0; i < __ssl_cache.num_entries; i++) {
+		__ssl_cache_ctx_free(__ssl_cache.entries[i]);
+		__ssl_cache.entries[i] = NULL;
+	}
+	__ssl_cache.num_entries = 0;
+
+	pthread_mutex_unlock(&__ssl_cache.lock);
+}
+
+/*! \brief Returns the cache statistics: SSL_CTX lookups that found (or did
+ *         not find) a configured context, handshakes that resumed a
+ *         session and full handshakes, and the resumption ratio */
+
+int PKI_SSL_CACHE_get_stats ( unsigned long *ctx_hits,
+			      unsigned long *ctx_misses,
+			      unsigned long *resumed,
+			      unsigned long *full,
+			      double *ratio ) {
+
+	pthread_mutex_lock(&__ssl_cache.lock);
+
+	if (ctx_hits) *ctx_hits = __ssl_cache.ctx_hits;
+	if (ctx_misses) *ctx_misses = __ssl_cache.ctx_misses;
+	if (resumed) *resumed = __ssl_cache.resumed;
+	if (full) *full = __ssl_cache.full;
+
+	if (ratio) {
+		unsigned long tot = __ssl_cache.resumed + __ssl_cache.full;
+		*ratio = tot > 0 ? (double) __ssl_cache.resumed / (double) tot : 0.0;
+	}
+
+	pthread_mutex_unlock(&__ssl_cache.lock);
+
+	return PKI_OK;
+}
+
 /*! \brief Sets the PKI_TOKEN to be used for the SSL connection */
 
 int PKI_SSL_set_token ( PKI_SSL *ssl, struct pki_token_st *tk ) {
@@ -1044,6 +1641,10 @@ int PKI_SSL_set_token ( PKI_SSL *ssl, struct pki_token_st *tk ) {
 
 	ssl->tk = tk;
 
+	// The token certificates are part of the trust store
+	PKI_TRUST_STORE_free(ssl->trust_store);
+	ssl->trust_store = NULL;
+
 	return PKI_OK;
 }
 
@@ -1071,6 +1672,10 @@ int PKI_SSL_set_trusted ( PKI_SSL *ssl, PKI_X509_CERT_STACK *sk ) {
 			PKI_STACK_X509_CERT_get_num (sk,i));
 	}
 
+	// The index is rebuilt when the connection is initialized
+	PKI_TRUST_STORE_free(ssl->trust_store);
+	ssl->trust_store = NULL;
+
 	return PKI_OK;
 }
 
@@ -1091,10 +1696,43 @@ int PKI_SSL_add_trusted ( PKI_SSL *ssl, PKI_X509_CERT *cert ) {
 	// Adds the certificate to the list of trusted certs
 	PKI_STACK_X509_CERT_push ( ssl->trusted_certs, cert);
 
+	// The index is rebuilt when the connection is initialized
+	PKI_TRUST_STORE_free(ssl->trust_store);
+	ssl->trust_store = NULL;
+
 	// All Done
 	return PKI_OK;
 }
 
+/*! \brief Sets a prebuilt (shared) trust store for SSL connections
+ *
+ * The PKI_SSL takes a new reference to the store, therefore the same
+ * store can be used by multiple PKI_SSL objects (e.g., one per server
+ * thread) without copying or re-indexing the trusted certificates. The
+ * trusted certificates set via PKI_SSL_set_trusted() or from the token
+ * are ignored as long as the store is set.
+ */
+
+int PKI_SSL_set_trust_store ( PKI_SSL *ssl, PKI_TRUST_STORE *ts ) {
+
+	if ( !ssl || !ts ) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	PKI_TRUST_STORE_dup(ts);
+	PKI_TRUST_STORE_free(ssl->trust_store);
+	ssl->trust_store = ts;
+
+	return PKI_OK;
+}
+
+/*! \brief Returns the trust store in use (if already built or set) */
+
+PKI_TRUST_STORE * PKI_SSL_get_trust_store ( PKI_SSL *ssl ) {
+
+	if ( !ssl ) return NULL;
+
+	return ssl->trust_store;
+}
+
 /*! \brief Sets the list of untrusted certificates for SSL connections */
 
 int PKI_SSL_set_others ( PKI_SSL *ssl, PKI_X509_CERT_STACK *sk ) {
@@ -1195,6 +1833,8 @@ void PKI_SSL_free ( PKI_SSL *ssl ) {
 		PKI_STACK_X509_CERT_free ( ssl->trusted_certs );
 	}
 
+	if (ssl->trust_store) PKI_TRUST_STORE_free(ssl->trust_store);
+
 	if (ssl->other_certs) {
 		while ((cert = PKI_STACK_X509_CERT_pop (ssl->other_certs))
 								!= NULL ) {
@@ -1216,6 +1856,8 @@ void PKI_SSL_free ( PKI_SSL *ssl ) {
 
 	if (ssl->servername) PKI_Free(ssl->servername);
 
+	if (ssl->session) PKI_Free(ssl->session);
+
 	PKI_Free ( ssl );
 
 	return;
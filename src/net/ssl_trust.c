@@ -0,0 +1,300 @@
+/* PKI_TRUST_STORE - indexed set of trusted certificates for PKI_SSL
+ * (c) 2012 by Massimiliano Pala and OpenCA Labs
+ * OpenCA Licensed Software
+ *
+ * The store is built once from a stack of certificates and it is read-only
+ * afterwards, therefore it can be shared (by reference) across PKI_SSL
+ * objects and threads. Certificates are indexed by subject name hash and
+ * by subjectKeyIdentifier so that looking up a certificate or its issuer
+ * does not require a linear scan of the trusted list.
+ */
+
+#include <libpki/pki.h>
+
+/* --------------------------- Static Functions -------------------------- */
+
+static unsigned long __ski_hash(const ASN1_OCTET_STRING *ski) {
+
+	unsigned long h = 2166136261UL;
+	int i = 0;
+
+	// FNV-1a over the key identifier bytes
+	for (i = 0; i < ski->length; i++) {
+		h ^= (unsigned long) ski->data[i];
+		h *= 16777619UL;
+	}
+
+	return h;
+}
+
+static const ASN1_OCTET_STRING * __get_ski(X509 *x) {
+
+#if OPENSSL_VERSION_NUMBER >= 0x1010000fL
+	return X509_get0_subject_key_id(x);
+#else
+	X509_check_purpose(x, -1, 0);
+	return x->skid;
+#endif
+}
+
+static const ASN1_OCTET_STRING * __get_akid(X509 *x) {
+
+#if OPENSSL_VERSION_NUMBER >= 0x1010000fL
+	return X509_get0_authority_key_id(x);
+#else
+	X509_check_purpose(x, -1, 0);
+	return x->akid ? x->akid->keyid : NULL;
+#endif
+}
+
+/* ----------------------------- Trust Store ----------------------------- */
+
+/*! \brief Builds a new trust store from a stack of certificates
+ *
+ * The returned store holds a reference to each certificate, the stack
+ * can be freed by the caller afterwards. Duplicated certificates are
+ * indexed only once.
+ */
+
+PKI_TRUST_STORE * PKI_TRUST_STORE_new ( PKI_X509_CERT_STACK *sk ) {
+
+	PKI_TRUST_STORE *ret = NULL;
+	EVP_MD_CTX *md = NULL;
+	int num = 0;
+	int i = 0;
+
+	if ((ret = PKI_Malloc(sizeof(PKI_TRUST_STORE))) == NULL) {
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		return NULL;
+	}
+
+	if (PKI_MUTEX_init(&ret->lock) != PKI_OK) {
+		PKI_Free(ret);
+		PKI_ERROR(PKI_ERR_GENERAL, "Can not initialize the mutex");
+		return NULL;
+	}
+	ret->references = 1;
+
+	if ((ret->store = X509_STORE_new()) == NULL) goto err;
+
+	// Digest of the trust set, used as part of the SSL_CTX cache key
+	if ((md = EVP_MD_CTX_new()) == NULL ||
+			!EVP_DigestInit_ex(md, EVP_sha256(), NULL)) goto err;
+
+	if (sk) num = PKI_STACK_X509_CERT_elements(sk);
+
+	// Power of two, at least twice the number of certificates
+	ret->num_buckets = 16;
+	while (ret->num_buckets < 2 * num) ret->num_buckets <<= 1;
+
+	ret->subject_buckets = PKI_Malloc(sizeof(int) * (size_t) ret->num_buckets);
+	ret->ski_buckets = PKI_Malloc(sizeof(int) * (size_t) ret->num_buckets);
+	if (!ret->subject_buckets || !ret->ski_buckets) goto err;
+
+	for (i = 0; i < ret->num_buckets; i++) {
+		ret->subject_buckets[i] = -1;
+		ret->ski_buckets[i] = -1;
+	}
+
+	if (num > 0) {
+		ret->certs = PKI_Malloc(sizeof(X509 *) * (size_t) num);
+		ret->subject_next = PKI_Malloc(sizeof(int) * (size_t) num);
+		ret->ski_next = PKI_Malloc(sizeof(int) * (size_t) num);
+		if (!ret->certs || !ret->subject_next || !ret->ski_next) goto err;
+	}
+
+	for (i = 0; i < num; i++) {
+
+		PKI_X509_CERT *cert = NULL;
+		const ASN1_OCTET_STRING *ski = NULL;
+		X509 *x = NULL;
+		unsigned char fp[EVP_MAX_MD_SIZE];
+		unsigned int fp_len = 0;
+		unsigned long h = 0;
+		int b = 0;
+
+		if ((cert = PKI_STACK_X509_CERT_get_num(sk, i)) == NULL ||
+				(x = (X509 *) cert->value) == NULL)
+			continue;
+
+		// Skips duplicates
+		if (PKI_TRUST_STORE_find(ret, x) >= 0) continue;
+
+		if (!X509_STORE_add_cert(ret->store, x)) {
+			// Already present in the store, nothing to do
+			ERR_clear_error();
+		}
+
+		// Computing the hash also caches the canonical encoding of
+		// the subject and the parsed extensions in the X509 structure,
+		// lookups from concurrent threads are read-only afterwards
+		h = X509_subject_name_hash(x);
+		ski = __get_ski(x);
+
+#if OPENSSL_VERSION_NUMBER >= 0x1010000fL
+		X509_up_ref(x);
+#else
+		CRYPTO_add(&x->references, 1, CRYPTO_LOCK_X509);
+#endif
+		ret->certs[ret->size] = x;
+
+		b = (int) (h & (unsigned long) (ret->num_buckets - 1));
+		ret->subject_next[ret->size] = ret->subject_buckets[b];
+		ret->subject_buckets[b] = ret->size;
+
+		ret->ski_next[ret->size] = -1;
+		if (ski && ski->length > 0) {
+			b = (int) (__ski_hash(ski) & (unsigned long) (ret->num_buckets - 1));
+			ret->ski_next[ret->size] = ret->ski_buckets[b];
+			ret->ski_buckets[b] = ret->size;
+		}
+
+		if (X509_digest(x, EVP_sha256(), fp, &fp_len))
+			EVP_DigestUpdate(md, fp, fp_len);
+
+		ret->size++;
+	}
+
+	EVP_DigestFinal_ex(md, ret->digest, NULL);
+	EVP_MD_CTX_free(md);
+
+	return ret;
+
+err:
+	PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+	if (md) EVP_MD_CTX_free(md);
+	PKI_TRUST_STORE_free(ret);
+	return NULL;
+}
+
+/*! \brief Returns a new reference to the trust store */
+
+PKI_TRUST_STORE * PKI_TRUST_STORE_dup ( PKI_TRUST_STORE *ts ) {
+
+	if (!ts) return NULL;
+
+	PKI_MUTEX_acquire(&ts->lock);
+	ts->references++;
+	PKI_MUTEX_release(&ts->lock);
+
+	return ts;
+}
+
+/*! \brief Releases a reference to the trust store (freed on the last one) */
+
+void PKI_TRUST_STORE_free ( PKI_TRUST_STORE *ts ) {
+
+	int refs = 0;
+	int i = 0;
+
+	if (!ts) return;
+
+	PKI_MUTEX_acquire(&ts->lock);
+	refs = --ts->references;
+	PKI_MUTEX_release(&ts->lock);
+
+	if (refs > 0) return;
+
+	for (i = 0; i < ts->size; i++) X509_free(ts->certs[i]);
+
+	if (ts->certs) PKI_Free(ts->certs);
+	if (ts->subject_buckets) PKI_Free(ts->subject_buckets);
+	if (ts->subject_next) PKI_Free(ts->subject_next);
+	if (ts->ski_buckets) PKI_Free(ts->ski_buckets);
+	if (ts->ski_next) PKI_Free(ts->ski_next);
+	if (ts->store) X509_STORE_free(ts->store);
+
+	PKI_MUTEX_destroy(&ts->lock);
+	PKI_Free(ts);
+}
+
+/*! \brief Returns the number of (unique) certificates in the store */
+
+int PKI_TRUST_STORE_elements ( const PKI_TRUST_STORE *ts ) {
+
+	if (!ts) return 0;
+
+	return ts->size;
+}
+
+/*! \brief Returns the index of the certificate in the store, -1 if the
+ *         certificate is not trusted */
+
+int PKI_TRUST_STORE_find ( const PKI_TRUST_STORE *ts,
+			   PKI_X509_CERT_VALUE *x ) {
+
+	unsigned long h = 0;
+	int i = 0;
+
+	if (!ts || !x || ts->size <= 0) return -1;
+
+	h = X509_subject_name_hash(x);
+
+	for (i = ts->subject_buckets[h & (unsigned long) (ts->num_buckets - 1)];
+			i >= 0; i = ts->subject_next[i]) {
+		if (X509_cmp(ts->certs[i], x) == 0) return i;
+	}
+
+	return -1;
+}
+
+/*! \brief Returns the trusted certificate that may have issued x (if any)
+ *
+ * Candidates are looked up by authorityKeyIdentifier first and then by
+ * issuer name, and they are matched with X509_check_issued(). That checks
+ * names, key identifiers and key usage only: the signature on x is NOT
+ * verified here, this is left to the chain verification (e.g., the one
+ * performed by OpenSSL with the store's X509_STORE).
+ */
+
+const PKI_X509_CERT_VALUE * PKI_TRUST_STORE_find_issuer (
+			   const PKI_TRUST_STORE *ts,
+			   PKI_X509_CERT_VALUE *x ) {
+
+	const ASN1_OCTET_STRING *akid = NULL;
+	const ASN1_OCTET_STRING *ski = NULL;
+	unsigned long h = 0;
+	int i = 0;
+
+	if (!ts || !x || ts->size <= 0) return NULL;
+
+	if ((akid = __get_akid(x)) != NULL && akid->length > 0) {
+
+		h = __ski_hash(akid);
+
+		for (i = ts->ski_buckets[h & (unsigned long) (ts->num_buckets - 1)];
+				i >= 0; i = ts->ski_next[i]) {
+
+			ski = __get_ski(ts->certs[i]);
+			if (ASN1_OCTET_STRING_cmp(ski, akid) != 0) continue;
+
+			if (X509_check_issued(ts->certs[i], x) == X509_V_OK)
+				return ts->certs[i];
+		}
+	}
+
+	h = X509_issuer_name_hash(x);
+
+	for (i = ts->subject_buckets[h & (unsigned long) (ts->num_buckets - 1)];
+			i >= 0; i = ts->subject_next[i]) {
+
+		if (X509_check_issued(ts->certs[i], x) == X509_V_OK)
+			return ts->certs[i];
+	}
+
+	return NULL;
+}
+
+/*! \brief Returns PKI_OK if the certificate is in the store or if its
+ *         issuer (by name/key identifier, signatures are not verified)
+ *         is in the store, PKI_ERR otherwise */
+
+int PKI_TRUST_STORE_check ( const PKI_TRUST_STORE *ts,
+			    PKI_X509_CERT_VALUE *x ) {
+
+	if (PKI_TRUST_STORE_find(ts, x) >= 0) return PKI_OK;
+
+	if (PKI_TRUST_STORE_find_issuer(ts, x) != NULL) return PKI_OK;
+
+	return PKI_ERR;
+}
@@ -400,6 +400,313 @@ PKI_MEM_STACK * URL_get_data_socket(const PKI_SOCKET * sock,
 	return ( ret );
 }
 
+/* ------------------------- Parallel Retrieval ------------------------- */
+
+#define URL_MULTI_PENDING	0
+#define URL_MULTI_RUNNING	1
+#define URL_MULTI_DONE		2
+
+static struct {
+	pthread_mutex_t lock;
+	int max_parallel;
+	int max_per_host;
+} __url_multi = { PTHREAD_MUTEX_INITIALIZER, PKI_URL_MULTI_MAX_PARALLEL,
+		PKI_URL_MULTI_MAX_PER_HOST };
+
+typedef struct url_multi_st {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	const URL **urls;
+	int *state;
+	int num;
+	// Items before this one are not pending
+	int next;
+	int max_per_host;
+
+	// End of the shared time budget (0 for none)
+	time_t deadline;
+	int timeout;
+	ssize_t max_size;
+	PKI_SSL *ssl;
+
+	PKI_MEM_STACK **results;
+	int *errors;
+} URL_MULTI;
+
+/*
+ * Returns 1 if the URLs are served by the same host (files are not)
+ */
+static int __url_multi_same_host(const URL *a, const URL *b)
+{
+	if (a->proto == URI_PROTO_FILE || a->proto == URI_PROTO_FD ||
+			b->proto == URI_PROTO_FILE || b->proto == URI_PROTO_FD)
+		return 0;
+
+	if (!a->addr || !b->addr || a->port != b->port) return 0;
+
+	return strcmp_nocase(a->addr, b->addr) == 0;
+}
+
+/*
+ * Returns the next URL to retrieve, -1 if none is pending or -2 if the
+ * pending ones have to wait for their host (called with the lock held)
+ */
+static int __url_multi_pick(URL_MULTI *m)
+{
+	int blocked = 0;
+	int running = 0;
+	int i = 0;
+	int j = 0;
+
+	while (m->next < m->num && m->state[m->next] != URL_MULTI_PENDING)
+		m->next++;
+
+	for (i = m->next; i < m->num; i++)
+	{
+		if (m->state[i] != URL_MULTI_PENDING) continue;
+
+		for (running = 0, j = 0; j < m->num; j++)
+		{
+			if (m->state[j] == URL_MULTI_RUNNING &&
+					__url_multi_same_host(m->urls[i], m->urls[j]))
+				running++;
+		}
+
+		if (m->max_per_host <= 0 || running < m->max_per_host) return i;
+
+		blocked = 1;
+	}
+
+	return blocked ? -2 : -1;
+}
+
+static void *__url_multi_worker(void *arg)
+{
+	URL_MULTI *m = (URL_MULTI *) arg;
+	PKI_SSL *ssl = NULL;
+	int timeout = 0;
+	int i = 0;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&m->lock);
+
+		while ((i = __url_multi_pick(m)) == -2)
+			pthread_cond_wait(&m->cond, &m->lock);
+
+		if (i < 0)
+		{
+			pthread_mutex_unlock(&m->lock);
+			break;
+		}
+
+		m->state[i] = URL_MULTI_RUNNING;
+
+		// Each HTTP retrieval owns its PKI_SSL
+		ssl = NULL;
+		if (m->ssl && (m->urls[i]->proto == URI_PROTO_HTTP ||
+				m->urls[i]->proto == URI_PROTO_HTTPS))
+			ssl = PKI_SSL_dup(m->ssl);
+
+		pthread_mutex_unlock(&m->lock);
+
+		// Every retrieval is bound by what is left of the budget
+		timeout = m->timeout;
+		if (m->deadline > 0) timeout = (int) (m->deadline - time(NULL));
+
+		if (m->deadline > 0 && timeout <= 0)
+		{
+			if (ssl) PKI_SSL_free(ssl);
+			m->errors[i] = PKI_ERR_URI_GENERAL;
+		}
+		else if ((m->results[i] = URL_get_data_url(m->urls[i], timeout,
+						m->max_size, ssl)) == NULL)
+		{
+			m->errors[i] = PKI_ERR_URI_READ;
+		}
+		else m->errors[i] = PKI_OK;
+
+		pthread_mutex_lock(&m->lock);
+		m->state[i] = URL_MULTI_DONE;
+		pthread_cond_broadcast(&m->cond);
+		pthread_mutex_unlock(&m->lock);
+	}
+
+	return NULL;
+}
+
+/*! \brief Sets the max number of concurrent retrievals and the max number
+ *         of concurrent retrievals from the same host (0 for no limit) for
+ *         URL_get_data_multi() */
+
+int PKI_URL_MULTI_set_limits(int max_parallel, int max_per_host)
+{
+	if (max_parallel <= 0 || max_per_host < 0)
+		return PKI_ERROR(PKI_ERR_PARAM_TYPE, NULL);
+
+	pthread_mutex_lock(&__url_multi.lock);
+	__url_multi.max_parallel = max_parallel;
+	__url_multi.max_per_host = max_per_host;
+	pthread_mutex_unlock(&__url_multi.lock);
+
+	return PKI_OK;
+}
+
+/*!
+ * \brief Retrieves the data from a list of URLs concurrently
+ *
+ * The URLs are retrieved in parallel by up to PKI_URL_MULTI_MAX_PARALLEL
+ * threads (the calling thread included), with up to
+ * PKI_URL_MULTI_MAX_PER_HOST concurrent retrievals from the same server
+ * (see PKI_URL_MULTI_set_limits()). The timeout (secs) is the budget for
+ * the whole list: the retrievals that are not started before it expires
+ * fail, the others are given the time that is left. Any protocol supported
+ * by URL_get_data_url() can be used.
+ *
+ * The data retrieved from urls[i] is returned in results[i] (NULL on
+ * failure), and if errors is not NULL errors[i] is set to PKI_OK or to
+ * the error code (PKI_ERR_URI_PARSE, PKI_ERR_URI_READ or
+ * PKI_ERR_URI_GENERAL if the budget expired). The passed PKI_SSL (if any)
+ * is duplicated for each HTTP retrieval, it is still owned by the caller.
+ *
+ * PKI_OK is returned if all the URLs were retrieved, PKI_ERR otherwise.
+ */
+
+int URL_get_data_multi(const char     ** urls,
+		       int                num,
+		       int                timeout,
+		       ssize_t            max_size,
+		       PKI_SSL          * ssl,
+		       PKI_MEM_STACK   ** results,
+		       int              * errors)
+{
+	URL **url_sk = NULL;
+	int ret = PKI_OK;
+	int i = 0;
+
+	if (!urls || num <= 0 || !results)
+		return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	if ((url_sk = PKI_Malloc(sizeof(URL *) * (size_t) num)) == NULL)
+		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+
+	for (i = 0; i < num; i++)
+	{
+		if (urls[i] && (url_sk[i] = URL_new(urls[i])) != NULL) continue;
+
+		PKI_DEBUG("Can not parse the URL (%s)", urls[i] ? urls[i] : "null");
+	}
+
+	ret = URL_get_data_multi_url((const URL **) url_sk, num, timeout,
+			max_size, ssl, results, errors);
+
+	for (i = 0; i < num; i++)
+		if (url_sk[i]) URL_free(url_sk[i]);
+	PKI_Free(url_sk);
+
+	return ret;
+}
+
+/*! \brief Retrieves the data from a list of (parsed) URLs concurrently
+ *
+ * See URL_get_data_multi(), NULL entries in urls fail with
+ * PKI_ERR_URI_PARSE.
+ */
+
+int URL_get_data_multi_url(const URL      ** urls,
+			   int                num,
+			   int                timeout,
+			   ssize_t            max_size,
+			   PKI_SSL          * ssl,
+			   PKI_MEM_STACK   ** results,
+			   int              * errors)
+{
+	URL_MULTI m;
+	PKI_THREAD **threads = NULL;
+	int num_threads = 0;
+	int pending = 0;
+	int ret = PKI_OK;
+	int i = 0;
+
+	if (!urls || num <= 0 || !results)
+		return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	memset(&m, 0, sizeof(m));
+	for (i = 0; i < num; i++) results[i] = NULL;
+
+	m.urls = urls;
+	m.num = num;
+	m.timeout = timeout;
+	m.max_size = max_size;
+	m.ssl = ssl;
+	m.results = results;
+	if (timeout > 0) m.deadline = time(NULL) + timeout;
+
+	if ((m.state = PKI_Malloc(sizeof(int) * (size_t) num)) == NULL ||
+			((m.errors = errors) == NULL &&
+			 (m.errors = PKI_Malloc(sizeof(int) * (size_t) num)) == NULL))
+	{
+		ret = PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		goto end;
+	}
+
+	for (i = 0; i < num; i++)
+	{
+		if (!urls[i])
+		{
+			m.errors[i] = PKI_ERR_URI_PARSE;
+			m.state[i] = URL_MULTI_DONE;
+			continue;
+		}
+		m.errors[i] = PKI_ERR_URI_GENERAL;
+		pending++;
+	}
+
+	pthread_mutex_lock(&__url_multi.lock);
+	num_threads = __url_multi.max_parallel;
+	m.max_per_host = __url_multi.max_per_host;
+	pthread_mutex_unlock(&__url_multi.lock);
+
+	if (num_threads > pending) num_threads = pending;
+
+	// The calling thread is one of the workers
+	num_threads--;
+
+	pthread_mutex_init(&m.lock, NULL);
+	pthread_cond_init(&m.cond, NULL);
+
+	if (num_threads > 0 &&
+			(threads = PKI_Malloc(sizeof(PKI_THREAD *) * (size_t) num_threads)) != NULL)
+	{
+		for (i = 0; i < num_threads; i++)
+			threads[i] = PKI_THREAD_new(__url_multi_worker, &m);
+	}
+
+	// If threads can not be created the list is retrieved sequentially
+	if (pending > 0) __url_multi_worker(&m);
+
+	for (i = 0; threads && i < num_threads; i++)
+	{
+		if (!threads[i]) continue;
+		PKI_THREAD_join(threads[i], NULL);
+		PKI_Free(threads[i]);
+	}
+
+	pthread_cond_destroy(&m.cond);
+	pthread_mutex_destroy(&m.lock);
+
+	for (i = 0; i < num; i++)
+		if (m.errors[i] != PKI_OK) ret = PKI_ERR;
+
+end:
+	if (threads) PKI_Free(threads);
+	if (m.errors && m.errors != errors) PKI_Free(m.errors);
+	if (m.state) PKI_Free(m.state);
+
+	return ret;
+}
+
 /*! \brief Sends/Writes a PKI_MEM object into a URL passed as a string
  *
  * This function sends (or writes) the content of a PKI_MEM object into
@@ -452,12 +759,10 @@ int URL_put_data_raw(const char          * url_s,
 	if (!url_s || !data || !size)
 		return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
 
-	if ((mem_data = PKI_MEM_new_null()) == NULL)
+	// Wraps the caller's data without copying it
+	if ((mem_data = PKI_MEM_new_static((unsigned char *)data, size)) == NULL)
 		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
 
-	mem_data->data = (unsigned char *)data;
-	mem_data->size = size;
-
 	ret = URL_put_data(url_s,
 			   mem_data,
 			   contType,
@@ -466,9 +771,6 @@ int URL_put_data_raw(const char          * url_s,
 			   max_size,
 			   ssl);
 
-	mem_data->data = NULL;
-	mem_data->size = 0;
-
 	PKI_MEM_free(mem_data);
 
 	return ret;
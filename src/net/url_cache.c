@@ -0,0 +1,920 @@
+/* URL cache - cached and conditional retrieval of URL data
+ * (c) 2012 by Massimiliano Pala and OpenCA Labs
+ * OpenCA Licensed Software
+ *
+ * Certificates and CRLs retrieved from http(s):// and ldap:// URLs (and from
+ * file:// URLs, if enabled with PKI_URL_CACHE_set_file_urls()) are kept in
+ * memory (and, optionally, in a directory) together with their validators:
+ * the ETag and Last-Modified headers for HTTP and the modification time of
+ * files. Cached objects are revalidated by using conditional requests
+ * (If-None-Match / If-Modified-Since) and, for CRLs, they are not
+ * revalidated at all until their nextUpdate. The data is immutable once
+ * cached, it is shared by reference with the callers.
+ */
+
+#include <libpki/pki.h>
+#include <sys/stat.h>
+
+#define URL_CACHE_MAGIC		"LIBPKI-URL-CACHE 1"
+
+#ifdef __APPLE__
+# define URL_CACHE_MTIME_NSEC(st)	((st)->st_mtimespec.tv_nsec)
+#else
+# define URL_CACHE_MTIME_NSEC(st)	((st)->st_mtim.tv_nsec)
+#endif
+
+struct pki_url_cache_entry_st {
+	char *url_s;
+	PKI_MEM_STACK *data;
+
+	// HTTP validators
+	char *etag;
+	char *last_modified;
+
+	// File validators
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	long mtime_nsec;
+
+	// CRL nextUpdate (0 if none) and end of the freshness period, the
+	// latter is modified on revalidation (under the cache lock)
+	time_t next_update;
+	time_t expires;
+
+	// Protected by the cache lock
+	int references;
+	int cached;
+
+	struct pki_url_cache_entry_st *next;
+};
+
+typedef struct pki_url_cache_entry_st URL_CACHE_ENTRY;
+
+static struct {
+	pthread_mutex_t lock;
+	// Most recently used first
+	URL_CACHE_ENTRY *entries;
+	int size;
+	int max_entries;
+	int max_age;
+	int file_urls;
+	char *dir;
+
+	// Statistics
+	unsigned long hits;
+	unsigned long revalidated;
+	unsigned long misses;
+} __url_cache = { PTHREAD_MUTEX_INITIALIZER, NULL, 0,
+		PKI_URL_CACHE_MAX_ENTRIES, PKI_URL_CACHE_MAX_AGE, 0, NULL,
+		0, 0, 0 };
+
+static void __url_cache_entry_free(URL_CACHE_ENTRY *e)
+{
+	PKI_MEM *m = NULL;
+
+	if (!e) return;
+
+	// The cached data is wiped before it is released
+	while (e->data && (m = PKI_STACK_MEM_pop(e->data)) != NULL)
+	{
+		if (m->data && m->size > 0) OPENSSL_cleanse(m->data, m->size);
+		PKI_MEM_free(m);
+	}
+
+	if (e->data) PKI_STACK_MEM_free(e->data);
+	if (e->url_s) PKI_Free(e->url_s);
+	if (e->etag) PKI_Free(e->etag);
+	if (e->last_modified) PKI_Free(e->last_modified);
+
+	PKI_Free(e);
+}
+
+/*
+ * Returns the end of the freshness period of an object with the passed
+ * nextUpdate (0 if the object has to be revalidated on every use)
+ */
+static time_t __url_cache_expires(time_t next_update, time_t now)
+{
+	time_t max = 0;
+
+	if (next_update <= now || __url_cache.max_age <= 0) return 0;
+
+	max = now + __url_cache.max_age;
+
+	return next_update < max ? next_update : max;
+}
+
+/*
+ * Returns the nextUpdate of a (DER or PEM) CRL, 0 if the data is not a CRL
+ * or it has no nextUpdate. Only the header of the CRL is parsed.
+ */
+static time_t __url_cache_crl_next_update(const PKI_MEM *m)
+{
+	const unsigned char *p = NULL;
+	const unsigned char *start = NULL;
+	const unsigned char *end = NULL;
+	unsigned char *der = NULL;
+	long der_len = 0;
+	long len = 0;
+	int tag = 0;
+	int xclass = 0;
+	int i = 0;
+	int rv = 0;
+	ASN1_TIME *t = NULL;
+	time_t ret = 0;
+	int days = 0;
+	int secs = 0;
+
+	if (!m || !m->data || m->size < 2) return 0;
+
+	if (m->data[0] == 0x30)
+	{
+		p = m->data;
+		end = p + m->size;
+	}
+	else
+	{
+		BIO *bio = NULL;
+
+		if ((bio = BIO_new_mem_buf(m->data, (int) m->size)) == NULL)
+			return 0;
+
+		rv = PEM_bytes_read_bio(&der, &der_len, NULL,
+				PEM_STRING_X509_CRL, bio, NULL, NULL);
+		BIO_free(bio);
+
+		if (!rv) {
+			ERR_clear_error();
+			return 0;
+		}
+
+		p = der;
+		end = p + der_len;
+	}
+
+	// CertificateList and tbsCertList
+	for (i = 0; i < 2; i++)
+	{
+		rv = ASN1_get_object(&p, &len, &tag, &xclass, end - p);
+		if ((rv & 0x80) || rv != V_ASN1_CONSTRUCTED ||
+				tag != V_ASN1_SEQUENCE) goto end;
+		end = p + len;
+	}
+
+	// version (optional), signature, issuer, thisUpdate, nextUpdate
+	for (i = 0; i < 5 && p < end; i++)
+	{
+		start = p;
+		rv = ASN1_get_object(&p, &len, &tag, &xclass, end - p);
+		if ((rv & 0x80) || rv == 0x21 || xclass != V_ASN1_UNIVERSAL)
+			goto end;
+
+		switch (i)
+		{
+			case 0:
+				// The version is optional (v1 CRLs)
+				if (tag == V_ASN1_INTEGER) break;
+				i++;
+				/* fall through */
+			case 1:
+			case 2:
+				if (tag != V_ASN1_SEQUENCE) goto end;
+				break;
+
+			case 3:
+			case 4:
+				if (tag != V_ASN1_UTCTIME &&
+						tag != V_ASN1_GENERALIZEDTIME) goto end;
+				break;
+		}
+
+		if (i == 4)
+		{
+			// nextUpdate
+			if ((t = d2i_ASN1_TIME(NULL, &start, (p - start) + len)) != NULL &&
+					ASN1_TIME_diff(&days, &secs, NULL, t))
+				ret = time(NULL) + (time_t) days * 86400 + secs;
+			break;
+		}
+
+		p += len;
+	}
+
+end:
+	if (t) ASN1_TIME_free(t);
+	if (der) OPENSSL_free(der);
+	ERR_clear_error();
+
+	return ret > 0 ? ret : 0;
+}
+
+/* --------------------------- On-disk Storage ---------------------------- */
+
+/*
+ * Returns the (allocated) path of the file that stores the URL's object
+ */
+static char *__url_cache_path(const char *dir, const char *url_s)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_len = 0;
+	char *ret = NULL;
+	size_t len = 0;
+	size_t pos = 0;
+	unsigned int i = 0;
+
+	if (!EVP_Digest(url_s, strlen(url_s), md, &md_len, EVP_sha256(), NULL))
+		return NULL;
+
+	len = strlen(dir) + 2 * md_len + 8;
+	if ((ret = PKI_Malloc(len)) == NULL) return NULL;
+
+	pos = (size_t) snprintf(ret, len, "%s/", dir);
+	for (i = 0; i < md_len; i++)
+		pos += (size_t) snprintf(ret + pos, len - pos, "%2.2x", md[i]);
+	snprintf(ret + pos, len - pos, ".cache");
+
+	return ret;
+}
+
+/*
+ * Returns the next line of the buffer (and skips it), NULL if there is none
+ */
+static char *__url_cache_line(const unsigned char **p, const unsigned char *end)
+{
+	const unsigned char *nl = NULL;
+	char *ret = NULL;
+
+	if ((nl = memchr(*p, '\n', (size_t)(end - *p))) == NULL) return NULL;
+
+	if ((ret = PKI_Malloc((size_t)(nl - *p) + 1)) == NULL) return NULL;
+	memcpy(ret, *p, (size_t)(nl - *p));
+
+	*p = nl + 1;
+
+	return ret;
+}
+
+/*
+ * Loads the URL's object from the cache directory. The format is a text
+ * header (magic, url, etag, last-modified, nextUpdate and number of
+ * objects) followed by the size and the contents of each object
+ */
+static URL_CACHE_ENTRY *__url_cache_load(const char *dir, const char *url_s)
+{
+	URL_CACHE_ENTRY *e = NULL;
+	PKI_MEM *buf = NULL;
+	PKI_MEM *obj = NULL;
+	const unsigned char *p = NULL;
+	const unsigned char *end = NULL;
+	char *lines[6] = { NULL };
+	char *path = NULL;
+	struct stat st;
+	unsigned long long size = 0;
+	long num = 0;
+	int fd = -1;
+	int i = 0;
+
+	if ((path = __url_cache_path(dir, url_s)) == NULL) return NULL;
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) != 0 ||
+			st.st_size <= 0 ||
+			(buf = PKI_MEM_new((size_t) st.st_size)) == NULL ||
+			read(fd, buf->data, (size_t) st.st_size) != st.st_size)
+		goto err;
+
+	p = buf->data;
+	end = p + st.st_size;
+
+	for (i = 0; i < 6; i++)
+		if ((lines[i] = __url_cache_line(&p, end)) == NULL) goto err;
+
+	if (strcmp(lines[0], URL_CACHE_MAGIC) != 0 ||
+			strcmp(lines[1], url_s) != 0 ||
+			(num = atol(lines[5])) <= 0)
+		goto err;
+
+	if ((e = PKI_Malloc(sizeof(URL_CACHE_ENTRY))) == NULL ||
+			(e->data = PKI_STACK_MEM_new()) == NULL)
+		goto err;
+
+	e->url_s = lines[1];
+	lines[1] = NULL;
+
+	if (*lines[2]) { e->etag = lines[2]; lines[2] = NULL; }
+	if (*lines[3]) { e->last_modified = lines[3]; lines[3] = NULL; }
+
+	e->next_update = (time_t) atoll(lines[4]);
+	e->references = 1;
+
+	for ( ; num > 0; num--)
+	{
+		char *tmp = NULL;
+
+		if ((tmp = __url_cache_line(&p, end)) == NULL) goto err;
+		size = strtoull(tmp, NULL, 10);
+		PKI_Free(tmp);
+
+		if (size > (unsigned long long)(end - p)) goto err;
+
+		if (size > 0) obj = PKI_MEM_new_data((size_t) size, (unsigned char *) p);
+		else obj = PKI_MEM_new_null();
+
+		if (!obj) goto err;
+
+		PKI_STACK_MEM_push(e->data, obj);
+		p += size;
+	}
+
+	for (i = 0; i < 6; i++) if (lines[i]) PKI_Free(lines[i]);
+	PKI_MEM_free(buf);
+	PKI_Free(path);
+	close(fd);
+
+	return e;
+
+err:
+	for (i = 0; i < 6; i++) if (lines[i]) PKI_Free(lines[i]);
+	if (buf) PKI_MEM_free(buf);
+	if (fd >= 0) close(fd);
+	PKI_Free(path);
+	__url_cache_entry_free(e);
+
+	return NULL;
+}
+
+/*
+ * Stores the URL's object in the cache directory (atomically replaces the
+ * previous version, if any)
+ */
+static int __url_cache_store(const char *dir, const URL_CACHE_ENTRY *e)
+{
+	PKI_MEM *mem = NULL;
+	char *path = NULL;
+	char *tmp = NULL;
+	char buf[256];
+	size_t len = 0;
+	int fd = -1;
+	int i = 0;
+	int ret = PKI_ERR;
+
+	if ((path = __url_cache_path(dir, e->url_s)) == NULL ||
+			(mem = PKI_MEM_new_null()) == NULL)
+		goto end;
+
+	snprintf(buf, sizeof(buf), "%s\n", URL_CACHE_MAGIC);
+	PKI_MEM_add(mem, buf, strlen(buf));
+	PKI_MEM_add(mem, e->url_s, strlen(e->url_s));
+	PKI_MEM_add(mem, "\n", 1);
+	if (e->etag) PKI_MEM_add(mem, e->etag, strlen(e->etag));
+	PKI_MEM_add(mem, "\n", 1);
+	if (e->last_modified)
+		PKI_MEM_add(mem, e->last_modified, strlen(e->last_modified));
+	PKI_MEM_add(mem, "\n", 1);
+
+	snprintf(buf, sizeof(buf), "%lld\n%d\n", (long long) e->next_update,
+		PKI_STACK_MEM_elements(e->data));
+	PKI_MEM_add(mem, buf, strlen(buf));
+
+	for (i = 0; i < PKI_STACK_MEM_elements(e->data); i++)
+	{
+		PKI_MEM *obj = PKI_STACK_MEM_get_num(e->data, i);
+
+		snprintf(buf, sizeof(buf), "%lu\n",
+			(unsigned long) (obj ? obj->size : 0));
+		PKI_MEM_add(mem, buf, strlen(buf));
+		if (obj && obj->size > 0)
+			PKI_MEM_add(mem, (char *) obj->data, obj->size);
+	}
+
+	len = strlen(dir) + 24;
+	if ((tmp = PKI_Malloc(len)) == NULL) goto end;
+	snprintf(tmp, len, "%s/.urlcache.XXXXXX", dir);
+
+	if ((fd = mkstemp(tmp)) < 0)
+	{
+		PKI_DEBUG("Can not create the URL cache file in %s", dir);
+		goto end;
+	}
+
+	if (write(fd, mem->data, mem->size) != (ssize_t) mem->size ||
+			close(fd) != 0 || rename(tmp, path) != 0)
+	{
+		if (fd >= 0) unlink(tmp);
+		fd = -1;
+		goto end;
+	}
+
+	fd = -1;
+	ret = PKI_OK;
+
+end:
+	if (fd >= 0) { close(fd); unlink(tmp); }
+	if (tmp) PKI_Free(tmp);
+	if (path) PKI_Free(path);
+	if (mem) PKI_MEM_free(mem);
+
+	return ret;
+}
+
+/*
+ * Returns a copy of the cache directory (NULL if not set)
+ */
+static char *__url_cache_dir(void)
+{
+	char *ret = NULL;
+
+	pthread_mutex_lock(&__url_cache.lock);
+	if (__url_cache.dir) ret = strdup(__url_cache.dir);
+	pthread_mutex_unlock(&__url_cache.lock);
+
+	return ret;
+}
+
+/* --------------------------- In-Memory Cache ---------------------------- */
+
+/*
+ * Returns a new reference to the (in memory) entry of the URL, if any
+ */
+static URL_CACHE_ENTRY *__url_cache_get(const char *url_s)
+{
+	URL_CACHE_ENTRY **pnt = NULL;
+	URL_CACHE_ENTRY *e = NULL;
+
+	pthread_mutex_lock(&__url_cache.lock);
+
+	for (pnt = &__url_cache.entries; *pnt; pnt = &(*pnt)->next)
+	{
+		if (strcmp((*pnt)->url_s, url_s) != 0) continue;
+
+		// Moves the entry to the front of the list
+		e = *pnt;
+		*pnt = e->next;
+		e->next = __url_cache.entries;
+		__url_cache.entries = e;
+
+		e->references++;
+		break;
+	}
+
+	pthread_mutex_unlock(&__url_cache.lock);
+
+	return e;
+}
+
+/*
+ * Adds the entry to the cache (the cache holds its own reference), the
+ * previous entry of the same URL and the least recently used ones (when
+ * the cache is full) are removed
+ */
+static void __url_cache_put(URL_CACHE_ENTRY *e)
+{
+	URL_CACHE_ENTRY *drop = NULL;
+	URL_CACHE_ENTRY **pnt = NULL;
+	URL_CACHE_ENTRY *tmp = NULL;
+	int n = 0;
+
+	pthread_mutex_lock(&__url_cache.lock);
+
+	if (__url_cache.max_entries <= 0)
+	{
+		pthread_mutex_unlock(&__url_cache.lock);
+		return;
+	}
+
+	for (pnt = &__url_cache.entries; *pnt; )
+	{
+		tmp = *pnt;
+
+		// Replaced entries (and the ones over the limit) are released
+		if (strcmp(tmp->url_s, e->url_s) == 0 ||
+				++n >= __url_cache.max_entries)
+		{
+			*pnt = tmp->next;
+			tmp->cached = 0;
+			__url_cache.size--;
+
+			if (--tmp->references == 0)
+			{
+				tmp->next = drop;
+				drop = tmp;
+			}
+			continue;
+		}
+
+		pnt = &tmp->next;
+	}
+
+	e->references++;
+	e->cached = 1;
+	e->next = __url_cache.entries;
+	__url_cache.entries = e;
+	__url_cache.size++;
+
+	pthread_mutex_unlock(&__url_cache.lock);
+
+	while ((tmp = drop) != NULL)
+	{
+		drop = tmp->next;
+		__url_cache_entry_free(tmp);
+	}
+}
+
+/*
+ * Builds a new entry with the retrieved data (owned by the entry)
+ */
+static URL_CACHE_ENTRY *__url_cache_entry_new(const URL *url,
+					      PKI_MEM_STACK *data,
+					      const PKI_HTTP *resp,
+					      const struct stat *st)
+{
+	URL_CACHE_ENTRY *e = NULL;
+	time_t now = time(NULL);
+
+	if ((e = PKI_Malloc(sizeof(URL_CACHE_ENTRY))) == NULL ||
+			(e->url_s = strdup(url->url_s)) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		if (e) PKI_Free(e);
+		PKI_STACK_MEM_free_all(data);
+		return NULL;
+	}
+
+	e->data = data;
+	e->references = 1;
+
+	if (resp)
+	{
+		e->etag = PKI_HTTP_get_header(resp, "ETag");
+		e->last_modified = PKI_HTTP_get_header(resp, "Last-Modified");
+	}
+
+	if (st)
+	{
+		e->dev = st->st_dev;
+		e->ino = st->st_ino;
+		e->size = st->st_size;
+		e->mtime = st->st_mtime;
+		e->mtime_nsec = URL_CACHE_MTIME_NSEC(st);
+	}
+
+	if (PKI_STACK_MEM_elements(data) > 0)
+		e->next_update = __url_cache_crl_next_update(
+					PKI_STACK_MEM_get_num(data, 0));
+
+	e->expires = __url_cache_expires(e->next_update, now);
+
+	return e;
+}
+
+/*
+ * Returns PKI_OK if the file has not changed since it was cached
+ */
+static int __url_cache_file_check(const URL_CACHE_ENTRY *e,
+				  const struct stat *st)
+{
+	if (e->dev != st->st_dev || e->ino != st->st_ino ||
+			e->size != st->st_size ||
+			e->mtime != st->st_mtime ||
+			e->mtime_nsec != URL_CACHE_MTIME_NSEC(st))
+		return PKI_ERR;
+
+	return PKI_OK;
+}
+
+/*
+ * Returns PKI_OK if the cache is enabled and it can serve the URL
+ */
+static int __url_cache_url_supported(const URL *url, ssize_t max_size)
+{
+	if (!url || !url->url_s || max_size > 0) return PKI_ERR;
+
+	if (__url_cache.max_entries <= 0) return PKI_ERR;
+
+	switch (url->proto)
+	{
+		case URI_PROTO_FILE:
+			return __url_cache.file_urls ? PKI_OK : PKI_ERR;
+
+		case URI_PROTO_HTTP:
+		case URI_PROTO_HTTPS:
+#ifdef HAVE_LDAP
+		case URI_PROTO_LDAP:
+#endif
+			return PKI_OK;
+
+		default:
+			break;
+	}
+
+	return PKI_ERR;
+}
+
+/*! \brief Returns PKI_OK if the URL cache is enabled and it can serve objects
+ *         of the passed type from the URL, PKI_ERR otherwise
+ *
+ * Only certificates and CRLs from http(s):// and ldap:// URLs are cached,
+ * file:// URLs are cached only if enabled with PKI_URL_CACHE_set_file_urls().
+ * Retrievals limited to max_size bytes are not cached.
+ */
+
+int PKI_URL_CACHE_supported(const URL * url, PKI_DATATYPE type,
+			    ssize_t max_size)
+{
+	if (type != PKI_DATATYPE_X509_CERT && type != PKI_DATATYPE_X509_CRL)
+		return PKI_ERR;
+
+	return __url_cache_url_supported(url, max_size);
+}
+
+/*! \brief Returns the (cached) data from the URL without copying it
+ *
+ * The data is cached regardless of its type, the caller should only use
+ * this function for public objects (see PKI_URL_CACHE_supported()).
+ * Cached objects are returned without contacting the server while they are
+ * fresh (i.e., before the nextUpdate of a CRL), otherwise they are
+ * revalidated (conditional GET for HTTP, modification time for files) and
+ * retrieved again only when they changed. Objects with no validators are
+ * not cached.
+ *
+ * The returned stack is shared and it must not be modified, the reference
+ * returned in ref has to be released with PKI_URL_CACHE_release() when the
+ * data is not needed anymore. As for PKI_HTTP_GET_data_url(), the passed
+ * PKI_SSL (if any) is owned by the function for http(s) URLs. In case of
+ * failure NULL is returned.
+ */
+
+const PKI_MEM_STACK * PKI_URL_CACHE_get_data(const URL          * url,
+					     int                  timeout,
+					     ssize_t              max_size,
+					     PKI_SSL            * ssl,
+					     PKI_URL_CACHE_REF ** ref)
+{
+	URL_CACHE_ENTRY *e = NULL;
+	URL_CACHE_ENTRY *ret = NULL;
+	PKI_MEM_STACK *data = NULL;
+	PKI_HTTP *resp = NULL;
+	char *dir = NULL;
+	struct stat st;
+	time_t now = time(NULL);
+	int fresh = 0;
+
+	if (ref) *ref = NULL;
+
+	if (!url || !ref)
+	{
+		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+		return NULL;
+	}
+
+	if (__url_cache_url_supported(url, max_size) != PKI_OK)
+	{
+		PKI_ERROR(PKI_ERR_URI_UNSUPPORTED, NULL);
+		return NULL;
+	}
+
+	// Files are never stored in the cache directory
+	if (url->proto != URI_PROTO_FILE) dir = __url_cache_dir();
+
+	if ((e = __url_cache_get(url->url_s)) == NULL && dir)
+	{
+		// Not in memory, the cache directory is checked
+		if ((e = __url_cache_load(dir, url->url_s)) != NULL)
+		{
+			e->expires = __url_cache_expires(e->next_update, now);
+			__url_cache_put(e);
+		}
+	}
+
+	if (url->proto == URI_PROTO_FILE)
+	{
+		// Stat before read, a concurrent change is caught next time
+		if (stat(url->addr, &st) != 0)
+		{
+			PKI_DEBUG("Can not access %s", url->addr);
+			goto end;
+		}
+
+		if (e && __url_cache_file_check(e, &st) == PKI_OK)
+		{
+			ret = e;
+			e = NULL;
+
+			pthread_mutex_lock(&__url_cache.lock);
+			__url_cache.revalidated++;
+			pthread_mutex_unlock(&__url_cache.lock);
+			goto end;
+		}
+
+		if ((data = URL_get_data_file(url, 0)) == NULL) goto end;
+
+		if ((ret = __url_cache_entry_new(url, data, NULL, &st)) != NULL)
+			__url_cache_put(ret);
+	}
+	else
+	{
+		if (e)
+		{
+			pthread_mutex_lock(&__url_cache.lock);
+			if ((fresh = (e->expires > now)) != 0) __url_cache.hits++;
+			pthread_mutex_unlock(&__url_cache.lock);
+
+			if (fresh)
+			{
+				// Consumed as if the request was sent
+				if (ssl && url->proto != URI_PROTO_LDAP)
+					PKI_SSL_free(ssl);
+				ret = e;
+				e = NULL;
+				goto end;
+			}
+		}
+
+		if (url->proto == URI_PROTO_HTTP || url->proto == URI_PROTO_HTTPS)
+		{
+			if (PKI_HTTP_GET_data_url_cond(url, e ? e->etag : NULL,
+					e ? e->last_modified : NULL, timeout, 0,
+					&data, &resp, ssl) != PKI_OK)
+				goto end;
+
+			if (e && resp && resp->code == 304)
+			{
+				// Not modified, the cached data is returned
+				pthread_mutex_lock(&__url_cache.lock);
+				e->expires = __url_cache_expires(e->next_update, now);
+				__url_cache.revalidated++;
+				pthread_mutex_unlock(&__url_cache.lock);
+
+				ret = e;
+				e = NULL;
+				goto end;
+			}
+
+			if (!data) goto end;
+		}
+#ifdef HAVE_LDAP
+		else if ((data = URL_get_data_ldap_url(url, timeout, 0)) == NULL)
+			goto end;
+#endif
+
+		if ((ret = __url_cache_entry_new(url, data, resp, NULL)) == NULL)
+			goto end;
+
+		// Only objects that can be revalidated (or that have a
+		// freshness period) are cached
+		if (ret->etag || ret->last_modified || ret->expires > now)
+		{
+			__url_cache_put(ret);
+			if (dir) __url_cache_store(dir, ret);
+		}
+	}
+
+	if (ret)
+	{
+		pthread_mutex_lock(&__url_cache.lock);
+		__url_cache.misses++;
+		pthread_mutex_unlock(&__url_cache.lock);
+	}
+
+end:
+	if (resp) PKI_HTTP_free(resp);
+	if (dir) PKI_Free(dir);
+	if (e) PKI_URL_CACHE_release(e);
+
+	*ref = ret;
+
+	return ret ? ret->data : NULL;
+}
+
+/*! \brief Releases a reference returned by PKI_URL_CACHE_get_data() */
+
+void PKI_URL_CACHE_release(PKI_URL_CACHE_REF *ref)
+{
+	int refs = 0;
+
+	if (!ref) return;
+
+	pthread_mutex_lock(&__url_cache.lock);
+	refs = --ref->references;
+	pthread_mutex_unlock(&__url_cache.lock);
+
+	if (refs == 0) __url_cache_entry_free(ref);
+}
+
+/*! \brief Sets the max number of cached objects (0 disables the cache) and
+ *         the max time (secs) a fresh object (e.g., a CRL before its
+ *         nextUpdate) is used without revalidation (0 always revalidates)
+ */
+
+int PKI_URL_CACHE_set_limits(int max_entries, int max_age)
+{
+	if (max_entries < 0 || max_age < 0)
+		return PKI_ERROR(PKI_ERR_PARAM_TYPE, NULL);
+
+	pthread_mutex_lock(&__url_cache.lock);
+	__url_cache.max_entries = max_entries;
+	__url_cache.max_age = max_age;
+	pthread_mutex_unlock(&__url_cache.lock);
+
+	// The cached entries are dropped (freshness set with the old limits)
+	PKI_URL_CACHE_flush();
+
+	return PKI_OK;
+}
+
+/*! \brief Enables (or disables) the caching of file:// URLs, which are
+ *         not cached by default */
+
+void PKI_URL_CACHE_set_file_urls(int enabled)
+{
+	pthread_mutex_lock(&__url_cache.lock);
+	__url_cache.file_urls = enabled ? 1 : 0;
+	pthread_mutex_unlock(&__url_cache.lock);
+
+	// Cached files are dropped when disabled
+	if (!enabled) PKI_URL_CACHE_flush();
+}
+
+/*! \brief Sets the directory where the cached objects are also stored (so
+ *         that they survive the process), NULL disables the storage */
+
+int PKI_URL_CACHE_set_dir(const char *dir)
+{
+	struct stat st;
+	char *tmp = NULL;
+
+	if (dir)
+	{
+		if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+			return PKI_ERROR(PKI_ERR_PARAM_TYPE, "Not a directory (%s)", dir);
+
+		if ((tmp = strdup(dir)) == NULL)
+			return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+	}
+
+	pthread_mutex_lock(&__url_cache.lock);
+	if (__url_cache.dir) PKI_Free(__url_cache.dir);
+	__url_cache.dir = tmp;
+	pthread_mutex_unlock(&__url_cache.lock);
+
+	return PKI_OK;
+}
+
+/*! \brief Returns the number of objects served from the cache without any
+ *         request, the number of revalidated ones (not modified) and the
+ *         number of objects that were retrieved */
+
+int PKI_URL_CACHE_get_stats(unsigned long *hits,
+			    unsigned long *revalidated,
+			    unsigned long *misses)
+{
+	pthread_mutex_lock(&__url_cache.lock);
+
+	if (hits) *hits = __url_cache.hits;
+	if (revalidated) *revalidated = __url_cache.revalidated;
+	if (misses) *misses = __url_cache.misses;
+
+	pthread_mutex_unlock(&__url_cache.lock);
+
+	return PKI_OK;
+}
+
+/*! \brief Removes all the objects from the (in memory) cache */
+
+void PKI_URL_CACHE_flush(void)
+{
+	URL_CACHE_ENTRY *drop = NULL;
+	URL_CACHE_ENTRY *e = NULL;
+
+	pthread_mutex_lock(&__url_cache.lock);
+
+	while ((e = __url_cache.entries) != NULL)
+	{
+		__url_cache.entries = e->next;
+		e->cached = 0;
+
+		if (--e->references == 0)
+		{
+			e->next = drop;
+			drop = e;
+		}
+	}
+	__url_cache.size = 0;
+
+	pthread_mutex_unlock(&__url_cache.lock);
+
+	while ((e = drop) != NULL)
+	{
+		drop = e->next;
+		__url_cache_entry_free(e);
+	}
+}
+
+/*! \brief Releases the URL cache (called by PKI_final_all) */
+
+void PKI_URL_CACHE_cleanup(void)
+{
+	PKI_URL_CACHE_flush();
+	PKI_URL_CACHE_set_dir(NULL);
+}
@@ -18,14 +18,300 @@ void PKI_DIGEST_free ( PKI_DIGEST *data )
 	return;
 }
 
+/* ------------------------- Per-thread Contexts -------------------------- */
+
+/* Crypto contexts are kept per-thread (no locking is needed) and reused
+ * across calls. Digest contexts are keyed by algorithm, public key contexts
+ * by key, digest and operation. The contexts of a thread are released when
+ * the thread exits or by calling PKI_DIGEST_CTX_flush().
+ *
+ * A public key context holds a reference to its key. To avoid keeping the
+ * keys freed by the application alive, every PKI_X509_KEYPAIR free bumps a
+ * global generation: a thread drops its key contexts when it sees a new
+ * generation. A freed key is therefore retained (by at most one slot per
+ * thread) only until the next sign/verify call of the threads that used
+ * it, PKI_DIGEST_CTX_flush() or the thread exit. */
+
+typedef struct pki_digest_ctx_slot_st {
+	const PKI_DIGEST_ALG * md;
+	EVP_MD_CTX * ctx;
+} PKI_DIGEST_CTX_SLOT;
+
+typedef struct pki_digest_pkey_slot_st {
+	const PKI_X509_KEYPAIR_VALUE * pkey;
+	const PKI_DIGEST_ALG * md;
+	int sign;
+	EVP_PKEY_CTX * ctx;
+	unsigned long used;
+} PKI_DIGEST_PKEY_SLOT;
+
+typedef struct pki_digest_tls_st {
+	PKI_DIGEST_CTX_SLOT md[PKI_DIGEST_CTX_POOL_SIZE];
+	PKI_DIGEST_PKEY_SLOT pkey[PKI_DIGEST_CTX_POOL_SIZE];
+	int md_next;
+	unsigned long pkey_gen;
+	unsigned long pkey_tick;
+} PKI_DIGEST_TLS;
+
+static pthread_key_t _digest_tls_key;
+static pthread_once_t _digest_tls_once = PTHREAD_ONCE_INIT;
+static int _digest_tls_ok = 0;
+static unsigned long _digest_pkey_gen = 0;
+
+static void __digest_tls_free(void *arg) {
+
+	PKI_DIGEST_TLS *tls = (PKI_DIGEST_TLS *) arg;
+	int i = 0;
+
+	if (!tls) return;
+
+	for (i = 0; i < PKI_DIGEST_CTX_POOL_SIZE; i++) {
+		if (tls->md[i].ctx) EVP_MD_CTX_free(tls->md[i].ctx);
+		if (tls->pkey[i].ctx) EVP_PKEY_CTX_free(tls->pkey[i].ctx);
+	}
+
+	PKI_Free(tls);
+}
+
+static void __digest_tls_init(void) {
+
+	if (pthread_key_create(&_digest_tls_key, __digest_tls_free) == 0)
+		_digest_tls_ok = 1;
+}
+
+static PKI_DIGEST_TLS * __digest_tls_get(void) {
+
+	PKI_DIGEST_TLS *tls = NULL;
+
+	pthread_once(&_digest_tls_once, __digest_tls_init);
+	if (!_digest_tls_ok) return NULL;
+
+	if ((tls = pthread_getspecific(_digest_tls_key)) != NULL) return tls;
+
+	if ((tls = PKI_Malloc(sizeof(PKI_DIGEST_TLS))) == NULL) return NULL;
+
+	if (pthread_setspecific(_digest_tls_key, tls) != 0) {
+		PKI_Free(tls);
+		return NULL;
+	}
+
+	return tls;
+}
+
+static void __digest_tls_pkey_clear(PKI_DIGEST_TLS *tls) {
+
+	int i = 0;
+
+	for (i = 0; i < PKI_DIGEST_CTX_POOL_SIZE; i++) {
+		if (tls->pkey[i].ctx) EVP_PKEY_CTX_free(tls->pkey[i].ctx);
+		memset(&tls->pkey[i], 0, sizeof(PKI_DIGEST_PKEY_SLOT));
+	}
+}
+
+/*! \brief Returns the calling thread's digest context for the algorithm
+ *
+ * The context is initialized and ready for EVP_DigestUpdate() (or
+ * EVP_VerifyUpdate() / EVP_SignUpdate()). It is owned by the thread's
+ * pool: it must not be freed and it is only valid until the next call
+ * for the same thread. NULL is returned in case of errors.
+ */
+
+EVP_MD_CTX * PKI_DIGEST_CTX_get(const PKI_DIGEST_ALG *alg) {
+
+	PKI_DIGEST_TLS *tls = NULL;
+	PKI_DIGEST_CTX_SLOT *slot = NULL;
+	int i = 0;
+
+	if (!alg) return NULL;
+
+	if ((tls = __digest_tls_get()) == NULL) return NULL;
+
+	for (i = 0; i < PKI_DIGEST_CTX_POOL_SIZE; i++) {
+
+		slot = &tls->md[i];
+		if (slot->md != alg || !slot->ctx) continue;
+
+		// Re-initializes with the digest already set in the context,
+		// this avoids fetching the algorithm implementation again
+		if (EVP_DigestInit_ex(slot->ctx, NULL, NULL) == 1) return slot->ctx;
+
+		break;
+	}
+
+	// Replaces (round-robin) one of the slots
+	if (i >= PKI_DIGEST_CTX_POOL_SIZE) {
+		slot = &tls->md[tls->md_next];
+		tls->md_next = (tls->md_next + 1) % PKI_DIGEST_CTX_POOL_SIZE;
+	}
+
+	slot->md = NULL;
+	if (!slot->ctx && (slot->ctx = EVP_MD_CTX_new()) == NULL) {
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		return NULL;
+	}
+
+	if (EVP_DigestInit_ex(slot->ctx, alg, NULL) != 1) {
+		EVP_MD_CTX_free(slot->ctx);
+		slot->ctx = NULL;
+		return NULL;
+	}
+
+	slot->md = alg;
+
+	return slot->ctx;
+}
+
+/*! \brief Returns the calling thread's public key context for signing
+ *         (sign != 0) or verifying digests calculated with alg
+ *
+ * The context is initialized for the operation, it can be passed directly
+ * to EVP_PKEY_sign() or EVP_PKEY_verify(). The context holds a reference
+ * to the key until it is replaced in the pool or until a PKI_X509_KEYPAIR
+ * is freed (see PKI_DIGEST_PKEY_CTX_invalidate()). It must not be freed
+ * by the caller. NULL is returned if the key does not support the
+ * operation.
+ */
+
+EVP_PKEY_CTX * PKI_DIGEST_PKEY_CTX_get(const PKI_X509_KEYPAIR_VALUE *pkey,
+				       const PKI_DIGEST_ALG *alg,
+				       int sign) {
+
+	PKI_DIGEST_TLS *tls = NULL;
+	PKI_DIGEST_PKEY_SLOT *slot = NULL;
+	unsigned long gen = 0;
+	int i = 0;
+
+	if (!pkey || !alg) return NULL;
+
+	if ((tls = __digest_tls_get()) == NULL) return NULL;
+
+	// Releases the cached keys when some key has been freed since
+	// the last call (it may be one of ours)
+	gen = __atomic_load_n(&_digest_pkey_gen, __ATOMIC_ACQUIRE);
+	if (gen != tls->pkey_gen) {
+		__digest_tls_pkey_clear(tls);
+		tls->pkey_gen = gen;
+	}
+
+	tls->pkey_tick++;
+
+	for (i = 0; i < PKI_DIGEST_CTX_POOL_SIZE; i++) {
+
+		slot = &tls->pkey[i];
+		if (slot->ctx && slot->pkey == pkey &&
+				slot->md == alg && slot->sign == sign) {
+			slot->used = tls->pkey_tick;
+			return slot->ctx;
+		}
+	}
+
+	// Replaces the least recently used slot
+	slot = &tls->pkey[0];
+	for (i = 1; i < PKI_DIGEST_CTX_POOL_SIZE; i++) {
+		if (tls->pkey[i].used < slot->used) slot = &tls->pkey[i];
+	}
+
+	if (slot->ctx) EVP_PKEY_CTX_free(slot->ctx);
+	memset(slot, 0, sizeof(PKI_DIGEST_PKEY_SLOT));
+
+	// The context keeps a reference to the key, therefore a cached key
+	// can not be freed (and its address reused) while it is in the pool
+	if ((slot->ctx = EVP_PKEY_CTX_new((EVP_PKEY *) pkey, NULL)) == NULL)
+		return NULL;
+
+	if ((sign ? EVP_PKEY_sign_init(slot->ctx) :
+			EVP_PKEY_verify_init(slot->ctx)) <= 0 ||
+			EVP_PKEY_CTX_set_signature_md(slot->ctx, alg) <= 0) {
+
+		EVP_PKEY_CTX_free(slot->ctx);
+		slot->ctx = NULL;
+		ERR_clear_error();
+
+		return NULL;
+	}
+
+	slot->pkey = pkey;
+	slot->md = alg;
+	slot->sign = sign;
+	slot->used = tls->pkey_tick;
+
+	return slot->ctx;
+}
+
+/*! \brief Invalidates the public key contexts cached by all threads
+ *
+ * This is called when a PKI_X509_KEYPAIR is freed, the threads release
+ * their cached key contexts (and the key references they hold) at their
+ * next PKI_DIGEST_PKEY_CTX_get() call.
+ */
+
+void PKI_DIGEST_PKEY_CTX_invalidate(void) {
+
+	__atomic_add_fetch(&_digest_pkey_gen, 1, __ATOMIC_RELEASE);
+}
+
+/*! \brief Releases the crypto contexts cached by the calling thread */
+
+void PKI_DIGEST_CTX_flush(void) {
+
+	PKI_DIGEST_TLS *tls = NULL;
+
+	pthread_once(&_digest_tls_once, __digest_tls_init);
+	if (!_digest_tls_ok) return;
+
+	if ((tls = pthread_getspecific(_digest_tls_key)) == NULL) return;
+
+	pthread_setspecific(_digest_tls_key, NULL);
+	__digest_tls_free(tls);
+}
+
+/* ---------------------------- Digest Values ---------------------------- */
+
+/*! \brief Calculates a digest into a caller provided buffer
+ *
+ * No memory is allocated (the thread's digest context is reused). Returns
+ * the size of the digest, or 0 in case of errors (e.g., if out_size is
+ * smaller than the digest size).
+ */
+
+int PKI_DIGEST_calculate(const PKI_DIGEST_ALG * alg,
+			 const unsigned char  * data,
+			 size_t                 size,
+			 unsigned char        * out,
+			 size_t                 out_size) {
+
+	EVP_MD_CTX * md_ctx = NULL;
+	unsigned int digest_size = 0;
+
+	// Input Checks
+	if (!data || !alg || !out) {
+		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+		return 0;
+	}
+
+	if (EVP_MD_size(alg) <= 0 || out_size < (size_t) EVP_MD_size(alg)) {
+		PKI_ERROR(PKI_ERR_PARAM_TYPE, "Output buffer too small");
+		return 0;
+	}
+
+	if ((md_ctx = PKI_DIGEST_CTX_get(alg)) == NULL) return 0;
+
+	if (EVP_DigestUpdate(md_ctx, data, size) != 1 ||
+			EVP_DigestFinal_ex(md_ctx, out, &digest_size) != 1)
+		return 0;
+
+	return (int) digest_size;
+}
+
+/*! \brief Calculates a digest, the output buffer is allocated if *dst_buf
+ *         is NULL (otherwise it must be at least EVP_MAX_MD_SIZE bytes)
+ */
+
 int PKI_DIGEST_new_value(unsigned char       ** dst_buf,
 		         const PKI_DIGEST_ALG * alg,
 		         const unsigned char  * data,
 		         size_t                 size) {
 
-	EVP_MD_CTX * md_ctx = NULL;
-		// Crypto Context for Digest Calculation
-
 	int mem_alloc = 0;
 		// Tracks where the mem alloc happened
 
@@ -38,62 +324,27 @@ int PKI_DIGEST_new_value(unsigned char       ** dst_buf,
 		return 0;
 	}
 
-	// Allocate a new CTX
-	if ((md_ctx = EVP_MD_CTX_new()) == NULL) {
-		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
-		return 0;
-	}
-
-	// Let's initialize the MD context
-	EVP_MD_CTX_init(md_ctx);
-	
 	// Allocates the buffer if not provided
 	if (*dst_buf == NULL) {
-		*dst_buf = PKI_Malloc(EVP_MAX_MD_SIZE); 
-		mem_alloc = 1;
-	}
-
-	// Initializes the Digest
-	if ((EVP_DigestInit_ex(md_ctx, alg, NULL )) == 1 ) {
-
-		// Updates the digest value
-		EVP_DigestUpdate(md_ctx, data, size);
-
-		// Finalize the digest
-		if ((EVP_DigestFinal_ex(md_ctx, *dst_buf, NULL)) == 1) {
-
-			// All Ok
-			digest_size = EVP_MD_CTX_size(md_ctx);
+		if ((*dst_buf = PKI_Malloc(EVP_MAX_MD_SIZE)) == NULL) {
+			PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+			return 0;
 		}
-
-		// Let's clean everything up
-		EVP_MD_CTX_reset(md_ctx);
-		md_ctx = NULL; // Safety
+		mem_alloc = 1;
 	}
 
-	// If we have an error, let's return '0'
-	if (digest_size <= 0) goto err;
-
-	// Return the calculated value
-	return digest_size;
-
-err:
-	// Let's clean everything up
-	if (md_ctx) {
-		EVP_MD_CTX_reset(md_ctx);
-		EVP_MD_CTX_free(md_ctx);
-	}
+	// Calculates the digest
+	digest_size = PKI_DIGEST_calculate(alg, data, size,
+					   *dst_buf, EVP_MAX_MD_SIZE);
 
 	// Free the allocated memory only if we are not re-using
 	// the provided output buffer (dst_buf)
-	if (mem_alloc) {
+	if (digest_size <= 0 && mem_alloc) {
 		PKI_Free(*dst_buf);
 		*dst_buf = NULL; // Safety
 	}
 
-	// Nothing to return
-	return 0;
-
+	return digest_size;
 }
 				     
 /*! \brief Calculate digest over data provided in a buffer
@@ -121,6 +372,7 @@ PKI_DIGEST *PKI_DIGEST_new(const PKI_DIGEST_ALG *alg,
 		}
 
 		ret->size = (size_t) dgst_size;
+		ret->algor = alg;
 	}
 
 	// All done
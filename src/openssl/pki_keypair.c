@@ -39,6 +39,7 @@ PKI_X509_KEYPAIR *PKI_X509_KEYPAIR_new( PKI_SCHEME_ID type, int bits,
 #ifdef ENABLE_ECDSA
 	kp.ec.form = PKI_EC_KEY_FORM_UNKNOWN;
 	kp.ec.curve = -1;
+	kp.ec.asn1flags = -1;
 #endif
 
 	return HSM_X509_KEYPAIR_new ( &kp, label, cred, hsm );
@@ -343,6 +344,7 @@ PKI_DIGEST *PKI_X509_KEYPAIR_VALUE_pub_digest (const PKI_X509_KEYPAIR_VALUE * pk
 	if (1 != X509_PUBKEY_get0_param(NULL, 
 			(const unsigned char **)&buf, &buf_size, NULL, xpk)) {
 		PKI_log_err("Can not get the PublicKeyInfo from the KeyPair.");
+		X509_PUBKEY_free(xpk);
 		return NULL;
 	}
 
@@ -359,16 +361,12 @@ PKI_DIGEST *PKI_X509_KEYPAIR_VALUE_pub_digest (const PKI_X509_KEYPAIR_VALUE * pk
 		if ((ret = PKI_DIGEST_new(md, buf, (size_t) buf_size)) == NULL) {
 			PKI_log_debug("PKI_X509_KEYPAIR_pub_digest()::%s",
 				ERR_error_string( ERR_get_error(), NULL ));
-			return NULL;
 		}
-
-		// Free the Buffer Memory
-		PKI_Free(buf);
 	}
 
-	// Now we might need to free the X509_PUBKEY structure
-	// if (xpk) X509_PUBKEY_free(xpk);
-	// xpk = NULL; // Safety
+	// The buffer is owned by the X509_PUBKEY structure
+	if (xpk) X509_PUBKEY_free(xpk);
+	xpk = NULL; // Safety
 
 	/* TODO: Remove this Debugging Info
 	printf("[DEBUG] PUBKEY Bit String:\n");
@@ -276,6 +276,69 @@ PKI_STRING * PKI_OCSP_CERTID_get_issuerKeyHash(PKI_OCSP_CERTID * c_id) {
   return ret;
 }
 
+/*! \brief Returns PKI_OK if the CertID identifies a certificate issued
+ *         by the passed issuer (issuerNameHash and issuerKeyHash match)
+ *
+ * The hashes are calculated into stack buffers by using the thread's
+ * digest contexts, matching CertIDs does not allocate memory.
+ */
+
+int PKI_OCSP_CERTID_match_issuer(PKI_OCSP_CERTID * c_id,
+				 const PKI_X509_CERT * issuer) {
+
+	ASN1_OCTET_STRING *nameHash = NULL;
+	ASN1_OCTET_STRING *keyHash = NULL;
+	ASN1_OBJECT *alg_oid = NULL;
+	const PKI_DIGEST_ALG *dgst = NULL;
+
+	unsigned char md[EVP_MAX_MD_SIZE];
+	int md_len = 0;
+
+	// Input checks
+	if (!c_id || !issuer || !issuer->value) return PKI_ERR;
+
+	OCSP_id_get0_info(&nameHash, &alg_oid, &keyHash, NULL, c_id);
+
+	if (!nameHash || !keyHash || !alg_oid ||
+			(dgst = EVP_get_digestbyobj(alg_oid)) == NULL)
+		return PKI_ERR;
+
+	// Checks the hash of the issuer's public key
+	md_len = PKI_X509_CERT_key_hash_buf(issuer, dgst, md, sizeof(md));
+	if (md_len <= 0 || md_len != keyHash->length ||
+			memcmp(md, keyHash->data, (size_t) md_len) != 0)
+		return PKI_ERR;
+
+	// Checks the hash of the issuer's name
+#if OPENSSL_VERSION_NUMBER >= 0x1010000fL
+	{
+		const unsigned char *der = NULL;
+		size_t der_len = 0;
+
+		if (!X509_NAME_get0_der(X509_get_subject_name(issuer->value),
+					&der, &der_len))
+			return PKI_ERR;
+
+		md_len = PKI_DIGEST_calculate(dgst, der, der_len, md, sizeof(md));
+	}
+#else
+	{
+		unsigned int len = 0;
+
+		if (!X509_NAME_digest(X509_get_subject_name(issuer->value),
+					dgst, md, &len))
+			return PKI_ERR;
+
+		md_len = (int) len;
+	}
+#endif
+	if (md_len <= 0 || md_len != nameHash->length ||
+			memcmp(md, nameHash->data, (size_t) md_len) != 0)
+		return PKI_ERR;
+
+	return PKI_OK;
+}
+
 /*! \brief Returns the serial of the requested certificate from the n-th
  *         single request */
 
@@ -823,6 +823,406 @@ int PKI_X509_OCSP_RESP_print_parsed ( PKI_X509_OCSP_RESP *r,
 	return ret;
 }
 
+/* ---------------------------- Response Cache --------------------------- */
+
+/* Max size of the lookup key (two hashes and the serial number) */
+#define PKI_OCSP_RESP_CACHE_KEY_SIZE	256
+
+/* Builds the lookup key as [len][issuerNameHash][len][issuerKeyHash][serial] */
+
+static size_t __ocsp_cache_key(PKI_OCSP_CERTID *cid, unsigned char *buf,
+						size_t size, unsigned long *hash) {
+
+	PKI_STRING *nameHash = NULL;
+	PKI_STRING *keyHash = NULL;
+	PKI_INTEGER *serial = NULL;
+
+	unsigned long h = 2166136261UL;
+	size_t len = 0;
+	size_t i = 0;
+
+	if ((nameHash = PKI_OCSP_CERTID_get_issuerNameHash(cid)) == NULL ||
+		(keyHash = PKI_OCSP_CERTID_get_issuerKeyHash(cid)) == NULL)
+		return 0;
+
+	OCSP_id_get0_info(NULL, NULL, NULL, &serial, cid);
+	if (!serial) return 0;
+
+	if (nameHash->length > 255 || keyHash->length > 255 ||
+			(size_t)(nameHash->length + keyHash->length +
+				serial->length + 3) > size)
+		return 0;
+
+	buf[len++] = (unsigned char) nameHash->length;
+	memcpy(buf + len, nameHash->data, (size_t) nameHash->length);
+	len += (size_t) nameHash->length;
+
+	buf[len++] = (unsigned char) keyHash->length;
+	memcpy(buf + len, keyHash->data, (size_t) keyHash->length);
+	len += (size_t) keyHash->length;
+
+	// Negative serials do not collide with positive ones
+	buf[len++] = (serial->type == V_ASN1_NEG_INTEGER);
+	memcpy(buf + len, serial->data, (size_t) serial->length);
+	len += (size_t) serial->length;
+
+	// FNV-1a
+	for (i = 0; i < len; i++) {
+		h ^= buf[i];
+		h *= 16777619UL;
+	}
+	*hash = h;
+
+	return len;
+}
+
+/* Drops one reference, the entry is freed when the last one goes away.
+ * The cache mutex must be held. */
+
+static void __ocsp_cache_entry_unref(PKI_OCSP_RESP_CACHE_ENTRY *e) {
+
+	if (--e->refs > 0) return;
+
+	PKI_MEM_cleanup(&e->der);
+	if (e->key) PKI_Free(e->key);
+	PKI_Free(e);
+}
+
+/* Removes the entries expired at now (all of them if now is 0). The cache
+ * mutex must be held. Returns the number of removed entries. */
+
+static int __ocsp_cache_purge(PKI_OCSP_RESP_CACHE *c, time_t now) {
+
+	PKI_OCSP_RESP_CACHE_ENTRY **pp = NULL;
+	PKI_OCSP_RESP_CACHE_ENTRY *e = NULL;
+	int ret = 0;
+	int i = 0;
+
+	for (i = 0; i < c->size; i++) {
+		pp = &c->buckets[i];
+		while ((e = *pp) != NULL) {
+			if (now && e->expires > now) {
+				pp = &e->next;
+				continue;
+			}
+			*pp = e->next;
+			__ocsp_cache_entry_unref(e);
+			c->entries--;
+			ret++;
+		}
+	}
+
+	return ret;
+}
+
+/*! \brief Allocates a new cache for (signed) OCSP responses
+ *
+ * The cache holds up to max_entries DER encoded responses, each one for
+ * a single CertID, and serves them until their nextUpdate.
+ */
+
+PKI_OCSP_RESP_CACHE * PKI_OCSP_RESP_CACHE_new ( int max_entries ) {
+
+	PKI_OCSP_RESP_CACHE *ret = NULL;
+	int size = 16;
+
+	if (max_entries <= 0) {
+		PKI_ERROR(PKI_ERR_PARAM_TYPE, NULL);
+		return NULL;
+	}
+
+	// Uses (at least) one bucket per entry
+	while (size < max_entries && size < (1 << 24)) size <<= 1;
+
+	if ((ret = PKI_Malloc(sizeof(PKI_OCSP_RESP_CACHE))) == NULL ||
+		(ret->buckets = PKI_Malloc(sizeof(PKI_OCSP_RESP_CACHE_ENTRY *) *
+						(size_t) size)) == NULL) {
+		if (ret) PKI_Free(ret);
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		return NULL;
+	}
+
+	ret->size = size;
+	ret->max_entries = max_entries;
+
+	if (PKI_MUTEX_init(&ret->mutex) != PKI_OK) {
+		PKI_Free(ret->buckets);
+		PKI_Free(ret);
+		PKI_ERROR(PKI_ERR_GENERAL, "Can not initialize the cache mutex");
+		return NULL;
+	}
+
+	return ret;
+}
+
+/*! \brief Frees a PKI_OCSP_RESP_CACHE and all the cached responses */
+
+void PKI_OCSP_RESP_CACHE_free ( PKI_OCSP_RESP_CACHE *c ) {
+
+	if (!c) return;
+
+	PKI_MUTEX_acquire(&c->mutex);
+	__ocsp_cache_purge(c, 0);
+	PKI_MUTEX_release(&c->mutex);
+
+	PKI_MUTEX_destroy(&c->mutex);
+
+	PKI_Free(c->buckets);
+	PKI_Free(c);
+
+	return;
+}
+
+/*! \brief Stores the DER of a signed response for the passed CertID
+ *
+ * The response must carry only the status of the passed CertID and a
+ * nextUpdate, which is used as the expiration time of the entry. An
+ * existing response for the same CertID is replaced. Responses that
+ * carry a nonce are bound to a single request and are not cached.
+ */
+
+int PKI_OCSP_RESP_CACHE_put ( PKI_OCSP_RESP_CACHE *c, PKI_OCSP_CERTID *cid,
+				PKI_X509_OCSP_RESP *resp ) {
+
+	PKI_OCSP_RESP_CACHE_ENTRY **pp = NULL;
+	PKI_OCSP_RESP_CACHE_ENTRY *e = NULL;
+	PKI_OCSP_RESP *r = NULL;
+	PKI_MEM *der = NULL;
+
+	unsigned char key[PKI_OCSP_RESP_CACHE_KEY_SIZE];
+	size_t key_size = 0;
+	unsigned long hash = 0;
+
+	ASN1_GENERALIZEDTIME *nextUpdate = NULL;
+	OCSP_SINGLERESP *single = NULL;
+	int reason = 0;
+	int day = 0;
+	int sec = 0;
+	int idx = -1;
+
+	if (!c || !cid || !resp || !resp->value)
+		return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	r = resp->value;
+
+	// Only responses for the single CertID are cached
+	if (!r->bs || OCSP_resp_count(r->bs) != 1 ||
+			(idx = OCSP_resp_find(r->bs, cid, -1)) < 0 ||
+			(single = OCSP_resp_get0(r->bs, idx)) == NULL) {
+		PKI_DEBUG("Response does not carry (only) the given CertID");
+		return PKI_ERR;
+	}
+
+	// Responses with a nonce can not be replayed to other requests
+	if (OCSP_BASICRESP_get_ext_by_NID(r->bs, NID_id_pkix_OCSP_Nonce,
+								-1) >= 0) {
+		PKI_DEBUG("Response carries a nonce, not caching it");
+		return PKI_ERR;
+	}
+
+	// Responses without nextUpdate can not be cached
+	OCSP_single_get0_status(single, &reason, NULL, NULL, &nextUpdate);
+	if (!nextUpdate || !ASN1_TIME_diff(&day, &sec, NULL, nextUpdate) ||
+			day < 0 || sec < 0 || (day == 0 && sec == 0)) {
+		PKI_DEBUG("Response has no nextUpdate (or is expired)");
+		return PKI_ERR;
+	}
+
+	if ((key_size = __ocsp_cache_key(cid, key, sizeof(key), &hash)) == 0)
+		return PKI_ERROR(PKI_ERR_PARAM_TYPE, "Unsupported CertID");
+
+	if ((der = PKI_X509_put_mem(resp, PKI_DATA_FORMAT_ASN1,
+						NULL, NULL)) == NULL)
+		return PKI_ERROR(PKI_ERR_OCSP_RESP_ENCODE, NULL);
+
+	if ((e = PKI_Malloc(sizeof(PKI_OCSP_RESP_CACHE_ENTRY))) == NULL ||
+			(e->key = PKI_Malloc(key_size)) == NULL) {
+		if (e) PKI_Free(e);
+		PKI_MEM_free(der);
+		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+	}
+
+	// Takes ownership of the encoded data
+	e->der = *der;
+	der->data = NULL;
+	der->size = 0;
+	PKI_MEM_free(der);
+
+	memcpy(e->key, key, key_size);
+	e->key_size = key_size;
+	e->hash = hash;
+	e->expires = time(NULL) + (time_t) day * 86400 + sec;
+	e->refs = 1;
+
+	PKI_MUTEX_acquire(&c->mutex);
+
+	// Removes the previous response for the same CertID, if any
+	pp = &c->buckets[hash & (unsigned long)(c->size - 1)];
+	while (*pp != NULL) {
+		if ((*pp)->hash == hash && (*pp)->key_size == key_size &&
+				memcmp((*pp)->key, key, key_size) == 0) {
+			PKI_OCSP_RESP_CACHE_ENTRY *old = *pp;
+			*pp = old->next;
+			__ocsp_cache_entry_unref(old);
+			c->entries--;
+			break;
+		}
+		pp = &(*pp)->next;
+	}
+
+	// Makes room by dropping expired responses
+	if (c->entries >= c->max_entries) __ocsp_cache_purge(c, time(NULL));
+
+	if (c->entries >= c->max_entries) {
+		PKI_MUTEX_release(&c->mutex);
+		__ocsp_cache_entry_unref(e);
+		PKI_DEBUG("OCSP response cache is full (%d entries)", c->entries);
+		return PKI_ERR;
+	}
+
+	pp = &c->buckets[hash & (unsigned long)(c->size - 1)];
+	e->next = *pp;
+	*pp = e;
+	c->entries++;
+
+	PKI_MUTEX_release(&c->mutex);
+
+	return PKI_OK;
+}
+
+/*! \brief Returns the cached DER response for the passed CertID
+ *
+ * The returned data is shared with the cache (no copy is made) and it
+ * must be returned via PKI_OCSP_RESP_CACHE_release() when done. Returns
+ * NULL if no valid response is cached.
+ */
+
+const PKI_MEM * PKI_OCSP_RESP_CACHE_get_cid ( PKI_OCSP_RESP_CACHE *c,
+				PKI_OCSP_CERTID *cid ) {
+
+	PKI_OCSP_RESP_CACHE_ENTRY **pp = NULL;
+	PKI_OCSP_RESP_CACHE_ENTRY *e = NULL;
+
+	unsigned char key[PKI_OCSP_RESP_CACHE_KEY_SIZE];
+	size_t key_size = 0;
+	unsigned long hash = 0;
+
+	if (!c || !cid) return NULL;
+
+	if ((key_size = __ocsp_cache_key(cid, key, sizeof(key), &hash)) == 0)
+		return NULL;
+
+	PKI_MUTEX_acquire(&c->mutex);
+
+	pp = &c->buckets[hash & (unsigned long)(c->size - 1)];
+	while ((e = *pp) != NULL) {
+		if (e->hash == hash && e->key_size == key_size &&
+				memcmp(e->key, key, key_size) == 0) break;
+		pp = &e->next;
+	}
+
+	// Expired responses are evicted on lookup
+	if (e && e->expires <= time(NULL)) {
+		*pp = e->next;
+		__ocsp_cache_entry_unref(e);
+		c->entries--;
+		e = NULL;
+	}
+
+	if (e) {
+		e->refs++;
+		c->hits++;
+	} else {
+		c->misses++;
+	}
+
+	PKI_MUTEX_release(&c->mutex);
+
+	return e ? &e->der : NULL;
+}
+
+/*! \brief Returns the cached DER response for an OCSP request
+ *
+ * Only requests for a single certificate and without a nonce can be
+ * answered from the cache. See PKI_OCSP_RESP_CACHE_get_cid().
+ */
+
+const PKI_MEM * PKI_OCSP_RESP_CACHE_get ( PKI_OCSP_RESP_CACHE *c,
+				PKI_X509_OCSP_REQ *req ) {
+
+	if (!c || !req || !req->value) return NULL;
+
+	// Responses to requests with a nonce must be freshly signed
+	if (PKI_X509_OCSP_REQ_elements(req) != 1 ||
+			PKI_X509_OCSP_REQ_has_nonce(req)) {
+		return NULL;
+	}
+
+	return PKI_OCSP_RESP_CACHE_get_cid(c, PKI_X509_OCSP_REQ_get_cid(req, 0));
+}
+
+/*! \brief Releases a response returned by PKI_OCSP_RESP_CACHE_get() */
+
+void PKI_OCSP_RESP_CACHE_release ( PKI_OCSP_RESP_CACHE *c,
+				const PKI_MEM *der ) {
+
+	if (!c || !der) return;
+
+	PKI_MUTEX_acquire(&c->mutex);
+	__ocsp_cache_entry_unref((PKI_OCSP_RESP_CACHE_ENTRY *) der);
+	PKI_MUTEX_release(&c->mutex);
+
+	return;
+}
+
+/*! \brief Removes the expired responses from the cache, returns the
+ *         number of removed responses */
+
+int PKI_OCSP_RESP_CACHE_expire ( PKI_OCSP_RESP_CACHE *c ) {
+
+	int ret = 0;
+
+	if (!c) return 0;
+
+	PKI_MUTEX_acquire(&c->mutex);
+	ret = __ocsp_cache_purge(c, time(NULL));
+	PKI_MUTEX_release(&c->mutex);
+
+	return ret;
+}
+
+/*! \brief Removes all the responses from the cache (e.g., when a new
+ *         CRL is loaded), returns the number of removed responses */
+
+int PKI_OCSP_RESP_CACHE_flush ( PKI_OCSP_RESP_CACHE *c ) {
+
+	int ret = 0;
+
+	if (!c) return 0;
+
+	PKI_MUTEX_acquire(&c->mutex);
+	ret = __ocsp_cache_purge(c, 0);
+	PKI_MUTEX_release(&c->mutex);
+
+	return ret;
+}
+
+/*! \brief Returns the cache hits, misses, and number of entries */
+
+void PKI_OCSP_RESP_CACHE_stats ( PKI_OCSP_RESP_CACHE *c,
+		unsigned long *hits, unsigned long *misses, int *entries ) {
+
+	if (!c) return;
+
+	PKI_MUTEX_acquire(&c->mutex);
+	if (hits) *hits = c->hits;
+	if (misses) *misses = c->misses;
+	if (entries) *entries = c->entries;
+	PKI_MUTEX_release(&c->mutex);
+
+	return;
+}
+
 /* PEM <-> INTERNAL Macros --- fix for errors in OpenSSL */
 PKI_OCSP_RESP *PEM_read_bio_PKI_OCSP_RESP( PKI_IO *bp, void *a, 
 						void *b, void *c ) {
@@ -39,6 +39,241 @@ PKI_X509_CERT *PKI_X509_CERT_dup(const PKI_X509_CERT *x) {
   return PKI_X509_dup ( x );
 }
 
+/* Returns the sum of the periods found under path (e.g., validity) */
+static int64_t __profile_get_period(const PKI_X509_PROFILE *conf,
+                                    const char             *path) {
+
+  static const struct {
+    const char *name;
+    int64_t secs;
+  } units[] = {
+    { "years",   3600 * 24 * 365 },
+    { "days",    3600 * 24 },
+    { "hours",   3600 },
+    { "minutes", 60 },
+    { "seconds", 1 }
+  };
+
+  char buf[128];
+  char *tmp_s = NULL;
+  int64_t ret = 0;
+  size_t i = 0;
+
+  for (i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+
+    snprintf(buf, sizeof(buf), "%s/%s", path, units[i].name);
+
+    if ((tmp_s = PKI_CONFIG_get_value(conf, buf)) != NULL) {
+      ret += (int64_t) atoll(tmp_s) * units[i].secs;
+      PKI_Free(tmp_s);
+    }
+  }
+
+  return ret;
+}
+
+/* Returns 1 if the value of the extension depends on the issued cert */
+static int __profile_ext_is_dynamic(int nid, const char *value) {
+
+  switch (nid) {
+    case NID_subject_key_identifier:
+    case NID_authority_key_identifier:
+    case NID_issuer_alt_name:
+      return 1;
+
+    default:
+      break;
+  }
+
+  // Values copied (or moved) from the subject
+  if (strstr(value, "copy") || strstr(value, "move")) return 1;
+
+  return 0;
+}
+
+/*! \brief Compiles a profile for certificate issuance
+ *
+ * The returned template holds the pre-parsed values of the profile (subject,
+ * validity, signing algorithm and extensions) so that it can be used to issue
+ * certificates (see PKI_X509_CERT_new_template()) without evaluating the XML
+ * again. Extensions that do not depend on the issued certificate are
+ * encoded once. The template is immutable, it can be shared across threads
+ * by taking a reference (see PKI_X509_PROFILE_TEMPLATE_up_ref()).
+ */
+
+PKI_X509_PROFILE_TEMPLATE * PKI_X509_PROFILE_TEMPLATE_new(
+                                   const PKI_X509_PROFILE * conf,
+                                   const PKI_CONFIG       * oids) {
+
+  PKI_X509_PROFILE_TEMPLATE *ret = NULL;
+  const PKI_CONFIG_ELEMENT *exts = NULL;
+  const PKI_CONFIG_ELEMENT *curr = NULL;
+  char *tmp_s = NULL;
+
+  if (!conf) {
+    PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+    return NULL;
+  }
+
+  if ((ret = PKI_Malloc(sizeof(PKI_X509_PROFILE_TEMPLATE))) == NULL) {
+    PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+    return NULL;
+  }
+
+  ret->references = 1;
+  ret->profile = conf;
+  ret->oids = oids;
+  ret->profile_stamp = PKI_CONFIG_get_stamp(conf);
+  ret->oids_stamp = PKI_CONFIG_get_stamp(oids);
+
+  ret->version = 2;
+  if ((tmp_s = PKI_CONFIG_get_value(conf, "/profile/version")) != NULL) {
+    ret->version = atoi(tmp_s) - 1;
+    if (ret->version < 0) ret->version = 0;
+    PKI_Free(tmp_s);
+  }
+
+  if ((tmp_s = PKI_CONFIG_get_value(conf, "/profile/subject/dn")) != NULL) {
+    if ((ret->subject = PKI_X509_NAME_new(tmp_s)) == NULL)
+      PKI_DEBUG("Can not parse the profile's subject (%s)", tmp_s);
+    PKI_Free(tmp_s);
+  }
+
+  ret->notBefore = __profile_get_period(conf, "/profile/notBefore");
+  ret->validity = (uint64_t) __profile_get_period(conf, "/profile/validity");
+
+  if ((tmp_s = PKI_CONFIG_get_value(conf,
+                        "/profile/keyParams/algorithm")) != NULL) {
+
+    if ((ret->algor = PKI_X509_ALGOR_VALUE_get_by_name(tmp_s)) != NULL) {
+      if ((ret->digest = PKI_X509_ALGOR_VALUE_get_digest(ret->algor)) == NULL)
+        PKI_DEBUG("Can not parse digest algorithm from %s", tmp_s);
+    } else {
+      PKI_DEBUG("Can not parse key algorithm from %s", tmp_s);
+    }
+
+    PKI_Free(tmp_s);
+  }
+
+  ret->ec_form = -1;
+  ret->ec_asn1flags = -1;
+
+#ifdef ENABLE_ECDSA
+  {
+    PKI_KEYPARAMS *kParams = NULL;
+
+    if ((kParams = PKI_KEYPARAMS_new(PKI_SCHEME_ECDSA, conf)) != NULL) {
+      if ((int) kParams->ec.form > 0) ret->ec_form = (int) kParams->ec.form;
+      ret->ec_asn1flags = kParams->ec.asn1flags;
+      PKI_KEYPARAMS_free(kParams);
+    }
+  }
+#endif
+
+  if ((exts = PKI_CONFIG_get_element(conf, "/profile/extensions", -1)) == NULL)
+    return ret;
+
+  for (curr = exts->children; curr; curr = curr->next)
+    if (curr->type == XML_ELEMENT_NODE) ret->exts_num++;
+
+  if (ret->exts_num <= 0) return ret;
+
+  if ((ret->exts = PKI_Malloc(sizeof(PKI_X509_PROFILE_TEMPLATE_EXT) *
+                              (size_t) ret->exts_num)) == NULL) {
+    PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+    ret->exts_num = 0;
+    goto err;
+  }
+
+  ret->exts_num = 0;
+  for (curr = exts->children; curr; curr = curr->next) {
+
+    PKI_X509_PROFILE_TEMPLATE_EXT *ext = NULL;
+
+    if (curr->type != XML_ELEMENT_NODE) continue;
+
+    ext = &ret->exts[ret->exts_num];
+
+    if ((ext->value = PKI_X509_EXTENSION_get_profile_conf(conf, oids,
+                                          curr, &ext->name)) == NULL) {
+      PKI_ERROR(PKI_ERR_X509_CERT_CREATE_EXT,
+        "Can not create EXTENSION Num. %d", ret->exts_num);
+      goto err;
+    }
+
+    ret->exts_num++;
+
+    ext->nid = OBJ_sn2nid(ext->name);
+
+    if (__profile_ext_is_dynamic(ext->nid, ext->value)) continue;
+
+    // Static value, let's encode it once
+    if ((ext->ext = PKI_X509_EXTENSION_VALUE_new_conf(ext->nid, ext->name,
+                                    ext->value, NULL, NULL, NULL)) == NULL) {
+      // Left for issuance time (errors are reported there)
+      PKI_DEBUG("Extension %s can not be pre-encoded", ext->name);
+      ERR_clear_error();
+    }
+  }
+
+  return ret;
+
+err:
+
+  PKI_X509_PROFILE_TEMPLATE_free(ret);
+  return NULL;
+}
+
+/*! \brief Takes a new reference to the template */
+
+int PKI_X509_PROFILE_TEMPLATE_up_ref(PKI_X509_PROFILE_TEMPLATE *tmpl) {
+
+  if (!tmpl) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+  __atomic_add_fetch(&tmpl->references, 1, __ATOMIC_RELAXED);
+
+  return PKI_OK;
+}
+
+/*! \brief Releases a reference to the template, the memory associated
+ *         with the compiled profile is freed when the last one is released */
+
+void PKI_X509_PROFILE_TEMPLATE_free(PKI_X509_PROFILE_TEMPLATE *tmpl) {
+
+  int i = 0;
+
+  if (!tmpl) return;
+
+  if (__atomic_sub_fetch(&tmpl->references, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+  for (i = 0; i < tmpl->exts_num; i++) {
+    if (tmpl->exts[i].name) PKI_Free(tmpl->exts[i].name);
+    if (tmpl->exts[i].value) PKI_Free(tmpl->exts[i].value);
+    if (tmpl->exts[i].ext) X509_EXTENSION_free(tmpl->exts[i].ext);
+  }
+
+  if (tmpl->exts) PKI_Free(tmpl->exts);
+  if (tmpl->subject) PKI_X509_NAME_free(tmpl->subject);
+  if (tmpl->algor) PKI_X509_ALGOR_VALUE_free(tmpl->algor);
+
+  PKI_Free(tmpl);
+}
+
+/*! \brief Returns PKI_OK if the template was compiled from the current
+ *         version of the profile (and OIDs), PKI_ERR otherwise */
+
+int PKI_X509_PROFILE_TEMPLATE_is_current(const PKI_X509_PROFILE_TEMPLATE *tmpl,
+                                         const PKI_X509_PROFILE          *conf,
+                                         const PKI_CONFIG                *oids) {
+
+  if (!tmpl || tmpl->profile != conf || tmpl->oids != oids) return PKI_ERR;
+
+  if (tmpl->profile_stamp != PKI_CONFIG_get_stamp(conf) ||
+      tmpl->oids_stamp != PKI_CONFIG_get_stamp(oids)) return PKI_ERR;
+
+  return PKI_OK;
+}
+
 /*! \brief Generates a new certificate */
 
 PKI_X509_CERT * PKI_X509_CERT_new (const PKI_X509_CERT        * ca_cert, 
@@ -51,25 +286,51 @@ PKI_X509_CERT * PKI_X509_CERT_new (const PKI_X509_CERT        * ca_cert,
                                    const PKI_X509_ALGOR_VALUE * algor,
                                    const PKI_CONFIG           * oids,
                                    HSM                        * hsm ) {
+
+  PKI_X509_PROFILE_TEMPLATE *tmpl = NULL;
+  PKI_X509_CERT *ret = NULL;
+
+  // One-shot compilation of the profile, when issuing many certs with
+  // the same profile, use PKI_X509_CERT_new_template() instead
+  if (conf && (tmpl = PKI_X509_PROFILE_TEMPLATE_new(conf, oids)) == NULL)
+    return NULL;
+
+  ret = PKI_X509_CERT_new_template(ca_cert, kPair, req, subj_s, serial_s,
+                                   validity, tmpl, algor, hsm);
+
+  if (tmpl) PKI_X509_PROFILE_TEMPLATE_free(tmpl);
+
+  return ret;
+}
+
+/*! \brief Generates a new certificate from a compiled profile (if any) */
+
+PKI_X509_CERT * PKI_X509_CERT_new_template (
+                                   const PKI_X509_CERT             * ca_cert,
+                                   const PKI_X509_KEYPAIR          * kPair,
+                                   const PKI_X509_REQ              * req,
+                                   const char                      * subj_s,
+                                   const char                      * serial_s,
+                                   uint64_t                          validity,
+                                   const PKI_X509_PROFILE_TEMPLATE * tmpl,
+                                   const PKI_X509_ALGOR_VALUE      * algor,
+                                   HSM                             * hsm ) {
   PKI_X509_CERT *ret = NULL;
   PKI_X509_CERT_VALUE *val = NULL;
   PKI_X509_NAME *subj = NULL;
   PKI_X509_NAME *issuer = NULL;
   PKI_DIGEST_ALG *digest = NULL;
   PKI_X509_KEYPAIR_VALUE *signingKey = NULL;
-  PKI_TOKEN *tk = NULL;
 
   PKI_X509_KEYPAIR_VALUE  *certPubKeyVal = NULL;
 
-  int rv = 0;
   int ver = 2;
+  int i = 0;
 
   int64_t notBeforeVal = 0;
 
   ASN1_INTEGER *serial = NULL;
 
-  char *ver_s = NULL;
-
   /* Check if the REQUIRED PKEY has been passed */
   if (!kPair || !kPair->value) {
     PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
@@ -83,21 +344,10 @@ PKI_X509_CERT * PKI_X509_CERT_new (const PKI_X509_CERT        * ca_cert,
   {
     subj = PKI_X509_NAME_new ( subj_s );
   }
-  else if (conf || req)
+  else if (tmpl || req)
   {
-    char *tmp_s = NULL;
-
     // Let's use the configuration option first
-    if (conf) {
-
-      // Get the value of the DN, if present
-      if ((tmp_s = PKI_CONFIG_get_value( conf, 
-                                 "/profile/subject/dn")) != NULL ) {
-        // Builds from the DN in the config  
-        subj = PKI_X509_NAME_new(tmp_s);
-        PKI_Free ( tmp_s );
-      }
-    }
+    if (tmpl && tmpl->subject) subj = PKI_X509_NAME_dup(tmpl->subject);
 
     // If we still do not have a name, let's check
     // the request for one
@@ -138,8 +388,6 @@ PKI_X509_CERT * PKI_X509_CERT_new (const PKI_X509_CERT        * ca_cert,
     const PKI_X509_NAME *ca_subject = NULL;
 
     /* Let's get the ca_cert subject and dup that data */
-    // ca_subject = (PKI_X509_NAME *) 
-    //     X509_get_subject_name( (X509 *) ca_cert );
     ca_subject = PKI_X509_CERT_get_data( ca_cert, 
         PKI_X509_DATA_SUBJECT );
 
@@ -167,19 +415,12 @@ PKI_X509_CERT * PKI_X509_CERT_new (const PKI_X509_CERT        * ca_cert,
   /* Alloc memory structure for the Certificate */
   if((ret->value = ret->cb->create()) == NULL ) {
     PKI_ERROR(PKI_ERR_OBJECT_CREATE, NULL);
-    return (NULL);
+    goto err;
   }
 
   val = ret->value;
 
-  if(( ver_s = PKI_CONFIG_get_value( conf, "/profile/version")) != NULL ) {
-    ver = atoi( ver_s ) - 1;
-    if ( ver < 0 ) 
-      ver = 0;
-    PKI_Free ( ver_s );
-  } else {
-    ver = 2;
-  };
+  if (tmpl) ver = tmpl->version;
 
   if (!X509_set_version(val,ver)) {
     PKI_ERROR(PKI_ERR_X509_CERT_CREATE_VERSION, NULL);
@@ -210,7 +451,6 @@ PKI_X509_CERT * PKI_X509_CERT_new (const PKI_X509_CERT        * ca_cert,
   }
 
   /* Set the issuer Name */
-  // rv = X509_set_issuer_name((X509 *) ret, (X509_NAME *) issuer);
   if(!X509_set_issuer_name( val, (X509_NAME *) issuer)) {
     PKI_ERROR(PKI_ERR_X509_CERT_CREATE_ISSUER, NULL);
     goto err;
@@ -222,101 +462,12 @@ PKI_X509_CERT * PKI_X509_CERT_new (const PKI_X509_CERT        * ca_cert,
     goto err;
   }
 
-  /* Set the start date (notBefore) */
-  if (conf)
-  {
-    int years = 0;
-    int days  = 0;
-    int hours = 0;
-    int mins  = 0;
-    int secs  = 0;
-
-    char *tmp_s = NULL;
-
-    if(( tmp_s = PKI_CONFIG_get_value( conf, 
-        "/profile/notBefore/years")) != NULL ) {
-      years = atoi( tmp_s );
-      PKI_Free ( tmp_s );
-    };
-
-    if(( tmp_s = PKI_CONFIG_get_value( conf, 
-        "/profile/notBefore/days")) != NULL ) {
-      days = atoi( tmp_s );
-      PKI_Free ( tmp_s );
-    };
-
-    if(( tmp_s = PKI_CONFIG_get_value( conf, 
-        "/profile/notBefore/hours")) != NULL ) {
-      hours = atoi( tmp_s );
-      PKI_Free ( tmp_s );
-    };
-
-    if(( tmp_s = PKI_CONFIG_get_value( conf, 
-        "/profile/notBefore/minutes")) != NULL ) {
-      mins = atoi( tmp_s );
-      PKI_Free ( tmp_s );
-    };
-
-    if(( tmp_s = PKI_CONFIG_get_value( conf, 
-        "/profile/notBefore/seconds")) != NULL ) {
-      secs = atoi( tmp_s );
-      PKI_Free ( tmp_s );
-    };
-
-    notBeforeVal =   secs +
-            ( mins * 60 ) + 
-            ( hours * 3600 ) + 
-            ( days   * 3600 * 24 ) + 
-            ( years * 3600 * 24 * 365 );
-  };
-
-  /* Set the validity (notAfter) */
-  if( conf && validity == 0 )
+  /* Set the start date (notBefore) and the validity (notAfter) */
+  if (tmpl)
   {
-    long long years = 0;
-    long long days  = 0;
-    long long hours = 0;
-    long long mins  = 0;
-    long long secs  = 0;
-
-    char *tmp_s = NULL;
-
-    if(( tmp_s = PKI_CONFIG_get_value( conf, 
-        "/profile/validity/years")) != NULL ) {
-      years = atoll( tmp_s );
-      PKI_Free ( tmp_s );
-    };
-
-    if(( tmp_s = PKI_CONFIG_get_value( conf, 
-        "/profile/validity/days")) != NULL ) {
-      days = atoll( tmp_s );
-      PKI_Free ( tmp_s );
-    };
-
-    if(( tmp_s = PKI_CONFIG_get_value( conf, 
-        "/profile/validity/hours")) != NULL ) {
-      hours = atoll( tmp_s );
-      PKI_Free ( tmp_s );
-    };
-
-    if(( tmp_s = PKI_CONFIG_get_value( conf, 
-        "/profile/validity/minutes")) != NULL ) {
-      mins = atoll( tmp_s );
-      PKI_Free ( tmp_s );
-    };
-
-    if(( tmp_s = PKI_CONFIG_get_value( conf, 
-        "/profile/validity/minutes")) != NULL ) {
-      secs = atoll( tmp_s );
-      PKI_Free ( tmp_s );
-    };
-
-    validity =   (unsigned long long) secs +
-          (unsigned long long) ( mins   * 60 ) + 
-          (unsigned long long) ( hours * 3600 ) + 
-          (unsigned long long) ( days   * 3600 * 24 ) + 
-          (unsigned long long) ( years * 3600 * 24 * 365 );
-  };
+    notBeforeVal = tmpl->notBefore;
+    if (validity == 0) validity = tmpl->validity;
+  }
 
   if (validity <= 0) validity = 30 * 3600 * 24;
 
@@ -357,87 +508,31 @@ PKI_X509_CERT * PKI_X509_CERT_new (const PKI_X509_CERT        * ca_cert,
     certPubKeyVal = signingKey;
   }
 
-  if (!ca_cert && conf)
+  if (!ca_cert && tmpl && tmpl->algor)
   {
-    char *tmp_s = NULL;
-
-    if(( tmp_s = PKI_X509_PROFILE_get_value( conf, 
-        "/profile/keyParams/algorithm")) != NULL )
-    {
-      PKI_X509_ALGOR_VALUE *myAlg = NULL;
-      PKI_DIGEST_ALG *dgst = NULL;
-
-      if((myAlg = PKI_X509_ALGOR_VALUE_get_by_name( tmp_s ))
-                                                      != NULL) {
-
-        if(!algor) algor = myAlg;
-
-        if((dgst = PKI_X509_ALGOR_VALUE_get_digest( myAlg )) != NULL ) {
-
-          PKI_DEBUG("Got Signing Algorithm: %s, %s",
-                    PKI_DIGEST_ALG_get_parsed(dgst), 
-                    PKI_X509_ALGOR_VALUE_get_parsed(myAlg));
-          digest = dgst;
-
-        } else {
-          PKI_DEBUG("Can not parse digest algorithm from %s", tmp_s);
-        }
-      } else {
-        PKI_DEBUG("Can not parse key algorithm from %s", tmp_s);
-      }
-
-      PKI_Free ( tmp_s );
-    }
+    if (!algor) algor = tmpl->algor;
+    if (tmpl->digest) digest = (PKI_DIGEST_ALG *) tmpl->digest;
   }
 
-  if (conf) {
-
-    PKI_KEYPARAMS *kParams = NULL;
-    PKI_SCHEME_ID scheme;
-
-    scheme = PKI_X509_ALGOR_VALUE_get_scheme( algor );
-
-    kParams = PKI_KEYPARAMS_new(scheme, conf);
-    if (kParams)
-    {
-      /* Sets the point compression */
-      switch ( kParams->scheme )
-      {
 #ifdef ENABLE_ECDSA
-        case PKI_SCHEME_ECDSA:
-            if ( (int) kParams->ec.form > 0 )
-            {
-# if OPENSSL_VERSION_NUMBER < 0x1010000fL
-              EC_KEY_set_conv_form(certPubKeyVal->pkey.ec, 
-              			   (point_conversion_form_t) kParams->ec.form);
-# else
-              EC_KEY_set_conv_form(EVP_PKEY_get0_EC_KEY(certPubKeyVal), 
-              (point_conversion_form_t) kParams->ec.form);
-# endif
-            }
-          if ( kParams->ec.asn1flags > -1 )
-          {
+  /* Sets the point compression and the curve encoding */
+  if (tmpl && PKI_X509_ALGOR_VALUE_get_scheme(algor ? algor : tmpl->algor)
+                                                      == PKI_SCHEME_ECDSA)
+  {
+    EC_KEY *ec = NULL;
+
 # if OPENSSL_VERSION_NUMBER < 0x1010000fL
-            EC_KEY_set_asn1_flag(certPubKeyVal->pkey.ec,
-              kParams->ec.asn1flags );
+    ec = certPubKeyVal->pkey.ec;
 # else
-            EC_KEY_set_asn1_flag(EVP_PKEY_get0_EC_KEY(certPubKeyVal),
-              kParams->ec.asn1flags );
+    ec = (EC_KEY *) EVP_PKEY_get0_EC_KEY(certPubKeyVal);
 # endif
-          }
-          break;
-#endif
-        case PKI_SCHEME_RSA:
-        case PKI_SCHEME_DSA:
-          break;
-
-        default:
-          // Nothing to do
-          PKI_ERROR(PKI_ERR_GENERAL, "Signing Scheme Uknown %d!", kParams->scheme);
-          break;
-      }
-    }
+    if (ec && tmpl->ec_form > 0)
+      EC_KEY_set_conv_form(ec, (point_conversion_form_t) tmpl->ec_form);
+
+    if (ec && tmpl->ec_asn1flags > -1)
+      EC_KEY_set_asn1_flag(ec, tmpl->ec_asn1flags);
   }
+#endif
 
   if (!X509_set_pubkey(val, certPubKeyVal))
   {
@@ -445,46 +540,45 @@ PKI_X509_CERT * PKI_X509_CERT_new (const PKI_X509_CERT        * ca_cert,
     goto err;
   }
 
-  if (conf)
+  for (i = 0; tmpl && i < tmpl->exts_num; i++)
   {
-    if((tk = PKI_TOKEN_new_null()) == NULL )
+    const PKI_X509_PROFILE_TEMPLATE_EXT *t_ext = &tmpl->exts[i];
+    PKI_X509_EXTENSION_VALUE *ext = NULL;
+    int rv = 0;
+
+    // Pre-encoded extensions are just copied into the certificate
+    if (t_ext->ext)
     {
-      PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
-      goto err;
+      if (!X509_add_ext(val, t_ext->ext, -1))
+      {
+        PKI_ERROR(PKI_ERR_X509_CERT_CREATE_EXT,
+          "Can not add EXTENSION Num. %d", i);
+        goto err;
+      }
+      continue;
     }
 
-    PKI_TOKEN_set_cert(tk, ret);
-
-    if (ca_cert) {
-      PKI_TOKEN_set_cacert(tk, (PKI_X509_CERT *)ca_cert);
-    } else {
-      PKI_TOKEN_set_cacert(tk, (PKI_X509_CERT *)ret);
+    if ((ext = PKI_X509_EXTENSION_VALUE_new_conf(t_ext->nid, t_ext->name,
+          t_ext->value, ca_cert ? PKI_X509_get_value(ca_cert) : val, val,
+          req ? PKI_X509_get_value(req) : NULL)) == NULL)
+    {
+      PKI_DEBUG("Can not generate the extension value from (%s=%s)",
+        t_ext->name, t_ext->value);
+      PKI_ERROR(PKI_ERR_X509_CERT_CREATE_EXT,
+        "Can not create EXTENSION Num. %d [%s]", i,
+        ERR_error_string(ERR_get_error(), NULL));
+      goto err;
     }
 
-    if (req) PKI_TOKEN_set_req(tk, (PKI_X509_REQ *)req );
-    if (kPair) PKI_TOKEN_set_keypair ( tk, (PKI_X509_KEYPAIR *)kPair );
+    rv = X509_add_ext(val, ext, -1);
+    X509_EXTENSION_free(ext);
 
-    rv = PKI_X509_EXTENSIONS_cert_add_profile(conf, oids, ret, tk);
-    if (rv != PKI_OK)
+    if (!rv)
     {
-      PKI_DEBUG( "ERROR, can not set extensions!");
-
-      tk->cert = NULL;
-      tk->cacert = NULL;
-      tk->req = NULL;
-      tk->keypair = NULL;
-
-      PKI_TOKEN_free ( tk );
-
+      PKI_ERROR(PKI_ERR_X509_CERT_CREATE_EXT,
+        "Can not add EXTENSION Num. %d", i);
       goto err;
     }
-
-    // Cleanup for the token (used only to add extensions)
-    tk->cert = NULL;
-    tk->cacert = NULL;
-    tk->req = NULL;
-    tk->keypair = NULL;
-    PKI_TOKEN_free ( tk );
   }
 
   if (!digest)
@@ -528,17 +622,21 @@ PKI_X509_CERT * PKI_X509_CERT_new (const PKI_X509_CERT        * ca_cert,
   // No Digest Here ? We failed...
   if (digest == NULL) {
     PKI_ERROR(PKI_ERR_DIGEST_VALUE_NULL, NULL);
-    return NULL;
+    goto err;
   }
 
   // Sign the data
   if (PKI_X509_sign(ret, digest, kPair) == PKI_ERR) {
     PKI_ERROR(PKI_ERR_SIGNATURE_CREATE, "Can not sign certificate [%s]",
       ERR_error_string(ERR_get_error(), NULL ));
-    PKI_X509_CERT_free ( ret );
-    return NULL;
+    goto err;
   }
 
+  // The names and the serial have been copied into the certificate
+  PKI_X509_NAME_free(subj);
+  PKI_X509_NAME_free(issuer);
+  if (serial) ASN1_INTEGER_free(serial);
+
   // All Done
   return ret;
 
@@ -547,6 +645,7 @@ err:
   if (ret) PKI_X509_CERT_free(ret);
   if (subj) PKI_X509_NAME_free(subj);
   if (issuer) PKI_X509_NAME_free(issuer);
+  if (serial) ASN1_INTEGER_free(serial);
 
   return NULL;
 }
@@ -1190,6 +1289,30 @@ PKI_DIGEST *PKI_X509_CERT_fingerprint(const PKI_X509_CERT *x,
 
 }
 
+/*! \brief Calculates the fingerprint over a certificate into the passed
+ *         buffer, returns the size of the fingerprint (0 on error)
+ */
+
+int PKI_X509_CERT_fingerprint_buf(const PKI_X509_CERT *x,
+				  const PKI_DIGEST_ALG *alg,
+				  unsigned char *buf,
+				  size_t size ) {
+
+  unsigned int ret_size = 0;
+
+  if ( !x || !x->value || x->type != PKI_DATATYPE_X509_CERT || !buf )
+    return 0;
+
+  if ( !alg ) alg = PKI_DIGEST_ALG_DEFAULT;
+
+  if ( EVP_MD_size(alg) <= 0 || size < (size_t) EVP_MD_size(alg) ) return 0;
+
+  if (!X509_digest((PKI_X509_CERT_VALUE *) x->value, alg, buf, &ret_size))
+    return 0;
+
+  return (int) ret_size;
+}
+
 /*! \brief Calculates the fingerprint over a certificate by using the
  *         passed digest string (char *) identifier
  */
@@ -1225,6 +1348,31 @@ PKI_DIGEST *PKI_X509_CERT_key_hash(const PKI_X509_CERT *x,
   return keyHash;
 }
 
+/*! \brief Calculates the Hash of the Public Key of the certificate into
+ *         the passed buffer, returns the size of the hash (0 on error)
+ *
+ * The hash is calculated over the subjectPublicKey BIT STRING (as for the
+ * issuerKeyHash of an OCSP CertID) without allocating memory.
+ */
+
+int PKI_X509_CERT_key_hash_buf(const PKI_X509_CERT *x,
+			       const PKI_DIGEST_ALG *alg,
+			       unsigned char *buf,
+			       size_t size ) {
+
+  ASN1_BIT_STRING *key = NULL;
+
+  if ( !x || !x->value || !buf ) return 0;
+
+  if ( !alg ) alg = PKI_DIGEST_ALG_DEFAULT;
+
+  if ((key = X509_get0_pubkey_bitstr((PKI_X509_CERT_VALUE *) x->value)) == NULL
+		  || !key->data)
+    return 0;
+
+  return PKI_DIGEST_calculate(alg, key->data, (size_t) key->length, buf, size);
+}
+
 /*! \brief Calculates the Hash of the Public Key of the certificate by using
  *         the hash algorithm passed as a (char *) */
 
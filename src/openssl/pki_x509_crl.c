@@ -54,35 +54,26 @@ void PKI_X509_CRL_free_void( void *x ) {
   return;
 }
 
-/*! \brief Generate a new CRL from a stack of revoked entries
- *
- * Generates a new signed CRL from a stack of revoked entries. A profile is
- * used to set the right extensions in the CRL. To generate a new revoked
- * entry the PKI_X509_CRL_ENTRY_new() function has to be used.
+/*
+ * Generates the unsigned CRL skeleton (crlNumber, lastUpdate, nextUpdate
+ * and issuer), the revoked entries are added by the caller. When baseNumber
+ * is provided, the CRL is a delta CRL for the base CRL with that number.
  */
 
-PKI_X509_CRL *PKI_X509_CRL_new(const PKI_X509_KEYPAIR *k,
+static PKI_X509_CRL * __crl_new_unsigned(const PKI_X509_KEYPAIR *k,
              const PKI_X509_CERT *cert, 
              const char * crlNumber_s,
              unsigned long validity,
-             const PKI_X509_CRL_ENTRY_STACK *sk, 
              const PKI_X509_PROFILE *profile,
-             const PKI_CONFIG *oids,
-             HSM *hsm) {
+             const ASN1_INTEGER *baseNumber) {
 
   PKI_X509_CRL *ret = NULL;
   PKI_X509_CRL_VALUE *val = NULL;
   ASN1_INTEGER *crlNumber = NULL;
   ASN1_TIME *time = NULL;
-  int rv = PKI_OK;
-  int i = 0;
 
   char * tmp_s = NULL;
 
-  PKI_X509_CRL_ENTRY *entry = NULL;
-
-  PKI_DIGEST_ALG *dgst = NULL;
-
   long long lastUpdateVal  = 0;
   long long nextUpdateVal  = 0;
 
@@ -105,6 +96,9 @@ PKI_X509_CRL *PKI_X509_CRL_new(const PKI_X509_KEYPAIR *k,
 
   val = ret->value;
 
+  // CRLs with extensions are v2 CRLs
+  X509_CRL_set_version(val, 1);
+
   if ( !crlNumber_s && profile ) {
 
     if(( tmp_s = PKI_CONFIG_get_value( profile, 
@@ -114,11 +108,31 @@ PKI_X509_CRL *PKI_X509_CRL_new(const PKI_X509_KEYPAIR *k,
     };
   } else if ( crlNumber_s ) {
     crlNumber = PKI_INTEGER_new_char( crlNumber_s );
-
-    // Let's add the CRLSerial extension
-    X509_CRL_add1_ext_i2d(val, NID_crl_number, crlNumber, 0, 0);
   };
 
+  // Let's add the CRLSerial extension
+  if ( crlNumber && !X509_CRL_add1_ext_i2d(val, NID_crl_number, 
+                                           crlNumber, 0, 0)) {
+    PKI_ERROR(PKI_ERR_X509_CRL_EXTENSION, "Can not add the CRL number");
+    goto err;
+  }
+
+  // Delta CRLs carry the (critical) deltaCRLIndicator extension and
+  // must also carry a CRL number (RFC 5280, Sec. 5.2.4)
+  if ( baseNumber ) {
+
+    if ( !crlNumber ) {
+      PKI_ERROR(PKI_ERR_X509_CRL_EXTENSION, "Delta CRLs require a CRL number");
+      goto err;
+    }
+
+    if ( !X509_CRL_add1_ext_i2d(val, NID_delta_crl, 
+                                (ASN1_INTEGER *) baseNumber, 1, 0)) {
+      PKI_ERROR(PKI_ERR_X509_CRL_EXTENSION, "Can not add the deltaCRLIndicator");
+      goto err;
+    }
+  }
+
   /* Set the start date (notBefore) */
   if (profile)
   {
@@ -256,77 +270,114 @@ PKI_X509_CRL *PKI_X509_CRL_new(const PKI_X509_KEYPAIR *k,
     goto err;
   }
 
-  if ( sk ) {
-    /* Adds the list of revoked certificates */
-    for(i=0; i < PKI_STACK_X509_CRL_ENTRY_elements(sk); i++ ) {
-      PKI_log_debug("CRL::ADDING ENTRY %d\n", i );
+  if ( crlNumber ) PKI_INTEGER_free ( crlNumber );
 
-      entry = PKI_STACK_X509_CRL_ENTRY_get_num(sk, i);
-      if(!entry) break;
+  return( ret );
 
-      X509_CRL_add0_revoked(val, entry);
-    };
-  }
+err:
 
-  /* Sorts the CRL entries */
-  X509_CRL_sort ( val );
+  if ( crlNumber ) PKI_INTEGER_free ( crlNumber );
+  if ( time ) PKI_TIME_free ( time );
+  if ( ret ) PKI_X509_CRL_free ( ret );
+  return NULL;
+}
 
-  /*
-  if((ret = PKI_X509_new_value( PKI_DATATYPE_X509_CRL, val, hsm)) == NULL ) {
-    PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
-    X509_CRL_free ( val );
-    return ( NULL );
-  }
-  */
+/*
+ * Adds the profile extensions to the CRL and signs it
+ */
+
+static int __crl_sign(PKI_X509_CRL *ret,
+             const PKI_X509_KEYPAIR *k,
+             const PKI_X509_CERT *cert, 
+             const PKI_X509_PROFILE *profile,
+             const PKI_CONFIG *oids) {
+
+  PKI_DIGEST_ALG *dgst = NULL;
+  PKI_TOKEN * tk = NULL;
+  int rv = PKI_OK;
 
   /* Get the extensions from the profile */
   if( profile ) {
-    PKI_TOKEN * tk;
 
     if((tk = PKI_TOKEN_new_null()) == NULL ) {
       PKI_log_err ( "Memory allocation failure");
-      PKI_X509_CRL_free ( ret );
-      return NULL;
+      return PKI_ERR;
     }
 
     PKI_TOKEN_set_cert(tk, (PKI_X509_CERT *)cert);
     PKI_TOKEN_set_keypair(tk, (PKI_X509_KEYPAIR *)k);
 
     if(PKI_X509_EXTENSIONS_crl_add_profile( profile, oids, ret, tk) == 0 ) {
-          PKI_log_debug( "ERROR, can not set extensions!");
-      PKI_X509_CRL_free ( ret );
-
-      tk->cert = NULL;
-      tk->keypair = NULL;
-      PKI_TOKEN_free ( tk );
-
-      return ( NULL );
+      PKI_log_debug( "ERROR, can not set extensions!");
+      rv = PKI_ERR;
     }
+
     tk->cert = NULL;
     tk->keypair = NULL;
     PKI_TOKEN_free ( tk );
+
+    if ( rv == PKI_ERR ) return PKI_ERR;
   }
 
   /* Get the Digest Algorithm */
   if( (dgst = PKI_DIGEST_ALG_get_by_key( k )) == NULL ) {
     PKI_log_err("Can not get digest algor from keypair!");
-    goto err;
+    return PKI_ERR;
   }
   
-  rv = PKI_X509_sign ( ret, dgst, k );
-
-  if ( rv == PKI_ERR ) {
+  if ( PKI_X509_sign ( ret, dgst, k ) == PKI_ERR ) {
     PKI_log_debug ("ERROR, can not sign CRL!");
-    goto err;
+    return PKI_ERR;
   }
 
-  return( ret );
+  return PKI_OK;
+}
 
-err:
+/*! \brief Generate a new CRL from a stack of revoked entries
+ *
+ * Generates a new signed CRL from a stack of revoked entries. A profile is
+ * used to set the right extensions in the CRL. To generate a new revoked
+ * entry the PKI_X509_CRL_ENTRY_new() function has to be used.
+ *
+ * When the entries are generated in bulk (e.g., from a database), use the
+ * PKI_X509_CRL_BUILDER instead.
+ */
 
-  if ( time ) PKI_TIME_free ( time );
-  if ( ret ) PKI_X509_CRL_free ( ret );
-  return NULL;
+PKI_X509_CRL *PKI_X509_CRL_new(const PKI_X509_KEYPAIR *k,
+             const PKI_X509_CERT *cert, 
+             const char * crlNumber_s,
+             unsigned long validity,
+             const PKI_X509_CRL_ENTRY_STACK *sk, 
+             const PKI_X509_PROFILE *profile,
+             const PKI_CONFIG *oids,
+             HSM *hsm) {
+
+  PKI_X509_CRL *ret = NULL;
+  PKI_X509_CRL_ENTRY *entry = NULL;
+  int num = 0;
+  int i = 0;
+
+  if ((ret = __crl_new_unsigned(k, cert, crlNumber_s, 
+                  validity, profile, NULL)) == NULL) return NULL;
+
+  /* Adds the list of revoked certificates */
+  num = sk ? PKI_STACK_X509_CRL_ENTRY_elements(sk) : 0;
+  for (i = 0; i < num; i++) {
+
+    if ((entry = PKI_STACK_X509_CRL_ENTRY_get_num(sk, i)) == NULL) break;
+
+    X509_CRL_add0_revoked(ret->value, entry);
+  }
+
+  /* Sorts the CRL entries */
+  X509_CRL_sort ( ret->value );
+
+  if (__crl_sign(ret, k, cert, profile, oids) == PKI_ERR) {
+    PKI_X509_CRL_free(ret);
+    return NULL;
+  }
+
+  return( ret );
 }
 
 /*!
@@ -410,6 +461,84 @@ PKI_X509_CRL_ENTRY * PKI_X509_CRL_ENTRY_new(const PKI_X509_CERT *cert,
   return ( entry );
 }
 
+/*
+ * Adds the reasonCode extension to a revoked entry, for the certificateHold
+ * reason the holdInstructionCode (and the invalidityDate, when revDate is
+ * provided) are added as well
+ */
+
+static int __crl_entry_set_reason(PKI_X509_CRL_ENTRY *entry,
+          PKI_X509_CRL_REASON reason, const PKI_TIME *revDate) {
+
+  ASN1_ENUMERATED *rtmp = NULL;
+  const char *hold = NULL;
+  int supported_reason = -1;
+  int rv = PKI_ERR;
+
+  switch (reason)
+  {
+    case PKI_CRL_REASON_UNSPECIFIED:
+      return PKI_OK;
+
+    case PKI_CRL_REASON_CERTIFICATE_HOLD:
+    case PKI_CRL_REASON_HOLD_INSTRUCTION_REJECT:
+      hold = "holdInstructionReject";
+      supported_reason = PKI_CRL_REASON_CERTIFICATE_HOLD;
+      break;
+
+    case PKI_CRL_REASON_HOLD_INSTRUCTION_CALLISSUER:
+      hold = "holdInstructionCallIssuer";
+      supported_reason = PKI_CRL_REASON_CERTIFICATE_HOLD;
+      break;
+
+    case PKI_CRL_REASON_KEY_COMPROMISE:
+    case PKI_CRL_REASON_CA_COMPROMISE:
+    case PKI_CRL_REASON_AFFILIATION_CHANGED:
+    case PKI_CRL_REASON_SUPERSEDED:
+    case PKI_CRL_REASON_CESSATION_OF_OPERATION:
+    case PKI_CRL_REASON_REMOVE_FROM_CRL:
+    case PKI_CRL_REASON_PRIVILEGE_WITHDRAWN:
+    case PKI_CRL_REASON_AA_COMPROMISE:
+      supported_reason = reason;
+      break;
+
+    default:
+      PKI_ERROR(PKI_ERR_GENERAL, "CRL Reason Unknown %d", reason);
+      return PKI_ERR;
+  }
+
+  if (hold) {
+
+    PKI_OID *oid = PKI_OID_get(hold);
+
+    if (!oid || !X509_REVOKED_add1_ext_i2d(entry, NID_hold_instruction_code,
+                                           oid, 0, 0)) {
+      PKI_ERROR(PKI_ERR_X509_CRL_EXTENSION, "Can not add %s", hold);
+      if (oid) PKI_OID_free(oid);
+      return PKI_ERR;
+    }
+    PKI_OID_free(oid);
+
+    if (revDate && !X509_REVOKED_add1_ext_i2d(entry,
+        NID_invalidity_date, (PKI_TIME *)revDate, 0, 0)) {
+      PKI_ERROR(PKI_ERR_X509_CRL_EXTENSION, "Can not add invalidity date");
+      return PKI_ERR;
+    }
+  }
+
+  if ((rtmp = ASN1_ENUMERATED_new()) != NULL &&
+        ASN1_ENUMERATED_set(rtmp, supported_reason) &&
+        X509_REVOKED_add1_ext_i2d(entry, NID_crl_reason, rtmp, 0, 0)) {
+    rv = PKI_OK;
+  } else {
+    PKI_ERROR(PKI_ERR_X509_CRL_EXTENSION, "Can not add the reason code");
+  }
+
+  if (rtmp) ASN1_ENUMERATED_free(rtmp);
+
+  return rv;
+}
+
 /*! \brief Generates a new PKI_X509_CRL_ENTRY from a serial number (string)
  *
  * This function generates a new PKI_X509_CRL_ENTRY starting from a string
@@ -443,11 +572,14 @@ PKI_X509_CRL_ENTRY * PKI_X509_CRL_ENTRY_new_serial( const char *serial,
   }
 
   // If no revocation date is provided, let's use "now"
-  if (!revDate && (a_date = PKI_TIME_new(0)) == NULL) {
+  if (!revDate) {
 
-    // Can not allocate the revocation date time
-    PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
-    return NULL;
+    if ((a_date = PKI_TIME_new(0)) == NULL) {
+      // Can not allocate the revocation date time
+      PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+      X509_REVOKED_free((X509_REVOKED *) entry);
+      return NULL;
+    }
 
   } else {
 
@@ -483,102 +615,8 @@ PKI_X509_CRL_ENTRY * PKI_X509_CRL_ENTRY_new_serial( const char *serial,
     goto err;
   }
 
-  if (reason != PKI_CRL_REASON_UNSPECIFIED) {
-
-    int supported_reason = -1;
-    ASN1_ENUMERATED *rtmp = ASN1_ENUMERATED_new();
-
-    switch (reason )
-    {
-      case PKI_CRL_REASON_CERTIFICATE_HOLD:
-      case PKI_CRL_REASON_HOLD_INSTRUCTION_REJECT:
-        if (!X509_REVOKED_add1_ext_i2d(entry,
-                                       NID_hold_instruction_code,
-                                       PKI_OID_get("holdInstructionReject"), 0, 0)) {
-          PKI_ERROR(PKI_ERR_X509_CRL_EXTENSION, "Can not add holdInstructionReject");
-          goto err;
-        }
-
-        if (revDate && !X509_REVOKED_add1_ext_i2d(entry,
-            NID_invalidity_date, (PKI_TIME *)revDate, 0, 0)) {
-          PKI_ERROR(PKI_ERR_X509_CRL_EXTENSION, "Can not add invalidity date");
-          goto err;
-        }
-
-        supported_reason = PKI_CRL_REASON_CERTIFICATE_HOLD;
-        break;
-
-      /* --- Deprecated in RFC 5280 ---
-      case PKI_CRL_REASON_HOLD_INSTRUCTION_NONE:
-        if (!X509_REVOKED_add1_ext_i2d(entry, NID_hold_instruction_code, 
-            PKI_OID_get( "holdInstructionReject"), 0, 0)) {
-          goto err;
-        };
-        if( revDate && !X509_REVOKED_add1_ext_i2d ( entry, 
-            NID_invalidity_date, revDate, 0, 0)) {
-          goto err;
-        };
-        reason = PKI_CRL_REASON_CERTIFICATE_HOLD;
-        break;
-      */
-
-      case PKI_CRL_REASON_HOLD_INSTRUCTION_CALLISSUER:
-        if (!X509_REVOKED_add1_ext_i2d(
-          entry, 
-          NID_hold_instruction_code, 
-          PKI_OID_get( 
-            "holdInstructionCallIssuer"), 0, 0)) {
-          goto err;
-        }
-
-        if( revDate && !X509_REVOKED_add1_ext_i2d(
-              entry, 
-              NID_invalidity_date, 
-              (PKI_TIME *)revDate, 
-              0, 0)) {
-          goto err;
-        }
-
-        supported_reason = PKI_CRL_REASON_CERTIFICATE_HOLD;
-        break;
-
-      case PKI_CRL_REASON_KEY_COMPROMISE:
-      case PKI_CRL_REASON_CA_COMPROMISE:
-      case PKI_CRL_REASON_AFFILIATION_CHANGED:
-      case PKI_CRL_REASON_SUPERSEDED:
-      case PKI_CRL_REASON_CESSATION_OF_OPERATION:
-      case PKI_CRL_REASON_REMOVE_FROM_CRL:
-      case PKI_CRL_REASON_PRIVILEGE_WITHDRAWN:
-      case PKI_CRL_REASON_AA_COMPROMISE:
-        PKI_ERROR(PKI_ERR_GENERAL, "CRL Reason Not Implemented Yet %d", reason);
-	break;
-
-      default:
-        PKI_ERROR(PKI_ERR_GENERAL, "CRL Reason Unknown %d", reason);
-        supported_reason = -1;
-        break;
-    }
-
-    if (supported_reason >= 0)
-    {
-      if (!ASN1_ENUMERATED_set(rtmp, supported_reason)) goto err;
-      if (!X509_REVOKED_add1_ext_i2d( entry, NID_crl_reason, rtmp, 0, 0)) goto err;
-    }
-
-    /*
-    if( reason == CRL_REASON_HOLD_INSTRUCTION ) {
-      // if (!X509_REVOKED_add1_ext_i2d ( entry, 
-      //     NID_invalidity_date, revDate, 0, 0)) {
-      //   goto err;
-      // };
-      // if (!X509_REVOKED_add1_ext_i2d(entry, NID_hold_instruction_code, 
-        //   PKI_OID_get( "holdInstructionReject"), 0, 0)) {
-      // goto err;
-      // };
-    };
-    */
-
-  }
+  // Adds the reason code (and the hold instruction, if any)
+  if (__crl_entry_set_reason(entry, reason, revDate) == PKI_ERR) goto err;
 
 /*
   if (rev && !X509_REVOKED_set_revocationDate(rev, revDate))
@@ -643,6 +681,82 @@ int PKI_X509_CRL_ENTRY_free ( PKI_X509_CRL_ENTRY *entry ) {
 
 }
 
+/*
+ * Serial number helpers - these convert the different serial number
+ * representations (hex string, long long) into the raw big-endian
+ * magnitude bytes used by the ASN1_INTEGER (no leading zeroes) by
+ * using caller provided buffers, so that lookups do not need to
+ * allocate a new PKI_INTEGER.
+ */
+
+#define PKI_X509_CRL_SERIAL_BUFF_SIZE   64
+
+static size_t __crl_serial_from_hex(const char *serial,
+                                    unsigned char *buf,
+                                    size_t buf_size) {
+
+  size_t digits = 0;
+  size_t i = 0;
+  size_t len = 0;
+  const char *pnt = NULL;
+
+  // Skips the optional prefix
+  if (serial[0] == '0' && (serial[1] == 'x' || serial[1] == 'X'))
+    serial += 2;
+
+  // Counts the digits (':' separators are allowed)
+  for (pnt = serial; *pnt; pnt++) {
+    if (isxdigit((unsigned char) *pnt)) digits++;
+    else if (*pnt != ':') return 0;
+  }
+
+  if (digits == 0 || (digits + 1) / 2 > buf_size) return 0;
+
+  // Converts the digits, the first byte gets the odd nibble (if any)
+  memset(buf, 0, buf_size);
+  for (pnt = serial, i = (digits % 2); *pnt; pnt++) {
+
+    int val = 0;
+
+    if (*pnt == ':') continue;
+
+    if (*pnt >= '0' && *pnt <= '9') val = *pnt - '0';
+    else val = tolower((unsigned char) *pnt) - 'a' + 10;
+
+    buf[i / 2] |= (unsigned char)(i % 2 ? val : val << 4);
+    i++;
+  }
+  len = (digits + 1) / 2;
+
+  // Removes the leading zeroes
+  for (i = 0; i < len - 1 && buf[i] == 0; i++);
+  if (i > 0) memmove(buf, buf + i, len - i);
+
+  return len - i;
+}
+
+static size_t __crl_serial_from_long(long long s,
+                                     unsigned char *buf,
+                                     int *negative) {
+
+  unsigned long long val = 0;
+  unsigned char tmp[sizeof(long long)];
+  size_t len = 0;
+
+  *negative = (s < 0);
+  val = *negative ? (unsigned long long)(-(s + 1)) + 1 : (unsigned long long) s;
+
+  // Big-endian encoding of the magnitude
+  do {
+    tmp[len++] = (unsigned char)(val & 0xFF);
+    val >>= 8;
+  } while (val);
+
+  for (val = 0; val < len; val++) buf[val] = tmp[len - val - 1];
+
+  return len;
+}
+
 /*! \brief Find an entry within a CRL by using the PKI_INTEGER serial
  *         number of the certificate
  *
@@ -650,78 +764,61 @@ int PKI_X509_CRL_ENTRY_free ( PKI_X509_CRL_ENTRY *entry ) {
  * if the passed serial is found.  The returned pointer refers to the
  * internal CRL structure, when the CRL is freed the pointer will no
  * more point to a valid memory area.
+ *
+ * When many lookups are performed against the same CRL (e.g., in an
+ * OCSP responder) use a PKI_X509_CRL_INDEX instead.
  */
 
 const PKI_X509_CRL_ENTRY * PKI_X509_CRL_lookup(const PKI_X509_CRL *x, 
                  const PKI_INTEGER *s ) {
 
-  long long end = 0;
-  const STACK_OF(X509_REVOKED) * r_sk = NULL;
-
   X509_CRL *crl = NULL;
 
   // Input Checks
-  if (!x || !s) return (NULL);
-
-  // Gets the revoked stack
-  if ((r_sk = X509_CRL_get_REVOKED(crl)) == NULL) {
-    // No Entries in the CRL
-    return NULL;
-  }
-
-  /* Set the end point to the last one */
-  if ((end = (long long) sk_X509_REVOKED_num(r_sk) - 1) < 0)
-    return NULL;
+  if (!x || !x->value || !s) return (NULL);
 
   // Gets a casted pointer
-  crl = (X509_CRL *) x;
-
-        /* Look for serial number of certificate in CRL */
-        // rtmp.serialNumber = (ASN1_INTEGER *) serial;
-        // ok = sk_X509_REVOKED_find(crl->crl->revoked, &rtmp);
+  crl = (X509_CRL *) x->value;
 
 #if OPENSSL_VERSION_NUMBER >= 0x1010000fL
 
   PKI_X509_CRL_ENTRY *r = NULL;
 
-  // Gets the reference in r
-  X509_CRL_get0_by_serial(crl, &r, (PKI_INTEGER *)s);
+  // Gets the reference in r (the stack is sorted once by OpenSSL)
+  if (X509_CRL_get0_by_serial(crl, &r, (PKI_INTEGER *)s) <= 0)
+    return NULL;
 
 #else
 
+  long long end = 0;
   long long curr = 0;
-  long long cmp_val = 0;
 
+  const STACK_OF(X509_REVOKED) * r_sk = NULL;
   const PKI_X509_CRL_ENTRY *r = NULL;
 
+  // Gets the revoked stack
+  if ((r_sk = X509_CRL_get_REVOKED(crl)) == NULL) {
+    // No Entries in the CRL
+    return NULL;
+  }
+
+  /* Set the end point to the last one */
+  if ((end = (long long) sk_X509_REVOKED_num(r_sk) - 1) < 0)
+    return NULL;
+
   for( curr = 0 ; curr <= end ; curr++ ) {
  
-    const PKI_X509_CRL_ENTRY *r = NULL;
-    const PKI_INTEGER * s_pnt;
-      // Pointer to the SN in the X509_REVOKED struct
+    const PKI_X509_CRL_ENTRY *tmp = NULL;
 
     // Gets the X509_REVOKED entry
-    if ((r = sk_X509_REVOKED_value( r_sk, (int) curr )) != NULL) {
-
-
-// # if OPENSSL_VERSION_NUMBER >= 0x1010000fL
-//       // Gets the Serial Number
-//       if ((s_pnt = X509_REVOKED_get0_serialNumber(r)) != NULL) {
-//         // Checks the value against the CRL
-//         if ((cmp_val = ASN1_INTEGER_cmp(s_pnt, s)) == 0) {
-//           // Found
-//           break;
-//         }
-//       }
-// # else
-      if ((s_pnt = r->serialNumber) != NULL) {
-        // Checks the value against the CRL
-        if ((cmp_val = ASN1_INTEGER_cmp(s_pnt, s)) == 0) {
-          // Found
-          break;
-        }
+    if ((tmp = sk_X509_REVOKED_value( r_sk, (int) curr )) != NULL) {
+
+      // Checks the value against the CRL
+      if (tmp->serialNumber && ASN1_INTEGER_cmp(tmp->serialNumber, s) == 0) {
+        // Found
+        r = tmp;
+        break;
       }
-// # endif
     }
   }
 
@@ -742,10 +839,23 @@ const PKI_X509_CRL_ENTRY * PKI_X509_CRL_lookup_serial(const PKI_X509_CRL *x,
                   const char *serial ) {
 
   ASN1_INTEGER *s = NULL;
+  ASN1_INTEGER tmp;
+  unsigned char buf[PKI_X509_CRL_SERIAL_BUFF_SIZE];
+  size_t len = 0;
+
   const PKI_X509_CRL_ENTRY *r = NULL;
 
   if (!x || !serial) return (NULL);
 
+  // Uses a stack-allocated integer for the common case
+  if ((len = __crl_serial_from_hex(serial, buf, sizeof(buf))) > 0) {
+    tmp.length = (int) len;
+    tmp.type = V_ASN1_INTEGER;
+    tmp.data = buf;
+    tmp.flags = 0;
+    return PKI_X509_CRL_lookup(x, &tmp);
+  }
+
   if ((s = PKI_INTEGER_new_char ( serial )) == NULL) return NULL;
 
   r = PKI_X509_CRL_lookup ( x, s );
@@ -785,18 +895,1085 @@ const PKI_X509_CRL_ENTRY * PKI_X509_CRL_lookup_cert(const PKI_X509_CRL *x,
 const PKI_X509_CRL_ENTRY * PKI_X509_CRL_lookup_long(const PKI_X509_CRL *x,
                 long long s ) {
 
-  PKI_INTEGER * serial = NULL;
-  const PKI_X509_CRL_ENTRY *entry = NULL;
+  ASN1_INTEGER tmp;
+  unsigned char buf[sizeof(long long)];
+  int negative = 0;
 
   if ( !x ) return NULL;
 
-  serial = PKI_INTEGER_new ( s );
+  tmp.length = (int) __crl_serial_from_long(s, buf, &negative);
+  tmp.type = negative ? V_ASN1_NEG_INTEGER : V_ASN1_INTEGER;
+  tmp.data = buf;
+  tmp.flags = 0;
+
+  return PKI_X509_CRL_lookup ( x, &tmp );
+}
 
-  entry = PKI_X509_CRL_lookup ( x, serial );
+/* ------------------------ CRL Revocation Index ------------------------ */
 
-  if ( serial ) PKI_INTEGER_free ( serial );
+/*
+ * Each serial is stored in the index buffer as one sign byte followed by
+ * the big-endian magnitude. Keys are ordered by size first and then by
+ * content, which is a total order (not the numeric one) that only needs
+ * a memcmp() when comparing two keys.
+ */
 
-  return ( entry );
+typedef struct __crl_index_item_st {
+  const unsigned char *data;
+  int size;
+  int negative;
+  int delta;
+  int pos;
+} __CRL_INDEX_ITEM;
+
+static int __crl_index_key_cmp(const unsigned char *a, size_t a_size,
+                               const unsigned char *b, size_t b_size) {
+
+  if (a_size != b_size) return a_size < b_size ? -1 : 1;
+
+  return memcmp(a, b, a_size);
+}
+
+static int __crl_index_item_cmp(const void *a, const void *b) {
+
+  const __CRL_INDEX_ITEM *i_a = a;
+  const __CRL_INDEX_ITEM *i_b = b;
+  int ret = 0;
+
+  if (i_a->size != i_b->size) return i_a->size < i_b->size ? -1 : 1;
+  if (i_a->negative != i_b->negative) return i_a->negative ? 1 : -1;
+  if ((ret = memcmp(i_a->data, i_b->data, (size_t) i_a->size)) != 0)
+    return ret;
+
+  // Delta CRL entries take precedence over the base CRL ones
+  if (i_a->delta != i_b->delta) return i_a->delta ? -1 : 1;
+
+  // Keeps the order of duplicates stable (first entry wins)
+  return i_a->pos - i_b->pos;
+}
+
+static int __crl_index_entry_reason(const PKI_X509_CRL_ENTRY *entry) {
+
+  ASN1_ENUMERATED *val = NULL;
+  int ret = -1;
+
+  if ((val = X509_REVOKED_get_ext_d2i((X509_REVOKED *) entry, 
+                  NID_crl_reason, NULL, NULL)) != NULL) {
+    ret = (int) ASN1_ENUMERATED_get(val);
+    ASN1_ENUMERATED_free(val);
+  }
+
+  return ret;
+}
+
+/*
+ * Builds the index for a CRL or, when delta is not NULL, for the logical
+ * revocation set of a base CRL updated by a delta CRL: the delta entries
+ * replace the base ones and the removeFromCRL entries are dropped
+ */
+
+static PKI_X509_CRL_INDEX * __crl_index_new(X509_CRL *crl, X509_CRL *delta) {
+
+  PKI_X509_CRL_INDEX *ret = NULL;
+  const STACK_OF(X509_REVOKED) * r_sk[2] = { NULL, NULL };
+  __CRL_INDEX_ITEM *items = NULL;
+
+  size_t buf_size = 0;
+  size_t offset = 0;
+  int num[2] = { 0, 0 };
+  int n = 0;
+  int i = 0;
+  int j = 0;
+
+  if ((ret = (PKI_X509_CRL_INDEX *) PKI_Malloc(sizeof(PKI_X509_CRL_INDEX))) 
+                  == NULL) {
+    PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+    return NULL;
+  }
+
+  // Empty CRLs get an empty (but valid) index
+  if ((r_sk[0] = X509_CRL_get_REVOKED(crl)) != NULL)
+    num[0] = sk_X509_REVOKED_num(r_sk[0]);
+
+  if (delta && (r_sk[1] = X509_CRL_get_REVOKED(delta)) != NULL)
+    num[1] = sk_X509_REVOKED_num(r_sk[1]);
+
+  if (num[0] + num[1] > 0) {
+
+    // Collects the serials and sorts them
+    if ((items = PKI_Malloc(sizeof(__CRL_INDEX_ITEM) * 
+                    (size_t)(num[0] + num[1]))) == NULL)
+      goto err;
+
+    for (j = 0; j < 2; j++) {
+
+      for (i = 0; i < num[j]; i++, n++) {
+
+        const PKI_X509_CRL_ENTRY *entry = sk_X509_REVOKED_value(r_sk[j], i);
+        const ASN1_INTEGER *serial = NULL;
+
+#if OPENSSL_VERSION_NUMBER >= 0x1010000fL
+        serial = X509_REVOKED_get0_serialNumber(entry);
+#else
+        serial = entry->serialNumber;
+#endif
+        if (!serial) {
+          PKI_ERROR(PKI_ERR_X509_CRL_, "Missing serial number in CRL entry %d", i);
+          goto err;
+        }
+
+        items[n].data = ASN1_STRING_get0_data(serial);
+        items[n].size = ASN1_STRING_length(serial);
+        items[n].negative = (ASN1_STRING_type(serial) == V_ASN1_NEG_INTEGER);
+        items[n].delta = j;
+        items[n].pos = i;
+
+        buf_size += (size_t) items[n].size + 1;
+      }
+    }
+
+    qsort(items, (size_t) n, sizeof(__CRL_INDEX_ITEM), __crl_index_item_cmp);
+
+    // Allocates the buffers for the serials and the side tables
+    ret->serials = PKI_Malloc(buf_size);
+    ret->offsets = PKI_Malloc(sizeof(size_t) * ((size_t) n + 1));
+    ret->reasons = PKI_Malloc(sizeof(int) * (size_t) n);
+    ret->dates   = PKI_Malloc(sizeof(PKI_TIME *) * (size_t) n);
+    ret->entries = PKI_Malloc(sizeof(PKI_X509_CRL_ENTRY *) * (size_t) n);
+
+    if (!ret->serials || !ret->offsets || !ret->reasons ||
+                  !ret->dates || !ret->entries) {
+      PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+      goto err;
+    }
+
+    // Fills in the index, duplicated serials are only indexed once
+    for (i = 0; i < n; i++) {
+
+      const PKI_X509_CRL_ENTRY *entry = NULL;
+      int reason = -1;
+
+      if (i > 0 && 
+            items[i].size == items[i-1].size &&
+            items[i].negative == items[i-1].negative &&
+            memcmp(items[i].data, items[i-1].data, (size_t)items[i].size) == 0)
+        continue;
+
+      entry = sk_X509_REVOKED_value(r_sk[items[i].delta], items[i].pos);
+      reason = __crl_index_entry_reason(entry);
+
+      // The serial is not revoked anymore
+      if (items[i].delta && reason == PKI_CRL_REASON_REMOVE_FROM_CRL)
+        continue;
+
+      ret->offsets[ret->size] = offset;
+      ret->serials[offset++] = (unsigned char) items[i].negative;
+      memcpy(ret->serials + offset, items[i].data, (size_t) items[i].size);
+      offset += (size_t) items[i].size;
+
+      ret->reasons[ret->size] = reason;
+#if OPENSSL_VERSION_NUMBER >= 0x1010000fL
+      ret->dates[ret->size] = X509_REVOKED_get0_revocationDate(entry);
+#else
+      ret->dates[ret->size] = entry->revocationDate;
+#endif
+      ret->entries[ret->size] = entry;
+      ret->size++;
+    }
+    ret->offsets[ret->size] = offset;
+
+    PKI_Free(items);
+    items = NULL;
+  }
+
+  // Keeps the CRLs around as long as the index is alive
+#if OPENSSL_VERSION_NUMBER >= 0x1010000fL
+  X509_CRL_up_ref(crl);
+  if (delta) X509_CRL_up_ref(delta);
+#else
+  CRYPTO_add(&crl->references, 1, CRYPTO_LOCK_X509_CRL);
+  if (delta) CRYPTO_add(&delta->references, 1, CRYPTO_LOCK_X509_CRL);
+#endif
+  ret->crl = crl;
+  ret->delta = delta;
+
+  return ret;
+
+err:
+
+  if (items) PKI_Free(items);
+  PKI_X509_CRL_INDEX_free(ret);
+
+  return NULL;
+}
+
+/*! \brief Builds a new PKI_X509_CRL_INDEX from a CRL
+ *
+ * This function builds an immutable revocation index for the passed CRL.
+ * The serial numbers are stored in a single sorted buffer together with
+ * side tables for the revocation reason, the revocation date and the
+ * original entry, so that lookups are O(log n) and do not allocate any
+ * memory. Since the index is never modified after it is built, it can be
+ * shared across threads without locking.
+ *
+ * The index holds a reference to the CRL value, therefore the pointers it
+ * returns stay valid even if the passed PKI_X509_CRL is freed.
+ */
+
+PKI_X509_CRL_INDEX * PKI_X509_CRL_INDEX_new(const PKI_X509_CRL *x) {
+
+  // Input Checks
+  if (!x || !x->value) {
+    PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+    return NULL;
+  }
+
+  return __crl_index_new((X509_CRL *) x->value, NULL);
+}
+
+/*! \brief Builds a new PKI_X509_CRL_INDEX from a base and a delta CRL
+ *
+ * The returned index covers the logical revocation set described by the
+ * pair: entries in the delta CRL take precedence over the ones in the base
+ * CRL and the serials listed as removeFromCRL in the delta are not indexed.
+ * Returns NULL if the delta CRL does not apply to the base CRL.
+ */
+
+PKI_X509_CRL_INDEX * PKI_X509_CRL_INDEX_new_delta(const PKI_X509_CRL *base,
+                                                  const PKI_X509_CRL *delta) {
+
+  if (PKI_X509_CRL_check_delta(base, delta) != PKI_OK) return NULL;
+
+  return __crl_index_new((X509_CRL *) base->value, (X509_CRL *) delta->value);
+}
+
+/*! \brief Frees the memory associated with a PKI_X509_CRL_INDEX */
+
+void PKI_X509_CRL_INDEX_free(PKI_X509_CRL_INDEX *idx) {
+
+  if (!idx) return;
+
+  if (idx->serials) PKI_Free(idx->serials);
+  if (idx->offsets) PKI_Free(idx->offsets);
+  if (idx->reasons) PKI_Free(idx->reasons);
+  if (idx->dates) PKI_Free((void *) idx->dates);
+  if (idx->entries) PKI_Free((void *) idx->entries);
+
+  // Releases the references to the CRLs
+  if (idx->crl) X509_CRL_free(idx->crl);
+  if (idx->delta) X509_CRL_free(idx->delta);
+
+  PKI_Free(idx);
+}
+
+/*! \brief Returns the number of (unique) serials in the index */
+
+int PKI_X509_CRL_INDEX_elements(const PKI_X509_CRL_INDEX *idx) {
+
+  if (!idx) return 0;
+
+  return idx->size;
+}
+
+/*! \brief Returns the position of a serial in the index, or -1
+ *
+ * The serial is provided as the big-endian magnitude of the integer
+ * (e.g., the contents of a DER INTEGER, leading zeroes are ignored) and
+ * the negative flag for (non RFC 5280 compliant) negative serials.
+ */
+
+int PKI_X509_CRL_INDEX_find(const PKI_X509_CRL_INDEX *idx,
+                            const unsigned char *serial,
+                            size_t size,
+                            int negative) {
+
+  unsigned char key[PKI_X509_CRL_SERIAL_BUFF_SIZE + 1];
+  unsigned char *key_pnt = key;
+  int low = 0;
+  int high = 0;
+  int ret = -1;
+
+  if (!idx || !serial || !size || idx->size <= 0) return -1;
+
+  // Leading zeroes are not part of the ASN1_INTEGER content
+  while (size > 1 && *serial == 0) {
+    serial++;
+    size--;
+  }
+
+  // Builds the lookup key (no allocation for the common sizes)
+  if (size >= sizeof(key) &&
+        (key_pnt = PKI_Malloc(size + 1)) == NULL) {
+    PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+    return -1;
+  }
+  key_pnt[0] = negative ? 1 : 0;
+  memcpy(key_pnt + 1, serial, size);
+
+  // Binary search on the sorted serials
+  high = idx->size - 1;
+  while (low <= high) {
+
+    int mid = low + (high - low) / 2;
+    int cmp = __crl_index_key_cmp(idx->serials + idx->offsets[mid],
+                      idx->offsets[mid + 1] - idx->offsets[mid],
+                      key_pnt, size + 1);
+
+    if (cmp == 0) {
+      ret = mid;
+      break;
+    }
+
+    if (cmp < 0) low = mid + 1;
+    else high = mid - 1;
+  }
+
+  if (key_pnt != key) PKI_Free(key_pnt);
+
+  return ret;
+}
+
+/*! \brief Returns the CRL entry at the specified position in the index and
+ *         (optionally) its revocation reason and date
+ *
+ * The reason is set to -1 if the entry carries no reason code extension.
+ */
+
+const PKI_X509_CRL_ENTRY * PKI_X509_CRL_INDEX_get_num(
+                                          const PKI_X509_CRL_INDEX *idx,
+                                          int num,
+                                          int *reason,
+                                          const PKI_TIME **revDate) {
+
+  if (!idx || num < 0 || num >= idx->size) return NULL;
+
+  if (reason) *reason = idx->reasons[num];
+  if (revDate) *revDate = idx->dates[num];
+
+  return idx->entries[num];
+}
+
+/*! \brief Lookup for a binary serial (big-endian) in a PKI_X509_CRL_INDEX */
+
+const PKI_X509_CRL_ENTRY * PKI_X509_CRL_INDEX_lookup_bin(
+                                          const PKI_X509_CRL_INDEX *idx,
+                                          const unsigned char *serial,
+                                          size_t size,
+                                          int *reason,
+                                          const PKI_TIME **revDate) {
+
+  return PKI_X509_CRL_INDEX_get_num(idx,
+            PKI_X509_CRL_INDEX_find(idx, serial, size, 0), reason, revDate);
+}
+
+/*! \brief Lookup for a PKI_INTEGER serial in a PKI_X509_CRL_INDEX */
+
+const PKI_X509_CRL_ENTRY * PKI_X509_CRL_INDEX_lookup(
+                                          const PKI_X509_CRL_INDEX *idx,
+                                          const PKI_INTEGER *s,
+                                          int *reason,
+                                          const PKI_TIME **revDate) {
+
+  int pos = -1;
+
+  if (!idx || !s) return NULL;
+
+  pos = PKI_X509_CRL_INDEX_find(idx, ASN1_STRING_get0_data(s),
+                                (size_t) ASN1_STRING_length(s),
+                                ASN1_STRING_type(s) == V_ASN1_NEG_INTEGER);
+
+  return PKI_X509_CRL_INDEX_get_num(idx, pos, reason, revDate);
+}
+
+/*! \brief Lookup for a serial (hex string) in a PKI_X509_CRL_INDEX */
+
+const PKI_X509_CRL_ENTRY * PKI_X509_CRL_INDEX_lookup_serial(
+                                          const PKI_X509_CRL_INDEX *idx,
+                                          const char *serial,
+                                          int *reason,
+                                          const PKI_TIME **revDate) {
+
+  unsigned char buf[PKI_X509_CRL_SERIAL_BUFF_SIZE];
+  size_t len = 0;
+
+  if (!idx || !serial) return NULL;
+
+  if ((len = __crl_serial_from_hex(serial, buf, sizeof(buf))) == 0)
+    return NULL;
+
+  return PKI_X509_CRL_INDEX_lookup_bin(idx, buf, len, reason, revDate);
+}
+
+/*! \brief Lookup for a serial (long long) in a PKI_X509_CRL_INDEX */
+
+const PKI_X509_CRL_ENTRY * PKI_X509_CRL_INDEX_lookup_long(
+                                          const PKI_X509_CRL_INDEX *idx,
+                                          long long s,
+                                          int *reason,
+                                          const PKI_TIME **revDate) {
+
+  unsigned char buf[sizeof(long long)];
+  size_t len = 0;
+  int negative = 0;
+
+  if (!idx) return NULL;
+
+  len = __crl_serial_from_long(s, buf, &negative);
+
+  return PKI_X509_CRL_INDEX_get_num(idx,
+            PKI_X509_CRL_INDEX_find(idx, buf, len, negative), reason, revDate);
+}
+
+/*
+ * PKI_X509_CRL_BUILDER - the entries are appended to columnar buffers (one
+ * buffer for all the serials plus the dates and reasons side tables), no
+ * ASN.1 object is allocated until the CRL is generated. When generating
+ * the CRL, the entries are sorted once (the sort is skipped altogether when
+ * they were appended in ascending order, e.g. from an ORDER BY query) and
+ * added to the CRL in their final (DER) order.
+ */
+
+static int __crl_builder_reserve(PKI_X509_CRL_BUILDER *b, int num) {
+
+  size_t *offsets = NULL;
+  time_t *dates = NULL;
+  int *reasons = NULL;
+  int capacity = 0;
+
+  if (num <= b->capacity) return PKI_OK;
+
+  capacity = b->capacity > 0 ? b->capacity * 2 : 1024;
+  if (capacity < num) capacity = num;
+
+  // The offsets table carries one extra element (end of the last serial)
+  if ((offsets = realloc(b->offsets, sizeof(size_t) * 
+                  ((size_t) capacity + 1))) == NULL) goto err;
+  b->offsets = offsets;
+
+  if ((dates = realloc(b->dates, sizeof(time_t) * (size_t) capacity)) == NULL)
+    goto err;
+  b->dates = dates;
+
+  if ((reasons = realloc(b->reasons, sizeof(int) * (size_t) capacity)) == NULL)
+    goto err;
+  b->reasons = reasons;
+
+  b->capacity = capacity;
+
+  return PKI_OK;
+
+err:
+
+  PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+  return PKI_ERR;
+}
+
+/*! \brief Returns a new (empty) PKI_X509_CRL_BUILDER
+ *
+ * The hint parameter is the expected number of entries (use 0 if not
+ * known), it is used to pre-allocate the internal buffers.
+ */
+
+PKI_X509_CRL_BUILDER * PKI_X509_CRL_BUILDER_new(int hint) {
+
+  PKI_X509_CRL_BUILDER *ret = NULL;
+
+  if ((ret = PKI_Malloc(sizeof(PKI_X509_CRL_BUILDER))) == NULL) {
+    PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+    return NULL;
+  }
+
+  ret->sorted = 1;
+
+  if (hint > 0 && (__crl_builder_reserve(ret, hint) == PKI_ERR ||
+        PKI_MEM_reserve(&ret->serials, (size_t) hint * 16) == PKI_ERR)) {
+    PKI_X509_CRL_BUILDER_free(ret);
+    return NULL;
+  }
+
+  return ret;
+}
+
+/*! \brief Frees the memory associated with a PKI_X509_CRL_BUILDER */
+
+void PKI_X509_CRL_BUILDER_free(PKI_X509_CRL_BUILDER *b) {
+
+  if (!b) return;
+
+  PKI_MEM_cleanup(&b->serials);
+  if (b->offsets) PKI_Free(b->offsets);
+  if (b->dates) PKI_Free(b->dates);
+  if (b->reasons) PKI_Free(b->reasons);
+
+  PKI_Free(b);
+}
+
+/*! \brief Returns the number of entries appended to the builder */
+
+int PKI_X509_CRL_BUILDER_elements(const PKI_X509_CRL_BUILDER *b) {
+
+  if (!b) return 0;
+
+  return b->size;
+}
+
+/*! \brief Appends a revoked serial number (binary) to the builder
+ *
+ * The serial is the big-endian magnitude of the (positive) serial number,
+ * as stored in the DER encoding. If revDate is 0 the current time is used.
+ * When the same serial is appended more than once, only the first entry
+ * is added to the CRL.
+ */
+
+int PKI_X509_CRL_BUILDER_add(PKI_X509_CRL_BUILDER *b,
+                             const unsigned char *serial,
+                             size_t size,
+                             time_t revDate,
+                             PKI_X509_CRL_REASON reason) {
+
+  size_t last = 0;
+
+  if (!b || !serial || !size) {
+    PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+    return PKI_ERR;
+  }
+
+  // Removes the leading zeroes (as in the ASN1_INTEGER)
+  while (size > 1 && serial[0] == 0) {
+    serial++;
+    size--;
+  }
+
+  if (size > PKI_X509_CRL_SERIAL_BUFF_SIZE) {
+    PKI_ERROR(PKI_ERR_PARAM_TYPE, "Serial too long (%d bytes)", (int) size);
+    return PKI_ERR;
+  }
+
+  if (__crl_builder_reserve(b, b->size + 1) == PKI_ERR) return PKI_ERR;
+
+  if (b->size == 0) b->offsets[0] = 0;
+  last = b->offsets[b->size];
+
+  // Keeps track of the ordering, so that sorting can be skipped
+  if (b->sorted && b->size > 0 && __crl_index_key_cmp(serial, size,
+        b->serials.data + b->offsets[b->size - 1],
+        last - b->offsets[b->size - 1]) <= 0) {
+    b->sorted = 0;
+  }
+
+  if (PKI_MEM_add(&b->serials, (char *) serial, size) == PKI_ERR)
+    return PKI_ERR;
+
+  b->offsets[b->size + 1] = last + size;
+  b->dates[b->size] = revDate ? revDate : time(NULL);
+  b->reasons[b->size] = reason;
+  b->size++;
+
+  return PKI_OK;
+}
+
+/*! \brief Appends a revoked serial number (hex string) to the builder */
+
+int PKI_X509_CRL_BUILDER_add_serial(PKI_X509_CRL_BUILDER *b,
+                                    const char *serial,
+                                    time_t revDate,
+                                    PKI_X509_CRL_REASON reason) {
+
+  unsigned char buf[PKI_X509_CRL_SERIAL_BUFF_SIZE];
+  size_t len = 0;
+
+  if (!b || !serial) {
+    PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+    return PKI_ERR;
+  }
+
+  if ((len = __crl_serial_from_hex(serial, buf, sizeof(buf))) == 0) {
+    PKI_ERROR(PKI_ERR_PARAM_TYPE, "Invalid serial number (%s)", serial);
+    return PKI_ERR;
+  }
+
+  return PKI_X509_CRL_BUILDER_add(b, buf, len, revDate, reason);
+}
+
+/*! \brief Appends all the entries returned by an iterator to the builder
+ *
+ * The iterator is called until it returns 0 (no more entries) or -1 (error),
+ * this allows to feed the builder directly from a DB cursor.
+ */
+
+int PKI_X509_CRL_BUILDER_add_iter(PKI_X509_CRL_BUILDER *b,
+                                  PKI_X509_CRL_BUILDER_ITER next,
+                                  void *arg) {
+
+  const char *serial = NULL;
+  time_t revDate = 0;
+  int reason = PKI_CRL_REASON_UNSPECIFIED;
+  int rv = 0;
+
+  if (!b || !next) {
+    PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+    return PKI_ERR;
+  }
+
+  for (;;) {
+
+    serial = NULL;
+    revDate = 0;
+    reason = PKI_CRL_REASON_UNSPECIFIED;
+
+    if ((rv = next(arg, &serial, &revDate, &reason)) <= 0) break;
+
+    if (PKI_X509_CRL_BUILDER_add_serial(b, serial, revDate,
+                (PKI_X509_CRL_REASON) reason) == PKI_ERR) return PKI_ERR;
+  }
+
+  return rv < 0 ? PKI_ERR : PKI_OK;
+}
+
+/*! \brief Appends the entries listed in a text file to the builder
+ *
+ * Each line of the file carries one entry:
+ *
+ *   serial [reason [revocationDate]]
+ *
+ * where serial is in hex, reason is a reason name (e.g., keyCompromise) or
+ * its numeric code and revocationDate is in seconds since the epoch. Fields
+ * are separated by spaces, tabs or commas. Empty lines and lines starting
+ * with '#' are skipped. Use "-" to read the entries from stdin.
+ */
+
+int PKI_X509_CRL_BUILDER_add_file(PKI_X509_CRL_BUILDER *b,
+                                  const char *file) {
+
+  FILE *fp = NULL;
+  char *line = NULL;
+  size_t line_size = 0;
+  int line_num = 0;
+  int rv = PKI_OK;
+
+  if (!b || !file) {
+    PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+    return PKI_ERR;
+  }
+
+  if (strcmp(file, "-") == 0) fp = stdin;
+  else if ((fp = fopen(file, "r")) == NULL) {
+    PKI_ERROR(PKI_ERR_GENERAL, "Can not open %s (%s)", file, strerror(errno));
+    return PKI_ERR;
+  }
+
+  while (rv == PKI_OK && getline(&line, &line_size, fp) != -1) {
+
+    char *serial = NULL;
+    char *reason_s = NULL;
+    char *date_s = NULL;
+    char *save = NULL;
+    char *end = NULL;
+    int reason = PKI_CRL_REASON_UNSPECIFIED;
+    time_t revDate = 0;
+
+    line_num++;
+
+    if ((serial = strtok_r(line, " \t,\r\n", &save)) == NULL ||
+          serial[0] == '#') continue;
+
+    reason_s = strtok_r(NULL, " \t,\r\n", &save);
+    date_s = strtok_r(NULL, " \t,\r\n", &save);
+
+    if (reason_s) {
+      if (isdigit((unsigned char) reason_s[0])) reason = atoi(reason_s);
+      else reason = PKI_X509_CRL_REASON_CODE_get(reason_s);
+    }
+
+    if (date_s) {
+      revDate = (time_t) strtoll(date_s, &end, 10);
+      if (*end != '\0' || revDate <= 0) reason = -1;
+    }
+
+    if (reason < 0) {
+      PKI_ERROR(PKI_ERR_PARAM_TYPE, "Malformed entry (%s:%d)", file, line_num);
+      rv = PKI_ERR;
+      break;
+    }
+
+    rv = PKI_X509_CRL_BUILDER_add_serial(b, serial, revDate,
+                    (PKI_X509_CRL_REASON) reason);
+  }
+
+  if (line) free(line);
+  if (fp != stdin) fclose(fp);
+
+  return rv;
+}
+
+/*
+ * Sorts the entries of the builder (duplicates are skipped) and adds them
+ * to a new CRL which is then signed with the passed key
+ */
+
+static PKI_X509_CRL * __crl_builder_sign(PKI_X509_CRL_BUILDER *b,
+             const PKI_X509_KEYPAIR *k,
+             const PKI_X509_CERT *cert, 
+             const char * crlNumber_s,
+             unsigned long validity,
+             const PKI_X509_PROFILE *profile,
+             const PKI_CONFIG *oids,
+             const ASN1_INTEGER *baseNumber) {
+
+  PKI_X509_CRL *ret = NULL;
+  __CRL_INDEX_ITEM *items = NULL;
+  PKI_X509_CRL_ENTRY *entry = NULL;
+  ASN1_INTEGER *s_int = NULL;
+  ASN1_TIME *r_date = NULL;
+
+  struct timespec start;
+  struct timespec end;
+
+  int num = 0;
+  int i = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if ((ret = __crl_new_unsigned(k, cert, crlNumber_s,
+                validity, profile, baseNumber)) == NULL) return NULL;
+
+  if (b->size > 0) {
+
+    if ((items = PKI_Malloc(sizeof(__CRL_INDEX_ITEM) * (size_t) b->size))
+                  == NULL || (s_int = ASN1_INTEGER_new()) == NULL ||
+                  (r_date = ASN1_TIME_new()) == NULL) {
+      PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+      goto err;
+    }
+
+    for (i = 0; i < b->size; i++) {
+      items[i].data = b->serials.data + b->offsets[i];
+      items[i].size = (int)(b->offsets[i + 1] - b->offsets[i]);
+      items[i].pos = i;
+    }
+
+    if (!b->sorted)
+      qsort(items, (size_t) b->size, sizeof(__CRL_INDEX_ITEM),
+                  __crl_index_item_cmp);
+
+    for (i = 0; i < b->size; i++) {
+
+      // Duplicates are adjacent, the first appended one is used
+      if (i > 0 && __crl_index_key_cmp(items[i].data, 
+            (size_t) items[i].size, items[i-1].data,
+            (size_t) items[i-1].size) == 0) continue;
+
+      if ((entry = X509_REVOKED_new()) == NULL) {
+        PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+        goto err;
+      }
+
+      if (!ASN1_STRING_set(s_int, items[i].data, items[i].size) ||
+            !X509_REVOKED_set_serialNumber(entry, s_int) ||
+            !ASN1_TIME_set(r_date, b->dates[items[i].pos]) ||
+            !X509_REVOKED_set_revocationDate(entry, r_date) ||
+            __crl_entry_set_reason(entry, (PKI_X509_CRL_REASON)
+                  b->reasons[items[i].pos], NULL) == PKI_ERR ||
+            !X509_CRL_add0_revoked(ret->value, entry)) {
+        PKI_ERROR(PKI_ERR_X509_CRL_, "Can not add CRL entry %d", num);
+        X509_REVOKED_free(entry);
+        goto err;
+      }
+      num++;
+    }
+
+    PKI_Free(items);
+    items = NULL;
+  }
+
+  // The entries have been added in their final order, there is no
+  // need to call X509_CRL_sort() here
+  if (__crl_sign(ret, k, cert, profile, oids) == PKI_ERR) goto err;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  b->last_entries = num;
+  b->last_secs = (double)(end.tv_sec - start.tv_sec) +
+                  (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+  PKI_log(PKI_LOG_INFO, "%s built: %d entries in %.3f secs (%.0f entries/sec)",
+    baseNumber ? "Delta CRL" : "CRL", num, b->last_secs, b->last_secs > 0 ? (double) num / b->last_secs : 0);
+
+  if (s_int) ASN1_INTEGER_free(s_int);
+  if (r_date) ASN1_TIME_free(r_date);
+
+  return ret;
+
+err:
+
+  if (items) PKI_Free(items);
+  if (s_int) ASN1_INTEGER_free(s_int);
+  if (r_date) ASN1_TIME_free(r_date);
+  PKI_X509_CRL_free(ret);
+
+  return NULL;
+}
+
+/*! \brief Generates a new signed CRL from the entries in the builder
+ *
+ * The entries are sorted (duplicates are skipped) and added to a new CRL
+ * which is then signed with the passed key. The builder is not modified
+ * (besides the statistics), thus it can be used to generate more CRLs.
+ */
+
+PKI_X509_CRL * PKI_X509_CRL_BUILDER_get_crl(PKI_X509_CRL_BUILDER *b,
+             const PKI_X509_KEYPAIR *k,
+             const PKI_X509_CERT *cert, 
+             const char * crlNumber_s,
+             unsigned long validity,
+             const PKI_X509_PROFILE *profile,
+             const PKI_CONFIG *oids,
+             HSM *hsm) {
+
+  if (!b) {
+    PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+    return NULL;
+  }
+
+  return __crl_builder_sign(b, k, cert, crlNumber_s, validity,
+                            profile, oids, NULL);
+}
+
+/*! \brief Returns the statistics about the last CRL generated by the builder
+ *
+ * Any of the output parameters can be NULL. Returns PKI_ERR if no CRL was
+ * generated yet.
+ */
+
+int PKI_X509_CRL_BUILDER_get_stats(const PKI_X509_CRL_BUILDER *b,
+                                   int *entries,
+                                   double *secs,
+                                   double *rate) {
+
+  if (!b) return PKI_ERR;
+
+  if (entries) *entries = b->last_entries;
+  if (secs) *secs = b->last_secs;
+  if (rate) *rate = b->last_secs > 0 ? (double) b->last_entries / b->last_secs : 0;
+
+  return b->last_secs > 0 ? PKI_OK : PKI_ERR;
+}
+
+/* ----------------------------- Delta CRLs ----------------------------- */
+
+/*
+ * Maps a reason to the value of the reasonCode extension generated for it
+ * (unspecified and missing reasons are equivalent)
+ */
+
+static int __crl_reason_code(int reason) {
+
+  switch (reason) {
+    case PKI_CRL_REASON_HOLD_INSTRUCTION_REJECT:
+    case PKI_CRL_REASON_HOLD_INSTRUCTION_CALLISSUER:
+      return PKI_CRL_REASON_CERTIFICATE_HOLD;
+
+    default:
+      return reason < 0 ? PKI_CRL_REASON_UNSPECIFIED : reason;
+  }
+}
+
+/*! \brief Returns PKI_OK if the CRL is a delta CRL (i.e., it carries the
+ *         deltaCRLIndicator extension) and PKI_ERR otherwise
+ */
+
+int PKI_X509_CRL_is_delta(const PKI_X509_CRL *x) {
+
+  if (!x || !x->value) return PKI_ERR;
+
+  return X509_CRL_get_ext_by_NID((X509_CRL *) x->value, 
+                NID_delta_crl, -1) >= 0 ? PKI_OK : PKI_ERR;
+}
+
+/*! \brief Checks that a delta CRL can be used to update a base CRL
+ *
+ * Returns PKI_OK if the delta CRL has the same issuer of the base CRL and
+ * its BaseCRLNumber is not greater than the CRL number of the base CRL
+ * (RFC 5280, Sec. 5.2.4), PKI_ERR otherwise.
+ */
+
+int PKI_X509_CRL_check_delta(const PKI_X509_CRL *base,
+                             const PKI_X509_CRL *delta) {
+
+  ASN1_INTEGER *baseNumber = NULL;
+  ASN1_INTEGER *crlNumber = NULL;
+  int rv = PKI_ERR;
+
+  if (!base || !base->value || !delta || !delta->value) {
+    PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+    return PKI_ERR;
+  }
+
+  if (PKI_X509_CRL_is_delta(base) == PKI_OK ||
+        PKI_X509_CRL_is_delta(delta) != PKI_OK) {
+    PKI_ERROR(PKI_ERR_X509_CRL_, "Not a base and delta CRLs pair");
+    return PKI_ERR;
+  }
+
+  if (X509_NAME_cmp(X509_CRL_get_issuer((X509_CRL *) base->value),
+          X509_CRL_get_issuer((X509_CRL *) delta->value)) != 0) {
+    PKI_ERROR(PKI_ERR_X509_CRL_, "Base and delta CRLs issuers differ");
+    return PKI_ERR;
+  }
+
+  crlNumber = X509_CRL_get_ext_d2i((X509_CRL *) base->value, 
+                                   NID_crl_number, NULL, NULL);
+  baseNumber = X509_CRL_get_ext_d2i((X509_CRL *) delta->value,
+                                    NID_delta_crl, NULL, NULL);
+
+  if (!crlNumber || !baseNumber) {
+    PKI_ERROR(PKI_ERR_X509_CRL_, "Missing CRL number");
+  } else if (ASN1_INTEGER_cmp(baseNumber, crlNumber) > 0) {
+    PKI_ERROR(PKI_ERR_X509_CRL_, "Delta CRL is for a newer base CRL");
+  } else {
+    rv = PKI_OK;
+  }
+
+  if (crlNumber) ASN1_INTEGER_free(crlNumber);
+  if (baseNumber) ASN1_INTEGER_free(baseNumber);
+
+  return rv;
+}
+
+/*! \brief Find an entry within the revocation set described by a base CRL
+ *         and a delta CRL
+ *
+ * The delta CRL is consulted first: if the serial is listed there with the
+ * removeFromCRL reason the certificate is not revoked (NULL is returned),
+ * otherwise the delta entry is returned. If the serial is not listed in the
+ * delta CRL, the base CRL is searched. The delta CRL is assumed to apply to
+ * the base CRL (see PKI_X509_CRL_check_delta()).
+ */
+
+const PKI_X509_CRL_ENTRY * PKI_X509_CRL_lookup_delta(
+                                          const PKI_X509_CRL *base,
+                                          const PKI_X509_CRL *delta,
+                                          const PKI_INTEGER *s) {
+
+  const PKI_X509_CRL_ENTRY *ret = NULL;
+
+  if (!delta) return PKI_X509_CRL_lookup(base, s);
+
+  if ((ret = PKI_X509_CRL_lookup(delta, s)) != NULL) {
+    if (__crl_index_entry_reason(ret) == PKI_CRL_REASON_REMOVE_FROM_CRL)
+      return NULL;
+    return ret;
+  }
+
+  return PKI_X509_CRL_lookup(base, s);
+}
+
+/*! \brief Generates a delta CRL from the entries in the builder
+ *
+ * The entries in the builder are the complete (current) revocation set,
+ * the generated delta CRL lists:
+ *
+ * - the serials that are not in the base CRL (new revocations)
+ * - the serials whose reason changed (e.g., a certificateHold that became
+ *   a keyCompromise)
+ * - the serials in the base CRL that are not in the builder anymore, with
+ *   the removeFromCRL reason (released from hold or expired)
+ *
+ * The delta CRL carries the (critical) deltaCRLIndicator extension with the
+ * CRL number of the base CRL, thus a CRL number (crlNumber_s or from the
+ * profile) is required.
+ */
+
+PKI_X509_CRL * PKI_X509_CRL_BUILDER_get_delta(PKI_X509_CRL_BUILDER *b,
+             const PKI_X509_CRL *base,
+             const PKI_X509_KEYPAIR *k,
+             const PKI_X509_CERT *cert, 
+             const char * crlNumber_s,
+             unsigned long validity,
+             const PKI_X509_PROFILE *profile,
+             const PKI_CONFIG *oids,
+             HSM *hsm) {
+
+  PKI_X509_CRL *ret = NULL;
+  PKI_X509_CRL_INDEX *idx = NULL;
+  PKI_X509_CRL_BUILDER *d = NULL;
+  ASN1_INTEGER *baseNumber = NULL;
+  unsigned char *seen = NULL;
+  time_t now = time(NULL);
+  int i = 0;
+
+  if (!b || !base || !base->value) {
+    PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+    return NULL;
+  }
+
+  if (PKI_X509_CRL_is_delta(base) == PKI_OK) {
+    PKI_ERROR(PKI_ERR_X509_CRL_, "The base CRL is a delta CRL");
+    return NULL;
+  }
+
+  if ((baseNumber = X509_CRL_get_ext_d2i((X509_CRL *) base->value,
+                        NID_crl_number, NULL, NULL)) == NULL) {
+    PKI_ERROR(PKI_ERR_X509_CRL_, "Missing CRL number in the base CRL");
+    return NULL;
+  }
+
+  if ((idx = PKI_X509_CRL_INDEX_new(base)) == NULL ||
+        (d = PKI_X509_CRL_BUILDER_new(0)) == NULL) goto end;
+
+  if (idx->size > 0 && (seen = PKI_Malloc((size_t) idx->size)) == NULL) {
+    PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+    goto end;
+  }
+
+  // New revocations and changed reasons
+  for (i = 0; i < b->size; i++) {
+
+    const unsigned char *serial = b->serials.data + b->offsets[i];
+    size_t size = b->offsets[i + 1] - b->offsets[i];
+    int pos = PKI_X509_CRL_INDEX_find(idx, serial, size, 0);
+
+    if (pos >= 0) {
+
+      // Only the first occurrence of a serial is considered
+      if (seen[pos]) continue;
+      seen[pos] = 1;
+
+      if (__crl_reason_code(b->reasons[i]) == 
+            __crl_reason_code(idx->reasons[pos])) continue;
+    }
+
+    if (PKI_X509_CRL_BUILDER_add(d, serial, size, b->dates[i],
+            (PKI_X509_CRL_REASON) b->reasons[i]) == PKI_ERR) goto end;
+  }
+
+  // Serials that are not revoked anymore
+  for (i = 0; i < idx->size; i++) {
+
+    const unsigned char *serial = idx->serials + idx->offsets[i];
+    size_t size = idx->offsets[i + 1] - idx->offsets[i];
+
+    // Skips the found and the (invalid) negative serials
+    if (seen[i] || serial[0]) continue;
+
+    if (PKI_X509_CRL_BUILDER_add(d, serial + 1, size - 1, now,
+            PKI_CRL_REASON_REMOVE_FROM_CRL) == PKI_ERR) goto end;
+  }
+
+  if ((ret = __crl_builder_sign(d, k, cert, crlNumber_s, validity,
+                                profile, oids, baseNumber)) != NULL) {
+    b->last_entries = d->last_entries;
+    b->last_secs = d->last_secs;
+  }
+
+end:
+
+  if (seen) PKI_Free(seen);
+  if (d) PKI_X509_CRL_BUILDER_free(d);
+  if (idx) PKI_X509_CRL_INDEX_free(idx);
+  ASN1_INTEGER_free(baseNumber);
+
+  return ret;
 }
 
 /*! \brief Adds an Extension to a CRL object
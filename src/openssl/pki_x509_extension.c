@@ -100,11 +100,18 @@ void PKI_X509_EXTENSION_free ( PKI_X509_EXTENSION *ext ) {
 }
 
 
-PKI_X509_EXTENSION *PKI_X509_EXTENSION_value_new_profile ( 
+/*! \brief Returns the value of an extension node of a profile in the
+ *         X509V3 configuration syntax (e.g., "critical,CA:TRUE")
+ *
+ * The name of the extension is returned in name. Both the returned value
+ * and the name must be freed by the caller (PKI_Free).
+ */
+
+char * PKI_X509_EXTENSION_get_profile_conf(
 						const PKI_X509_PROFILE   * profile,
 						const PKI_CONFIG         * oids,
 						const PKI_CONFIG_ELEMENT * extNode,
-						const PKI_TOKEN          * tk) {
+						char                    ** name) {
 
 	/* TODO: Implement the extended version of the extensions, this
 	   should allow better extensions management. That is, the value
@@ -127,10 +134,7 @@ PKI_X509_EXTENSION *PKI_X509_EXTENSION_value_new_profile (
 
 	  */
 
-	PKI_X509_EXTENSION *ret = NULL;
-
 	PKI_CONFIG_ELEMENT *valNode = NULL;
-	PKI_X509_EXTENSION_VALUE *ext = NULL;
 
 	xmlChar *type_s = NULL;
 	xmlChar *tag_s = NULL;
@@ -141,19 +145,16 @@ PKI_X509_EXTENSION *PKI_X509_EXTENSION_value_new_profile (
 
 	PKI_OID *oid = NULL;
 
-
-	X509V3_CTX v3_ctx;
-	CONF *conf = NULL;
-
-	char *envValString = NULL;
 	char *valString = NULL;
 	int crit = 0;
 
-	if (!profile || !extNode) {
+	if (!profile || !extNode || !name) {
 		PKI_ERROR(PKI_ERR_PARAM_NULL, "No profile or extNode provided");
 		return NULL;
 	}
 
+	*name = NULL;
+
 	if ((crit_s = xmlGetProp((PKI_CONFIG_ELEMENT *)extNode, BAD_CAST "critical" )) != NULL ) {
 
 		if( strncmp_nocase((char *) crit_s, "y", 1 ) == 0) {
@@ -174,6 +175,8 @@ PKI_X509_EXTENSION *PKI_X509_EXTENSION_value_new_profile (
 		if ((oid = PKI_CONFIG_OID_search((PKI_CONFIG *)oids, (char *)name_s)) == NULL)
 		{
 			PKI_ERROR(PKI_ERR_OBJECT_CREATE, NULL);
+			xmlFree(name_s);
+			if (crit_s) xmlFree(crit_s);
 			return NULL;
 		}
 	}
@@ -276,37 +279,86 @@ PKI_X509_EXTENSION *PKI_X509_EXTENSION_value_new_profile (
         	}
 	}
 
-	v3_ctx.db = NULL;
-	v3_ctx.db_meth = NULL;
-	v3_ctx.crl = NULL;
-	v3_ctx.flags = 0;
-
-	if ( tk ) {
-		v3_ctx.issuer_cert  =  (X509 *)
-			PKI_X509_get_value ( tk->cacert );
-		v3_ctx.subject_cert =  (X509 *)
-			PKI_X509_get_value ( tk->cert );
-		v3_ctx.subject_req  =  (X509_REQ *)
-			PKI_X509_get_value ( tk->req );
-	} else {
-		v3_ctx.issuer_cert = NULL;
-		v3_ctx.subject_cert = NULL;
-		v3_ctx.subject_req = NULL;
+	*name = strdup((char *) name_s);
+
+	if( name_s ) xmlFree ( name_s );
+	if( crit_s ) xmlFree (crit_s );
+
+	if (*name == NULL) {
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		PKI_Free(valString);
+		return NULL;
+	}
+
+	return valString;
+}
+
+/*! \brief Builds an extension from its X509V3 configuration value
+ *
+ * The issuer and subject certificates (and the request) are used for
+ * the values that are derived from them (e.g., keyid, issuer:copy). If
+ * nid is NID_undef, the extension is looked up by name.
+ */
+
+PKI_X509_EXTENSION_VALUE * PKI_X509_EXTENSION_VALUE_new_conf(
+					int                         nid,
+					const char                * name,
+					const char                * value,
+					const PKI_X509_CERT_VALUE * issuer,
+					const PKI_X509_CERT_VALUE * subject,
+					const PKI_X509_REQ_VALUE  * req) {
+
+	PKI_X509_EXTENSION_VALUE *ext = NULL;
+
+	X509V3_CTX v3_ctx;
+	CONF *conf = NULL;
+
+	if ((nid == NID_undef && !name) || !value) {
+		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+		return NULL;
 	}
 
+	X509V3_set_ctx(&v3_ctx, (X509 *) issuer, (X509 *) subject,
+			(X509_REQ *) req, NULL, 0);
+
 	/* Sets the ctx.db and ctx.method */
 	conf = NCONF_new( NULL );
 	X509V3_set_nconf(&v3_ctx, conf);
 
-	if (valString) {
-		ext = X509V3_EXT_conf(NULL, &v3_ctx, (char *) name_s, 
-						(char *) valString);
-	} else if ((envValString = get_env_string(valString)) != NULL) {
-		ext = X509V3_EXT_conf(NULL, &v3_ctx, (char *) name_s, 
-						(char *) envValString);
-		PKI_Free(envValString);
+	if (nid != NID_undef) {
+		ext = X509V3_EXT_conf_nid(NULL, &v3_ctx, nid, (char *) value);
+	} else {
+		ext = X509V3_EXT_conf(NULL, &v3_ctx, (char *) name,
+						(char *) value);
+	}
+
+	if( conf ) NCONF_free ( conf );
+
+	return ext;
+}
+
+PKI_X509_EXTENSION *PKI_X509_EXTENSION_value_new_profile ( 
+						const PKI_X509_PROFILE   * profile,
+						const PKI_CONFIG         * oids,
+						const PKI_CONFIG_ELEMENT * extNode,
+						const PKI_TOKEN          * tk) {
+
+	PKI_X509_EXTENSION *ret = NULL;
+	PKI_X509_EXTENSION_VALUE *ext = NULL;
+
+	char *name_s = NULL;
+	char *valString = NULL;
+
+	if ((valString = PKI_X509_EXTENSION_get_profile_conf(profile, oids,
+						extNode, &name_s)) == NULL) {
+		return NULL;
 	}
 
+	ext = PKI_X509_EXTENSION_VALUE_new_conf(NID_undef, name_s, valString,
+		tk ? PKI_X509_get_value(tk->cacert) : NULL,
+		tk ? PKI_X509_get_value(tk->cert) : NULL,
+		tk ? PKI_X509_get_value(tk->req) : NULL);
+
 	if (!ext) {
 		PKI_DEBUG("Can not generate the extension value from (%s=%s)", 
 			name_s, valString);
@@ -318,18 +370,18 @@ PKI_X509_EXTENSION *PKI_X509_EXTENSION_value_new_profile (
         if(( ret = PKI_X509_EXTENSION_new()) == NULL ) {
 		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
 		X509_EXTENSION_free ( ext );
-		return NULL;
+		goto err;
 	}
 
+	// Replaces the empty value allocated by PKI_X509_EXTENSION_new()
+	if (ret->value) X509_EXTENSION_free(ret->value);
+
 	ret->value = ext;
 	ret->oid = X509_EXTENSION_get_object(ext);
 
 err:
-	if( name_s ) xmlFree ( name_s );
-	if( crit_s ) xmlFree (crit_s );
-
+	if( name_s ) PKI_Free ( name_s );
 	if( valString ) PKI_Free ( valString );
-	if( conf ) NCONF_free ( conf );
 
 	return ( ret );
 }
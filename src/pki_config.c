@@ -16,6 +16,43 @@ static char *def_conf_dirs[] = {
 };
 
 #define PKI_DEF_CONF_DIRS_SIZE	2
+
+/* Number of buckets and max number of entries of the per-document cache */
+#define PKI_CONFIG_CACHE_BUCKETS	64
+#define PKI_CONFIG_CACHE_MAX_ENTRIES	512
+
+/* Cached search, results are valid for the document's stamp only */
+typedef struct pki_config_cache_entry_st {
+	char *search;
+	unsigned long hash;
+	// Compiled XPath expression (namespace already added)
+	xmlXPathCompExpr *comp;
+	// Stamp of the document when the results were collected
+	unsigned long stamp;
+	// Matching elements (same order as PKI_CONFIG_get_element_stack)
+	PKI_CONFIG_ELEMENT **nodes;
+	int nodes_num;
+	// Raw content of the selected (last) element, if already requested
+	char *value;
+	int has_value;
+	struct pki_config_cache_entry_st *next;
+} PKI_CONFIG_CACHE_ENTRY;
+
+/* Per-document cache, referenced by the document's _private pointer */
+typedef struct pki_config_cache_st {
+	pthread_mutex_t lock;
+	// Modification stamp (see PKI_CONFIG_get_stamp)
+	unsigned long stamp;
+	xmlXPathContext *xpathCtx;
+	PKI_CONFIG_CACHE_ENTRY *buckets[PKI_CONFIG_CACHE_BUCKETS];
+	int size;
+} PKI_CONFIG_CACHE;
+
+/* Source of the modification stamps, also protects the cache creation */
+static struct {
+	pthread_mutex_t lock;
+	unsigned long last;
+} __config_stamp = { PTHREAD_MUTEX_INITIALIZER, 0 };
 #define LIBXML_MIN_VERSION 20600
 
 #if LIBXML_VERSION < LIBXML_MIN_VERSION
@@ -89,6 +126,195 @@ static char * _xml_search_namespace_add ( char *search ) {
 	return( ret );
 }
 
+/* ----------------------- Search Cache Functions ------------------------ */
+
+static void __config_cache_entry_reset(PKI_CONFIG_CACHE_ENTRY *e) {
+
+	if (e->nodes) PKI_Free(e->nodes);
+	if (e->value) PKI_Free(e->value);
+
+	e->nodes = NULL;
+	e->nodes_num = 0;
+	e->value = NULL;
+	e->has_value = 0;
+}
+
+static void __config_cache_flush(PKI_CONFIG_CACHE *c) {
+
+	PKI_CONFIG_CACHE_ENTRY *e = NULL;
+	int i = 0;
+
+	for (i = 0; i < PKI_CONFIG_CACHE_BUCKETS; i++) {
+		while ((e = c->buckets[i]) != NULL) {
+			c->buckets[i] = e->next;
+			__config_cache_entry_reset(e);
+			if (e->comp) xmlXPathFreeCompExpr(e->comp);
+			PKI_Free(e->search);
+			PKI_Free(e);
+		}
+	}
+
+	c->size = 0;
+}
+
+static void __config_cache_free(PKI_CONFIG_CACHE *c) {
+
+	if (!c) return;
+
+	__config_cache_flush(c);
+
+	if (c->xpathCtx) xmlXPathFreeContext(c->xpathCtx);
+	pthread_mutex_destroy(&c->lock);
+
+	PKI_Free(c);
+}
+
+/* Returns the cache of the document, it is allocated on first use */
+static PKI_CONFIG_CACHE * __config_cache_get(const PKI_CONFIG *doc) {
+
+	PKI_CONFIG_CACHE *c = NULL;
+
+	pthread_mutex_lock(&__config_stamp.lock);
+
+	if ((c = (PKI_CONFIG_CACHE *) doc->_private) == NULL &&
+		(c = PKI_Malloc(sizeof(PKI_CONFIG_CACHE))) != NULL) {
+
+		pthread_mutex_init(&c->lock, NULL);
+		c->stamp = ++__config_stamp.last;
+		((PKI_CONFIG *) doc)->_private = c;
+	}
+
+	pthread_mutex_unlock(&__config_stamp.lock);
+
+	if (!c) PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+
+	return c;
+}
+
+/* Returns the results of the search, the cache must be locked */
+static PKI_CONFIG_CACHE_ENTRY * __config_cache_search(PKI_CONFIG_CACHE *c,
+						const PKI_CONFIG *doc,
+						const char *search) {
+
+	PKI_CONFIG_CACHE_ENTRY *e = NULL;
+	xmlXPathObject *xpathObj = NULL;
+	xmlNodeSet *nodes = NULL;
+	unsigned long h = 2166136261UL;
+	const char *pnt = NULL;
+	int i = 0;
+
+	// FNV-1a over the search path
+	for (pnt = search; *pnt; pnt++) {
+		h ^= (unsigned long) (unsigned char) *pnt;
+		h *= 16777619UL;
+	}
+
+	for (e = c->buckets[h % PKI_CONFIG_CACHE_BUCKETS]; e; e = e->next) {
+		if (e->hash == h && strcmp(e->search, search) == 0) break;
+	}
+
+	if (e && e->stamp == c->stamp) return e;
+
+	if (!e) {
+
+		char *my_search = NULL;
+
+		// Searches built from user data (e.g., OID names) can fill
+		// up the cache, let's start over when it is full
+		if (c->size >= PKI_CONFIG_CACHE_MAX_ENTRIES)
+			__config_cache_flush(c);
+
+		if (!c->xpathCtx) {
+			if ((c->xpathCtx = xmlXPathNewContext((PKI_CONFIG *)doc)) == NULL) {
+				PKI_log_err("Unable to create new XPath context [Search: %s]",
+					search);
+				return NULL;
+			}
+			xmlXPathRegisterNs(c->xpathCtx, (xmlChar *) PKI_NAMESPACE_PREFIX,
+						(xmlChar *) PKI_NAMESPACE_HREF);
+		}
+
+		if ((e = PKI_Malloc(sizeof(PKI_CONFIG_CACHE_ENTRY))) == NULL ||
+				(e->search = strdup(search)) == NULL) {
+			PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+			if (e) PKI_Free(e);
+			return NULL;
+		}
+
+		// Invalid expressions are cached as well (no results)
+		my_search = _xml_search_namespace_add((char *)search);
+		e->comp = xmlXPathCtxtCompile(c->xpathCtx, (xmlChar *) my_search);
+		PKI_Free(my_search);
+
+		e->hash = h;
+		e->next = c->buckets[h % PKI_CONFIG_CACHE_BUCKETS];
+		c->buckets[h % PKI_CONFIG_CACHE_BUCKETS] = e;
+		c->size++;
+	}
+
+	__config_cache_entry_reset(e);
+	e->stamp = c->stamp;
+
+	if (!e->comp ||
+		(xpathObj = xmlXPathCompiledEval(e->comp, c->xpathCtx)) == NULL)
+		return e;
+
+	if ((nodes = xpathObj->nodesetval) != NULL && nodes->nodeNr > 0) {
+
+		if ((e->nodes = PKI_Malloc(sizeof(PKI_CONFIG_ELEMENT *) *
+						(size_t) nodes->nodeNr)) != NULL) {
+
+			// Same order as the one of the returned stacks
+			for (i = nodes->nodeNr - 1; i >= 0; i--) {
+				if (nodes->nodeTab[i]->type != XML_ELEMENT_NODE)
+					continue;
+				e->nodes[e->nodes_num++] = nodes->nodeTab[i];
+			}
+		}
+	}
+
+	xmlXPathFreeObject(xpathObj);
+
+	return e;
+}
+
+/* Assigns a new modification stamp to the document (drops the results
+ * of the cached searches) */
+static void _pki_update_config ( PKI_CONFIG *doc ) {
+
+	PKI_CONFIG_CACHE *c = NULL;
+
+	if ((c = __config_cache_get(doc)) == NULL) return;
+
+	pthread_mutex_lock(&c->lock);
+	pthread_mutex_lock(&__config_stamp.lock);
+	c->stamp = ++__config_stamp.last;
+	pthread_mutex_unlock(&__config_stamp.lock);
+	pthread_mutex_unlock(&c->lock);
+}
+
+/*! \brief Returns the modification stamp of a PKI_CONFIG
+ *
+ * Stamps are unique across documents and they change every time the
+ * document is modified through the PKI_CONFIG_ELEMENT_add_* functions,
+ * therefore they can be used to detect if data derived from the document
+ * (e.g., a compiled profile) is stale. Returns 0 if doc is NULL.
+ */
+
+unsigned long PKI_CONFIG_get_stamp(const PKI_CONFIG *doc) {
+
+	PKI_CONFIG_CACHE *c = NULL;
+	unsigned long ret = 0;
+
+	if (!doc || (c = __config_cache_get(doc)) == NULL) return 0;
+
+	pthread_mutex_lock(&c->lock);
+	ret = c->stamp;
+	pthread_mutex_unlock(&c->lock);
+
+	return ret;
+}
+
 /*! \brief Loads a PKI_CONFIG object (XML config file) */
 
 PKI_CONFIG * PKI_CONFIG_load(const char *urlPath)
@@ -157,6 +383,10 @@ void PKI_CONFIG_free_void ( void * doc )
 int PKI_CONFIG_free ( PKI_CONFIG * doc ) {
 	if( !doc ) return (PKI_OK);
 
+	// Search cache (see PKI_CONFIG_get_element_stack)
+	__config_cache_free((PKI_CONFIG_CACHE *) doc->_private);
+	doc->_private = NULL;
+
 	xmlFreeDoc( doc );
 
 	/*
@@ -232,6 +462,8 @@ PKI_CONFIG * PKI_CONFIG_OID_load(const char *oidFile ) {
 		}
 	}
 
+	PKI_STACK_CONFIG_ELEMENT_free ( sk );
+
 	return (doc);
 }
 
@@ -292,6 +524,8 @@ PKI_OID * PKI_CONFIG_OID_search(const PKI_CONFIG *doc, const char *searchName )
 		}
 	}
 
+	PKI_STACK_CONFIG_ELEMENT_free ( sk );
+
 	return (oid);
 }
 
@@ -319,28 +553,63 @@ PKI_STACK * PKI_CONFIG_get_stack_value(const PKI_CONFIG *doc, const char *search
 	while ((curr = PKI_STACK_CONFIG_ELEMENT_pop ( sk )) != NULL ) {
 		if( curr && curr->type == XML_ELEMENT_NODE ) {
 			if((val = PKI_CONFIG_get_element_value ( curr )) != NULL ) {
-				PKI_STACK_push ( ret, strdup (val) );
+				PKI_STACK_push ( ret, val );
 			}
 		}
 	}
 
-	PKI_STACK_free_all ( sk );
+	PKI_STACK_CONFIG_ELEMENT_free ( sk );
 
 	return ret;
 }
 
 
-/*! \brief Returns the first value found via the provided search path */
+/*! \brief Returns the first value found via the provided search path
+ *
+ * The raw content of the element is kept in the document's cache, repeated
+ * lookups of the same path do not evaluate the XPath expression again.
+ */
 
 char * PKI_CONFIG_get_value(const PKI_CONFIG *doc, const char *search ) {
 
-	PKI_CONFIG_ELEMENT *curr = NULL;
+	PKI_CONFIG_CACHE *c = NULL;
+	PKI_CONFIG_CACHE_ENTRY *e = NULL;
+	char *ret = NULL;
+
+	if (!doc || !search) return NULL;
+
+	if ((c = __config_cache_get(doc)) == NULL) return NULL;
 
-	if (( curr = PKI_CONFIG_get_element ( doc, search, -1 )) == NULL ) {
+	pthread_mutex_lock(&c->lock);
+
+	if ((e = __config_cache_search(c, doc, search)) == NULL ||
+			e->nodes_num <= 0) {
+		pthread_mutex_unlock(&c->lock);
+		PKI_DEBUG("Element Not Found [Search: %s, Position: %d]", search, -1);
 		return NULL;
 	}
 
-	return PKI_CONFIG_get_element_value ( curr );
+	if (!e->has_value) {
+
+		xmlChar *val = NULL;
+
+		// Snapshot of the raw content, the environment variables
+		// are expanded at every lookup
+		if ((val = xmlNodeGetContent(e->nodes[e->nodes_num - 1])) != NULL) {
+			e->value = strdup((char *) val);
+			xmlFree(val);
+		}
+		e->has_value = 1;
+	}
+
+	if (e->value) {
+		if (strchr(e->value, '$')) ret = get_env_string(e->value);
+		else ret = strdup(e->value);
+	}
+
+	pthread_mutex_unlock(&c->lock);
+
+	return ret;
 }
  
 /*! \brief Returns the value of the named attribute in the searched item */
@@ -369,21 +638,20 @@ char * PKI_CONFIG_get_attribute_value(const PKI_CONFIG *doc,
 
 int PKI_CONFIG_get_elements_num(const PKI_CONFIG *doc, const char *search ) {
 
-	PKI_STACK *sk = NULL;
+	PKI_CONFIG_CACHE *c = NULL;
+	PKI_CONFIG_CACHE_ENTRY *e = NULL;
 	int ret = -1;
-	PKI_CONFIG_ELEMENT *pnt = NULL;
 
-	if((sk = PKI_CONFIG_get_element_stack((PKI_CONFIG *)doc, search )) == NULL ) {
-		return -1;
-	}
+	if (!doc || !search) return -1;
 
-	ret = PKI_STACK_elements ( sk );
+	if ((c = __config_cache_get(doc)) == NULL) return -1;
 
-	while((pnt = PKI_STACK_pop ( sk)) != NULL ) {
-		// Nothing, we do not want to free the node's memory!
+	pthread_mutex_lock(&c->lock);
+	if ((e = __config_cache_search(c, doc, search)) != NULL &&
+			e->nodes_num > 0) {
+		ret = e->nodes_num;
 	}
-
-	PKI_STACK_free ( sk );
+	pthread_mutex_unlock(&c->lock);
 
 	return ret;
 }
@@ -394,113 +662,77 @@ PKI_CONFIG_ELEMENT * PKI_CONFIG_get_element(const PKI_CONFIG * doc,
 					    const char       * search,
 					    int                num ) {
 
-	PKI_CONFIG_ELEMENT_STACK *sk = NULL;
-		// Stack of Elements from the Search
-
+	PKI_CONFIG_CACHE *c = NULL;
+	PKI_CONFIG_CACHE_ENTRY *e = NULL;
 	PKI_CONFIG_ELEMENT *ret = NULL;
-    // Return Value
-  
-	PKI_CONFIG_ELEMENT *tmp_el = NULL;
-		// Temporary reference used to free
-		// the nodes from the returned stack
+		// Return Value
 
   	// Some input checks
 	if (!doc || !search) return NULL;
 
+	if ((c = __config_cache_get(doc)) == NULL) return NULL;
+
+	pthread_mutex_lock(&c->lock);
+
 	// Checks if the search returns any element(s)
-	if ((sk = PKI_CONFIG_get_element_stack((PKI_CONFIG *)doc, search)) == NULL) {
+	if ((e = __config_cache_search(c, doc, search)) == NULL ||
+			e->nodes_num <= 0) {
+		pthread_mutex_unlock(&c->lock);
 		PKI_DEBUG("Element Not Found [Search: %s, Position: %d]", search, num);
 		return NULL;
 	}
-  
-  // Use the magic 'negative' values as setting for the last
+
+	// Use the magic 'negative' values as setting for the last
 	// element in the stack
-	if ( num < 0 ) num = PKI_STACK_CONFIG_ELEMENT_elements ( sk ) - 1;
-  
-  // Gets the right element
-	if ((ret = PKI_STACK_CONFIG_ELEMENT_get_num(sk, num)) == NULL) {
+	if (num < 0) num = e->nodes_num - 1;
+
+	// Gets the right element
+	if (num < e->nodes_num) ret = e->nodes[num];
+
+	pthread_mutex_unlock(&c->lock);
+
+	if (!ret) {
 		PKI_DEBUG("Can not get element number %d from the search [Search: %s]",
 			num, search);
-  }
-  
-	// Free all remaining parts of the stack
-	while ((tmp_el = PKI_STACK_CONFIG_ELEMENT_pop(sk)) != NULL) {
-		// Nothing to do - the elements are xmlNode and
-		// the memory would be freed with xmlFreeNode function,
-		// however, it is our understanding that the passed
-		// nodes are just references and do not need to be
-		// freed by the calling function
-		//
-		// Not Needed: xmlFreeNode(tmp_el);
 	}
 
-	// Free all the remaining memory
-	PKI_STACK_CONFIG_ELEMENT_free_all(sk);
-
 	// All Done.
 	return ret;
 }
 
-/*! \brief Returns the stack of elements identified by the search path */
+/*! \brief Returns the stack of elements identified by the search path
+ *
+ * XPath expressions are compiled once and their results are cached in
+ * the document until it is modified (see PKI_CONFIG_get_stamp). The
+ * returned stack holds references to the document's nodes, it must be
+ * freed with PKI_STACK_CONFIG_ELEMENT_free().
+ */
 
 PKI_CONFIG_ELEMENT_STACK * PKI_CONFIG_get_element_stack(const PKI_CONFIG * doc, 
 							const char * search ) {
 
-	xmlXPathContext *xpathCtx = NULL; 
-	xmlXPathObject *xpathObj = NULL;
-	xmlNodeSet *nodes = NULL;
-
+	PKI_CONFIG_CACHE *c = NULL;
+	PKI_CONFIG_CACHE_ENTRY *e = NULL;
 	PKI_CONFIG_ELEMENT_STACK *ret = NULL;
 
-	int size = 0;
 	int i = 0;
 
-	char *my_search = NULL;
-
 	if( !doc || !search ) return (NULL);
 
-	xpathCtx = xmlXPathNewContext((PKI_CONFIG *)doc);
-	if(xpathCtx == NULL) {
-        	PKI_log_err("Unable to create new XPath context [Search: %s]",
-        		search);
-		return NULL;
-	}
-
-	xmlXPathRegisterNs(xpathCtx, (xmlChar *) PKI_NAMESPACE_PREFIX, 
-					(xmlChar *) PKI_NAMESPACE_HREF);
-
-	my_search = _xml_search_namespace_add((char *)search);
+	if ((c = __config_cache_get(doc)) == NULL) return NULL;
 
-	xpathObj = xmlXPathEvalExpression( (xmlChar *) my_search, xpathCtx);
-	if( xpathObj == NULL ) {
-		xmlXPathFreeContext(xpathCtx);
-		PKI_Free ( my_search );
-		return(NULL);
-	}
-
-	nodes = xpathObj->nodesetval;
-	if( nodes ) {
-		size = nodes->nodeNr;
-	} else {
-		size = -1;
-	}
+	pthread_mutex_lock(&c->lock);
 
-	if( size > 0 ) {
-		ret = PKI_STACK_CONFIG_ELEMENT_new();
+	if ((e = __config_cache_search(c, doc, search)) != NULL &&
+			e->nodes_num > 0 &&
+			(ret = PKI_STACK_CONFIG_ELEMENT_new()) != NULL) {
 
-		/* recursively copy the node */
-		for( i = size-1; i >= 0; i-- ) {
-			if( nodes->nodeTab[i]->type != XML_ELEMENT_NODE )
-				continue;
-			// curr = xmlCopyNode( nodes->nodeTab[i], 1);
-			PKI_STACK_CONFIG_ELEMENT_push( ret, nodes->nodeTab[i] );
+		for (i = 0; i < e->nodes_num; i++) {
+			PKI_STACK_CONFIG_ELEMENT_push(ret, e->nodes[i]);
 		}
 	}
 
-	xmlXPathFreeObject(xpathObj);
-	xmlXPathFreeContext(xpathCtx);
-
-	PKI_Free ( my_search );
+	pthread_mutex_unlock(&c->lock);
 
 	return (ret);
 }
@@ -1013,7 +1245,7 @@ int PKI_CONFIG_ELEMENT_add_attribute(PKI_CONFIG         * doc,
 	// snprintf(buf, sizeof(buf), "%s", PKI_NAMESPACE_PREFIX, name );
 	xmlNewProp( node, BAD_CAST name, BAD_CAST value );
 
-	// if( doc ) _pki_update_config ( &doc );
+	if( doc ) _pki_update_config ( doc );
 	 
 	return ( PKI_OK );
 }
@@ -1059,7 +1291,7 @@ PKI_CONFIG_ELEMENT *PKI_CONFIG_ELEMENT_add_child(PKI_CONFIG         * doc,
 
 	// xmlFreeNs ( ns );
 
-	// if(doc) _pki_update_config( &doc );
+	if( ret && doc ) _pki_update_config( doc );
 
 	return ( ret );
 }
@@ -1073,7 +1305,7 @@ PKI_CONFIG_ELEMENT *PKI_CONFIG_ELEMENT_add_child_el ( PKI_CONFIG * doc,
 
 	xmlAddChild( node, el );
 
-	// if ( doc ) _pki_update_config ( &doc );
+	if ( doc ) _pki_update_config ( doc );
 
 	return ( el );
 }
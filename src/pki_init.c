@@ -217,6 +217,10 @@ void PKI_final_all( void )
 {
 	if ( _libpki_init != 0)
 	{
+		PKI_X509_KEYPAIR_POOL_cleanup();
+		PKI_DNS_CACHE_cleanup();
+		PKI_URL_CACHE_cleanup();
+		PKI_DIGEST_CTX_flush();
 		xmlCleanupParser();
 		ERR_free_strings();
 		EVP_cleanup();
@@ -21,6 +21,58 @@ static pthread_cond_t log_cond;
 static pthread_mutex_t log_res_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t log_res_cond;
 
+/* Asynchronous logging - ring of formatted entries consumed by a writer
+ * thread. Sizes must be powers of two. */
+#define PKI_LOG_ASYNC_RING_SIZE		4096
+#define PKI_LOG_ASYNC_LINE_SIZE		1024
+#define PKI_LOG_ASYNC_BATCH_SIZE	65536
+#define PKI_LOG_ASYNC_WAIT_MSECS	100
+
+typedef struct pki_log_async_slot_st {
+	size_t seq;
+	size_t len;
+	int level;
+	char data[PKI_LOG_ASYNC_LINE_SIZE];
+} PKI_LOG_ASYNC_SLOT;
+
+typedef struct pki_log_async_st {
+	/* Ring of entries, it is never freed as producers might still be
+	 * running while the log is finalized */
+	PKI_LOG_ASYNC_SLOT *ring;
+	size_t head;
+	size_t tail;
+
+	/* Writer thread and its output */
+	PKI_THREAD *writer;
+	PKI_LOG_TYPE type;
+	int fd;
+	int stop;
+	int sleeping;
+
+	/* Producers currently queueing entries, the finalization waits for
+	 * them after clearing the accepting flag */
+	int accepting;
+	unsigned long producers;
+
+	/* Wakes up the writer */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	/* Entries dropped because the ring was full */
+	unsigned long dropped;
+	unsigned long reported;
+} PKI_LOG_ASYNC;
+
+static PKI_LOG_ASYNC _log_async = {
+	NULL, 0, 0, NULL, PKI_LOG_TYPE_SYSLOG, -1, 0, 0, 0, 0,
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0
+};
+
+/* Per-thread formatting buffer and cached timestamp */
+static __thread char _log_tls_line[PKI_LOG_ASYNC_LINE_SIZE];
+static __thread char _log_tls_time[32];
+static __thread time_t _log_tls_sec = 0;
+
 /* Local function prototypes */
 static int _pki_syslog_init( PKI_LOG *l );
 static int _pki_stdout_init( PKI_LOG *l );
@@ -37,6 +89,11 @@ static int _pki_stdout_finalize( PKI_LOG *l );
 static int _pki_stderr_finalize( PKI_LOG *l );
 static int _pki_file_finalize( PKI_LOG *l );
 
+static int _pki_async_init( PKI_LOG *l );
+static const char * _pki_async_time( void );
+static void _pki_async_add( int, const char *fmt, va_list ap );
+static int _pki_async_finalize( PKI_LOG *l );
+
 static int _pki_syslog_entry_sign( PKI_LOG *l, char *entry );
 static int _pki_stdout_entry_sign( PKI_LOG *l, char *entry );
 static int _pki_file_entry_sign( PKI_LOG *l, char *entry );
@@ -90,6 +147,9 @@ int PKI_log_init ( PKI_LOG_TYPE type, PKI_LOG_LEVEL level, char *resource,
 	pthread_mutex_lock( &log_res_mutex );
 	pthread_mutex_lock( &log_mutex );
 
+	/* Stops the writer of a previous asynchronous log */
+	if ( _log_async.writer ) _pki_async_finalize( &_log_st );
+
 	_log_st.type  = type;
 	_log_st.level = level;
 
@@ -171,6 +231,17 @@ int PKI_log_init ( PKI_LOG_TYPE type, PKI_LOG_LEVEL level, char *resource,
 		ret = _log_st.init( & _log_st );
 	}
 
+	/* The entries are formatted by the callers and written by a
+	   background thread */
+	if ( ret == PKI_OK && (flags & PKI_LOG_FLAGS_ASYNC) ) {
+		if ((ret = _pki_async_init( & _log_st )) == PKI_OK) {
+			_log_st.add = _pki_async_add;
+			_log_st.finalize = _pki_async_finalize;
+		} else {
+			_log_st.flags &= ~PKI_LOG_FLAGS_ASYNC;
+		}
+	}
+
 err:
 	pthread_cond_signal ( &log_cond );
 	pthread_mutex_unlock( &log_mutex );
@@ -216,6 +287,32 @@ int PKI_log_end( void )
 	return ret;
 }
 
+/*! \brief Returns the number of entries dropped by the asynchronous log
+ *         because the writer could not keep up */
+
+unsigned long PKI_log_dropped( void ) {
+
+	return __atomic_load_n( &_log_async.dropped, __ATOMIC_RELAXED );
+}
+
+/* Dispatches an entry to the add callback. Asynchronous logging does not
+ * need the resource mutex, entries are queued without blocking. */
+
+static void _pki_log_add( int level, const char *fmt, va_list ap ) {
+
+	if ( _log_st.flags & PKI_LOG_FLAGS_ASYNC ) {
+		if ( _log_st.add ) _log_st.add( level, fmt, ap );
+		return;
+	}
+
+	pthread_mutex_lock( &log_res_mutex );
+
+	if( _log_st.add ) _log_st.add( level, fmt, ap );
+
+	pthread_mutex_unlock( &log_res_mutex );
+	pthread_cond_signal ( &log_res_cond );
+}
+
 /*! \brief Add an entry in the log */
 
 void PKI_log( int level, const char *fmt, ... ) {
@@ -225,13 +322,9 @@ void PKI_log( int level, const char *fmt, ... ) {
 	if( (_log_st.add) && ((level == PKI_LOG_ALWAYS) ||
 			((level > PKI_LOG_NONE) && (level <= _log_st.level))) ) {
 
-		pthread_mutex_lock( &log_res_mutex );
 		va_start (ap, fmt);
-			_log_st.add( level, fmt, ap );
+		_pki_log_add( level, fmt, ap );
 		va_end (ap);
-
-		pthread_mutex_unlock( &log_res_mutex );
-		pthread_cond_signal ( &log_res_cond );
 	}
 
 	return;
@@ -248,15 +341,10 @@ void PKI_log_debug_simple( const char *fmt, ... ) {
 		return;
 	}
 
-	pthread_mutex_lock( &log_res_mutex );
-
 	va_start (ap, fmt);
-	if( _log_st.add ) _log_st.add ( PKI_LOG_INFO, fmt, ap );
+	_pki_log_add( PKI_LOG_INFO, fmt, ap );
 	va_end (ap);
 
-	pthread_mutex_unlock( &log_res_mutex );
-	pthread_cond_signal ( &log_res_cond );
-
 	return;
 }
 
@@ -266,15 +354,10 @@ void PKI_log_err_simple( const char *fmt, ... ) {
 
 	va_list ap;
 
-	pthread_mutex_lock( &log_res_mutex );
-
 	va_start (ap, fmt);
-	if( _log_st.add ) _log_st.add ( PKI_LOG_ERR, fmt, ap );
+	_pki_log_add( PKI_LOG_ERR, fmt, ap );
 	va_end (ap);
 
-	pthread_mutex_unlock( &log_res_mutex );
-	pthread_cond_signal ( &log_res_cond );
-
 	return;
 }
 
@@ -499,6 +582,337 @@ static void _pki_file_add( int level, const char *fmt, va_list ap ) {
 	return;
 }
 
+/* ===================== Asynchronous Log Functions ==================== */
+
+/* Writes the whole buffer to the log output */
+
+static void _pki_async_write( const char *buf, size_t len ) {
+
+	ssize_t n = 0;
+
+	while ( len > 0 ) {
+		if ((n = write( _log_async.fd, buf, len )) < 0) {
+			if ( errno == EINTR ) continue;
+			return;
+		}
+		buf += n;
+		len -= (size_t) n;
+	}
+}
+
+/* Pops one entry from the ring (single consumer), returns 0 if empty */
+
+static int _pki_async_pop( char *buf, size_t *len, int *level ) {
+
+	PKI_LOG_ASYNC_SLOT *slot = NULL;
+	size_t pos = _log_async.head;
+
+	slot = &_log_async.ring[pos & (PKI_LOG_ASYNC_RING_SIZE - 1)];
+
+	if (__atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE ) != pos + 1)
+		return 0;
+
+	memcpy( buf, slot->data, slot->len );
+	*len = slot->len;
+	*level = slot->level;
+
+	// Hands the slot back to the producers
+	__atomic_store_n( &slot->seq, pos + PKI_LOG_ASYNC_RING_SIZE,
+							__ATOMIC_RELEASE );
+	_log_async.head = pos + 1;
+
+	return 1;
+}
+
+/* Sends one entry to syslog (entries are not batched there) */
+
+static void _pki_async_syslog( int level, const char *line, size_t len ) {
+
+	static const int prio[] = { LOG_USER, LOG_ERR, LOG_WARNING,
+				    LOG_NOTICE, LOG_INFO, LOG_DEBUG };
+
+	syslog( level >= 0 && level <= PKI_LOG_DEBUG ? prio[level] : LOG_INFO,
+		"%.*s", (int) (len > 0 ? len - 1 : 0), line );
+}
+
+/* Writer thread: drains the ring and writes the entries in batches */
+
+static void * _pki_async_writer( void *arg ) {
+
+	char *batch = NULL;
+	size_t batch_len = 0;
+	size_t len = 0;
+	int level = 0;
+	int stop = 0;
+	unsigned long dropped = 0;
+
+	if ((batch = PKI_Malloc( PKI_LOG_ASYNC_BATCH_SIZE )) == NULL)
+		return NULL;
+
+	for (;;) {
+
+		batch_len = 0;
+
+		while ( batch_len + PKI_LOG_ASYNC_LINE_SIZE <= PKI_LOG_ASYNC_BATCH_SIZE &&
+				_pki_async_pop( batch + batch_len, &len, &level ) ) {
+			if ( _log_async.type == PKI_LOG_TYPE_SYSLOG ) {
+				_pki_async_syslog( level, batch + batch_len, len );
+			} else {
+				batch_len += len;
+			}
+		}
+
+		// Reports the entries lost since the last report
+		dropped = __atomic_load_n( &_log_async.dropped, __ATOMIC_RELAXED );
+		if ( dropped != _log_async.reported &&
+				batch_len + 128 <= PKI_LOG_ASYNC_BATCH_SIZE ) {
+			len = (size_t) snprintf( batch + batch_len, 128,
+				"%s [%d]: WARNING: %lu log entries dropped\n",
+				_pki_async_time(), getpid(), dropped - _log_async.reported );
+			_log_async.reported = dropped;
+			if ( _log_async.type == PKI_LOG_TYPE_SYSLOG ) {
+				_pki_async_syslog( PKI_LOG_WARNING, batch + batch_len, len );
+			} else {
+				batch_len += len;
+			}
+		}
+
+		if ( batch_len > 0 ) {
+			_pki_async_write( batch, batch_len );
+			continue;
+		}
+
+		// Nothing left to write, exits if requested
+		if ( stop ) break;
+
+		pthread_mutex_lock( &_log_async.mutex );
+
+		__atomic_store_n( &_log_async.sleeping, 1, __ATOMIC_SEQ_CST );
+
+		if ( !_log_async.stop ) {
+			struct timespec ts;
+
+			clock_gettime( CLOCK_REALTIME, &ts );
+			ts.tv_nsec += PKI_LOG_ASYNC_WAIT_MSECS * 1000000L;
+			if ( ts.tv_nsec >= 1000000000L ) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait( &_log_async.cond, &_log_async.mutex, &ts );
+		}
+
+		__atomic_store_n( &_log_async.sleeping, 0, __ATOMIC_SEQ_CST );
+
+		// One more pass to drain what was queued before stopping
+		stop = _log_async.stop;
+
+		pthread_mutex_unlock( &_log_async.mutex );
+	}
+
+	PKI_Free( batch );
+
+	return NULL;
+}
+
+/* Sets up the ring, the output and starts the writer thread */
+
+static int _pki_async_init( PKI_LOG *l ) {
+
+	size_t i = 0;
+
+	if ( !l ) return ( PKI_ERR );
+
+	if ( !_log_async.ring ) {
+		if ((_log_async.ring = PKI_Malloc( sizeof(PKI_LOG_ASYNC_SLOT) *
+					PKI_LOG_ASYNC_RING_SIZE )) == NULL )
+			return ( PKI_ERR );
+
+		for ( i = 0; i < PKI_LOG_ASYNC_RING_SIZE; i++ )
+			_log_async.ring[i].seq = i;
+	}
+
+	_log_async.type = l->type;
+
+	switch ( l->type ) {
+
+		case PKI_LOG_TYPE_STDOUT:
+			_log_async.fd = STDOUT_FILENO;
+			break;
+
+		case PKI_LOG_TYPE_STDERR:
+			_log_async.fd = STDERR_FILENO;
+			break;
+
+		case PKI_LOG_TYPE_FILE:
+			// The file is kept open until the log is finalized
+			if ((_log_async.fd = open( l->resource,
+					O_WRONLY | O_APPEND | O_CREAT,
+					S_IRUSR | S_IWUSR )) == -1 )
+				return ( PKI_ERR );
+			break;
+
+		default:
+			_log_async.fd = -1;
+	}
+
+	_log_async.stop = 0;
+
+	if ((_log_async.writer = PKI_THREAD_new( _pki_async_writer, NULL )) == NULL ) {
+		if ( l->type == PKI_LOG_TYPE_FILE ) close( _log_async.fd );
+		_log_async.fd = -1;
+		return ( PKI_ERR );
+	}
+
+	__atomic_store_n( &_log_async.accepting, 1, __ATOMIC_SEQ_CST );
+
+	return ( PKI_OK );
+}
+
+/* Returns the cached text of the current time, refreshed every second */
+
+static const char * _pki_async_time( void ) {
+
+	time_t now = time( NULL );
+	struct tm tm;
+
+	if ( now != _log_tls_sec ) {
+		gmtime_r( &now, &tm );
+		strftime( _log_tls_time, sizeof(_log_tls_time),
+				"%b %e %H:%M:%S %Y GMT", &tm );
+		_log_tls_sec = now;
+	}
+
+	return _log_tls_time;
+}
+
+/* Leaves the producers' section, wakes up a finalization waiting for the
+ * last producer */
+
+static void _pki_async_leave( void ) {
+
+	if ( __atomic_sub_fetch( &_log_async.producers, 1, __ATOMIC_SEQ_CST ) == 0 &&
+			!__atomic_load_n( &_log_async.accepting, __ATOMIC_SEQ_CST )) {
+		pthread_mutex_lock( &_log_async.mutex );
+		pthread_cond_broadcast( &_log_async.cond );
+		pthread_mutex_unlock( &_log_async.mutex );
+	}
+}
+
+/* Formats the entry in the thread's buffer and queues it for the writer,
+ * the entry is dropped if the ring is full or if the log is being
+ * finalized */
+
+static void _pki_async_add( int level, const char *fmt, va_list ap ) {
+
+	PKI_LOG_ASYNC_SLOT *slot = NULL;
+	size_t pos = 0;
+	size_t seq = 0;
+	int len = 0;
+	int n = 0;
+
+	// Registers as a producer before checking that entries are still
+	// accepted, the finalization does the opposite
+	__atomic_add_fetch( &_log_async.producers, 1, __ATOMIC_SEQ_CST );
+	if ( !__atomic_load_n( &_log_async.accepting, __ATOMIC_SEQ_CST )) {
+		_pki_async_leave();
+		return;
+	}
+
+	if ( _log_async.type == PKI_LOG_TYPE_FILE ) {
+		len = snprintf( _log_tls_line, sizeof(_log_tls_line), "%s [%d]: %s: ",
+			_pki_async_time(), getpid(), _get_info_string( level ));
+	} else if ( _log_async.type != PKI_LOG_TYPE_SYSLOG ) {
+		len = snprintf( _log_tls_line, sizeof(_log_tls_line), "%s [%d] %s: ",
+			_pki_async_time(), getpid(), _get_info_string( level ));
+	}
+
+	if ( len < 0 ) len = 0;
+
+	if ((n = vsnprintf( _log_tls_line + len, sizeof(_log_tls_line) -
+				(size_t) len, fmt, ap )) < 0 ) n = 0;
+
+	// Truncated entries keep the trailing new line
+	len += n;
+	if ( len > (int) sizeof(_log_tls_line) - 2 )
+		len = (int) sizeof(_log_tls_line) - 2;
+	_log_tls_line[len++] = '\n';
+	_log_tls_line[len] = '\x0';
+
+	pos = __atomic_load_n( &_log_async.tail, __ATOMIC_RELAXED );
+
+	for (;;) {
+		slot = &_log_async.ring[pos & (PKI_LOG_ASYNC_RING_SIZE - 1)];
+		seq = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+
+		if ( seq == pos ) {
+			if ( __atomic_compare_exchange_n( &_log_async.tail, &pos,
+					pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ))
+				break;
+		} else if ( (ssize_t) (seq - pos) < 0 ) {
+			// The ring is full
+			__atomic_fetch_add( &_log_async.dropped, 1, __ATOMIC_RELAXED );
+			_pki_async_leave();
+			return;
+		} else {
+			pos = __atomic_load_n( &_log_async.tail, __ATOMIC_RELAXED );
+		}
+	}
+
+	memcpy( slot->data, _log_tls_line, (size_t) len );
+	slot->len = (size_t) len;
+	slot->level = level;
+
+	__atomic_store_n( &slot->seq, pos + 1, __ATOMIC_RELEASE );
+
+	if ( __atomic_load_n( &_log_async.sleeping, __ATOMIC_SEQ_CST ))
+		pthread_cond_signal( &_log_async.cond );
+
+	_pki_async_leave();
+}
+
+/* Stops accepting entries, waits for the producers still queueing, then
+ * flushes the queued entries and stops the writer thread */
+
+static int _pki_async_finalize( PKI_LOG *l ) {
+
+	struct timespec ts;
+
+	if ( !_log_async.writer ) return ( PKI_ERR );
+
+	__atomic_store_n( &_log_async.accepting, 0, __ATOMIC_SEQ_CST );
+
+	pthread_mutex_lock( &_log_async.mutex );
+
+	// The last producer broadcasts the condition when leaving, the
+	// timeout only guards against a missed wake up
+	while ( __atomic_load_n( &_log_async.producers, __ATOMIC_SEQ_CST ) > 0 ) {
+		clock_gettime( CLOCK_REALTIME, &ts );
+		ts.tv_nsec += 10 * 1000000L;
+		if ( ts.tv_nsec >= 1000000000L ) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait( &_log_async.cond, &_log_async.mutex, &ts );
+	}
+
+	_log_async.stop = 1;
+	pthread_cond_signal( &_log_async.cond );
+	pthread_mutex_unlock( &_log_async.mutex );
+
+	PKI_THREAD_join( _log_async.writer, NULL );
+	PKI_Free( _log_async.writer );
+	_log_async.writer = NULL;
+
+	if ( _log_async.type == PKI_LOG_TYPE_FILE && _log_async.fd >= 0 )
+		close( _log_async.fd );
+	else if ( _log_async.type == PKI_LOG_TYPE_SYSLOG )
+		closelog();
+
+	_log_async.fd = -1;
+
+	return ( PKI_OK );
+}
+
 /* ===================== Finalize Callbacks Functions =================== */
 
 static int _pki_syslog_finalize( PKI_LOG *l ) {
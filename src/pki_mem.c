@@ -38,6 +38,7 @@ PKI_MEM *PKI_MEM_new ( size_t size ) {
 		return (NULL);
 	}
 	ret->size = size;
+	ret->capacity = size;
 
 	return(ret);
 }
@@ -74,6 +75,50 @@ PKI_MEM *PKI_MEM_dup ( PKI_MEM *mem ) {
 }
 
 
+/*! \brief Returns a new PKI_MEM that wraps (without copying) caller-owned data
+ *
+ * The data is not freed when the PKI_MEM is freed. If the PKI_MEM needs to
+ * grow past size bytes, the contents are first moved into a new buffer that
+ * is owned by the PKI_MEM.
+ */
+
+PKI_MEM *PKI_MEM_new_static ( unsigned char *data, size_t size ) {
+
+	PKI_MEM *ret = NULL;
+
+	if (!data || size == 0) {
+		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+		return NULL;
+	}
+
+	if ((ret = PKI_MEM_new_null()) == NULL) return NULL;
+
+	PKI_MEM_init_static(ret, data, size);
+	ret->size = size;
+
+	return ret;
+}
+
+/*! \brief Initializes a caller-allocated PKI_MEM (e.g. on the stack) to use
+ *         the passed buffer as its (empty) storage
+ *
+ * No allocation happens as long as the contents fit in capacity bytes. Use
+ * PKI_MEM_cleanup() to release the memory that might have been allocated
+ * when growing past the buffer's capacity.
+ */
+
+int PKI_MEM_init_static ( PKI_MEM *buf, unsigned char *data, size_t capacity ) {
+
+	if (!buf) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	buf->data = data;
+	buf->size = 0;
+	buf->capacity = data ? capacity : 0;
+	buf->flags = data ? PKI_MEM_FLAGS_STATIC : 0;
+
+	return PKI_OK;
+}
+
 /*! \brief Returns a PKI_MEM with the contents decoded via a function 
  *
  * Returns a new PKI_MEM object filled with the data from an object
@@ -162,44 +207,130 @@ int PKI_MEM_free ( PKI_MEM *buf ) {
 
 	if( !buf ) return (0);
 
-	if (buf->data)
-	{
-		PKI_ZFree(buf->data, buf->size);
-		buf->data = NULL;
-	}
+	PKI_MEM_cleanup(buf);
 
 	PKI_ZFree(buf, sizeof(PKI_MEM));
 
 	return 1;
 }
 
-/*! \brief Grows the allocated size of data_size bytes */
+/*! \brief Frees the data owned by a PKI_MEM but not the PKI_MEM itself */
 
-int PKI_MEM_grow( PKI_MEM *buf, size_t data_size )
+void PKI_MEM_cleanup ( PKI_MEM *buf ) {
+
+	if (!buf) return;
+
+	if (buf->data && !(buf->flags & PKI_MEM_FLAGS_STATIC))
+		PKI_ZFree(buf->data, PKI_MEM_get_capacity(buf));
+
+	buf->data = NULL;
+	buf->size = 0;
+	buf->capacity = 0;
+	buf->flags = 0;
+}
+
+/*! \brief Makes sure the PKI_MEM can hold at least capacity bytes without
+ *         any further allocation. Capacity grows geometrically so that
+ *         repeated appends are amortized.
+ */
+
+int PKI_MEM_reserve( PKI_MEM *buf, size_t capacity )
 {
-	size_t new_size = 0;
+	unsigned char *data = NULL;
+	size_t curr = 0;
+	size_t new_capacity = 0;
 
 	if (!buf) return PKI_ERR;
 
-	if (buf->data == NULL)
-	{
-		buf->data = PKI_Malloc(data_size);
+	if ((curr = PKI_MEM_get_capacity(buf)) >= capacity) return PKI_OK;
 
-		if (!buf->data)
+	new_capacity = curr * 2;
+	if (new_capacity < capacity) new_capacity = capacity;
+	if (new_capacity < PKI_MEM_MIN_CAPACITY) new_capacity = PKI_MEM_MIN_CAPACITY;
+
+	if (buf->data == NULL || (buf->flags & PKI_MEM_FLAGS_STATIC))
+	{
+		// Static data is moved into a buffer owned by the PKI_MEM
+		if ((data = PKI_Malloc(new_capacity)) == NULL)
 		{
 			PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
-			return (PKI_ERR);
+			return PKI_ERR;
 		}
-		
-		buf->size = data_size;
+
+		if (buf->data && buf->size) memcpy(data, buf->data, buf->size);
+		if (!buf->data) buf->size = 0;
+
+		buf->flags &= ~PKI_MEM_FLAGS_STATIC;
 	}
-	else
+	else if ((data = realloc(buf->data, new_capacity)) == NULL)
 	{
-		new_size = buf->size + data_size;
-		buf->data = realloc(buf->data, new_size);
-		buf->size = new_size;
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		return PKI_ERR;
 	}
 
+	buf->data = data;
+	buf->capacity = new_capacity;
+
+	return PKI_OK;
+}
+
+/*! \brief Releases the unused capacity of a PKI_MEM */
+
+int PKI_MEM_shrink( PKI_MEM *buf )
+{
+	unsigned char *data = NULL;
+
+	if (!buf) return PKI_ERR;
+
+	if (!buf->data || (buf->flags & PKI_MEM_FLAGS_STATIC) ||
+			buf->capacity <= buf->size)
+		return PKI_OK;
+
+	if (buf->size == 0)
+	{
+		PKI_MEM_cleanup(buf);
+		return PKI_OK;
+	}
+
+	if ((data = realloc(buf->data, buf->size)) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		return PKI_ERR;
+	}
+
+	buf->data = data;
+	buf->capacity = buf->size;
+
+	return PKI_OK;
+}
+
+/*! \brief Empties a PKI_MEM but keeps its storage for later reuse */
+
+int PKI_MEM_reset( PKI_MEM *buf )
+{
+	if (!buf) return PKI_ERR;
+
+	if (buf->data && !(buf->flags & PKI_MEM_FLAGS_STATIC))
+		memset(buf->data, 0, buf->size);
+
+	buf->size = 0;
+
+	return PKI_OK;
+}
+
+/*! \brief Grows the size of the data by data_size bytes */
+
+int PKI_MEM_grow( PKI_MEM *buf, size_t data_size )
+{
+	if (!buf) return PKI_ERR;
+
+	if (!buf->data) buf->size = 0;
+
+	if (PKI_MEM_reserve(buf, buf->size + data_size) != PKI_OK)
+		return PKI_ERR;
+
+	buf->size += data_size;
+
 	return ((int) buf->size);
 }
 
@@ -215,7 +346,7 @@ int PKI_MEM_add( PKI_MEM *buf, char *data, size_t data_size ) {
 
 	curr_size = PKI_MEM_get_size ( buf );
 
-	if( PKI_MEM_grow( buf, data_size ) == 0 ) {
+	if( PKI_MEM_grow( buf, data_size ) == PKI_ERR ) {
 		PKI_log_err("Can not mem grow!");
 		return (PKI_ERR);
 	}
@@ -249,6 +380,16 @@ size_t PKI_MEM_get_size( PKI_MEM *buf ) {
 	return( buf->size );
 }
 
+/*! \brief Returns the number of bytes allocated for the data of a PKI_MEM */
+
+size_t PKI_MEM_get_capacity( PKI_MEM *buf ) {
+
+	if (!buf || !buf->data) return 0;
+
+	// Data assigned directly by the caller is as large as its size
+	return buf->capacity > buf->size ? buf->capacity : buf->size;
+}
+
 /*! \brief Returns the contents of the PKI_MEM in a string which is guaranteed
  *         to carry all the contents of the original PKI_MEM and terminated (at
  *         size + 1) with a NULL char.
@@ -403,8 +544,6 @@ PKI_MEM *PKI_MEM_new_membio ( PKI_IO *io ) {
 
 PKI_MEM *PKI_MEM_new_bio(PKI_IO *io, PKI_MEM **mem)
 {
-	unsigned char buf[1024];
-
 	PKI_MEM *my_mem = NULL;
 
 	if (!io) return NULL;
@@ -430,9 +569,12 @@ PKI_MEM *PKI_MEM_new_bio(PKI_IO *io, PKI_MEM **mem)
 
 	{
 		int i = -1;
-		for (i = BIO_read(io, buf, sizeof(buf)); i > 0; i = BIO_read(io, buf, sizeof(buf)))
+
+		// Reads directly into the spare capacity of the PKI_MEM
+		while (PKI_MEM_reserve(my_mem, my_mem->size + BUFF_MAX_SIZE) == PKI_OK &&
+				(i = BIO_read(io, my_mem->data + my_mem->size, BUFF_MAX_SIZE)) > 0)
 		{
-			if (i > 0) PKI_MEM_add(my_mem, (char *)buf, (size_t) i);
+			my_mem->size += (size_t) i;
 		}
 	}
 
@@ -777,18 +919,17 @@ int PKI_MEM_encode(PKI_MEM *mem, PKI_DATA_FORMAT format, int opts)
 	}
 
 	// Clears the memory for the old PKI_MEM
-	// if (mem->data) PKI_Free(mem->data);
+	PKI_MEM_cleanup(mem);
 
-	// Transfer ownership of the data
-	mem->data = encoded->data;
-	mem->size = encoded->size;
+	// Transfer ownership of the data (and of its capacity)
+	*mem = *encoded;
 
 	// Clears the encoded data container
-	// encoded->data = NULL;
-	// encoded->size = 0;
+	encoded->data = NULL;
+	encoded->size = 0;
 
 	// Free the newly-allocated (now empty) container
-	// PKI_MEM_free(encoded);
+	PKI_MEM_free(encoded);
 
 	// Returns success
 	return PKI_OK;
@@ -817,11 +958,10 @@ int PKI_MEM_decode(PKI_MEM *mem, PKI_DATA_FORMAT format, int opts)
 	}
 
 	// Clears the memory for the old PKI_MEM
-	if (mem->data) PKI_Free(mem->data);
+	PKI_MEM_cleanup(mem);
 
-	// Transfer ownership of the data
-	mem->data = decoded->data;
-	mem->size = decoded->size;
+	// Transfer ownership of the data (and of its capacity)
+	*mem = *decoded;
 
 	// Clears the encoded data container
 	decoded->data = NULL;
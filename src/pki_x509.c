@@ -196,6 +196,10 @@ void PKI_X509_free ( PKI_X509 *x ) {
 
 	if (!x ) return;
 
+	// Lets the threads release the key contexts they cached for the key
+	if (x->value && x->type == PKI_DATATYPE_X509_KEYPAIR)
+		PKI_DIGEST_PKEY_CTX_invalidate();
+
 	if (x->value)
 	{
 		if (x->cb->free)
@@ -59,17 +59,9 @@ void PKI_X509_PROFILE_free_void ( void * doc ) {
 }
 
 int PKI_X509_PROFILE_free ( PKI_X509_PROFILE * doc ) {
-	if( !doc ) return (PKI_OK);
 
-	xmlFreeDoc( doc );
-
-	/*
-	*Free the global variables that may
-	*have been allocated by the parser.
-	*/
-	//xmlCleanupParser();
-
-	return( PKI_OK );
+	// Also releases the document's search cache
+	return PKI_CONFIG_free( doc );
 }
 
 /* ------------------------- Node Generation Code ------------------ */
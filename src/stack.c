@@ -18,30 +18,43 @@
 #include <libpki/stack.h>
 #include <pki.h>
 
-static PKI_STACK_NODE * _PKI_STACK_NODE_new( void *data )
+/* Initial number of slots allocated for a new PKI_STACK */
+#define PKI_STACK_MIN_SIZE	8
+
+/*
+ * Makes sure there is space for (at least) num elements in the stack, the
+ * array of pointers is grown geometrically to keep push() amortized O(1)
+ */
+static int _PKI_STACK_grow(PKI_STACK *st, int num)
 {
-	PKI_STACK_NODE *ret = NULL;
+	void **data = NULL;
+	int size = 0;
+
+	if (num <= st->size) return PKI_STACK_OK;
 
-	if ((ret = (PKI_STACK_NODE *) PKI_Malloc(sizeof(PKI_STACK))) == NULL)
+	size = st->size > 0 ? st->size : PKI_STACK_MIN_SIZE;
+	while (size < num)
 	{
-		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
-		return(NULL);
+		// Checks for overflows
+		if (size > INT_MAX / 2)
+		{
+			size = num;
+			break;
+		}
+		size *= 2;
 	}
 
-	ret->next = NULL;
-	ret->prev = NULL;
-	ret->data = data;
-
-	return (ret);
-}
-
-static int _PKI_STACK_NODE_free(PKI_STACK_NODE *n)
-{
-	if (!n) return (PKI_STACK_ERR);
+	if ((data = (void **) realloc(st->data, sizeof(void *) * (size_t) size))
+			== NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		return PKI_STACK_ERR;
+	}
 
-	PKI_Free(n);
+	st->data = data;
+	st->size = size;
 
-	return(0);
+	return PKI_STACK_OK;
 }
 
 /*!
@@ -61,11 +74,11 @@ PKI_STACK * PKI_STACK_new( void (*free)())
 		return(NULL);
 	}
 
-	ret->head = NULL;
-	ret->tail = NULL;
+	ret->data = NULL;
+	ret->size = 0;
 	ret->elements = 0;
 
-	if (ret->free) ret->free = free;
+	if (free) ret->free = free;
 	else ret->free = PKI_Free;
 
 	return(ret);
@@ -73,14 +86,15 @@ PKI_STACK * PKI_STACK_new( void (*free)())
 
 PKI_STACK *PKI_STACK_new_type ( PKI_DATATYPE type ) {
 
-	const PKI_X509_CALLBACKS *cb = NULL;
-
-	if ((cb = PKI_X509_CALLBACKS_get(type, NULL)) == NULL)
+	// The stack carries PKI_X509 objects of the specified type,
+	// therefore the generic PKI_X509_free() is the right function
+	// to use (the type's callbacks only free the internal value)
+	if (PKI_X509_CALLBACKS_get(type, NULL) == NULL)
 	{
 		return PKI_STACK_new( NULL );
 	}
 
-	return PKI_STACK_new(cb->free);
+	return PKI_STACK_new((void (*)(void *)) PKI_X509_free);
 }
 
 PKI_STACK * PKI_STACK_new_null( void ) {
@@ -92,7 +106,7 @@ PKI_STACK * PKI_STACK_new_null( void ) {
  * \brief PKI_STACK free all function
  *
  * This function frees the memory used by a PKI_STACK structure.
- * If the structure is not empty, the pointers to every node are freed,
+ * If the structure is not empty, the internal storage is freed,
  * but the pointers to the actualy DATA are not freed. If you want to
  * completely clean up memorty, use the PKI_STACK_free_all().
  *
@@ -102,19 +116,13 @@ PKI_STACK * PKI_STACK_new_null( void ) {
 */
 int PKI_STACK_free (PKI_STACK * st)
 {
-	void * data = NULL;
-
 	if (st == NULL)
 	{
 		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
 		return(PKI_STACK_ERR);
 	}
 
-	data = PKI_STACK_pop(st);
-	while (data != NULL)
-	{
-		data = PKI_STACK_pop(st);
-	}
+	if (st->data) PKI_Free(st->data);
 
 	PKI_Free ( st );
 
@@ -125,7 +133,8 @@ int PKI_STACK_free (PKI_STACK * st)
  * \brief Frees memory associated with a PKI_STACK
  *
  * This function frees the memory used by a PKI_STACK structure.
- * If the structure is not empty, the pointers to every node are freed,
+ * If the structure is not empty, every element is freed by using the
+ * function passed at initialization time.
  * If the type of data within the STACK is not known to the
  * stack itself, it is suggested that you use the PKI_STACK_pop() function
  * and free the elements by using the appropriate function.
@@ -147,59 +156,33 @@ int PKI_STACK_free_all (PKI_STACK * st)
 		return PKI_ERR;
 	}
 
-	// Removes and frees all the nodes in the stack
+	// Removes and frees all the elements in the stack
 	while (PKI_STACK_pop_free(st) == PKI_OK);
 
 	// Let's free the PKI_STACK data structure's memory
-	PKI_Free(st);
-
-	// All Done.
-	return PKI_OK;
+	return PKI_STACK_free(st);
 }
 
 /*!
  * \brief Pops the last element in PKI_STACK
  *
  * This function returns the data pointed by the last element of a PKI_STACK
- * and frees the internal memory. The calling program will have to free the
+ * and removes it from the stack. The calling program will have to free the
  * memory related to the returned pointer.
  */
 
 void * PKI_STACK_pop ( PKI_STACK *st ) {
 
-	PKI_STACK_NODE *n = NULL;
 	void *data = NULL;
 
 	// Checks the input
-	if((st == NULL) || ( st->tail == NULL)) return NULL;
-
-	// Get the last node of the structure
-	n = st->tail;
+	if((st == NULL) || (st->elements <= 0)) return NULL;
 
-	// Let's update the tail pointers
-	st->tail = n->prev;
+	// Gets the last element and updates the number of elements
+	data = st->data[--st->elements];
+	st->data[st->elements] = NULL; // Safety
 
-	// Let's check if the node we popped was also the head
-	if (st->head == n)
-	{
-		// We are actually emptying the list
-		st->elements = 0;
-		st->head = NULL;
-	}
-	else
-	{
-		// Updates the number of elements
-		st->elements--;
-	}
-
-	// Let's save the data pointer (we will return that)
-	data = n->data;
-	n->data = NULL; // Safety
-
-	// Now let's free the node data structure
-	PKI_Free(n);
-
-	// We return the data from the freed node
+	// We return the data from the removed slot
 	return data;
 }
 
@@ -241,6 +224,24 @@ int PKI_STACK_pop_free ( PKI_STACK *st )
 	return PKI_OK;
 }
 
+/*!
+ * \brief Pre-allocates space for a number of elements in a PKI_STACK
+ *
+ * Use this function before adding a known (large) number of elements
+ * to a PKI_STACK to avoid re-allocating the internal storage while
+ * pushing them. The function returns PKI_STACK_OK if successful or
+ * PKI_STACK_ERR otherwise.
+ */
+int PKI_STACK_reserve(PKI_STACK *st, int num)
+{
+	if (st == NULL || num < 0)
+	{
+		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+		return(PKI_STACK_ERR);
+	}
+
+	return _PKI_STACK_grow(st, num);
+}
 
 /*!
  * \brief Adds a new element to a PKI_STACK
@@ -251,35 +252,18 @@ int PKI_STACK_pop_free ( PKI_STACK *st )
  */
 int PKI_STACK_push(PKI_STACK *st, void *obj)
 {
-	PKI_STACK_NODE *n = NULL;
-
 	if (st == NULL || obj == NULL)
 	{
 		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
 		return(PKI_STACK_ERR);
 	}
 
-	if((n = _PKI_STACK_NODE_new(obj)) == NULL)
+	if (_PKI_STACK_grow(st, st->elements + 1) != PKI_STACK_OK)
 	{
-		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
 		return(PKI_STACK_ERR);
 	}
 
-	if (st->tail)
-	{
-		n->prev = st->tail;
-		n->next = NULL;
-
-		st->tail->next = n;
-		st->tail = n;
-	}
-	else
-	{
-		st->tail = n;
-		st->head = n;
-	}
-
-	st->elements++;
+	st->data[st->elements++] = obj;
 
 	return(st->elements);
 }
@@ -300,7 +284,7 @@ int PKI_STACK_elements(PKI_STACK *st)
  * \brief Returns data stored in the n-th element of the PKI_STACK
  *
  * Use this function to retrieve data from a specific element of the PKI_STACK.
- * The returned pointer points to the data stored in the PKI_STACK node,
+ * The returned pointer points to the data stored in the PKI_STACK,
  * therefore it is not advisable to free the returned memory. You should use
  * the PKI_STACK_del_num() function to detatch the data from the PKI_STACK.
  * The function returns the pointer to the requested data, in case of error
@@ -308,22 +292,9 @@ int PKI_STACK_elements(PKI_STACK *st)
  */
 void * PKI_STACK_get_num(PKI_STACK *st, int num)
 {
-	PKI_STACK_NODE *n;
-	int i;
-
-	if ((st == NULL) || (st->elements < num)) return NULL;
+	if ((st == NULL) || (num < 0) || (num >= st->elements)) return NULL;
 
-	i = 0;
-	n = st->head;
-
-	while (n)
-	{
-		if (i == num) return n->data;
-		n=n->next;
-		i++;
-	}
-
-	return NULL;
+	return st->data[num];
 }
 
 /*!
@@ -338,50 +309,25 @@ void * PKI_STACK_get_num(PKI_STACK *st, int num)
 
 int PKI_STACK_ins_num ( PKI_STACK *st, int num, void *obj )
 {
-	PKI_STACK_NODE *n = NULL;
-	PKI_STACK_NODE *new_n = NULL;
-
-	int i;
-
-	if ((st == NULL) || (num > st->elements) || (obj == NULL ))
+	if ((st == NULL) || (num < 0) || (num > st->elements) || (obj == NULL ))
 	{
 		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
 		return PKI_STACK_ERR;
 	}
 
-	n = st->head;
-	i = 0;
-	while (n)
-	{
-		if (i == num) break;
-		if (i > num) return PKI_STACK_ERR;
-
-		n = n->next;
-		i++;
-	}
-
-	if ((new_n = _PKI_STACK_NODE_new ( obj )) == NULL)
+	if (_PKI_STACK_grow(st, st->elements + 1) != PKI_STACK_OK)
 	{
 		return PKI_STACK_ERR;
 	}
 
-	new_n->next = n;
-
-	if (n) {
-		new_n->prev = n->prev;
-		n->prev = new_n;
-	} 
-
-
-	if (num == 0)
-	{
-		st->head = new_n;
-	}
-	else
+	// Makes room for the new element
+	if (num < st->elements)
 	{
-		new_n->prev->next = new_n;
+		memmove(&st->data[num + 1], &st->data[num],
+			sizeof(void *) * (size_t)(st->elements - num));
 	}
 
+	st->data[num] = obj;
 	st->elements++;
 	
 	return PKI_STACK_OK;
@@ -400,48 +346,73 @@ int PKI_STACK_ins_num ( PKI_STACK *st, int num, void *obj )
  * NULL.
  */
 void * PKI_STACK_del_num ( PKI_STACK *st, int num ) {
-	PKI_STACK_NODE *tmp_n = NULL;
-	PKI_STACK_NODE *n = NULL;
 
-	int i;
 	void *obj = NULL;
 
-	if( st == NULL ) return (NULL);
-
-	tmp_n = st->head; i = 0;
-	while ( tmp_n ) {
-		if ( i == num ) {
-			n = tmp_n;
-			break;
-		}
-		i++;
-		tmp_n = tmp_n->next;
-	}
-	if( n == NULL) return( NULL);
+	if ((st == NULL) || (num < 0) || (num >= st->elements)) return NULL;
 
-	if( n->prev != NULL ) {
-		n->prev->next = n->next;
-	}
+	obj = st->data[num];
 
-	if( n->next ) {
-		n->next->prev = n->prev;
+	// Closes the gap
+	if (num < st->elements - 1)
+	{
+		memmove(&st->data[num], &st->data[num + 1],
+			sizeof(void *) * (size_t)(st->elements - num - 1));
 	}
 
-	if( num == 0 ) {
-		st->head = n->next;
-	}
+	st->elements--;
+	st->data[st->elements] = NULL; // Safety
+	
+	return(obj);
+}
 
-	if( num == PKI_STACK_elements( st ) ) {
-		st->tail = n->prev;
+/*!
+ * \brief Sorts the elements of a PKI_STACK
+ *
+ * The elements of the PKI_STACK are sorted in place by using the passed
+ * comparison function. As for qsort(3), the function receives pointers to
+ * the stored elements' pointers (i.e., the arguments are 'void **').
+ *
+ * The function returns PKI_STACK_OK if successful, PKI_STACK_ERR otherwise.
+ */
+int PKI_STACK_sort ( PKI_STACK *st, int (*cmp)(const void *, const void *) )
+{
+	if (st == NULL || cmp == NULL)
+	{
+		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+		return PKI_STACK_ERR;
 	}
 
-	obj = n->data;
-	n->data = NULL;
+	if (st->elements > 1)
+		qsort(st->data, (size_t) st->elements, sizeof(void *), cmp);
 
-	_PKI_STACK_NODE_free( n );
-	st->elements--;
-	
-	return(obj);
+	return PKI_STACK_OK;
 }
 
+/*!
+ * \brief Binary search of an element in a sorted PKI_STACK
+ *
+ * This function looks for an element in a PKI_STACK that has been sorted
+ * (see PKI_STACK_sort()) by using the same comparison function. The
+ * comparison function receives the address of the obj pointer as its
+ * first argument and the address of the stored element's pointer as its
+ * second argument.
+ *
+ * The function returns the position of the element, or -1 if the element
+ * is not found.
+ */
+int PKI_STACK_find ( PKI_STACK *st, const void *obj,
+			int (*cmp)(const void *, const void *) )
+{
+	void **pnt = NULL;
+
+	if (st == NULL || cmp == NULL || st->elements <= 0) return -1;
+
+	if ((pnt = (void **) bsearch(&obj, st->data, (size_t) st->elements,
+					sizeof(void *), cmp)) == NULL)
+	{
+		return -1;
+	}
 
+	return (int)(pnt - st->data);
+}
@@ -1,10 +1,12 @@
 
 #include <libpki/pki.h>
+#include <sys/wait.h>
 
 int gen_RSA_PKey( void );
 
 /* Function Prototypes */
 int test_gen_PKeys(int scheme);
+int test_key_pool(void);
 int gen_X509_Req(int scheme, int bits, char *file );
 
 /* File_names */
@@ -31,6 +33,8 @@ int main (int argc, char *argv[] ) {
 	test_gen_PKeys( PKI_SCHEME_DSA );
 	test_gen_PKeys( PKI_SCHEME_ECDSA );
 
+	if (!test_key_pool()) exit(1);
+
 	PKI_log_end();
 
 	gen_X509_Req(PKI_SCHEME_RSA, 2048, "req_rsa.pem");
@@ -197,3 +201,101 @@ int test_gen_PKeys(int scheme) {
 	return (1);
 }
 
+
+/* Waits (up to 30 secs) for the ECDSA pool to reach the depth */
+static int wait_key_pool(int target) {
+
+	int depth = 0;
+	int i = 0;
+
+	for (i = 0; i < 300; i++) {
+		PKI_X509_KEYPAIR_POOL_get_stats(PKI_SCHEME_ECDSA, 256, -1,
+			&depth, NULL, NULL);
+		if (depth >= target) break;
+		usleep(100000);
+	}
+
+	return depth;
+}
+
+int test_key_pool(void) {
+
+	PKI_X509_KEYPAIR *p = NULL;
+	PKI_KEYPARAMS kp;
+	unsigned long hits = 0;
+	unsigned long misses = 0;
+	unsigned long taken = 0;
+	int depth = 0;
+	int status = 0;
+	pid_t pid = 0;
+	int i = 0;
+
+	printf("Pre-generating ECDSA Keys (pool) ... ");
+
+	if (PKI_X509_KEYPAIR_POOL_set(PKI_SCHEME_ECDSA, 256, -1, 4) != PKI_OK) {
+		printf("ERROR, can not configure the pool!\n");
+		return 0;
+	}
+
+	wait_key_pool(4);
+
+	for (i = 0; i < 5; i++) {
+		if ((p = PKI_X509_KEYPAIR_new(PKI_SCHEME_ECDSA, 256,
+				NULL, NULL, NULL)) == NULL ||
+			PKI_X509_KEYPAIR_get_scheme(p) != PKI_SCHEME_ECDSA) {
+			printf("ERROR, can not get a keypair!\n");
+			return 0;
+		}
+		PKI_X509_KEYPAIR_free(p);
+	}
+
+	if (PKI_X509_KEYPAIR_POOL_get_stats(PKI_SCHEME_ECDSA, 256, -1,
+			&depth, &hits, &misses) != PKI_OK ||
+		hits < 4 || hits + misses != 5) {
+		printf("ERROR, wrong pool stats (%lu/%lu)!\n", hits, misses);
+		return 0;
+	}
+
+	// Keys with different encoding parameters are not taken from the pool
+	memset(&kp, 0, sizeof(kp));
+	kp.scheme = PKI_SCHEME_ECDSA;
+	kp.bits = 256;
+	kp.rsa.exponent = -1;
+	kp.ec.curve = -1;
+	kp.ec.form = PKI_EC_KEY_FORM_UNKNOWN;
+	kp.ec.asn1flags = 0;
+
+	wait_key_pool(1);
+	if ((p = PKI_X509_KEYPAIR_new_kp(&kp, NULL, NULL, NULL)) == NULL ||
+		PKI_X509_KEYPAIR_POOL_get_stats(PKI_SCHEME_ECDSA, 256, -1,
+			NULL, &taken, NULL) != PKI_OK || taken != hits) {
+		printf("ERROR, pooled key with different parameters!\n");
+		return 0;
+	}
+	PKI_X509_KEYPAIR_free(p);
+
+	// The child discards the keys it shares with the parent and refills
+	// the pool with its own workers
+	wait_key_pool(1);
+	if ((pid = fork()) == 0) {
+		PKI_X509_KEYPAIR_POOL_get_stats(PKI_SCHEME_ECDSA, 256, -1,
+			&depth, NULL, NULL);
+		if (depth != 0) _exit(1);
+		if ((p = PKI_X509_KEYPAIR_new(PKI_SCHEME_ECDSA, 256,
+				NULL, NULL, NULL)) == NULL) _exit(2);
+		PKI_X509_KEYPAIR_free(p);
+		_exit(wait_key_pool(1) > 0 ? 0 : 3);
+	}
+
+	if (pid < 0 || waitpid(pid, &status, 0) != pid ||
+			!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		printf("ERROR, wrong pool state after fork (%d)!\n",
+			WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+		return 0;
+	}
+
+	PKI_X509_KEYPAIR_POOL_cleanup();
+
+	printf("Ok\n\n");
+	return 1;
+}
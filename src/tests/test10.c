@@ -0,0 +1,269 @@
+#include <libpki/pki.h>
+
+#define TEST_CRL_ENTRIES	2000
+
+int main (int argc, char *argv[] ) {
+
+	PKI_X509_KEYPAIR *k = NULL;
+	PKI_X509_CERT *cert = NULL;
+	PKI_X509_CRL *crl = NULL;
+	PKI_X509_CRL_ENTRY *entry = NULL;
+	PKI_X509_CRL_ENTRY_STACK *sk = NULL;
+	PKI_X509_CRL_INDEX *idx = NULL;
+	PKI_X509_CRL_BUILDER *b = NULL;
+	PKI_X509_CRL *delta = NULL;
+	PKI_INTEGER *s_int = NULL;
+
+	const PKI_X509_CRL_ENTRY *found = NULL;
+	const PKI_TIME *revDate = NULL;
+	unsigned char bin[2];
+	char serial[32];
+	int reason = 0;
+	int i = 0;
+
+	printf("\n\nlibpki Test - Massimiliano Pala <madwolf@openca.org>\n");
+	printf("(c) 2006 by Massimiliano Pala and OpenCA Project\n");
+	printf("OpenCA Licensed Software\n\n");
+
+	PKI_init_all();
+
+	if(( PKI_log_init (PKI_LOG_TYPE_SYSLOG, PKI_LOG_NOTICE, NULL,
+			PKI_LOG_FLAGS_ENABLE_DEBUG, NULL )) == PKI_ERR ) {
+		exit(1);
+	}
+
+	printf("Generating a new Keypair and Certificate ... ");
+	if((k = PKI_X509_KEYPAIR_new(PKI_SCHEME_RSA, 2048,
+					NULL, NULL, NULL)) == NULL ) {
+		printf("ERROR, can not generate new keypair!\n");
+		exit(1);
+	}
+
+	if((cert = PKI_X509_CERT_new(NULL, k, NULL, NULL, NULL,
+				PKI_VALIDITY_ONE_HOUR, NULL,
+				PKI_X509_ALGOR_VALUE_get(PKI_ALGOR_ID_RSA_SHA256),
+				NULL, NULL)) == NULL ) {
+		printf("ERROR, can not generate new certificate!\n");
+		exit(1);
+	}
+	printf("Ok\n");
+
+	printf("Generating %d CRL ENTRIES ... ", TEST_CRL_ENTRIES);
+	sk = PKI_STACK_X509_CRL_ENTRY_new();
+
+	// Even serials only, every 10th is on hold
+	for (i = TEST_CRL_ENTRIES; i > 0; i--) {
+		snprintf(serial, sizeof(serial), "%X", i * 2);
+		if((entry = PKI_X509_CRL_ENTRY_new_serial(serial,
+				i % 10 ? PKI_CRL_REASON_UNSPECIFIED :
+					PKI_CRL_REASON_CERTIFICATE_HOLD,
+				NULL, NULL)) == NULL ) {
+			printf("ERROR!\n");
+			exit(1);
+		}
+		PKI_STACK_X509_CRL_ENTRY_push(sk, entry);
+	}
+	printf("Ok\n");
+
+	printf("Generating new CRL ... ");
+	if((crl = PKI_X509_CRL_new(k, cert, "1", PKI_VALIDITY_ONE_WEEK,
+				sk, NULL, NULL, NULL)) == NULL ) {
+		printf("ERROR, can not generate new CRL!\n");
+		exit(1);
+	}
+	// Entries are now owned by the CRL
+	PKI_STACK_X509_CRL_ENTRY_free(sk);
+	printf("Ok\n");
+
+	printf("Building the CRL Index ... ");
+	if((idx = PKI_X509_CRL_INDEX_new(crl)) == NULL) {
+		printf("ERROR, can not build the index!\n");
+		exit(1);
+	}
+
+	if (PKI_X509_CRL_INDEX_elements(idx) != TEST_CRL_ENTRIES) {
+		printf("ERROR, wrong number of entries (%d)!\n",
+			PKI_X509_CRL_INDEX_elements(idx));
+		exit(1);
+	}
+	printf("Ok\n");
+
+	printf("Looking up serials in the CRL ... ");
+	if (!PKI_X509_CRL_lookup_long(crl, 4) ||
+			PKI_X509_CRL_lookup_long(crl, 3) ||
+			!PKI_X509_CRL_lookup_serial(crl, "FA0")) {
+		printf("ERROR, wrong lookup result!\n");
+		exit(1);
+	}
+	printf("Ok\n");
+
+	// The index does not depend on the CRL object anymore
+	PKI_X509_CRL_free(crl);
+	crl = NULL;
+
+	printf("Looking up revoked and valid serials ... ");
+	for (i = 1; i <= TEST_CRL_ENTRIES * 2; i++) {
+		found = PKI_X509_CRL_INDEX_lookup_long(idx, i, &reason, &revDate);
+		if ((i % 2 == 0) != (found != NULL)) {
+			printf("ERROR, wrong lookup result for %d!\n", i);
+			exit(1);
+		}
+		if (found && !revDate) {
+			printf("ERROR, missing revocation date for %d!\n", i);
+			exit(1);
+		}
+		if (found && (i % 20 == 0) !=
+				(reason == PKI_CRL_REASON_CERTIFICATE_HOLD)) {
+			printf("ERROR, wrong reason (%d) for %d!\n", reason, i);
+			exit(1);
+		}
+	}
+
+	// Binary (DER content) serial with a leading zero: 0x00FA == 250
+	bin[0] = 0x00; bin[1] = 0xFA;
+	if (!PKI_X509_CRL_INDEX_lookup_bin(idx, bin, sizeof(bin), NULL, NULL)) {
+		printf("ERROR, binary lookup failed!\n");
+		exit(1);
+	}
+
+	if (!PKI_X509_CRL_INDEX_lookup_serial(idx, "0F:A0", NULL, NULL) ||
+			PKI_X509_CRL_INDEX_lookup_serial(idx, "FA1", NULL, NULL)) {
+		printf("ERROR, string lookup failed!\n");
+		exit(1);
+	}
+	printf("Ok\n");
+
+	PKI_X509_CRL_INDEX_free(idx);
+
+	printf("Generating a new CRL with the CRL Builder ... ");
+	if ((b = PKI_X509_CRL_BUILDER_new(TEST_CRL_ENTRIES)) == NULL) {
+		printf("ERROR, can not allocate the builder!\n");
+		exit(1);
+	}
+
+	// Same entries (out of order), plus a duplicated serial
+	for (i = TEST_CRL_ENTRIES; i > 0; i--) {
+		snprintf(serial, sizeof(serial), "%X", i * 2);
+		if (PKI_X509_CRL_BUILDER_add_serial(b, serial, 0,
+				i % 10 ? PKI_CRL_REASON_KEY_COMPROMISE :
+					PKI_CRL_REASON_CERTIFICATE_HOLD) == PKI_ERR) {
+			printf("ERROR, can not add entry %s!\n", serial);
+			exit(1);
+		}
+	}
+	if (PKI_X509_CRL_BUILDER_add_serial(b, "0x04", 0,
+			PKI_CRL_REASON_CA_COMPROMISE) == PKI_ERR ||
+		PKI_X509_CRL_BUILDER_add_serial(b, "XYZ", 0,
+			PKI_CRL_REASON_UNSPECIFIED) != PKI_ERR) {
+		printf("ERROR, wrong add result!\n");
+		exit(1);
+	}
+
+	if((crl = PKI_X509_CRL_BUILDER_get_crl(b, k, cert, "2",
+			PKI_VALIDITY_ONE_WEEK, NULL, NULL, NULL)) == NULL ) {
+		printf("ERROR, can not generate new CRL!\n");
+		exit(1);
+	}
+
+	if ((idx = PKI_X509_CRL_INDEX_new(crl)) == NULL ||
+			PKI_X509_CRL_INDEX_elements(idx) != TEST_CRL_ENTRIES) {
+		printf("ERROR, wrong number of entries!\n");
+		exit(1);
+	}
+
+	for (i = 1; i <= TEST_CRL_ENTRIES * 2; i++) {
+		found = PKI_X509_CRL_INDEX_lookup_long(idx, i, &reason, &revDate);
+		if ((i % 2 == 0) != (found != NULL)) {
+			printf("ERROR, wrong lookup result for %d!\n", i);
+			exit(1);
+		}
+		if (found && reason != (i % 20 ? PKI_CRL_REASON_KEY_COMPROMISE :
+					PKI_CRL_REASON_CERTIFICATE_HOLD)) {
+			printf("ERROR, wrong reason (%d) for %d!\n", reason, i);
+			exit(1);
+		}
+	}
+
+	PKI_X509_CRL_INDEX_free(idx);
+	PKI_X509_CRL_BUILDER_free(b);
+	printf("Ok\n");
+
+	printf("Generating a delta CRL ... ");
+	b = PKI_X509_CRL_BUILDER_new(0);
+
+	// Serial 2 is released, held serials become compromised, 3 is new
+	for (i = TEST_CRL_ENTRIES; i > 1; i--) {
+		snprintf(serial, sizeof(serial), "%X", i * 2);
+		PKI_X509_CRL_BUILDER_add_serial(b, serial, 0,
+					PKI_CRL_REASON_KEY_COMPROMISE);
+	}
+	PKI_X509_CRL_BUILDER_add_serial(b, "3", 0, PKI_CRL_REASON_KEY_COMPROMISE);
+
+	if((delta = PKI_X509_CRL_BUILDER_get_delta(b, crl, k, cert, "3",
+			PKI_VALIDITY_ONE_WEEK, NULL, NULL, NULL)) == NULL ) {
+		printf("ERROR, can not generate the delta CRL!\n");
+		exit(1);
+	}
+
+	if (PKI_X509_CRL_is_delta(delta) != PKI_OK ||
+			PKI_X509_CRL_is_delta(crl) == PKI_OK ||
+			PKI_X509_CRL_check_delta(crl, delta) != PKI_OK ||
+			PKI_X509_CRL_check_delta(delta, crl) == PKI_OK) {
+		printf("ERROR, wrong delta CRL checks!\n");
+		exit(1);
+	}
+
+	if ((idx = PKI_X509_CRL_INDEX_new(delta)) == NULL ||
+			PKI_X509_CRL_INDEX_elements(idx) != TEST_CRL_ENTRIES / 10 + 2) {
+		printf("ERROR, wrong number of delta entries!\n");
+		exit(1);
+	}
+	PKI_X509_CRL_INDEX_free(idx);
+	printf("Ok\n");
+
+	printf("Looking up serials in the base + delta CRLs ... ");
+	if ((idx = PKI_X509_CRL_INDEX_new_delta(crl, delta)) == NULL ||
+			PKI_X509_CRL_INDEX_elements(idx) != TEST_CRL_ENTRIES) {
+		printf("ERROR, wrong number of entries!\n");
+		exit(1);
+	}
+
+	if (PKI_X509_CRL_INDEX_lookup_long(idx, 2, NULL, NULL) ||
+			!PKI_X509_CRL_INDEX_lookup_long(idx, 3, NULL, NULL) ||
+			!PKI_X509_CRL_INDEX_lookup_long(idx, 20, &reason, NULL) ||
+			reason != PKI_CRL_REASON_KEY_COMPROMISE) {
+		printf("ERROR, wrong index lookup result!\n");
+		exit(1);
+	}
+	PKI_X509_CRL_INDEX_free(idx);
+
+	s_int = PKI_INTEGER_new_char("2");
+	if (PKI_X509_CRL_lookup_delta(crl, delta, s_int) ||
+			!PKI_X509_CRL_lookup(crl, s_int)) {
+		printf("ERROR, wrong lookup result!\n");
+		exit(1);
+	}
+	PKI_INTEGER_free(s_int);
+
+	s_int = PKI_INTEGER_new_char("FA0");
+	if (!PKI_X509_CRL_lookup_delta(crl, delta, s_int)) {
+		printf("ERROR, wrong lookup result!\n");
+		exit(1);
+	}
+	PKI_INTEGER_free(s_int);
+
+	PKI_X509_CRL_free(delta);
+	PKI_X509_CRL_free(crl);
+	PKI_X509_CRL_BUILDER_free(b);
+	printf("Ok\n");
+
+	PKI_X509_CERT_free(cert);
+	PKI_X509_KEYPAIR_free(k);
+
+	PKI_log_end();
+
+	printf("\n\n[ Test Ended Succesfully ]\n\n");
+
+	return (0);
+}
+
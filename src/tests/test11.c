@@ -0,0 +1,100 @@
+#include <libpki/pki.h>
+
+#define TEST_STACK_ELEMENTS	10000
+
+static int cmp_mem(const void *a, const void *b) {
+
+	const PKI_MEM *m_a = *(const PKI_MEM * const *) a;
+	const PKI_MEM *m_b = *(const PKI_MEM * const *) b;
+
+	return strcmp((const char *)m_a->data, (const char *)m_b->data);
+}
+
+int main (int argc, char *argv[] ) {
+
+	PKI_MEM_STACK *sk = NULL;
+	PKI_MEM *mem = NULL;
+	PKI_MEM *key = NULL;
+	char buf[32];
+	int i = 0;
+
+	printf("\n\nlibpki Test - Massimiliano Pala <madwolf@openca.org>\n");
+	printf("(c) 2006 by Massimiliano Pala and OpenCA Project\n");
+	printf("OpenCA Licensed Software\n\n");
+
+	PKI_init_all();
+
+	printf("Filling a PKI_MEM_STACK (%d elements) ... ",
+						TEST_STACK_ELEMENTS);
+	if ((sk = PKI_STACK_MEM_new()) == NULL ||
+			PKI_STACK_reserve(sk, TEST_STACK_ELEMENTS) == PKI_ERR) {
+		printf("ERROR, can not allocate the stack!\n");
+		exit(1);
+	}
+
+	// Pushes the elements in reverse order
+	for (i = TEST_STACK_ELEMENTS - 1; i >= 0; i--) {
+		snprintf(buf, sizeof(buf), "%08d", i);
+		mem = PKI_MEM_new_data(strlen(buf) + 1, (unsigned char *) buf);
+		if (PKI_STACK_MEM_push(sk, mem) != TEST_STACK_ELEMENTS - i) {
+			printf("ERROR, can not push element %d!\n", i);
+			exit(1);
+		}
+	}
+	printf("Ok\n");
+
+	printf("Checking indexed access ... ");
+	for (i = 0; i < PKI_STACK_MEM_elements(sk); i++) {
+		mem = PKI_STACK_MEM_get_num(sk, i);
+		if (!mem || atoi((char *) mem->data) !=
+					TEST_STACK_ELEMENTS - i - 1) {
+			printf("ERROR, wrong element at %d!\n", i);
+			exit(1);
+		}
+	}
+
+	if (PKI_STACK_MEM_get_num(sk, -1) ||
+			PKI_STACK_MEM_get_num(sk, TEST_STACK_ELEMENTS)) {
+		printf("ERROR, out of bound access!\n");
+		exit(1);
+	}
+	printf("Ok\n");
+
+	printf("Sorting and searching ... ");
+	PKI_STACK_sort(sk, cmp_mem);
+	for (i = 0; i < PKI_STACK_MEM_elements(sk); i += 7) {
+		snprintf(buf, sizeof(buf), "%08d", i);
+		key = PKI_MEM_new_data(strlen(buf) + 1, (unsigned char *) buf);
+		if (PKI_STACK_find(sk, key, cmp_mem) != i) {
+			printf("ERROR, can not find element %d!\n", i);
+			exit(1);
+		}
+		PKI_MEM_free(key);
+	}
+	printf("Ok\n");
+
+	printf("Inserting and deleting elements ... ");
+	mem = PKI_STACK_MEM_del_num(sk, 0);
+	PKI_STACK_MEM_ins_num(sk, 5, mem);
+	if (PKI_STACK_MEM_get_num(sk, 5) != mem ||
+			atoi((char *) (PKI_STACK_MEM_get_num(sk, 0))->data) != 1 ||
+			PKI_STACK_MEM_elements(sk) != TEST_STACK_ELEMENTS) {
+		printf("ERROR, wrong stack contents!\n");
+		exit(1);
+	}
+
+	mem = PKI_STACK_MEM_pop(sk);
+	if (!mem || atoi((char *) mem->data) != TEST_STACK_ELEMENTS - 1) {
+		printf("ERROR, wrong popped element!\n");
+		exit(1);
+	}
+	PKI_MEM_free(mem);
+	printf("Ok\n");
+
+	PKI_STACK_MEM_free_all(sk);
+
+	printf("\n\n[ Test Ended Succesfully ]\n\n");
+
+	return (0);
+}
+
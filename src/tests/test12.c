@@ -0,0 +1,428 @@
+#include <libpki/pki.h>
+#include <sys/stat.h>
+
+#define TEST_BATCH_SIZE		64
+
+/* Loads the PKCS#11 module from LIBPKI_TEST_PKCS11_MODULE (e.g., SoftHSM)
+ * as an HSM with max_sessions sessions, NULL if the module is not set */
+static HSM *test_pkcs11_hsm(int max_sessions, PKI_CRED **cred) {
+
+	char dir[] = "/tmp/libpki-hsm-XXXXXX";
+	char path[256];
+	const char *module = getenv("LIBPKI_TEST_PKCS11_MODULE");
+	const char *pin = getenv("LIBPKI_TEST_PKCS11_PIN");
+	const char *slot = getenv("LIBPKI_TEST_PKCS11_SLOT");
+	HSM *hsm = NULL;
+	FILE *f = NULL;
+
+	if (!module || !*module) return NULL;
+
+	if (!mkdtemp(dir)) return NULL;
+	snprintf(path, sizeof(path), "%s/hsm.d", dir);
+	mkdir(path, 0700);
+	snprintf(path, sizeof(path), "%s/hsm.d/test.xml", dir);
+
+	if ((f = fopen(path, "w")) != NULL) {
+		fprintf(f, "<?xml version=\"1.0\" ?>\n"
+			"<pki:hsm xmlns:pki=\"http://www.openca.org/openca/pki/1/0/0\">\n"
+			"  <pki:name>Test</pki:name>\n"
+			"  <pki:type>pkcs11</pki:type>\n"
+			"  <pki:id>file://%s</pki:id>\n"
+			"  <pki:sessions>%d</pki:sessions>\n"
+			"</pki:hsm>\n", module, max_sessions);
+		fclose(f);
+		hsm = HSM_new(dir, "test");
+	}
+
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/hsm.d", dir);
+	rmdir(path);
+	rmdir(dir);
+
+	*cred = PKI_CRED_new(NULL, pin ? pin : "1234");
+	if (hsm && (HSM_SLOT_select(slot ? (unsigned long) atol(slot) : 0,
+				*cred, hsm) != PKI_OK ||
+			HSM_login(hsm, *cred) != PKI_OK)) {
+		HSM_free(hsm);
+		hsm = NULL;
+	}
+
+	return hsm;
+}
+
+/* Re-signs a batch of certificates issued with sw_key by using a PKCS#11
+ * key (skipped unless LIBPKI_TEST_PKCS11_MODULE is set) */
+static int test_pkcs11_batch(const PKI_X509_KEYPAIR *sw_key) {
+
+	PKI_X509_KEYPAIR *k = NULL;
+	PKI_X509_CERT *certs[TEST_BATCH_SIZE];
+	PKI_CRED *cred = NULL;
+	HSM *hsm = NULL;
+	URL *label = NULL;
+	char serial[32];
+	int i = 0;
+
+	printf("Signing a batch with a PKCS#11 key ... ");
+	if (!getenv("LIBPKI_TEST_PKCS11_MODULE")) {
+		printf("Skipped (LIBPKI_TEST_PKCS11_MODULE not set)\n");
+		return PKI_OK;
+	}
+
+	if ((hsm = test_pkcs11_hsm(4, &cred)) == NULL ||
+			(label = URL_new("id://libpki-test12")) == NULL ||
+			(k = PKI_X509_KEYPAIR_new_url(PKI_SCHEME_RSA, 2048,
+				label, cred, hsm)) == NULL) {
+		printf("ERROR, can not generate the PKCS#11 key!\n");
+		return PKI_ERR;
+	}
+
+	for (i = 0; i < TEST_BATCH_SIZE; i++) {
+		snprintf(serial, sizeof(serial), "%d", i + 1);
+		if ((certs[i] = PKI_X509_CERT_new(NULL, sw_key, NULL, NULL,
+				serial, PKI_VALIDITY_ONE_HOUR, NULL,
+				PKI_X509_ALGOR_VALUE_get(PKI_ALGOR_ID_RSA_SHA256),
+				NULL, NULL)) == NULL) {
+			printf("ERROR, can not generate certificate %d!\n", i);
+			return PKI_ERR;
+		}
+	}
+
+	if (PKI_X509_sign_batch(certs, TEST_BATCH_SIZE,
+				PKI_DIGEST_ALG_SHA256, k) != PKI_OK) {
+		printf("ERROR, can not sign the batch!\n");
+		return PKI_ERR;
+	}
+
+	for (i = 0; i < TEST_BATCH_SIZE; i++) {
+		if (PKI_X509_verify(certs[i], k) != PKI_OK ||
+				PKI_X509_verify(certs[i], sw_key) == PKI_OK) {
+			printf("ERROR, wrong signature on certificate %d!\n", i);
+			return PKI_ERR;
+		}
+		PKI_X509_CERT_free(certs[i]);
+	}
+	printf("Ok\n");
+
+	HSM_X509_del_url(PKI_DATATYPE_X509_KEYPAIR, label, cred, hsm);
+	PKI_X509_KEYPAIR_free(k);
+	URL_free(label);
+	PKI_CRED_free(cred);
+	HSM_free(hsm);
+
+	return PKI_OK;
+}
+
+#define TEST_POOL_SESSIONS	3
+
+typedef struct {
+	PKCS11_HANDLER *lib;
+	CK_SESSION_HANDLE session;
+	unsigned long gen;
+	volatile int done;
+} TEST_POOL_WAITER;
+
+static void *test_pool_waiter(void *arg) {
+
+	TEST_POOL_WAITER *w = (TEST_POOL_WAITER *) arg;
+
+	if (HSM_PKCS11_session_pool_get(w->lib, &w->session, &w->gen) != PKI_OK)
+		w->done = -1;
+	else
+		w->done = 1;
+
+	return NULL;
+}
+
+/* Checks the limits of the PKCS#11 sessions pool and signs concurrently
+ * over the pooled sessions (skipped unless LIBPKI_TEST_PKCS11_MODULE is
+ * set) */
+static int test_pkcs11_pool(void) {
+
+	CK_SESSION_HANDLE sessions[TEST_POOL_SESSIONS];
+	unsigned long gens[TEST_POOL_SESSIONS];
+	TEST_POOL_WAITER w;
+	PKI_MEM *data[TEST_BATCH_SIZE];
+	PKI_MEM *sig[TEST_BATCH_SIZE];
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_len = 0;
+	char buf[64];
+	PKCS11_HANDLER *lib = NULL;
+	PKI_X509_KEYPAIR *k = NULL;
+	PKI_THREAD *th = NULL;
+	PKI_CRED *cred = NULL;
+	HSM *hsm = NULL;
+	URL *label = NULL;
+	RSA *rsa = NULL;
+	RSA *pub = NULL;
+	int i = 0;
+	int j = 0;
+
+	printf("Checking the PKCS#11 sessions pool limits ... ");
+	if (!getenv("LIBPKI_TEST_PKCS11_MODULE")) {
+		printf("Skipped (LIBPKI_TEST_PKCS11_MODULE not set)\n");
+		return PKI_OK;
+	}
+
+	if ((hsm = test_pkcs11_hsm(TEST_POOL_SESSIONS, &cred)) == NULL ||
+			(lib = _hsm_get_pkcs11_handler(hsm)) == NULL) {
+		printf("ERROR, can not load the PKCS#11 module!\n");
+		return PKI_ERR;
+	}
+
+	// The configured size, unless the token allows fewer sessions
+	if (lib->pool_len < 1 || lib->pool_len > TEST_POOL_SESSIONS) {
+		printf("ERROR, pool size is %d!\n", lib->pool_len);
+		return PKI_ERR;
+	}
+
+	for (i = 0; i < lib->pool_len; i++) {
+		if (HSM_PKCS11_session_pool_get(lib, &sessions[i],
+						 &gens[i]) != PKI_OK) {
+			printf("ERROR, can not check out session %d!\n", i);
+			return PKI_ERR;
+		}
+
+		for (j = 0; j < i; j++) {
+			if (sessions[j] == sessions[i]) {
+				printf("ERROR, session %d checked out twice!\n", j);
+				return PKI_ERR;
+			}
+		}
+	}
+
+	if (lib->pool_size != lib->pool_len || lib->pool_free != 0) {
+		printf("ERROR, %d sessions open, %d free!\n", lib->pool_size,
+			lib->pool_free);
+		return PKI_ERR;
+	}
+
+	// With all the sessions checked out, the next checkout waits
+	memset(&w, 0, sizeof(w));
+	w.lib = lib;
+	if ((th = PKI_THREAD_new(test_pool_waiter, &w)) == NULL) {
+		printf("ERROR, can not spawn the thread!\n");
+		return PKI_ERR;
+	}
+
+	usleep(200000);
+	if (w.done != 0) {
+		printf("ERROR, checkout beyond the pool size!\n");
+		return PKI_ERR;
+	}
+
+	HSM_PKCS11_session_pool_put(lib, sessions[0], gens[0], CKR_OK);
+	PKI_THREAD_join(th, NULL);
+	PKI_Free(th);
+
+	if (w.done != 1 || w.session != sessions[0] ||
+			lib->pool_size != lib->pool_len) {
+		printf("ERROR, returned session not handed over!\n");
+		return PKI_ERR;
+	}
+
+	sessions[0] = w.session;
+	gens[0] = w.gen;
+	for (i = 0; i < lib->pool_len; i++)
+		HSM_PKCS11_session_pool_put(lib, sessions[i], gens[i], CKR_OK);
+
+	if (lib->pool_free != lib->pool_len) {
+		printf("ERROR, %d sessions back in the pool!\n", lib->pool_free);
+		return PKI_ERR;
+	}
+	printf("Ok\n");
+
+	printf("Signing concurrently over the PKCS#11 sessions pool ... ");
+	if ((label = URL_new("id://libpki-test12-pool")) == NULL ||
+			(k = PKI_X509_KEYPAIR_new_url(PKI_SCHEME_RSA, 2048,
+				label, cred, hsm)) == NULL ||
+			(rsa = EVP_PKEY_get1_RSA((EVP_PKEY *) k->value)) == NULL ||
+			(pub = RSAPublicKey_dup(rsa)) == NULL) {
+		printf("ERROR, can not generate the PKCS#11 key!\n");
+		return PKI_ERR;
+	}
+
+	for (i = 0; i < TEST_BATCH_SIZE; i++) {
+		snprintf(buf, sizeof(buf), "libpki test data %d", i);
+		if ((data[i] = PKI_MEM_new_data(strlen(buf),
+					(unsigned char *) buf)) == NULL) {
+			printf("ERROR, memory allocation!\n");
+			return PKI_ERR;
+		}
+	}
+
+	// Starts from an empty pool, sessions are opened as needed
+	if (HSM_PKCS11_session_pool_init(lib) != PKI_OK) {
+		printf("ERROR, can not reset the pool!\n");
+		return PKI_ERR;
+	}
+
+	if (HSM_PKCS11_sign_batch(data, sig, TEST_BATCH_SIZE,
+				  PKI_DIGEST_ALG_SHA256, k) != PKI_OK) {
+		printf("ERROR, can not sign the batch!\n");
+		return PKI_ERR;
+	}
+
+	for (i = 0; i < TEST_BATCH_SIZE; i++) {
+		if (!sig[i] || !EVP_Digest(data[i]->data, data[i]->size, md,
+				&md_len, PKI_DIGEST_ALG_SHA256, NULL) ||
+				!RSA_verify(NID_sha256, md, md_len, sig[i]->data,
+					(unsigned int) sig[i]->size, pub)) {
+			printf("ERROR, wrong signature %d!\n", i);
+			return PKI_ERR;
+		}
+		PKI_MEM_free(data[i]);
+		PKI_MEM_free(sig[i]);
+	}
+
+	// Every signing thread used its own session, all of them back
+	if ((lib->pool_len > 1 && lib->pool_size < 2) ||
+			lib->pool_size > lib->pool_len ||
+			lib->pool_free != lib->pool_size) {
+		printf("ERROR, %d sessions open, %d free!\n", lib->pool_size,
+			lib->pool_free);
+		return PKI_ERR;
+	}
+	printf("Ok\n");
+
+	HSM_X509_del_url(PKI_DATATYPE_X509_KEYPAIR, label, cred, hsm);
+	RSA_free(pub);
+	RSA_free(rsa);
+	PKI_X509_KEYPAIR_free(k);
+	URL_free(label);
+	PKI_CRED_free(cred);
+	HSM_free(hsm);
+
+	return PKI_OK;
+}
+
+int main (int argc, char *argv[] ) {
+
+	PKI_X509_KEYPAIR *k = NULL;
+	PKI_X509_KEYPAIR *k2 = NULL;
+	PKI_X509_CERT *certs[TEST_BATCH_SIZE];
+	const PKI_X509_KEYPAIR *keys[TEST_BATCH_SIZE];
+	int status[TEST_BATCH_SIZE];
+	char serial[32];
+	unsigned long hits = 0;
+	unsigned long hits2 = 0;
+	int entries = 0;
+	int i = 0;
+
+	printf("\n\nlibpki Test - Massimiliano Pala <madwolf@openca.org>\n");
+	printf("(c) 2006 by Massimiliano Pala and OpenCA Project\n");
+	printf("OpenCA Licensed Software\n\n");
+
+	PKI_init_all();
+
+	if(( PKI_log_init (PKI_LOG_TYPE_SYSLOG, PKI_LOG_NOTICE, NULL,
+			PKI_LOG_FLAGS_ENABLE_DEBUG, NULL )) == PKI_ERR ) {
+		exit(1);
+	}
+
+	printf("Generating two new Keypairs ... ");
+	if((k = PKI_X509_KEYPAIR_new(PKI_SCHEME_RSA, 2048,
+					NULL, NULL, NULL)) == NULL ||
+		(k2 = PKI_X509_KEYPAIR_new(PKI_SCHEME_RSA, 2048,
+					NULL, NULL, NULL)) == NULL ) {
+		printf("ERROR, can not generate new keypair!\n");
+		exit(1);
+	}
+	printf("Ok\n");
+
+	printf("Generating %d Certificates ... ", TEST_BATCH_SIZE);
+	for (i = 0; i < TEST_BATCH_SIZE; i++) {
+		snprintf(serial, sizeof(serial), "%d", i + 1);
+		if((certs[i] = PKI_X509_CERT_new(NULL, k, NULL, NULL, serial,
+				PKI_VALIDITY_ONE_HOUR, NULL,
+				PKI_X509_ALGOR_VALUE_get(PKI_ALGOR_ID_RSA_SHA256),
+				NULL, NULL)) == NULL ) {
+			printf("ERROR, can not generate certificate %d!\n", i);
+			exit(1);
+		}
+	}
+	printf("Ok\n");
+
+	// Re-signs all the certificates with the second key
+	printf("Signing the Certificates in one batch ... ");
+	if (PKI_X509_sign_batch(certs, TEST_BATCH_SIZE,
+				PKI_DIGEST_ALG_SHA256, k2) != PKI_OK) {
+		printf("ERROR, can not sign the batch!\n");
+		exit(1);
+	}
+	printf("Ok\n");
+
+	printf("Verifying the batch signatures ... ");
+	for (i = 0; i < TEST_BATCH_SIZE; i++) {
+		if (PKI_X509_verify(certs[i], k2) != PKI_OK ||
+				PKI_X509_verify(certs[i], k) == PKI_OK) {
+			printf("ERROR, wrong signature on certificate %d!\n", i);
+			exit(1);
+		}
+	}
+	printf("Ok\n");
+
+	// The second round should be served from the verification cache
+	printf("Verifying the batch signatures again (cached) ... ");
+	PKI_VERIFY_CACHE_get_stats(&hits, NULL, NULL);
+	for (i = 0; i < TEST_BATCH_SIZE; i++) {
+		if (PKI_X509_verify(certs[i], k2) != PKI_OK ||
+				PKI_X509_verify(certs[i], k) == PKI_OK) {
+			printf("ERROR, wrong signature on certificate %d!\n", i);
+			exit(1);
+		}
+	}
+	PKI_VERIFY_CACHE_get_stats(&hits2, NULL, &entries);
+	if (hits2 - hits != TEST_BATCH_SIZE || entries != TEST_BATCH_SIZE) {
+		printf("ERROR, %lu cache hits (%d entries)!\n",
+			hits2 - hits, entries);
+		exit(1);
+	}
+	printf("Ok\n");
+
+	printf("Verifying the signatures in one batch ... ");
+	for (i = 0; i < TEST_BATCH_SIZE; i++) keys[i] = (i == 7 ? k : k2);
+	if (PKI_X509_verify_batch((const PKI_X509 **) certs, keys,
+			TEST_BATCH_SIZE, status, 4) == PKI_OK) {
+		printf("ERROR, wrong key not detected in the batch!\n");
+		exit(1);
+	}
+	for (i = 0; i < TEST_BATCH_SIZE; i++) {
+		if ((i == 7 && status[i] == PKI_OK) ||
+				(i != 7 && status[i] != PKI_OK)) {
+			printf("ERROR, wrong status for certificate %d!\n", i);
+			exit(1);
+		}
+	}
+	keys[7] = k2;
+	if (PKI_X509_verify_batch((const PKI_X509 **) certs, keys,
+			TEST_BATCH_SIZE, NULL, 0) != PKI_OK) {
+		printf("ERROR, can not verify the batch!\n");
+		exit(1);
+	}
+	printf("Ok\n");
+
+	printf("Invalidating the cached results for the key ... ");
+	PKI_VERIFY_CACHE_invalidate_key(k2);
+	PKI_VERIFY_CACHE_get_stats(NULL, NULL, &entries);
+	if (entries != 0 || PKI_X509_verify(certs[0], k2) != PKI_OK) {
+		printf("ERROR, %d entries still in the cache!\n", entries);
+		exit(1);
+	}
+	printf("Ok\n");
+
+	for (i = 0; i < TEST_BATCH_SIZE; i++) PKI_X509_CERT_free(certs[i]);
+
+	if (test_pkcs11_batch(k) != PKI_OK) exit(1);
+
+	if (test_pkcs11_pool() != PKI_OK) exit(1);
+
+	PKI_X509_KEYPAIR_free(k2);
+	PKI_X509_KEYPAIR_free(k);
+
+	PKI_log_end();
+
+	printf("\n\n[ Test Ended Succesfully ]\n\n");
+
+	return (0);
+}
+
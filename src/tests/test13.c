@@ -0,0 +1,189 @@
+#include <libpki/pki.h>
+
+static int key_freed = 0;
+
+static void test_key_free_cb(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+			int idx, long argl, void *argp) {
+	key_freed = 1;
+}
+
+int main (int argc, char *argv[] ) {
+
+	PKI_X509_KEYPAIR *k = NULL;
+	PKI_X509_KEYPAIR *k2 = NULL;
+	EVP_PKEY_CTX *pctx = NULL;
+	PKI_X509_CERT *cert = NULL;
+	PKI_X509_OCSP_REQ *req = NULL;
+	PKI_X509_OCSP_REQ *req_nonce = NULL;
+	PKI_X509_OCSP_RESP *resp = NULL;
+	PKI_X509_OCSP_RESP *resp_nonce = NULL;
+	PKI_OCSP_RESP_CACHE *cache = NULL;
+	PKI_OCSP_CERTID *cid = NULL;
+	PKI_TIME *nextUpdate = NULL;
+	PKI_MEM *der = NULL;
+	PKI_DIGEST *dgst = NULL;
+	unsigned char md[EVP_MAX_MD_SIZE];
+
+	const PKI_MEM *cached = NULL;
+	unsigned long hits = 0;
+	unsigned long misses = 0;
+	int entries = 0;
+	int idx = -1;
+
+	printf("\n\nlibpki Test - Massimiliano Pala <madwolf@openca.org>\n");
+	printf("(c) 2006 by Massimiliano Pala and OpenCA Project\n");
+	printf("OpenCA Licensed Software\n\n");
+
+	PKI_init_all();
+
+	if(( PKI_log_init (PKI_LOG_TYPE_SYSLOG, PKI_LOG_NOTICE, NULL,
+			PKI_LOG_FLAGS_ENABLE_DEBUG, NULL )) == PKI_ERR ) {
+		exit(1);
+	}
+
+	printf("Generating a new Keypair and Certificate ... ");
+	if((k = PKI_X509_KEYPAIR_new(PKI_SCHEME_RSA, 2048,
+					NULL, NULL, NULL)) == NULL ||
+		(cert = PKI_X509_CERT_new(NULL, k, NULL, NULL, "10",
+				PKI_VALIDITY_ONE_HOUR, NULL,
+				PKI_X509_ALGOR_VALUE_get(PKI_ALGOR_ID_RSA_SHA256),
+				NULL, NULL)) == NULL ) {
+		printf("ERROR, can not generate keypair or certificate!\n");
+		exit(1);
+	}
+	printf("Ok\n");
+
+	printf("Generating OCSP requests (with and without nonce) ... ");
+	if ((req = PKI_X509_OCSP_REQ_new()) == NULL ||
+		(req_nonce = PKI_X509_OCSP_REQ_new()) == NULL ||
+		PKI_X509_OCSP_REQ_add_cert(req, cert, cert, NULL) != PKI_OK ||
+		PKI_X509_OCSP_REQ_add_cert(req_nonce, cert, cert, NULL) != PKI_OK ||
+		PKI_X509_OCSP_REQ_add_nonce(req_nonce, 0) != PKI_OK) {
+		printf("ERROR, can not generate the requests!\n");
+		exit(1);
+	}
+	printf("Ok\n");
+
+	printf("Matching the CertID against the issuer ... ");
+	cid = PKI_X509_OCSP_REQ_get_cid(req, 0);
+	if (PKI_OCSP_CERTID_match_issuer(cid, cert) != PKI_OK ||
+		PKI_X509_CERT_key_hash_buf(cert, PKI_DIGEST_ALG_SHA1, md,
+			sizeof(md)) != 20 ||
+		memcmp(md, PKI_OCSP_CERTID_get_issuerKeyHash(cid)->data, 20) ||
+		PKI_X509_CERT_key_hash_buf(cert, PKI_DIGEST_ALG_SHA1, md, 8) ||
+		(dgst = PKI_X509_CERT_fingerprint(cert, NULL)) == NULL ||
+		PKI_X509_CERT_fingerprint_buf(cert, NULL, md, sizeof(md)) !=
+			(int) dgst->size ||
+		memcmp(md, dgst->digest, dgst->size) != 0) {
+		printf("ERROR, CertID does not match the issuer!\n");
+		exit(1);
+	}
+	PKI_DIGEST_free(dgst);
+	printf("Ok\n");
+
+	printf("Generating the OCSP response ... ");
+	nextUpdate = PKI_TIME_new(PKI_VALIDITY_ONE_HOUR);
+	if ((resp = PKI_X509_OCSP_RESP_new()) == NULL ||
+		PKI_X509_OCSP_RESP_add(resp, cid, PKI_OCSP_CERTSTATUS_GOOD,
+			NULL, NULL, nextUpdate, PKI_CRL_REASON_UNSPECIFIED,
+			NULL) != PKI_OK ||
+		PKI_X509_OCSP_RESP_sign(resp, k, cert, cert, NULL, NULL,
+			PKI_X509_OCSP_RESPID_TYPE_BY_NAME) != PKI_OK) {
+		printf("ERROR, can not generate the response!\n");
+		exit(1);
+	}
+	printf("Ok\n");
+
+	printf("Caching the OCSP response ... ");
+	if ((cache = PKI_OCSP_RESP_CACHE_new(1024)) == NULL ||
+		PKI_OCSP_RESP_CACHE_get(cache, req) != NULL ||
+		PKI_OCSP_RESP_CACHE_put(cache, cid, resp) != PKI_OK) {
+		printf("ERROR, can not cache the response!\n");
+		exit(1);
+	}
+	printf("Ok\n");
+
+	printf("Looking up cached responses ... ");
+	der = PKI_X509_put_mem(resp, PKI_DATA_FORMAT_ASN1, NULL, NULL);
+	if ((cached = PKI_OCSP_RESP_CACHE_get(cache, req)) == NULL ||
+		!der || cached->size != der->size ||
+		memcmp(cached->data, der->data, der->size) != 0) {
+		printf("ERROR, wrong cached response!\n");
+		exit(1);
+	}
+
+	// The response stays valid after a flush until released
+	PKI_OCSP_RESP_CACHE_flush(cache);
+	if (memcmp(cached->data, der->data, der->size) != 0) {
+		printf("ERROR, cached response changed!\n");
+		exit(1);
+	}
+	PKI_OCSP_RESP_CACHE_release(cache, cached);
+
+	if (PKI_OCSP_RESP_CACHE_get(cache, req) != NULL ||
+		PKI_OCSP_RESP_CACHE_put(cache, cid, resp) != PKI_OK ||
+		PKI_OCSP_RESP_CACHE_get(cache, req_nonce) != NULL) {
+		printf("ERROR, wrong lookup result!\n");
+		exit(1);
+	}
+
+	// Responses bound to a request via its nonce are not cached
+	if ((resp_nonce = PKI_X509_OCSP_RESP_new()) == NULL ||
+		PKI_X509_OCSP_RESP_add(resp_nonce, cid, PKI_OCSP_CERTSTATUS_GOOD,
+			NULL, NULL, nextUpdate, PKI_CRL_REASON_UNSPECIFIED,
+			NULL) != PKI_OK ||
+		PKI_X509_OCSP_RESP_copy_nonce(resp_nonce, req_nonce) != PKI_OK ||
+		PKI_X509_OCSP_RESP_sign(resp_nonce, k, cert, cert, NULL, NULL,
+			PKI_X509_OCSP_RESPID_TYPE_BY_NAME) != PKI_OK ||
+		PKI_OCSP_RESP_CACHE_put(cache, cid, resp_nonce) == PKI_OK) {
+		printf("ERROR, response with nonce was cached!\n");
+		exit(1);
+	}
+
+	PKI_OCSP_RESP_CACHE_stats(cache, &hits, &misses, &entries);
+	if (hits != 1 || misses != 2 || entries != 1) {
+		printf("ERROR, wrong stats (%lu/%lu/%d)!\n",
+			hits, misses, entries);
+		exit(1);
+	}
+	printf("Ok\n");
+
+	printf("Releasing freed keys from the context pool ... ");
+	idx = EVP_PKEY_get_ex_new_index(0, NULL, NULL, NULL, test_key_free_cb);
+	if ((k2 = PKI_X509_KEYPAIR_new(PKI_SCHEME_RSA, 2048,
+					NULL, NULL, NULL)) == NULL ||
+		idx < 0 || !EVP_PKEY_set_ex_data(k2->value, idx, &key_freed) ||
+		(pctx = PKI_DIGEST_PKEY_CTX_get(k2->value,
+			PKI_DIGEST_ALG_SHA256, 1)) == NULL ||
+		PKI_DIGEST_PKEY_CTX_get(k2->value,
+			PKI_DIGEST_ALG_SHA256, 1) != pctx) {
+		printf("ERROR, can not pool the key context!\n");
+		exit(1);
+	}
+
+	// The pool drops its reference at the next call of the thread
+	PKI_X509_KEYPAIR_free(k2);
+	if (PKI_DIGEST_PKEY_CTX_get(k->value, PKI_DIGEST_ALG_SHA256, 1) == NULL ||
+			!key_freed) {
+		printf("ERROR, freed key still referenced by the pool!\n");
+		exit(1);
+	}
+	printf("Ok\n");
+
+	PKI_OCSP_RESP_CACHE_free(cache);
+	PKI_MEM_free(der);
+	PKI_TIME_free(nextUpdate);
+	PKI_X509_OCSP_RESP_free(resp_nonce);
+	PKI_X509_OCSP_RESP_free(resp);
+	PKI_X509_OCSP_REQ_free(req_nonce);
+	PKI_X509_OCSP_REQ_free(req);
+	PKI_X509_CERT_free(cert);
+	PKI_X509_KEYPAIR_free(k);
+
+	PKI_log_end();
+
+	printf("\n\n[ Test Ended Succesfully ]\n\n");
+
+	return (0);
+}
+
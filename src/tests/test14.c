@@ -0,0 +1,175 @@
+#include <libpki/pki.h>
+
+#define TEST_MEM_CHUNK		1000
+#define TEST_MEM_CHUNKS		500
+
+#define TEST_LOG_THREADS	4
+#define TEST_LOG_LINES		500
+
+static void * test_log_thread(void *arg) {
+
+	int id = *((int *) arg);
+	int i = 0;
+
+	for (i = 0; i < TEST_LOG_LINES; i++)
+		PKI_log(PKI_LOG_ERR, "test14 thread %d line %d", id, i);
+
+	return NULL;
+}
+
+static int test_log_async(void) {
+
+	PKI_THREAD *th[TEST_LOG_THREADS];
+	int ids[TEST_LOG_THREADS];
+	char name[] = "/tmp/libpki-log-XXXXXX";
+	char line[256];
+	FILE *fp = NULL;
+	int lines = 0;
+	int fd = -1;
+	int i = 0;
+
+	printf("Logging asynchronously from %d threads ... ",
+		TEST_LOG_THREADS);
+
+	if ((fd = mkstemp(name)) < 0) {
+		printf("ERROR, can not create the log file!\n");
+		return PKI_ERR;
+	}
+	close(fd);
+
+	if (PKI_log_init(PKI_LOG_TYPE_FILE, PKI_LOG_NOTICE, name,
+			PKI_LOG_FLAGS_ASYNC, NULL) != PKI_OK) {
+		printf("ERROR, can not initialize the log!\n");
+		unlink(name);
+		return PKI_ERR;
+	}
+
+	for (i = 0; i < TEST_LOG_THREADS; i++) {
+		ids[i] = i;
+		th[i] = PKI_THREAD_new(test_log_thread, &ids[i]);
+	}
+
+	for (i = 0; i < TEST_LOG_THREADS; i++) {
+		if (!th[i]) continue;
+		PKI_THREAD_join(th[i], NULL);
+		PKI_Free(th[i]);
+	}
+
+	// Every queued entry must be written when the log is finalized
+	PKI_log_end();
+
+	if ((fp = fopen(name, "r")) != NULL) {
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			if (strstr(line, "test14 thread ")) lines++;
+		}
+		fclose(fp);
+	}
+	unlink(name);
+
+	if (lines != TEST_LOG_THREADS * TEST_LOG_LINES ||
+			PKI_log_dropped() != 0) {
+		printf("ERROR, %d of %d entries logged (%lu dropped)!\n",
+			lines, TEST_LOG_THREADS * TEST_LOG_LINES,
+			PKI_log_dropped());
+		return PKI_ERR;
+	}
+	printf("Ok\n");
+
+	return PKI_OK;
+}
+
+int main (int argc, char *argv[] ) {
+
+	PKI_MEM *mem = NULL;
+	PKI_MEM st_mem;
+	unsigned char st_buf[16];
+	unsigned char chunk[TEST_MEM_CHUNK];
+	unsigned char *data = NULL;
+	size_t capacity = 0;
+	int reallocs = 0;
+	int i = 0;
+
+	printf("\n\nlibpki Test - Massimiliano Pala <madwolf@openca.org>\n");
+	printf("(c) 2006 by Massimiliano Pala and OpenCA Project\n");
+	printf("OpenCA Licensed Software\n\n");
+
+	PKI_init_all();
+
+	printf("Appending %d chunks to a PKI_MEM ... ", TEST_MEM_CHUNKS);
+	if ((mem = PKI_MEM_new_null()) == NULL) {
+		printf("ERROR, memory allocation!\n");
+		exit(1);
+	}
+
+	for (i = 0; i < TEST_MEM_CHUNKS; i++) {
+		memset(chunk, i & 0xFF, sizeof(chunk));
+		if (PKI_MEM_add(mem, (char *) chunk, sizeof(chunk)) != PKI_OK) {
+			printf("ERROR, can not add chunk %d!\n", i);
+			exit(1);
+		}
+		if (PKI_MEM_get_capacity(mem) != capacity) {
+			capacity = PKI_MEM_get_capacity(mem);
+			reallocs++;
+		}
+	}
+
+	if (mem->size != TEST_MEM_CHUNK * TEST_MEM_CHUNKS ||
+			mem->data[TEST_MEM_CHUNK * 7] != 7 ||
+			mem->data[mem->size - 1] != ((TEST_MEM_CHUNKS - 1) & 0xFF)) {
+		printf("ERROR, wrong contents!\n");
+		exit(1);
+	}
+
+	// Growth must be geometric, not one allocation per append
+	if (reallocs > 20) {
+		printf("ERROR, too many allocations (%d)!\n", reallocs);
+		exit(1);
+	}
+	printf("Ok (%d allocations)\n", reallocs);
+
+	printf("Reserving, resetting and shrinking ... ");
+	data = mem->data;
+	if (PKI_MEM_reset(mem) != PKI_OK || mem->size != 0 ||
+			PKI_MEM_reserve(mem, 1024) != PKI_OK || mem->data != data ||
+			PKI_MEM_add(mem, "ABCD", 4) != PKI_OK ||
+			PKI_MEM_shrink(mem) != PKI_OK ||
+			PKI_MEM_get_capacity(mem) != 4 || memcmp(mem->data, "ABCD", 4)) {
+		printf("ERROR!\n");
+		exit(1);
+	}
+	PKI_MEM_free(mem);
+	printf("Ok\n");
+
+	printf("Wrapping caller-owned buffers ... ");
+	memcpy(st_buf, "0123456789", 10);
+	if ((mem = PKI_MEM_new_static(st_buf, 10)) == NULL ||
+			mem->data != st_buf || mem->size != 10) {
+		printf("ERROR, can not wrap the buffer!\n");
+		exit(1);
+	}
+
+	// Growing past the wrapped buffer moves the data to the heap
+	if (PKI_MEM_add(mem, "ABCDEFGHIJ", 10) != PKI_OK ||
+			mem->data == st_buf || mem->size != 20 ||
+			memcmp(mem->data, "0123456789ABCDEFGHIJ", 20) ||
+			memcmp(st_buf, "0123456789", 10)) {
+		printf("ERROR, wrong growth of a static buffer!\n");
+		exit(1);
+	}
+	PKI_MEM_free(mem);
+
+	PKI_MEM_init_static(&st_mem, st_buf, sizeof(st_buf));
+	if (PKI_MEM_add(&st_mem, "TEST", 4) != PKI_OK ||
+			st_mem.data != st_buf || memcmp(st_buf, "TEST", 4)) {
+		printf("ERROR, wrong use of a stack buffer!\n");
+		exit(1);
+	}
+	PKI_MEM_cleanup(&st_mem);
+	printf("Ok\n");
+
+	if (test_log_async() != PKI_OK) exit(1);
+
+	printf("\n\n[ Test Ended Succesfully ]\n\n");
+
+	return (0);
+}
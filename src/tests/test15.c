@@ -0,0 +1,1577 @@
+#ifdef HAVE_CONFIG_H
+#include <libpki/config.h>
+#endif
+
+#include <libpki/pki.h>
+#include <libpki/net/pki_mysql.h>
+#include <libpki/net/pki_pg.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <poll.h>
+
+static const char *pipelined =
+	"POST /ocsp HTTP/1.1\r\n"
+	"Host: localhost\r\n"
+	"Content-Type: application/ocsp-request\r\n"
+	"Content-Length: 5\r\n"
+	"\r\n"
+	"HELLO"
+	"GET /ca.crt HTTP/1.0\r\n"
+	"Host: localhost\r\n"
+	"\r\n";
+
+static const char *chunked =
+	"HTTP/1.1 200 OK\r\n"
+	"Transfer-Encoding: chunked\r\n"
+	"\r\n"
+	"4;ext=1\r\nWiki\r\n"
+	"5\r\npedia\r\n"
+	"0\r\n"
+	"X-Trailer: yes\r\n"
+	"\r\n"
+	"HTTP/1.1 204 No Content\r\n"
+	"\r\n";
+
+static const char *until_close =
+	"HTTP/1.0 200 OK\r\n"
+	"Content-Type: text/plain\r\n"
+	"\r\n"
+	"Body until close";
+
+static const char *malformed =
+	"HTTP/1.1 200 OK\r\n"
+	"Transfer-Encoding: chunked\r\n"
+	"\r\n"
+	"ZZ\r\n";
+
+static volatile int dns_queries = 0;
+
+/* Resolver stand-in: a TXT record (TTL 300) for test.example and a TXT
+ * record whose length exceeds the record data for bad.example */
+static int test_resolver(const char *name, int type,
+			 unsigned char *answer, int anslen) {
+
+	static const unsigned char response[] = {
+		0x12, 0x34, 0x81, 0x80, 0, 1, 0, 1, 0, 0, 0, 0,
+		4, 't', 'e', 's', 't', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0,
+		0, 16, 0, 1,
+		0xc0, 0x0c, 0, 16, 0, 1, 0, 0, 0x01, 0x2c, 0, 6,
+		5, 'h', 'e', 'l', 'l', 'o' };
+
+	dns_queries++;
+
+	if ((strcmp(name, "test.example") != 0 &&
+			strcmp(name, "bad.example") != 0) || type != 16 ||
+			anslen < (int) sizeof(response)) {
+		h_errno = HOST_NOT_FOUND;
+		return -1;
+	}
+
+	memcpy(answer, response, sizeof(response));
+	if (name[0] == 'b') answer[sizeof(response) - 6] = 9;
+
+	return (int) sizeof(response);
+}
+
+static int test_dns_cache(void) {
+
+	PKI_MEM_STACK *sk = NULL;
+	PKI_MEM *mem = NULL;
+	struct addrinfo *ai = NULL;
+	URL *url = NULL;
+	URL *missing = NULL;
+	unsigned long hits = 0;
+	unsigned long misses = 0;
+	unsigned long refreshes = 0;
+	int i = 0;
+
+	printf("Caching DNS lookups ... ");
+	PKI_DNS_CACHE_set_resolver(test_resolver);
+
+	url = URL_new("dns://test.example?TXT");
+	missing = URL_new("dns://missing.example?TXT");
+	if (!url || !missing) {
+		printf("ERROR, can not parse the URLs!\n");
+		return PKI_ERR;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if ((sk = URL_get_data_dns_url(url, 0)) == NULL ||
+				(mem = PKI_STACK_MEM_get_num(sk, 0)) == NULL ||
+				mem->size != 5 || memcmp(mem->data, "hello", 5) != 0) {
+			printf("ERROR, wrong record!\n");
+			return PKI_ERR;
+		}
+		PKI_STACK_MEM_free_all(sk);
+
+		// Negative answers are cached as well
+		if (URL_get_data_dns_url(missing, 0) != NULL) {
+			printf("ERROR, missing name resolved!\n");
+			return PKI_ERR;
+		}
+	}
+
+	PKI_DNS_CACHE_get_stats(&hits, &misses, NULL, NULL, NULL);
+	if (dns_queries != 2 || hits != 4 || misses != 2) {
+		printf("ERROR, %d queries (%lu hits, %lu misses)!\n",
+			dns_queries, hits, misses);
+		return PKI_ERR;
+	}
+	printf("Ok\n");
+
+	printf("Resolving hosts without DNS queries ... ");
+
+	// Host addresses come from getaddrinfo() only (fixed TTL)
+	if (PKI_DNS_CACHE_getaddrinfo("localhost", 80, &ai) != 0 || !ai ||
+			dns_queries != 2) {
+		printf("ERROR, %d queries!\n", dns_queries);
+		return PKI_ERR;
+	}
+	PKI_DNS_CACHE_freeaddrinfo(ai);
+	printf("Ok\n");
+
+	printf("Refreshing DNS lookups before expiry ... ");
+
+	// With a 1 sec TTL any hit triggers a background refresh
+	PKI_DNS_CACHE_set_limits(PKI_DNS_CACHE_MAX_ENTRIES, 1);
+	for (i = 0; i < 2; i++) {
+		if ((sk = URL_get_data_dns_url(url, 0)) == NULL) {
+			printf("ERROR, lookup failed!\n");
+			return PKI_ERR;
+		}
+		PKI_STACK_MEM_free_all(sk);
+	}
+
+	for (i = 0; i < 100 && refreshes == 0; i++) {
+		usleep(10000);
+		PKI_DNS_CACHE_get_stats(NULL, NULL, &refreshes, NULL, NULL);
+	}
+
+	if (refreshes == 0) {
+		printf("ERROR, entry not refreshed!\n");
+		return PKI_ERR;
+	}
+	printf("Ok\n");
+
+	printf("Rejecting malformed TXT records ... ");
+	URL_free(missing);
+	if ((missing = URL_new("dns://bad.example?TXT")) == NULL ||
+			(sk = URL_get_data_dns_url(missing, 0)) == NULL ||
+			PKI_STACK_MEM_elements(sk) != 0) {
+		printf("ERROR, malformed record accepted!\n");
+		return PKI_ERR;
+	}
+	PKI_STACK_MEM_free_all(sk);
+	printf("Ok\n");
+
+	PKI_DNS_CACHE_set_limits(PKI_DNS_CACHE_MAX_ENTRIES, PKI_DNS_CACHE_MAX_TTL);
+	PKI_DNS_CACHE_set_resolver(NULL);
+
+	URL_free(url);
+	URL_free(missing);
+
+	return PKI_OK;
+}
+
+/* Minimal HTTP server: replies 304 when the request carries the ETag */
+static void test_http_server(int fd, int num, const unsigned char *body,
+			     size_t body_len) {
+
+	char buf[4096];
+	char ok[128];
+	ssize_t len = 0;
+	size_t pos = 0;
+	int c = -1;
+	const char *not_modified =
+		"HTTP/1.1 304 Not Modified\r\n"
+		"ETag: \"v1\"\r\n"
+		"Connection: close\r\n"
+		"\r\n";
+
+	snprintf(ok, sizeof(ok),
+		"HTTP/1.1 200 OK\r\n"
+		"ETag: \"v1\"\r\n"
+		"Content-Length: %zu\r\n"
+		"Connection: close\r\n"
+		"\r\n", body_len);
+
+	for ( ; num > 0; num--) {
+		if ((c = accept(fd, NULL, NULL)) < 0) break;
+
+		for (pos = 0; pos < sizeof(buf) - 1; pos += (size_t) len) {
+			if ((len = read(c, buf + pos, sizeof(buf) - 1 - pos)) <= 0) break;
+			buf[pos + (size_t) len] = '\0';
+			if (strstr(buf, "\r\n\r\n")) break;
+		}
+
+		if (strstr(buf, "If-None-Match: \"v1\""))
+			len = write(c, not_modified, strlen(not_modified));
+		else if ((len = write(c, ok, strlen(ok))) > 0)
+			len = write(c, body, body_len);
+
+		close(c);
+	}
+}
+
+/* Removes the cache directory and its files */
+static void test_rm_dir(const char *dir_name) {
+
+	struct dirent *dd = NULL;
+	char path[256];
+	DIR *dir = NULL;
+
+	if ((dir = opendir(dir_name)) == NULL) return;
+
+	while ((dd = readdir(dir)) != NULL) {
+		if (strcmp(dd->d_name, ".") == 0 || strcmp(dd->d_name, "..") == 0)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir_name, dd->d_name);
+		unlink(path);
+	}
+
+	closedir(dir);
+	rmdir(dir_name);
+}
+
+static int test_url_cache(void) {
+
+	const PKI_MEM_STACK *data = NULL;
+	PKI_X509_KEYPAIR *k = NULL;
+	PKI_X509_CERT *cert = NULL;
+	PKI_X509_CRL *crl = NULL;
+	PKI_MEM *der = NULL;
+	PKI_URL_CACHE_REF *ref = NULL;
+	PKI_MEM_STACK *sk = NULL;
+	PKI_MEM *mem = NULL;
+	struct sockaddr_in sa;
+	socklen_t sa_len = sizeof(sa);
+	char file_name[] = "/tmp/libpki-url-XXXXXX";
+	char dir_name[] = "/tmp/libpki-cache-XXXXXX";
+	char url_s[128];
+	unsigned long hits = 0;
+	unsigned long revalidated = 0;
+	unsigned long misses = 0;
+	unsigned long h = 0;
+	unsigned long r = 0;
+	unsigned long m = 0;
+	URL *url = NULL;
+	pid_t pid = 0;
+	int fd = -1;
+	int i = 0;
+
+	printf("Revalidating cached files ... ");
+	if ((fd = mkstemp(file_name)) < 0 || write(fd, "first", 5) != 5) {
+		printf("ERROR, can not create the file!\n");
+		return PKI_ERR;
+	}
+	close(fd);
+
+	snprintf(url_s, sizeof(url_s), "file://%s", file_name);
+	if ((url = URL_new(url_s)) == NULL) {
+		printf("ERROR, can not parse the URL!\n");
+		return PKI_ERR;
+	}
+
+	// Files are cached only on request, private keys never
+	if (PKI_URL_CACHE_supported(url, PKI_DATATYPE_X509_CRL, 0) == PKI_OK) {
+		printf("ERROR, files cached by default!\n");
+		return PKI_ERR;
+	}
+	PKI_URL_CACHE_set_file_urls(1);
+	if (PKI_URL_CACHE_supported(url, PKI_DATATYPE_X509_CRL, 0) != PKI_OK ||
+			PKI_URL_CACHE_supported(url, PKI_DATATYPE_X509_KEYPAIR,
+				0) == PKI_OK) {
+		printf("ERROR, wrong datatypes cached!\n");
+		return PKI_ERR;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if ((data = PKI_URL_CACHE_get_data(url, 0, 0, NULL, &ref)) == NULL ||
+				(mem = PKI_STACK_MEM_get_num(data, 0)) == NULL ||
+				mem->size != 5 || memcmp(mem->data, "first", 5) != 0) {
+			printf("ERROR, wrong data!\n");
+			return PKI_ERR;
+		}
+		PKI_URL_CACHE_release(ref);
+	}
+
+	// A modified file is read again
+	if ((fd = open(file_name, O_WRONLY | O_TRUNC)) < 0 ||
+			write(fd, "second!", 7) != 7) {
+		printf("ERROR, can not modify the file!\n");
+		return PKI_ERR;
+	}
+	close(fd);
+
+	if ((data = PKI_URL_CACHE_get_data(url, 0, 0, NULL, &ref)) == NULL ||
+			(mem = PKI_STACK_MEM_get_num(data, 0)) == NULL ||
+			mem->size != 7 || memcmp(mem->data, "second!", 7) != 0) {
+		printf("ERROR, stale data returned!\n");
+		return PKI_ERR;
+	}
+	PKI_URL_CACHE_release(ref);
+
+	// Untyped retrievals do not use the cache
+	if ((sk = URL_get_data_url(url, 0, 0, NULL)) == NULL) {
+		printf("ERROR, can not read the file!\n");
+		return PKI_ERR;
+	}
+	PKI_STACK_MEM_free_all(sk);
+
+	PKI_URL_CACHE_get_stats(&hits, &revalidated, &misses);
+	if (revalidated != 1 || misses != 2) {
+		printf("ERROR, %lu revalidated, %lu misses!\n", revalidated, misses);
+		return PKI_ERR;
+	}
+
+	PKI_URL_CACHE_set_file_urls(0);
+	unlink(file_name);
+	URL_free(url);
+	printf("Ok\n");
+
+	printf("Conditional GET of cached objects ... ");
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+			bind(fd, (struct sockaddr *) &sa, sizeof(sa)) != 0 ||
+			listen(fd, 4) != 0 ||
+			getsockname(fd, (struct sockaddr *) &sa, &sa_len) != 0) {
+		printf("ERROR, can not listen!\n");
+		return PKI_ERR;
+	}
+
+	if ((pid = fork()) == 0) {
+		test_http_server(fd, 3, (const unsigned char *) "CACHED", 6);
+		_exit(0);
+	}
+	close(fd);
+
+	snprintf(url_s, sizeof(url_s), "http://127.0.0.1:%d/ca.crl",
+		ntohs(sa.sin_port));
+	if ((url = URL_new(url_s)) == NULL || !mkdtemp(dir_name)) {
+		printf("ERROR, can not parse the URL!\n");
+		return PKI_ERR;
+	}
+	PKI_URL_CACHE_set_dir(dir_name);
+
+	for (i = 0; i < 3; i++) {
+
+		// The last time the object is loaded from the directory
+		if (i == 2) PKI_URL_CACHE_flush();
+
+		if ((data = PKI_URL_CACHE_get_data(url, 5, 0, NULL, &ref)) == NULL ||
+				(mem = PKI_STACK_MEM_get_num(data, 0)) == NULL ||
+				mem->size != 6 || memcmp(mem->data, "CACHED", 6) != 0) {
+			printf("ERROR, wrong data (%d)!\n", i);
+			kill(pid, SIGTERM);
+			return PKI_ERR;
+		}
+		PKI_URL_CACHE_release(ref);
+	}
+	waitpid(pid, NULL, 0);
+
+	PKI_URL_CACHE_get_stats(NULL, &revalidated, &misses);
+	if (revalidated != 3 || misses != 3) {
+		printf("ERROR, %lu revalidated, %lu misses!\n", revalidated, misses);
+		return PKI_ERR;
+	}
+
+	PKI_URL_CACHE_set_dir(NULL);
+	PKI_URL_CACHE_flush();
+	URL_free(url);
+	test_rm_dir(dir_name);
+	printf("Ok\n");
+
+	printf("Serving fresh CRLs without requests ... ");
+	if ((k = PKI_X509_KEYPAIR_new(PKI_SCHEME_RSA, 2048,
+					NULL, NULL, NULL)) == NULL ||
+			(cert = PKI_X509_CERT_new(NULL, k, NULL, "CN=Test15 CRL CA",
+				"1", PKI_VALIDITY_ONE_HOUR, NULL,
+				PKI_X509_ALGOR_VALUE_get(PKI_ALGOR_ID_RSA_SHA256),
+				NULL, NULL)) == NULL ||
+			(crl = PKI_X509_CRL_new(k, cert, "1", PKI_VALIDITY_ONE_HOUR,
+				NULL, NULL, NULL, NULL)) == NULL ||
+			(der = PKI_X509_put_mem(crl, PKI_DATA_FORMAT_ASN1,
+				NULL, NULL)) == NULL) {
+		printf("ERROR, can not generate the CRL!\n");
+		return PKI_ERR;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa_len = sizeof(sa);
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+			bind(fd, (struct sockaddr *) &sa, sizeof(sa)) != 0 ||
+			listen(fd, 4) != 0 ||
+			getsockname(fd, (struct sockaddr *) &sa, &sa_len) != 0) {
+		printf("ERROR, can not listen!\n");
+		return PKI_ERR;
+	}
+
+	// Only two requests are served: the first retrieval and the
+	// revalidation after max_age
+	if ((pid = fork()) == 0) {
+		test_http_server(fd, 2, der->data, der->size);
+		_exit(0);
+	}
+	close(fd);
+
+	snprintf(url_s, sizeof(url_s), "http://127.0.0.1:%d/fresh.crl",
+		ntohs(sa.sin_port));
+	if ((url = URL_new(url_s)) == NULL) {
+		printf("ERROR, can not parse the URL!\n");
+		return PKI_ERR;
+	}
+
+	// The nextUpdate is one hour away, max_age caps the freshness
+	PKI_URL_CACHE_set_limits(PKI_URL_CACHE_MAX_ENTRIES, 2);
+	PKI_URL_CACHE_get_stats(&hits, &revalidated, &misses);
+
+	for (i = 0; i < 3; i++) {
+
+		if (i == 2) sleep(3);
+
+		if ((data = PKI_URL_CACHE_get_data(url, 5, 0, NULL, &ref)) == NULL ||
+				(mem = PKI_STACK_MEM_get_num(data, 0)) == NULL ||
+				mem->size != der->size ||
+				memcmp(mem->data, der->data, der->size) != 0) {
+			printf("ERROR, wrong CRL (%d)!\n", i);
+			kill(pid, SIGTERM);
+			return PKI_ERR;
+		}
+		PKI_URL_CACHE_release(ref);
+	}
+	waitpid(pid, NULL, 0);
+
+	// One miss, one hit (no request) and one revalidation
+	if (PKI_URL_CACHE_get_stats(&h, &r, &m) != PKI_OK ||
+			h != hits + 1 || r != revalidated + 1 || m != misses + 1) {
+		printf("ERROR, %lu hits, %lu revalidated, %lu misses!\n",
+			h - hits, r - revalidated, m - misses);
+		return PKI_ERR;
+	}
+
+	PKI_URL_CACHE_set_limits(PKI_URL_CACHE_MAX_ENTRIES, PKI_URL_CACHE_MAX_AGE);
+	PKI_URL_CACHE_flush();
+	URL_free(url);
+	PKI_MEM_free(der);
+	PKI_X509_CRL_free(crl);
+	PKI_X509_CERT_free(cert);
+	PKI_X509_KEYPAIR_free(k);
+	printf("Ok\n");
+
+	return PKI_OK;
+}
+
+static int test_url_multi(void) {
+
+	const char *urls[6];
+	char names[4][32];
+	char url_s[4][64];
+	PKI_MEM_STACK *results[6];
+	PKI_MEM *mem = NULL;
+	int errors[6];
+	int fd = -1;
+	int i = 0;
+
+	printf("Retrieving URLs concurrently ... ");
+	for (i = 0; i < 4; i++) {
+		snprintf(names[i], sizeof(names[i]), "/tmp/libpki-multi-XXXXXX");
+		if ((fd = mkstemp(names[i])) < 0 || write(fd, names[i], 24) != 24) {
+			printf("ERROR, can not create the files!\n");
+			return PKI_ERR;
+		}
+		close(fd);
+
+		snprintf(url_s[i], sizeof(url_s[i]), "file://%s", names[i]);
+		urls[i] = url_s[i];
+	}
+	urls[4] = "file:///tmp/libpki-multi-missing";
+	urls[5] = NULL;
+
+	if (URL_get_data_multi(urls, 6, 10, 0, NULL, results, errors) != PKI_ERR) {
+		printf("ERROR, failures not reported!\n");
+		return PKI_ERR;
+	}
+
+	for (i = 0; i < 4; i++) {
+		if (errors[i] != PKI_OK || !results[i] ||
+				(mem = PKI_STACK_MEM_get_num(results[i], 0)) == NULL ||
+				mem->size != 24 || memcmp(mem->data, names[i], 24) != 0) {
+			printf("ERROR, wrong data for %s!\n", urls[i]);
+			return PKI_ERR;
+		}
+		PKI_STACK_MEM_free_all(results[i]);
+		unlink(names[i]);
+	}
+
+	if (results[4] || errors[4] != PKI_ERR_URI_READ ||
+			results[5] || errors[5] != PKI_ERR_URI_PARSE) {
+		printf("ERROR, wrong errors (%d, %d)!\n", errors[4], errors[5]);
+		return PKI_ERR;
+	}
+	printf("Ok\n");
+
+	return PKI_OK;
+}
+
+#define TEST_SLOW_MAX_CONN	16
+
+static long long test_now_ms(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* HTTP server that answers every request after hold_ms, returns the max
+ * number of requests that were served at the same time */
+static int test_slow_server(int fd, int num, int hold_ms) {
+
+	struct pollfd pfd[TEST_SLOW_MAX_CONN + 1];
+	long long due[TEST_SLOW_MAX_CONN];
+	int conn[TEST_SLOW_MAX_CONN];
+	long long end = test_now_ms() + 30000;
+	long long now = 0;
+	char buf[1024];
+	int served = 0;
+	int open = 0;
+	int max = 0;
+	int lst = 0;
+	int i = 0;
+	const char *ok =
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Length: 2\r\n"
+		"Connection: close\r\n"
+		"\r\n"
+		"OK";
+
+	while (served < num && (now = test_now_ms()) < end) {
+
+		for (i = 0; i < open; i++) {
+			pfd[i].fd = conn[i];
+			pfd[i].events = POLLIN;
+		}
+		lst = open;
+		pfd[lst].fd = open < TEST_SLOW_MAX_CONN ? fd : -1;
+		pfd[lst].events = POLLIN;
+
+		if (poll(pfd, (nfds_t) lst + 1, 10) < 0) break;
+
+		now = test_now_ms();
+
+		for (i = open - 1; i >= 0; i--) {
+
+			// Requests are read as they arrive, a closed connection
+			// counts as served
+			if ((pfd[i].revents & (POLLIN | POLLHUP)) &&
+					read(conn[i], buf, sizeof(buf)) <= 0) {
+				close(conn[i]);
+			} else if (now >= due[i]) {
+				if (send(conn[i], ok, strlen(ok), MSG_NOSIGNAL) < 0) {
+					// The client gave up
+				}
+				close(conn[i]);
+			} else continue;
+
+			conn[i] = conn[--open];
+			due[i] = due[open];
+			served++;
+		}
+
+		if ((pfd[lst].revents & POLLIN) && open < TEST_SLOW_MAX_CONN &&
+				(conn[open] = accept(fd, NULL, NULL)) >= 0) {
+			due[open++] = now + hold_ms;
+			if (open > max) max = open;
+		}
+	}
+
+	return max;
+}
+
+/* Retrieves num URLs from a local test_slow_server(), returns the max
+ * number of concurrent requests (-1 on errors) */
+static int test_url_multi_run(int num, int timeout, int hold_ms, int serve,
+			      int *errors) {
+
+	const char *urls[8];
+	char url_s[8][64];
+	PKI_MEM_STACK *results[8];
+	struct sockaddr_in sa;
+	socklen_t sa_len = sizeof(sa);
+	int status = 0;
+	pid_t pid = 0;
+	int fd = -1;
+	int i = 0;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+			bind(fd, (struct sockaddr *) &sa, sizeof(sa)) != 0 ||
+			listen(fd, 16) != 0 ||
+			getsockname(fd, (struct sockaddr *) &sa, &sa_len) != 0)
+		return -1;
+
+	if ((pid = fork()) == 0) _exit(test_slow_server(fd, serve, hold_ms));
+	close(fd);
+
+	for (i = 0; i < num; i++) {
+		snprintf(url_s[i], sizeof(url_s[i]), "http://127.0.0.1:%d/%d",
+			ntohs(sa.sin_port), i);
+		urls[i] = url_s[i];
+	}
+
+	URL_get_data_multi(urls, num, timeout, 0, NULL, results, errors);
+
+	for (i = 0; i < num; i++) {
+		if (results[i]) PKI_STACK_MEM_free_all(results[i]);
+	}
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) return -1;
+
+	return WEXITSTATUS(status);
+}
+
+static int test_url_multi_limits(void) {
+
+	int errors[8];
+	int max = 0;
+	int i = 0;
+
+	printf("Limiting concurrent retrievals per host ... ");
+	PKI_URL_MULTI_set_limits(8, 2);
+	if ((max = test_url_multi_run(6, 10, 300, 6, errors)) != 2) {
+		printf("ERROR, %d concurrent requests!\n", max);
+		return PKI_ERR;
+	}
+	for (i = 0; i < 6; i++) {
+		if (errors[i] != PKI_OK) {
+			printf("ERROR, retrieval %d failed (%d)!\n", i, errors[i]);
+			return PKI_ERR;
+		}
+	}
+	printf("Ok\n");
+
+	// The calling thread counts as one of the parallel retrievals
+	printf("Limiting parallel retrievals ... ");
+	PKI_URL_MULTI_set_limits(3, 0);
+	if ((max = test_url_multi_run(6, 10, 300, 6, errors)) != 3) {
+		printf("ERROR, %d concurrent requests!\n", max);
+		return PKI_ERR;
+	}
+	printf("Ok\n");
+
+	// The first retrieval uses the whole budget, the others are not
+	// started at all
+	printf("Failing retrievals after the time budget ... ");
+	PKI_URL_MULTI_set_limits(1, 0);
+	if ((max = test_url_multi_run(3, 1, 3000, 1, errors)) != 1 ||
+			errors[0] != PKI_ERR_URI_READ ||
+			errors[1] != PKI_ERR_URI_GENERAL ||
+			errors[2] != PKI_ERR_URI_GENERAL) {
+		printf("ERROR, wrong errors (%d, %d, %d)!\n",
+			errors[0], errors[1], errors[2]);
+		return PKI_ERR;
+	}
+	printf("Ok\n");
+
+	PKI_URL_MULTI_set_limits(PKI_URL_MULTI_MAX_PARALLEL,
+		PKI_URL_MULTI_MAX_PER_HOST);
+
+	return PKI_OK;
+}
+
+/* Issues a certificate for key signed with ca_key (self-signed if no
+ * ca_cert is provided) */
+static PKI_X509_CERT * test_issue_cert(const PKI_X509_CERT *ca_cert,
+			const PKI_X509_KEYPAIR *ca_key, const PKI_X509_KEYPAIR *key,
+			const char *subj, const char *serial,
+			const PKI_X509_PROFILE *prof) {
+
+	PKI_X509_REQ *req = NULL;
+	PKI_X509_CERT *ret = NULL;
+
+	if (ca_cert && (req = PKI_X509_REQ_new(key, subj, NULL, NULL,
+						NULL, NULL)) == NULL)
+		return NULL;
+
+	ret = PKI_X509_CERT_new(ca_cert, ca_key, req, subj, serial,
+			PKI_VALIDITY_ONE_HOUR, prof,
+			PKI_X509_ALGOR_VALUE_get(PKI_ALGOR_ID_RSA_SHA256),
+			NULL, NULL);
+
+	if (req) PKI_X509_REQ_free(req);
+
+	return ret;
+}
+
+/* Profile for the test CAs */
+static PKI_X509_PROFILE * test_ca_profile(void) {
+
+	PKI_X509_PROFILE *ret = NULL;
+
+	if ((ret = PKI_X509_PROFILE_new("test15-ca")) == NULL) return NULL;
+
+	if (!PKI_X509_PROFILE_add_extension(ret, "basicConstraints",
+						"TRUE", "CA", 1) ||
+			!PKI_X509_PROFILE_add_extension(ret, "keyUsage",
+						"keyCertSign,cRLSign", NULL, 1)) {
+		PKI_X509_PROFILE_free(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
+#if defined(HAVE_PG) || defined(HAVE_MYSQL)
+
+/* SQL backend under test, the URL (e.g. pg://user:pwd@host/db/table) is
+ * taken from the environment and the table needs a text 'data' column */
+typedef struct {
+	const char *env;
+	PKI_MEM_STACK *(*get)(const URL *url, ssize_t size);
+	int (*put)(const URL *url, const PKI_MEM *data);
+	int (*stats)(unsigned long *opened, unsigned long *reused,
+		     unsigned long *retried);
+	char *(*table)(const URL *url);
+	int (*exec)(const URL *url, const char *query);
+	int (*close_idle)(const URL *url);
+} TEST_DB;
+
+#ifdef HAVE_PG
+static int test_pg_exec(const URL *url, const char *query) {
+
+	PGconn *sql = NULL;
+	PGresult *res = NULL;
+	int ret = PKI_ERR;
+
+	if ((sql = pg_db_connect(url)) == NULL) return PKI_ERR;
+
+	if ((res = PQexec(sql, query)) != NULL &&
+			(PQresultStatus(res) == PGRES_COMMAND_OK ||
+			 PQresultStatus(res) == PGRES_TUPLES_OK)) ret = PKI_OK;
+
+	if (res) PQclear(res);
+	pg_db_close(sql);
+
+	return ret;
+}
+
+/* Terminates the other sessions of the same user on the same database,
+ * the pooled connections included */
+static int test_pg_close_idle(const URL *url) {
+
+	return test_pg_exec(url, "SELECT pg_terminate_backend(pid) "
+		"FROM pg_stat_activity WHERE pid <> pg_backend_pid() "
+		"AND datname = current_database() AND usename = current_user");
+}
+#endif
+
+#ifdef HAVE_MYSQL
+static int test_mysql_exec(const URL *url, const char *query) {
+
+	MYSQL *sql = NULL;
+	int ret = PKI_ERR;
+
+	if ((sql = db_connect(url)) == NULL) return PKI_ERR;
+
+	if (mysql_query(sql, query) == 0) ret = PKI_OK;
+
+	db_close(sql);
+
+	return ret;
+}
+
+/* Kills the other sessions of the same user on the same database, the
+ * pooled connections included */
+static int test_mysql_close_idle(const URL *url) {
+
+	MYSQL *sql = NULL;
+	MYSQL_RES *res = NULL;
+	MYSQL_ROW row;
+	char query[64];
+	int ret = PKI_OK;
+
+	if ((sql = db_connect(url)) == NULL) return PKI_ERR;
+
+	if (mysql_query(sql, "SELECT ID FROM information_schema.PROCESSLIST "
+			"WHERE USER = SUBSTRING_INDEX(USER(), '@', 1) "
+			"AND DB = DATABASE() AND ID <> CONNECTION_ID()") != 0 ||
+			(res = mysql_store_result(sql)) == NULL) {
+		db_close(sql);
+		return PKI_ERR;
+	}
+
+	while ((row = mysql_fetch_row(res)) != NULL) {
+		snprintf(query, sizeof(query), "KILL %s", row[0]);
+		if (mysql_query(sql, query) != 0) ret = PKI_ERR;
+	}
+
+	mysql_free_result(res);
+	db_close(sql);
+
+	return ret;
+}
+#endif
+
+static int test_db_pool(const char *name, const TEST_DB *db) {
+
+	const char *base = getenv(db->env);
+	char url_s[512];
+	char value[64];
+	char query[640];
+	char *table = NULL;
+	PKI_MEM_STACK *sk = NULL;
+	PKI_MEM *mem = NULL;
+	URL *bad = NULL;
+	URL *store = NULL;
+	URL *fetch = NULL;
+	unsigned long opened = 0, reused = 0, retried = 0;
+	unsigned long o = 0, r = 0, t = 0;
+	int i = 0;
+
+	printf("Pooling %s connections ... ", name);
+	if (!base) {
+		printf("Skipped (%s not set)\n", db->env);
+		return PKI_OK;
+	}
+
+	snprintf(value, sizeof(value), "libpki-test15-%d", (int) getpid());
+	snprintf(url_s, sizeof(url_s), "%s?data;DROP", base);
+	bad = URL_new(url_s);
+	snprintf(url_s, sizeof(url_s), "%s?data", base);
+	store = URL_new(url_s);
+	snprintf(url_s, sizeof(url_s), "%s/(data=%s)?data", base, value);
+	fetch = URL_new(url_s);
+
+	if (!bad || !store || !fetch || (mem = PKI_MEM_new_null()) == NULL ||
+			PKI_MEM_add(mem, value, strlen(value)) == PKI_ERR) {
+		printf("ERROR, can not parse %s!\n", base);
+		return PKI_ERR;
+	}
+
+	// Column names are never copied into the statement as they are
+	db->stats(&opened, &reused, &retried);
+	if ((sk = db->get(bad, 0)) != NULL) {
+		printf("ERROR, invalid column accepted!\n");
+		return PKI_ERR;
+	}
+	db->stats(&o, &r, &t);
+	if (o != opened) {
+		printf("ERROR, invalid statement sent!\n");
+		return PKI_ERR;
+	}
+
+	// The rows are stored (and fetched) over the same connection
+	for (i = 0; i < 3; i++) {
+		if (db->put(store, mem) != PKI_OK) {
+			printf("ERROR, can not store the data!\n");
+			return PKI_ERR;
+		}
+	}
+
+	if ((sk = db->get(fetch, 0)) == NULL || PKI_STACK_MEM_elements(sk) != 3) {
+		printf("ERROR, %d rows fetched!\n", sk ? PKI_STACK_MEM_elements(sk) : 0);
+		return PKI_ERR;
+	}
+	PKI_STACK_MEM_free_all(sk);
+
+	db->stats(&o, &r, &t);
+	if (o != opened + 1 || r < reused + 3) {
+		printf("ERROR, %lu opened, %lu reused!\n", o - opened, r - reused);
+		return PKI_ERR;
+	}
+	printf("Ok\n");
+
+	printf("Reconnecting after a server-side close (%s) ... ", name);
+	opened = o;
+	if (db->close_idle(store) != PKI_OK) {
+		printf("ERROR, can not close the pooled connections!\n");
+		return PKI_ERR;
+	}
+
+	// The server closes the sessions asynchronously
+	usleep(200000);
+
+	// A closed connection is either dropped from the pool or the
+	// statement is sent again over a new one
+	if ((sk = db->get(fetch, 0)) == NULL || PKI_STACK_MEM_elements(sk) != 3) {
+		printf("ERROR, fetch failed after the close!\n");
+		return PKI_ERR;
+	}
+	PKI_STACK_MEM_free_all(sk);
+
+	db->stats(&o, &r, &t);
+	if (o != opened + 1) {
+		printf("ERROR, %lu connections opened!\n", o - opened);
+		return PKI_ERR;
+	}
+	printf("Ok\n");
+
+	// The value is generated above, it can be used as it is
+	if ((table = db->table(store)) != NULL) {
+		snprintf(query, sizeof(query), "DELETE FROM %s WHERE data = '%s'",
+			table, value);
+		db->exec(store, query);
+		PKI_Free(table);
+	}
+
+	URL_free(bad);
+	URL_free(store);
+	URL_free(fetch);
+	PKI_MEM_free(mem);
+
+	return PKI_OK;
+}
+
+#endif
+
+static int test_sql_pools(void) {
+
+#ifdef HAVE_PG
+	TEST_DB pg = { "LIBPKI_TEST_PG_URL", URL_get_data_pg_url,
+		URL_put_data_pg_url, PKI_PG_POOL_get_stats, pg_parse_url_table,
+		test_pg_exec, test_pg_close_idle };
+#endif
+#ifdef HAVE_MYSQL
+	TEST_DB mysql = { "LIBPKI_TEST_MYSQL_URL", URL_get_data_mysql_url,
+		URL_put_data_mysql_url, PKI_MYSQL_POOL_get_stats, parse_url_table,
+		test_mysql_exec, test_mysql_close_idle };
+#endif
+
+#ifdef HAVE_PG
+	if (test_db_pool("PostgreSQL", &pg) != PKI_OK) return PKI_ERR;
+	PKI_PG_POOL_flush();
+#else
+	printf("Pooling PostgreSQL connections ... Skipped (no support)\n");
+#endif
+
+#ifdef HAVE_MYSQL
+	if (test_db_pool("MySQL", &mysql) != PKI_OK) return PKI_ERR;
+	PKI_MYSQL_POOL_flush();
+#else
+	printf("Pooling MySQL connections ... Skipped (no support)\n");
+#endif
+
+	return PKI_OK;
+}
+
+#ifdef HAVE_LDAP
+
+#define TEST_LDAP_BATCH		100
+
+/* Runs the batch, every other entry is missing */
+static int test_ldap_run(const URL *url, const char **dn) {
+
+	PKI_MEM_STACK *results[TEST_LDAP_BATCH];
+	PKI_MEM *first = NULL;
+	PKI_MEM *mem = NULL;
+	int ret = PKI_OK;
+	int i = 0;
+
+	if (URL_get_data_ldap_batch(url, dn, TEST_LDAP_BATCH, results,
+				    10, 0) != PKI_OK) {
+		printf("ERROR, batch failed!\n");
+		ret = PKI_ERR;
+	}
+
+	for (i = 0; i < TEST_LDAP_BATCH; i++) {
+		mem = results[i] ? PKI_STACK_MEM_get_num(results[i], 0) : NULL;
+		if (i == 0) first = mem;
+
+		if (ret == PKI_OK && (i % 2 ? results[i] != NULL : (!mem ||
+				mem->size != first->size ||
+				memcmp(mem->data, first->data, mem->size) != 0))) {
+			printf("ERROR, wrong result for entry %d!\n", i);
+			ret = PKI_ERR;
+		}
+	}
+
+	for (i = 0; i < TEST_LDAP_BATCH; i++)
+		if (results[i]) PKI_STACK_MEM_free_all(results[i]);
+
+	return ret;
+}
+
+#endif
+
+/* The URL (e.g. ldap://host:389/cn=ca,dc=example,dc=com?cACertificate)
+ * selects an entry that carries the attribute */
+static int test_ldap_batch(void) {
+
+#ifdef HAVE_LDAP
+	const char *url_s = getenv("LIBPKI_TEST_LDAP_URL");
+	const char *idle = getenv("LIBPKI_TEST_LDAP_IDLE_TIMEOUT");
+	const char *dn[TEST_LDAP_BATCH];
+	char missing[512];
+	URL *url = NULL;
+	unsigned long opened = 0, reused = 0;
+	unsigned long o = 0, r = 0;
+	int i = 0;
+
+	printf("Searching a batch of LDAP entries ... ");
+	if (!url_s) {
+		printf("Skipped (LIBPKI_TEST_LDAP_URL not set)\n");
+		return PKI_OK;
+	}
+
+	if ((url = URL_new(url_s)) == NULL || !url->path || !url->attrs) {
+		printf("ERROR, can not parse %s!\n", url_s);
+		return PKI_ERR;
+	}
+
+	snprintf(missing, sizeof(missing), "cn=libpki-test15-%d,%s",
+		(int) getpid(), url->path);
+
+	// More entries than searches outstanding on the session at once
+	for (i = 0; i < TEST_LDAP_BATCH; i++)
+		dn[i] = i % 2 ? missing : url->path;
+
+	PKI_LDAP_POOL_get_stats(&opened, &reused, NULL);
+	if (test_ldap_run(url, dn) != PKI_OK ||
+			test_ldap_run(url, dn) != PKI_OK) return PKI_ERR;
+
+	PKI_LDAP_POOL_get_stats(&o, &r, NULL);
+	if (o != opened + 1 || r != reused + 1) {
+		printf("ERROR, %lu opened, %lu reused!\n", o - opened, r - reused);
+		return PKI_ERR;
+	}
+	printf("Ok\n");
+
+	printf("Searching LDAP entries after a server-side close ... ");
+	if (!idle || atoi(idle) <= 0) {
+		printf("Skipped (LIBPKI_TEST_LDAP_IDLE_TIMEOUT not set)\n");
+	} else {
+		// The server closes the idle session before the pool does
+		PKI_LDAP_POOL_set_limits(PKI_LDAP_POOL_MAX_IDLE, atoi(idle) + 60);
+		sleep((unsigned int) atoi(idle) + 2);
+
+		opened = o;
+		if (test_ldap_run(url, dn) != PKI_OK) return PKI_ERR;
+
+		PKI_LDAP_POOL_get_stats(&o, NULL, NULL);
+		if (o != opened + 1) {
+			printf("ERROR, %lu sessions opened!\n", o - opened);
+			return PKI_ERR;
+		}
+
+		PKI_LDAP_POOL_set_limits(PKI_LDAP_POOL_MAX_IDLE,
+					 PKI_LDAP_POOL_IDLE_TIMEOUT);
+		printf("Ok\n");
+	}
+
+	PKI_LDAP_POOL_flush();
+	URL_free(url);
+#else
+	printf("Searching a batch of LDAP entries ... Skipped (no support)\n");
+#endif
+
+	return PKI_OK;
+}
+
+/* Verifies the certificate with the OpenSSL store of the trust store */
+static int test_trust_verify(const PKI_TRUST_STORE *ts, PKI_X509_CERT *x) {
+
+	X509_STORE_CTX *ctx = NULL;
+	int ret = 0;
+
+	if ((ctx = X509_STORE_CTX_new()) == NULL) return 0;
+
+	if (X509_STORE_CTX_init(ctx, ts->store, x->value, NULL))
+		ret = X509_verify_cert(ctx);
+
+	X509_STORE_CTX_free(ctx);
+
+	return ret == 1;
+}
+
+static int test_trust_store(void) {
+
+	PKI_X509_PROFILE *ca_prof = NULL;
+	PKI_X509_KEYPAIR *keys[3] = { NULL, NULL, NULL };
+	PKI_X509_CERT *ca[2] = { NULL, NULL };
+	PKI_X509_CERT *leaf[3] = { NULL, NULL, NULL };
+	PKI_X509_CERT_STACK *sk = NULL;
+	PKI_TRUST_STORE *ts = NULL;
+	int i = 0;
+
+	printf("Verifying chains through a trust store ... ");
+
+	if ((ca_prof = test_ca_profile()) == NULL) {
+		printf("ERROR, can not build the CA profile!\n");
+		return PKI_ERR;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if ((keys[i] = PKI_X509_KEYPAIR_new(PKI_SCHEME_RSA, 2048,
+						NULL, NULL, NULL)) == NULL) {
+			printf("ERROR, can not generate the keys!\n");
+			return PKI_ERR;
+		}
+	}
+
+	// Two CAs, only the first one is trusted. The third certificate
+	// claims to be issued by the first CA but is signed by the second
+	if ((ca[0] = test_issue_cert(NULL, keys[0], keys[0], "CN=Test15 CA 1",
+					"1", ca_prof)) == NULL ||
+			(ca[1] = test_issue_cert(NULL, keys[1], keys[1],
+					"CN=Test15 CA 2", "1", ca_prof)) == NULL ||
+			(leaf[0] = test_issue_cert(ca[0], keys[0], keys[2],
+					"CN=Test15 Leaf 1", "2", NULL)) == NULL ||
+			(leaf[1] = test_issue_cert(ca[1], keys[1], keys[2],
+					"CN=Test15 Leaf 2", "2", NULL)) == NULL ||
+			(leaf[2] = test_issue_cert(ca[0], keys[1], keys[2],
+					"CN=Test15 Leaf 3", "3", NULL)) == NULL) {
+		printf("ERROR, can not issue the certificates!\n");
+		return PKI_ERR;
+	}
+
+	// Duplicates are indexed once
+	if ((sk = PKI_STACK_X509_CERT_new()) == NULL ||
+			PKI_STACK_X509_CERT_push(sk, ca[0]) == PKI_ERR ||
+			PKI_STACK_X509_CERT_push(sk, ca[0]) == PKI_ERR ||
+			(ts = PKI_TRUST_STORE_new(sk)) == NULL ||
+			PKI_TRUST_STORE_elements(ts) != 1) {
+		printf("ERROR, can not build the trust store!\n");
+		return PKI_ERR;
+	}
+	PKI_STACK_X509_CERT_free(sk);
+
+	if (PKI_TRUST_STORE_find(ts, ca[0]->value) != 0 ||
+			PKI_TRUST_STORE_find_issuer(ts, leaf[0]->value) !=
+								ca[0]->value ||
+			PKI_TRUST_STORE_check(ts, leaf[0]->value) != PKI_OK ||
+			!test_trust_verify(ts, leaf[0])) {
+		printf("ERROR, trusted chain rejected!\n");
+		return PKI_ERR;
+	}
+
+	if (PKI_TRUST_STORE_find(ts, ca[1]->value) >= 0 ||
+			PKI_TRUST_STORE_check(ts, leaf[1]->value) != PKI_ERR ||
+			test_trust_verify(ts, leaf[1])) {
+		printf("ERROR, untrusted chain accepted!\n");
+		return PKI_ERR;
+	}
+
+	// The lookup does not verify signatures, the chain verification does
+	if (test_trust_verify(ts, leaf[2])) {
+		printf("ERROR, forged certificate accepted!\n");
+		return PKI_ERR;
+	}
+
+	PKI_TRUST_STORE_free(ts);
+	for (i = 0; i < 3; i++) {
+		if (i < 2) PKI_X509_CERT_free(ca[i]);
+		PKI_X509_CERT_free(leaf[i]);
+		PKI_X509_KEYPAIR_free(keys[i]);
+	}
+	PKI_X509_PROFILE_free(ca_prof);
+	printf("Ok\n");
+
+	return PKI_OK;
+}
+
+/* Minimal TLS server: sends "OK" and waits for the client to close */
+static void test_tls_server(int fd, int num, PKI_X509_CERT *cert,
+					PKI_X509_KEYPAIR *key) {
+
+	SSL_CTX *ctx = NULL;
+	SSL *ssl = NULL;
+	char buf[16];
+	int c = -1;
+
+	if ((ctx = SSL_CTX_new(TLS_server_method())) == NULL ||
+			!SSL_CTX_use_certificate(ctx, cert->value) ||
+			!SSL_CTX_use_PrivateKey(ctx, key->value))
+		return;
+
+	for ( ; num > 0; num--) {
+		if ((c = accept(fd, NULL, NULL)) < 0) break;
+
+		if ((ssl = SSL_new(ctx)) != NULL && SSL_set_fd(ssl, c) &&
+				SSL_accept(ssl) == 1 && SSL_write(ssl, "OK", 2) == 2) {
+			while (SSL_read(ssl, buf, sizeof(buf)) > 0);
+			SSL_shutdown(ssl);
+		}
+
+		if (ssl) SSL_free(ssl);
+		close(c);
+	}
+
+	SSL_CTX_free(ctx);
+}
+
+static int test_tls_resume(void) {
+
+	PKI_X509_PROFILE *ca_prof = NULL;
+	PKI_X509_KEYPAIR *keys[2] = { NULL, NULL };
+	PKI_X509_CERT *ca = NULL;
+	PKI_X509_CERT *cert = NULL;
+	PKI_X509_CERT_STACK *chain = NULL;
+	PKI_SSL *ssl = NULL;
+	struct sockaddr_in sa;
+	socklen_t sa_len = sizeof(sa);
+	char url_s[64];
+	char buf[2];
+	pid_t pid = 0;
+	int fd = -1;
+	int i = 0;
+
+	printf("Resuming TLS sessions ... ");
+
+	if ((ca_prof = test_ca_profile()) == NULL ||
+			(keys[0] = PKI_X509_KEYPAIR_new(PKI_SCHEME_RSA, 2048,
+					NULL, NULL, NULL)) == NULL ||
+			(keys[1] = PKI_X509_KEYPAIR_new(PKI_SCHEME_RSA, 2048,
+					NULL, NULL, NULL)) == NULL ||
+			(ca = test_issue_cert(NULL, keys[0], keys[0],
+					"CN=Test15 TLS CA", "1", ca_prof)) == NULL ||
+			(cert = test_issue_cert(ca, keys[0], keys[1],
+					"CN=127.0.0.1", "2", NULL)) == NULL) {
+		printf("ERROR, can not issue the certificates!\n");
+		return PKI_ERR;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+			bind(fd, (struct sockaddr *) &sa, sizeof(sa)) != 0 ||
+			listen(fd, 4) != 0 ||
+			getsockname(fd, (struct sockaddr *) &sa, &sa_len) != 0) {
+		printf("ERROR, can not listen!\n");
+		return PKI_ERR;
+	}
+
+	if ((pid = fork()) == 0) {
+		test_tls_server(fd, 2, cert, keys[1]);
+		_exit(0);
+	}
+	close(fd);
+
+	snprintf(url_s, sizeof(url_s), "https://127.0.0.1:%d/",
+		ntohs(sa.sin_port));
+
+	// The second connection resumes the session of the first one,
+	// the peer chain must be available in both cases
+	for (i = 0; i < 2; i++) {
+
+		// The PKI_SSL takes ownership of the trusted certificate
+		if ((ssl = PKI_SSL_new(NULL)) == NULL ||
+				PKI_SSL_add_trusted(ssl,
+					PKI_X509_CERT_dup(ca)) != PKI_OK ||
+				PKI_SSL_set_verify(ssl,
+					PKI_SSL_VERIFY_PEER_REQUIRE) != PKI_OK ||
+				PKI_SSL_connect(ssl, url_s, 5) != PKI_OK ||
+				PKI_SSL_read(ssl, buf, 2) != 2) {
+			printf("ERROR, can not connect (%d)!\n", i);
+			kill(pid, SIGTERM);
+			return PKI_ERR;
+		}
+
+		if (PKI_SSL_session_reused(ssl) != i ||
+				(chain = PKI_SSL_get_peer_chain(ssl)) == NULL ||
+				PKI_STACK_X509_CERT_elements(chain) <= 0) {
+			printf("ERROR, wrong session (%d, reused %d)!\n",
+				i, PKI_SSL_session_reused(ssl));
+			kill(pid, SIGTERM);
+			return PKI_ERR;
+		}
+
+		PKI_SSL_close(ssl);
+		PKI_SSL_free(ssl);
+	}
+	waitpid(pid, NULL, 0);
+
+	PKI_X509_CERT_free(cert);
+	PKI_X509_CERT_free(ca);
+	PKI_X509_KEYPAIR_free(keys[0]);
+	PKI_X509_KEYPAIR_free(keys[1]);
+	PKI_X509_PROFILE_free(ca_prof);
+	printf("Ok\n");
+
+	return PKI_OK;
+}
+
+typedef struct {
+	volatile int accepts;
+	volatile int closes;
+	volatile int block;
+	volatile int blocked;
+} TEST_LOOP_STATS;
+
+/* Echo handler, optionally blocks the worker in ACCEPT */
+static int test_loop_cb(PKI_NET_CONN *conn, PKI_NET_EVENT event, void *arg) {
+
+	TEST_LOOP_STATS *st = (TEST_LOOP_STATS *) arg;
+	char buf[256];
+	ssize_t n = 0;
+
+	switch (event) {
+
+		case PKI_NET_EVENT_ACCEPT:
+			__atomic_add_fetch(&st->accepts, 1, __ATOMIC_SEQ_CST);
+			if (st->block) {
+				st->blocked = 1;
+				while (st->block) usleep(1000);
+			}
+			break;
+
+		case PKI_NET_EVENT_READ:
+			while ((n = PKI_NET_CONN_read(conn, buf, sizeof(buf))) > 0) {
+				if (PKI_NET_CONN_write(conn, buf, (size_t) n) != n)
+					return PKI_ERR;
+			}
+			if (n < 0) return PKI_ERR;
+			break;
+
+		case PKI_NET_EVENT_CLOSE:
+			__atomic_add_fetch(&st->closes, 1, __ATOMIC_SEQ_CST);
+			break;
+
+		default:
+			break;
+	}
+
+	return PKI_OK;
+}
+
+static void * test_loop_run(void *arg) {
+
+	PKI_NET_LOOP_run((PKI_NET_LOOP *) arg);
+
+	return NULL;
+}
+
+static int test_loop_connect(const struct sockaddr_in *sa) {
+
+	int fd = -1;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) return -1;
+
+	if (connect(fd, (const struct sockaddr *) sa, sizeof(*sa)) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int test_net_loop(void) {
+
+	TEST_LOOP_STATS st;
+	PKI_NET_LOOP *loop = NULL;
+	PKI_THREAD *th = NULL;
+	struct sockaddr_in sa;
+	socklen_t sa_len = sizeof(sa);
+	char buf[8];
+	int cl[2] = { -1, -1 };
+	int fd = -1;
+	int c = -1;
+	int i = 0;
+
+	printf("Serving connections from the event loop ... ");
+	memset(&st, 0, sizeof(st));
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	// One worker, so that a blocked callback holds the queue
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+			bind(fd, (struct sockaddr *) &sa, sizeof(sa)) != 0 ||
+			listen(fd, 16) != 0 ||
+			getsockname(fd, (struct sockaddr *) &sa, &sa_len) != 0 ||
+			(loop = PKI_NET_LOOP_new(1, 16)) == NULL ||
+			PKI_NET_LOOP_add_listener(loop, fd, NULL, test_loop_cb,
+					&st, 5) != PKI_OK ||
+			(th = PKI_THREAD_new(test_loop_run, loop)) == NULL) {
+		printf("ERROR, can not start the loop!\n");
+		return PKI_ERR;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if ((c = test_loop_connect(&sa)) < 0 ||
+				write(c, "PING", 4) != 4 ||
+				recv(c, buf, 4, MSG_WAITALL) != 4 ||
+				memcmp(buf, "PING", 4) != 0) {
+			printf("ERROR, wrong echo (%d)!\n", i);
+			return PKI_ERR;
+		}
+		close(c);
+	}
+
+	for (i = 0; i < 5000 && st.closes < 3; i++) usleep(1000);
+	if (st.accepts != 3 || st.closes != 3) {
+		printf("ERROR, %d accepts, %d closes!\n", st.accepts, st.closes);
+		return PKI_ERR;
+	}
+	printf("Ok\n");
+
+	printf("Stopping the loop with queued connections ... ");
+
+	// The first connection blocks the worker, the second one is
+	// accepted and queued, then the loop is stopped
+	st.block = 1;
+	if ((cl[0] = test_loop_connect(&sa)) < 0) {
+		printf("ERROR, can not connect!\n");
+		return PKI_ERR;
+	}
+	for (i = 0; i < 5000 && !st.blocked; i++) usleep(1000);
+
+	if ((cl[1] = test_loop_connect(&sa)) < 0) {
+		printf("ERROR, can not connect!\n");
+		return PKI_ERR;
+	}
+	usleep(200000);
+
+	PKI_NET_LOOP_stop(loop);
+	st.block = 0;
+
+	PKI_THREAD_join(th, NULL);
+	PKI_Free(th);
+
+	// The queued connection never saw ACCEPT, it must not see CLOSE
+	if (!st.blocked || st.accepts != 4 || st.closes != 4) {
+		printf("ERROR, %d accepts, %d closes!\n", st.accepts, st.closes);
+		return PKI_ERR;
+	}
+
+	close(cl[0]);
+	close(cl[1]);
+	close(fd);
+	PKI_NET_LOOP_free(loop);
+	printf("Ok\n");
+
+	return PKI_OK;
+}
+
+int main (int argc, char *argv[] ) {
+
+	PKI_HTTP_PARSER *p = NULL;
+	PKI_HTTP *msg = NULL;
+	size_t i = 0;
+
+	printf("\n\nlibpki Test - Massimiliano Pala <madwolf@openca.org>\n");
+	printf("(c) 2006 by Massimiliano Pala and OpenCA Project\n");
+	printf("OpenCA Licensed Software\n\n");
+
+	PKI_init_all();
+
+	printf("Parsing pipelined requests (byte by byte) ... ");
+	if ((p = PKI_HTTP_PARSER_new(0)) == NULL) {
+		printf("ERROR, memory allocation!\n");
+		exit(1);
+	}
+
+	for (i = 0; i < strlen(pipelined) && !msg; i++) {
+		PKI_HTTP_PARSER_add(p, &pipelined[i], 1);
+		if (PKI_HTTP_PARSER_get_message(p, 0, &msg) != PKI_OK) {
+			printf("ERROR, parsing failed at byte %d!\n", (int) i);
+			exit(1);
+		}
+	}
+
+	if (!msg || msg->method != PKI_HTTP_METHOD_POST ||
+			strcmp(msg->path, "/ocsp") != 0 ||
+			msg->body->size != 5 ||
+			memcmp(msg->body->data, "HELLO", 5) != 0 ||
+			!msg->keep_alive) {
+		printf("ERROR, wrong first request!\n");
+		exit(1);
+	}
+	PKI_HTTP_free(msg);
+	msg = NULL;
+
+	PKI_HTTP_PARSER_add(p, &pipelined[i], strlen(pipelined) - i);
+	if (PKI_HTTP_PARSER_get_message(p, 0, &msg) != PKI_OK || !msg ||
+			msg->method != PKI_HTTP_METHOD_GET ||
+			strcmp(msg->path, "/ca.crt") != 0 ||
+			msg->body->size != 0 || msg->keep_alive ||
+			PKI_HTTP_PARSER_pending(p) != 0) {
+		printf("ERROR, wrong second request!\n");
+		exit(1);
+	}
+	PKI_HTTP_free(msg);
+	msg = NULL;
+	printf("Ok\n");
+
+	printf("Parsing chunked responses ... ");
+	PKI_HTTP_PARSER_add(p, chunked, strlen(chunked));
+	if (PKI_HTTP_PARSER_get_message(p, 0, &msg) != PKI_OK || !msg ||
+			msg->code != 200 || msg->body->size != 9 ||
+			strcmp((char *) msg->body->data, "Wikipedia") != 0 ||
+			!msg->keep_alive) {
+		printf("ERROR, wrong chunked body!\n");
+		exit(1);
+	}
+	PKI_HTTP_free(msg);
+	msg = NULL;
+
+	if (PKI_HTTP_PARSER_get_message(p, 0, &msg) != PKI_OK || !msg ||
+			msg->code != 204 || msg->body->size != 0) {
+		printf("ERROR, wrong response after the chunked one!\n");
+		exit(1);
+	}
+	PKI_HTTP_free(msg);
+	msg = NULL;
+	printf("Ok\n");
+
+	printf("Parsing a response delimited by the close ... ");
+	PKI_HTTP_PARSER_add(p, until_close, strlen(until_close));
+	if (PKI_HTTP_PARSER_get_message(p, 0, &msg) != PKI_OK || msg) {
+		printf("ERROR, response completed before the close!\n");
+		exit(1);
+	}
+
+	if (PKI_HTTP_PARSER_get_message(p, 1, &msg) != PKI_OK || !msg ||
+			strcmp((char *) msg->body->data, "Body until close") != 0 ||
+			strcmp(msg->type, "text/plain") != 0 || msg->keep_alive) {
+		printf("ERROR, wrong response!\n");
+		exit(1);
+	}
+	PKI_HTTP_free(msg);
+	msg = NULL;
+	printf("Ok\n");
+
+	printf("Rejecting malformed messages ... ");
+	PKI_HTTP_PARSER_add(p, malformed, strlen(malformed));
+	if (PKI_HTTP_PARSER_get_message(p, 0, &msg) != PKI_ERR || msg ||
+			PKI_HTTP_PARSER_pending(p) != 0) {
+		printf("ERROR, malformed chunk accepted!\n");
+		exit(1);
+	}
+	printf("Ok\n");
+
+	PKI_HTTP_PARSER_free(p);
+
+	if (test_dns_cache() != PKI_OK) exit(1);
+
+	if (test_url_cache() != PKI_OK) exit(1);
+
+	if (test_url_multi() != PKI_OK) exit(1);
+
+	if (test_url_multi_limits() != PKI_OK) exit(1);
+
+	if (test_net_loop() != PKI_OK) exit(1);
+
+	if (test_sql_pools() != PKI_OK) exit(1);
+
+	if (test_ldap_batch() != PKI_OK) exit(1);
+
+	if (test_trust_store() != PKI_OK) exit(1);
+
+	if (test_tls_resume() != PKI_OK) exit(1);
+
+	printf("\n\n[ Test Ended Succesfully ]\n\n");
+
+	return (0);
+}
@@ -1,6 +1,126 @@
 
 #include <libpki/pki.h>
 
+/* Repeated (cached) lookups must reflect the changes to the document */
+static int test_config_cache(PKI_X509_PROFILE *prof) {
+
+	char *val = NULL;
+	int num = 0;
+	int ret = 0;
+	int i = 0;
+
+	printf("Looking up (cached) profile values ... ");
+
+	for (i = 0; i < 3; i++) {
+		if ((val = PKI_CONFIG_get_value(prof, "/profile/name")) == NULL ||
+				strcmp(val, "test") != 0) goto end;
+		PKI_Free(val);
+		val = NULL;
+	}
+
+	if (PKI_CONFIG_get_value(prof, "/profile/notThere") != NULL ||
+		PKI_CONFIG_get_element(prof, "/profile/notThere", -1) != NULL)
+		goto end;
+
+	// Nodes added by the library are not bound to the pki namespace
+	if ((num = PKI_CONFIG_get_elements_num(prof,
+				"/profile/extensions/child::*")) <= 0) goto end;
+
+	if (PKI_X509_PROFILE_add_extension(prof, "nsComment", "Test5",
+					NULL, 0) == NULL) goto end;
+
+	if (PKI_CONFIG_get_elements_num(prof,
+			"/profile/extensions/child::*") != num + 1) goto end;
+
+	if ((val = PKI_CONFIG_get_value(prof,
+			"/profile/extensions/child::*[last()]/child::*")) == NULL ||
+		strcmp(val, "Test5") != 0) goto end;
+
+	ret = 1;
+
+end:
+	if (val) PKI_Free(val);
+
+	printf("%s\n", ret ? "Ok." : "ERROR!");
+
+	return ret;
+}
+
+/* Issues certificates from the compiled (cached) version of the profile */
+static int test_profile_template(PKI_TOKEN *tk, PKI_X509_PROFILE *prof) {
+
+	PKI_X509_PROFILE_TEMPLATE *tmpl = NULL;
+	PKI_X509_PROFILE_TEMPLATE *tmpl2 = NULL;
+	PKI_X509_CERT *c1 = NULL;
+	PKI_X509_CERT *c2 = NULL;
+	int exts_num = 0;
+	int ret = 0;
+	int i = 0;
+
+	printf("Issuing certificates from the compiled profile ... ");
+
+	if ((exts_num = PKI_X509_PROFILE_get_exts_num(prof)) <= 0) goto end;
+
+	if ((tmpl = PKI_TOKEN_get_profile_template(tk, prof)) == NULL ||
+		(tmpl2 = PKI_TOKEN_get_profile_template(tk, prof)) != tmpl)
+		goto end;
+
+	PKI_X509_PROFILE_TEMPLATE_free(tmpl2);
+	tmpl2 = NULL;
+
+	if ((c1 = PKI_TOKEN_issue_cert(tk, "CN=Test5 User", "2", 0,
+					NULL, "test")) == NULL ||
+		(c2 = PKI_TOKEN_issue_cert(tk, "CN=Test5 User", "3", 0,
+					NULL, "test")) == NULL) goto end;
+
+	if (X509_get_ext_count(c1->value) != exts_num ||
+		X509_get_ext_count(c2->value) != exts_num) goto end;
+
+	// The extensions must match the ones built from the XML profile
+	for (i = 0; i < exts_num; i++) {
+
+		PKI_X509_EXTENSION *ext = NULL;
+		int cmp = 0;
+
+		if ((ext = PKI_X509_PROFILE_get_ext_by_num(prof, i, tk)) == NULL)
+			goto end;
+
+		cmp = ASN1_STRING_cmp(X509_EXTENSION_get_data(ext->value),
+				X509_EXTENSION_get_data(X509_get_ext(c1->value, i)));
+		PKI_X509_EXTENSION_free(ext);
+
+		if (cmp != 0) goto end;
+	}
+
+	PKI_X509_CERT_free(c1);
+	c1 = NULL;
+
+	// Modified profiles are compiled again
+	if (PKI_X509_PROFILE_add_extension(prof, "nsComment", "Test5",
+					NULL, 0) == NULL) goto end;
+
+	if ((c1 = PKI_TOKEN_issue_cert(tk, "CN=Test5 User", "4", 0,
+					NULL, "test")) == NULL ||
+		X509_get_ext_count(c1->value) != exts_num + 1) goto end;
+
+	// The reference to the stale template is still valid
+	if ((tmpl2 = PKI_TOKEN_get_profile_template(tk, prof)) == NULL ||
+		tmpl2 == tmpl || tmpl->exts_num != exts_num ||
+		tmpl2->exts_num != exts_num + 1) goto end;
+
+	ret = 1;
+
+end:
+	if (tmpl) PKI_X509_PROFILE_TEMPLATE_free(tmpl);
+	if (tmpl2) PKI_X509_PROFILE_TEMPLATE_free(tmpl2);
+	if (c1) PKI_X509_CERT_free(c1);
+	if (c2) PKI_X509_CERT_free(c2);
+
+	printf("%s\n", ret ? "Ok." : "ERROR!");
+
+	return ret;
+}
+
 int main (int argc, char *argv[] ) {
 
 	PKI_TOKEN *tk = NULL;
@@ -46,6 +166,22 @@ int main (int argc, char *argv[] ) {
 		printf("Ok.\n");
 	}
 
+	printf("Generating a new CA certificate ... ");
+	if((PKI_TOKEN_new_keypair ( tk, 2048, NULL )) == PKI_ERR ||
+		(PKI_TOKEN_self_sign( tk, "CN=Test5 CA", "1", 24*3600,
+					NULL )) == PKI_ERR ) {
+		printf("ERROR!\n\n");
+		exit(1);
+	} else {
+		printf("Ok.\n");
+	}
+
+	if (!test_config_cache( prof )) exit(1);
+
+	// The token owns the profile from now on
+	PKI_TOKEN_add_profile( tk, prof );
+	if (!test_profile_template( tk, prof )) exit(1);
+	prof = NULL;
 
 	if( tk ) PKI_TOKEN_free ( tk );
 	if( prof ) PKI_X509_PROFILE_free ( prof );
@@ -6,6 +6,9 @@
 #include <sys/types.h>
 #include <dirent.h>
 
+/* Protects the compiled profiles cached in the tokens */
+static pthread_mutex_t __token_tmpl_lock = PTHREAD_MUTEX_INITIALIZER;
+
 PKI_CRED *PKI_TOKEN_cred_cb_stdin ( char * prompt ) {
 
 	PKI_CRED *ret = NULL;
@@ -394,6 +397,14 @@ int PKI_TOKEN_free( PKI_TOKEN *tk )
 		tk->profiles = NULL;
 	}
 
+	if (tk->profile_templates)
+	{
+		pthread_mutex_lock(&__token_tmpl_lock);
+		PKI_STACK_free_all(tk->profile_templates);
+		tk->profile_templates = NULL;
+		pthread_mutex_unlock(&__token_tmpl_lock);
+	}
+
 	if (tk->cert)
 	{
 		PKI_X509_CERT_free( tk->cert );
@@ -1700,6 +1711,188 @@ int PKI_TOKEN_load_crls ( PKI_TOKEN *tk, char *url_string)
 	return PKI_OK;
 }
 
+/* Moves the objects from x_sk into sk, returns the number of objects */
+static int __token_move_objects(PKI_X509_STACK *sk, PKI_X509_STACK *x_sk)
+{
+	PKI_X509 *x = NULL;
+	int ret = 0;
+
+	while ((x = PKI_STACK_X509_pop(x_sk)) != NULL)
+	{
+		PKI_STACK_X509_push(sk, x);
+		ret++;
+	}
+	PKI_STACK_X509_free(x_sk);
+
+	return ret;
+}
+
+/*
+ * Retrieves the URLs concurrently and returns the objects of the given type
+ * loaded from them, failed is set to the number of URLs with no objects.
+ * The token's credentials are used as in PKI_X509_STACK_get_url(), id://
+ * URLs are loaded from the token's HSM (one at the time).
+ */
+static PKI_X509_STACK * __token_load_multi(PKI_TOKEN *tk, const char **urls,
+					   int num, PKI_DATATYPE type,
+					   int *failed)
+{
+	PKI_X509_STACK *ret = NULL;
+	PKI_X509_STACK *x_sk = NULL;
+	PKI_MEM_STACK **results = NULL;
+	URL **url_sk = NULL;
+	int *found = NULL;
+	PKI_SSL *ssl = NULL;
+	URL *url = NULL;
+	int i = 0;
+	int j = 0;
+
+	*failed = num;
+
+	if (!tk->cred) tk->cred = PKI_TOKEN_cred_get(tk, NULL);
+	if (tk->cred) ssl = (PKI_SSL *) tk->cred->ssl;
+
+	if ((results = PKI_Malloc(sizeof(PKI_MEM_STACK *) * (size_t) num)) == NULL ||
+			(url_sk = PKI_Malloc(sizeof(URL *) * (size_t) num)) == NULL ||
+			(found = PKI_Malloc(sizeof(int) * (size_t) num)) == NULL ||
+			(ret = PKI_STACK_X509_new()) == NULL)
+	{
+		PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+		if (results) PKI_Free(results);
+		if (url_sk) PKI_Free(url_sk);
+		if (found) PKI_Free(found);
+		return NULL;
+	}
+
+	for (i = 0; i < num; i++)
+	{
+		if (!urls[i] || (url = URL_new(urls[i])) == NULL) continue;
+
+		// HSM objects are not retrieved, they use the single URL path
+		if (url->proto == URI_PROTO_ID)
+		{
+			if ((x_sk = PKI_X509_STACK_get_url(url, type,
+					PKI_DATA_FORMAT_UNKNOWN, tk->cred, tk->hsm)) != NULL)
+				found[i] = __token_move_objects(ret, x_sk);
+
+			URL_free(url);
+			continue;
+		}
+
+		// Credentials are used unless the URL carries its own
+		if (tk->cred && !url->usr && tk->cred->username)
+			url->usr = strdup(tk->cred->username);
+
+		if (tk->cred && !url->pwd && tk->cred->password)
+			url->pwd = strdup(tk->cred->password);
+
+		url_sk[i] = url;
+	}
+
+	// Same budget as for a single URL (see PKI_X509_STACK_get_url)
+	URL_get_data_multi_url((const URL **) url_sk, num, 60, 0, ssl,
+		results, NULL);
+
+	for (i = 0; i < num; i++)
+	{
+		for (j = 0; results[i] && j < PKI_STACK_MEM_elements(results[i]); j++)
+		{
+			if ((x_sk = PKI_X509_STACK_get_mem(
+					PKI_STACK_MEM_get_num(results[i], j), type,
+					PKI_DATA_FORMAT_UNKNOWN, tk->cred, tk->hsm)) == NULL)
+				continue;
+
+			found[i] += __token_move_objects(ret, x_sk);
+		}
+
+		if (results[i]) PKI_STACK_MEM_free_all(results[i]);
+		if (url_sk[i]) URL_free(url_sk[i]);
+
+		if (found[i] > 0) (*failed)--;
+		else PKI_ERROR(PKI_ERR_URI_GENERAL, urls[i]);
+	}
+
+	PKI_Free(found);
+	PKI_Free(url_sk);
+	PKI_Free(results);
+
+	return ret;
+}
+
+/*!
+ * \brief Get the CRLs from a list of URLs (retrieved concurrently) and adds
+ *        them to the PKI_TOKEN
+ *
+ * The URLs (e.g., the CRL distribution points of a set of CAs) are loaded
+ * as by PKI_TOKEN_load_crls(), with the token's credentials and HSM, but
+ * they are retrieved in parallel via URL_get_data_multi_url(). The CRLs
+ * are added to the ones already in the token.
+ *
+ * The function returns PKI_OK if all URLs were loaded, otherwise it returns
+ * PKI_ERR (the CRLs from the other URLs are added anyway).
+ */
+
+int PKI_TOKEN_load_crls_multi(PKI_TOKEN *tk, const char **urls, int num)
+{
+	PKI_X509_STACK *sk = NULL;
+	PKI_X509 *x = NULL;
+	int failed = 0;
+
+	if (!tk || !urls || num <= 0) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	if ((sk = __token_load_multi(tk, urls, num, PKI_DATATYPE_X509_CRL,
+					&failed)) == NULL)
+		return PKI_ERR;
+
+	if (!tk->crls && (tk->crls = PKI_STACK_X509_CRL_new()) == NULL)
+	{
+		PKI_STACK_X509_free_all(sk);
+		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+	}
+
+	while ((x = PKI_STACK_X509_pop(sk)) != NULL)
+		PKI_STACK_X509_CRL_push(tk->crls, x);
+
+	PKI_STACK_X509_free(sk);
+
+	return failed ? PKI_ERR : PKI_OK;
+}
+
+/*!
+ * \brief Get TRUSTED certificates from a list of URLs (retrieved
+ *        concurrently) and adds them to the PKI_TOKEN
+ *
+ * See PKI_TOKEN_load_crls_multi(), the certificates are added to the
+ * trusted ones already in the token.
+ */
+
+int PKI_TOKEN_load_trustedCerts_multi(PKI_TOKEN *tk, const char **urls, int num)
+{
+	PKI_X509_STACK *sk = NULL;
+	PKI_X509 *x = NULL;
+	int failed = 0;
+
+	if (!tk || !urls || num <= 0) return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+
+	if ((sk = __token_load_multi(tk, urls, num, PKI_DATATYPE_X509_CERT,
+					&failed)) == NULL)
+		return PKI_ERR;
+
+	if (!tk->trustedCerts &&
+			(tk->trustedCerts = PKI_STACK_X509_CERT_new()) == NULL)
+	{
+		PKI_STACK_X509_free_all(sk);
+		return PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+	}
+
+	while ((x = PKI_STACK_X509_pop(sk)) != NULL)
+		PKI_STACK_X509_CERT_push(tk->trustedCerts, x);
+
+	PKI_STACK_X509_free(sk);
+
+	return failed ? PKI_ERR : PKI_OK;
+}
+
 /*!
  * \brief Get a PKI_X509_KEYPAIR from a URL and assigns it to the PKI_TOKEN
  *
@@ -2215,6 +2408,64 @@ PKI_X509_CRL * PKI_TOKEN_issue_crl ( PKI_TOKEN *tk, char *serial,
 	return( crl );
 }
 
+/*! \brief Generate a new CRL from the entries of a PKI_X509_CRL_BUILDER by
+ *         using the provided token
+ */
+
+PKI_X509_CRL * PKI_TOKEN_issue_crl_builder ( PKI_TOKEN *tk, char *serial,
+	unsigned long validity, PKI_X509_CRL_BUILDER *b, char *profile_s) {
+
+	PKI_X509_PROFILE *profile = NULL;
+
+	if( !tk || !b ) return ( NULL );
+
+	if( profile_s ) {
+		if((profile = PKI_TOKEN_search_profile( tk, profile_s )) == NULL) {
+			PKI_log_debug("ERROR, no matching profile found (%s)!\n",
+				profile_s);
+			return (NULL);
+		};
+	};
+
+	if( PKI_TOKEN_login( tk ) != PKI_OK ) {
+		return ( NULL );
+	}
+
+	return PKI_X509_CRL_BUILDER_get_crl( b, tk->keypair, tk->cert, serial,
+				validity, profile, tk->oids, tk->hsm );
+}
+
+/*! \brief Generate a new delta CRL against a base CRL from the entries of a
+ *         PKI_X509_CRL_BUILDER by using the provided token
+ *
+ * The builder carries the complete (current) revocation set, see the
+ * PKI_X509_CRL_BUILDER_get_delta() function for the details.
+ */
+
+PKI_X509_CRL * PKI_TOKEN_issue_delta_crl ( PKI_TOKEN *tk, char *serial,
+	unsigned long validity, const PKI_X509_CRL *base,
+	PKI_X509_CRL_BUILDER *b, char *profile_s) {
+
+	PKI_X509_PROFILE *profile = NULL;
+
+	if( !tk || !base || !b ) return ( NULL );
+
+	if( profile_s ) {
+		if((profile = PKI_TOKEN_search_profile( tk, profile_s )) == NULL) {
+			PKI_log_debug("ERROR, no matching profile found (%s)!\n",
+				profile_s);
+			return (NULL);
+		};
+	};
+
+	if( PKI_TOKEN_login( tk ) != PKI_OK ) {
+		return ( NULL );
+	}
+
+	return PKI_X509_CRL_BUILDER_get_delta( b, base, tk->keypair, tk->cert,
+				serial, validity, profile, tk->oids, tk->hsm );
+}
+
 /*!
  * \brief Generates a new PKI_X509_REQ object
  */
@@ -2325,6 +2576,7 @@ int PKI_TOKEN_self_sign (PKI_TOKEN *tk, char *subject, char *serial,
 				unsigned long validity, char *profile_s ) {
 
 	PKI_X509_PROFILE *cert_profile = NULL;
+	PKI_X509_PROFILE_TEMPLATE *tmpl = NULL;
 
 	if (!tk || !tk->keypair)
 		return PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
@@ -2348,24 +2600,107 @@ int PKI_TOKEN_self_sign (PKI_TOKEN *tk, char *subject, char *serial,
 			PKI_log_err("Requested profile (%s) not found when self-signing cert!\n", profile_s);
 			return (PKI_ERR);
 		}
+
+		if ((tmpl = PKI_TOKEN_get_profile_template(tk, cert_profile))
+							== NULL) {
+			tk->cert = NULL;
+			return PKI_ERROR(PKI_ERR_X509_CERT_CREATE, NULL);
+		}
 	}
 
 	if (!tk->cred ) tk->cred = PKI_TOKEN_cred_get(tk, NULL );
 
 	if (!serial) serial = "0";
 
-	tk->cert = PKI_X509_CERT_new ( NULL, tk->keypair, tk->req, subject,
-		serial, validity, cert_profile, tk->algor, tk->oids, tk->hsm );
+	tk->cert = PKI_X509_CERT_new_template ( NULL, tk->keypair, tk->req,
+		subject, serial, validity, tmpl, tk->algor, tk->hsm );
+
+	PKI_X509_PROFILE_TEMPLATE_free(tmpl);
 
 	if (!tk->cert) return PKI_ERROR(PKI_ERR_X509_CERT_CREATE, NULL);
 
 	return (PKI_OK);
 }
 
+/*!
+ * \brief Returns the compiled version of one of the token's profiles
+ *
+ * Profiles are compiled (see PKI_X509_PROFILE_TEMPLATE_new()) the first time
+ * they are used for issuing and the templates are cached in the token. A
+ * template is rebuilt when the profile (or the token's OIDs) is modified.
+ *
+ * The cache can be used by concurrent threads: the returned template is a
+ * new reference that the caller releases with
+ * PKI_X509_PROFILE_TEMPLATE_free(), it stays valid even if the cached one
+ * is replaced meanwhile.
+ */
+
+PKI_X509_PROFILE_TEMPLATE * PKI_TOKEN_get_profile_template(PKI_TOKEN *tk,
+					const PKI_X509_PROFILE *profile) {
+
+	PKI_X509_PROFILE_TEMPLATE *ret = NULL;
+	PKI_X509_PROFILE_TEMPLATE *stale = NULL;
+	int i = 0;
+
+	if (!tk || !profile) {
+		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&__token_tmpl_lock);
+
+	if (tk->profile_templates == NULL) {
+		if ((tk->profile_templates = PKI_STACK_new(
+			(void (*)(void *)) PKI_X509_PROFILE_TEMPLATE_free)) == NULL) {
+			pthread_mutex_unlock(&__token_tmpl_lock);
+			PKI_ERROR(PKI_ERR_MEMORY_ALLOC, NULL);
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < PKI_STACK_elements(tk->profile_templates); i++) {
+
+		ret = PKI_STACK_get_num(tk->profile_templates, i);
+		if (ret->profile != profile) {
+			ret = NULL;
+			continue;
+		}
+
+		if (PKI_X509_PROFILE_TEMPLATE_is_current(ret, profile,
+						tk->oids) == PKI_OK) break;
+
+		// Stale template, the profile has been modified (the threads
+		// still using it hold their own references)
+		PKI_STACK_del_num(tk->profile_templates, i);
+		stale = ret;
+		ret = NULL;
+		break;
+	}
+
+	if (!ret && (ret = PKI_X509_PROFILE_TEMPLATE_new(profile,
+						tk->oids)) != NULL) {
+		if (PKI_STACK_push(tk->profile_templates, ret) == PKI_ERR) {
+			PKI_X509_PROFILE_TEMPLATE_free(ret);
+			ret = NULL;
+		}
+	}
+
+	// Reference for the caller
+	if (ret) PKI_X509_PROFILE_TEMPLATE_up_ref(ret);
+
+	pthread_mutex_unlock(&__token_tmpl_lock);
+
+	PKI_X509_PROFILE_TEMPLATE_free(stale);
+
+	return ret;
+}
+
 PKI_X509_CERT * PKI_TOKEN_issue_cert(PKI_TOKEN *tk, char *subject, char *serial,
 		unsigned long validity, PKI_X509_REQ *req, char *profile_s ) {
 
 	PKI_X509_PROFILE *cert_profile = NULL;
+	PKI_X509_PROFILE_TEMPLATE *tmpl = NULL;
+	PKI_X509_CERT *ret = NULL;
 
 	if (!tk || !tk->keypair) {
 		PKI_ERROR(PKI_ERR_PARAM_NULL, NULL);
@@ -2390,6 +2725,12 @@ PKI_X509_CERT * PKI_TOKEN_issue_cert(PKI_TOKEN *tk, char *subject, char *serial,
 			PKI_DEBUG("Can not find requested profile (%s)", profile_s);
 			return NULL;
 		}
+
+		if ((tmpl = PKI_TOKEN_get_profile_template(tk, cert_profile))
+							== NULL) {
+			PKI_DEBUG("Can not compile requested profile (%s)", profile_s);
+			return NULL;
+		}
 	}
 
 	if( !req ) req = tk->req;
@@ -2398,9 +2739,12 @@ PKI_X509_CERT * PKI_TOKEN_issue_cert(PKI_TOKEN *tk, char *subject, char *serial,
 		tk->cred = PKI_TOKEN_cred_get ( tk, NULL );
 	}
 
-	return PKI_X509_CERT_new (tk->cert, tk->keypair, req, subject,
-			serial, validity, cert_profile, tk->algor, 
-				tk->oids, tk->hsm );
+	ret = PKI_X509_CERT_new_template (tk->cert, tk->keypair, req, subject,
+			serial, validity, tmpl, tk->algor, tk->hsm );
+
+	PKI_X509_PROFILE_TEMPLATE_free(tmpl);
+
+	return ret;
 }
 
 PKI_TOKEN *PKI_TOKEN_issue_proxy (PKI_TOKEN *tk, char *subject, 
@@ -2548,6 +2892,15 @@ int PKI_TOKEN_clear_profiles(PKI_TOKEN * tk) {
 		tk->profiles = NULL;
 	}
 
+	// Compiled profiles are not needed anymore (the templates still
+	// in use are freed when released)
+	pthread_mutex_lock(&__token_tmpl_lock);
+	if (tk->profile_templates) {
+		PKI_STACK_free_all(tk->profile_templates);
+		tk->profile_templates = NULL;
+	}
+	pthread_mutex_unlock(&__token_tmpl_lock);
+
 	return PKI_OK;
 }
 
@@ -44,7 +44,9 @@ void usage ( void ) {
 	printf(BLUE "    -profile " RED "<opt>" NORM ".......: Name of the CRL profile to use\n");
 	printf(BLUE "    -profileuri " RED "<URI>" NORM "....: URI of a CRL profile to be loaded\n");
 	printf(BLUE "    -entry " RED "<ser:[code]>" NORM "..: Revoked Entry (with reason code)\n");
+	printf(BLUE "    -entries " RED "<file>" NORM "......: Revoked Entries file (ser [code [date]])\n");
 	printf(BLUE "    -crlNum " RED "<num>" NORM "........: CRL's serial number\n");
+	printf(BLUE "    -base " RED "<URI>" NORM "..........: Generates a delta CRL against the base CRL\n");
 	printf(BLUE "    -validity " RED "<secs>" NORM ".....: CRL validity period (in secs)\n");
 	printf(BLUE "    -outform " RED "<opt>" NORM ".......: Output format (PEM, DER, TXT, XML)\n");
 	printf(BLUE "    -verbose"        NORM " ............: Be verbose during operations\n");
@@ -117,6 +119,7 @@ int main (int argc, char *argv[] ) {
 	char *profile_s = NULL;
 	char *profile_uri_s = NULL;
 	char *crlNum_s = NULL;
+	char *base_s = NULL;
 	char *entry_s = NULL;
 	char *cert_s = NULL;
 	char *key_s = NULL;
@@ -124,14 +127,13 @@ int main (int argc, char *argv[] ) {
 	char *password = NULL;
 
 	long long validity = PKI_VALIDITY_ONE_WEEK;
-	PKI_X509_CRL_ENTRY_STACK *entryStack = NULL;
-	PKI_X509_CRL_ENTRY *crlEntry = NULL;
+	PKI_X509_CRL_BUILDER *builder = NULL;
 
 	int new = 0;
 
 	PKI_init_all();
 
-	if((entryStack = PKI_STACK_X509_CRL_ENTRY_new()) == NULL ) {
+	if((builder = PKI_X509_CRL_BUILDER_new(0)) == NULL ) {
 		fprintf(stderr, "ERROR, memory allocation!\n\n");
 		exit(1);
 	};
@@ -182,6 +184,16 @@ int main (int argc, char *argv[] ) {
 				break;
 			}
 			key_s=(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-entries", 8 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			if (PKI_X509_CRL_BUILDER_add_file(builder, argv[++i]) == PKI_ERR) {
+				fprintf(stderr, "ERROR, can not load CRL entries from %s!\n\n",
+					argv[i]);
+				exit(1);
+			}
 		} else if ( strncmp_nocase ( argv[i], "-entry", 6 ) == 0) {
 			PKI_X509_CRL_REASON instruction = PKI_CRL_REASON_UNSPECIFIED;
 			char *idx = NULL;
@@ -201,18 +213,13 @@ int main (int argc, char *argv[] ) {
 				instruction = PKI_CRL_REASON_UNSPECIFIED;
 			}
 
-			if ((crlEntry = PKI_X509_CRL_ENTRY_new_serial(entry_s,
-            						instruction, NULL, NULL )) == NULL ) {
-        			fprintf(stderr, "ERROR, can not generate CRL entry from -entry %s!\n\n",
+			if (PKI_X509_CRL_BUILDER_add_serial(builder, entry_s,
+							0, instruction) == PKI_ERR) {
+				fprintf(stderr, "ERROR, can not add entry %s to CRL!\n\n",
 					entry_s);
-        			exit(1);
-    			}
-
-			if( PKI_STACK_X509_CRL_ENTRY_push( entryStack, crlEntry ) == PKI_ERR ) {
-				fprintf(stderr, "ERROR, can not add entry %s to CRL "
-					"entries' stack!\n\n", entry_s);
 				exit ( 1 );
 			};
+			free(entry_s);
 		} else if ( strncmp_nocase ( argv[i], "-passin", 7 ) == 0) {
 			if( argv[i+1] == NULL ) {
 				error=1;
@@ -225,6 +232,12 @@ int main (int argc, char *argv[] ) {
 				break;
 			}
 			password=(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-base", 5 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			base_s=(argv[++i]);
 		} else if ( strncmp_nocase ( argv[i], "-crlNum", 7 ) == 0) {
 			if( argv[i+1] == NULL ) {
 				error=1;
@@ -404,10 +417,39 @@ int main (int argc, char *argv[] ) {
 		// fprintf( stderr, "REASON CODES = > %d\n",
 		// 	PKI_X509_CRL_REASON_CODE_get ( "" ) );
 
-		if ((crl = PKI_TOKEN_issue_crl(tk, crlNum_s, (long unsigned int) validity, entryStack, profile_s )) == NULL ) {
+		if ( base_s ) {
+			PKI_X509_CRL *base = NULL;
+
+			if((base = PKI_X509_CRL_get( base_s, PKI_DATA_FORMAT_UNKNOWN,
+							NULL, NULL )) == NULL ) {
+				fprintf( stderr, "ERROR, can not load base CRL %s!\n\n",
+					base_s);
+				exit(1);
+			};
+
+			crl = PKI_TOKEN_issue_delta_crl(tk, crlNum_s,
+				(long unsigned int) validity, base, builder, profile_s );
+
+			PKI_X509_CRL_free( base );
+		} else {
+			crl = PKI_TOKEN_issue_crl_builder(tk, crlNum_s,
+				(long unsigned int) validity, builder, profile_s );
+		};
+
+		if ( crl == NULL ) {
 			fprintf( stderr, "ERROR, can not issue new CRL!\n\n");
 			exit(1);
 		};
+
+		if( verbose ) {
+			int entries = 0;
+			double secs = 0;
+			double rate = 0;
+
+			PKI_X509_CRL_BUILDER_get_stats(builder, &entries, &secs, &rate);
+			fprintf( stderr, "    * CRL Entries ............ %d (%.3f secs, %.0f entries/sec)\n",
+				entries, secs, rate);
+		};
 	} else {
 		if((crl = PKI_X509_CRL_get_url( inUrl, PKI_DATA_FORMAT_UNKNOWN, NULL, NULL )) == NULL) {
 			if(!verbose) fprintf(stderr,"\n");
@@ -439,6 +481,7 @@ int main (int argc, char *argv[] ) {
 	};
 
 	if( crl ) PKI_X509_CRL_free( crl );
+	if( builder ) PKI_X509_CRL_BUILDER_free( builder );
 
 	return(0);
 }
@@ -0,0 +1,750 @@
+/*
+ * PKI OCSP Response Pre-Generation Tool (pki-ocsp)
+ *
+ * Signs one OCSP response for every serial number covered by a CRL
+ * (revoked entries) and, optionally, by a list of issued serials (good
+ * entries), and stores them in a single indexed file that a responder
+ * can mmap() and serve without any signing operation at request time.
+ *
+ * Output file layout (all integers are in network byte order):
+ *
+ *   Header (32 bytes)
+ *     magic[8] ......... "LPKIOCSP"
+ *     version .......... uint32 (PKI_OCSP_STORE_VERSION)
+ *     count ............ uint32, number of index records
+ *     nextUpdate ....... uint64, seconds since the epoch (0 if not set)
+ *     reserved ......... uint64, always 0
+ *
+ *   Index (count records of 40 bytes, sorted by serial)
+ *     serial_len ....... uint8, length of the serial magnitude
+ *     status ........... uint8, PKI_OCSP_CERTSTATUS value
+ *     reserved[2] ...... always 0
+ *     length ........... uint32, size of the DER response
+ *     offset ........... uint64, offset of the DER response in the file
+ *     serial[24] ....... big-endian serial magnitude, zero padded
+ *
+ *   Data
+ *     DER encoded OCSPResponse structures
+ *
+ * Records are ordered by serial_len first and then by memcmp() on the
+ * serial bytes, so that a responder can bsearch() the index by using
+ * the content octets of the requested CertID serial number.
+ */
+
+#include <libpki/pki.h>
+
+#define BOLD     "\x1B[1m"
+#define NORM     "\x1B[0m"
+#define BLACK    "\x1B[30m"
+#define RED      "\x1B[31m"
+#define GREEN    "\x1B[32m"
+#define BLUE     "\x1B[34m"
+
+#define BG       "\x1B[47m"
+#define BG_BOLD  "\x1B[31;47m"
+#define BG_NORM  "\x1B[30;47m"
+#define BG_RED   "\x1B[31;47m"
+#define BG_GREEN "\x1B[32;47m"
+#define BG_BLUE  "\x1B[34;47m"
+
+#define PKI_OCSP_STORE_MAGIC		"LPKIOCSP"
+#define PKI_OCSP_STORE_VERSION		1
+#define PKI_OCSP_STORE_HEADER_SIZE	32
+#define PKI_OCSP_STORE_RECORD_SIZE	40
+#define PKI_OCSP_STORE_SERIAL_SIZE	24
+
+#define PKI_OCSP_MAX_THREADS		64
+
+typedef struct ocsp_job_st {
+	PKI_INTEGER *serial;
+	PKI_OCSP_CERTSTATUS status;
+	int reason;
+	const PKI_TIME *revDate;
+	PKI_MEM *der;
+} OCSP_JOB;
+
+typedef struct ocsp_worker_st {
+	OCSP_JOB *jobs;
+	int num;
+	int first;
+	int step;
+	int errors;
+	PKI_TOKEN *tk;
+	PKI_X509_CERT *issuer;
+	const PKI_TIME *nextUpdate;
+	PKI_DIGEST_ALG *digest;
+	PKI_X509_OCSP_RESPID_TYPE respidType;
+} OCSP_WORKER;
+
+char banner[] =
+	"\n   " BOLD "PKI OCSP Pre-Generation Tool " NORM "(pki-ocsp)\n"
+	"   (c) 2008-2015 by " BOLD "Massimiliano Pala" NORM
+			" and " BOLD "Open" RED "CA" NORM BOLD " Labs\n" NORM
+	"       " BOLD BLUE "Open" RED "CA" NORM " Licensed software\n\n";
+
+char usage_str[] =
+	"     " BG "                                                " NORM "\n"
+	"     " BG_BOLD "  USAGE: " BG_NORM "pki-ocsp "
+		BG_GREEN "[options]                     " NORM "\n"
+	"     " BG "                                                " NORM "\n\n";
+
+void usage ( void ) {
+
+	printf( "%s", banner );
+	printf( "%s", usage_str );
+
+	printf("   Where options are:\n");
+	printf(BLUE "    -crl " RED "<URI> " NORM "..........: CRL with the revoked entries\n");
+	printf(BLUE "    -serials " RED "<URI> " NORM "......: Issued serials (hex, one per line)\n");
+	printf(BLUE "    -out " RED "<file> " NORM ".........: Output response store (required)\n");
+	printf(BLUE "    -cert " RED "<URI>" NORM "..........: Certificate of the OCSP signer\n");
+	printf(BLUE "    -key " RED "<URI>" NORM "...........: Private Key of the OCSP signer\n");
+	printf(BLUE "    -issuer " RED "<URI>" NORM "........: Issuer of the certificates (def. -cert)\n");
+	printf(BLUE "    -token " RED "<URI>" NORM ".........: URI of the Token to load\n");
+	printf(BLUE "    -config " RED "<URI>" NORM "........: Token configuration directory\n");
+	printf(BLUE "    -passin " RED "<opt>" NORM "........: Password method (stdin, env:var, file://.., none)\n");
+	printf(BLUE "    -password " RED "<pwd>" NORM "......: Password of the Token\n");
+	printf(BLUE "    -digest " RED "<alg>" NORM "........: Signature digest (def. token's)\n");
+	printf(BLUE "    -respid " RED "<opt>" NORM "........: Responder ID type (name, key)\n");
+	printf(BLUE "    -validity " RED "<secs>" NORM ".....: nextUpdate offset (def. CRL's nextUpdate)\n");
+	printf(BLUE "    -threads " RED "<num>" NORM ".......: Signing threads (def. one per CPU)\n");
+	printf(BLUE "    -verbose"        NORM " ............: Be verbose during operations\n");
+	printf(BLUE "    -debug"        NORM " ..............: Print debug information\n");
+	printf(BLUE "    -help"        NORM " ...............: Print this message\n");
+	printf("\n");
+
+	exit (1);
+}
+
+/* Orders the jobs by serial length first and then by serial bytes */
+static int cmp_job(const void *a, const void *b) {
+
+	const OCSP_JOB *j_a = (const OCSP_JOB *) a;
+	const OCSP_JOB *j_b = (const OCSP_JOB *) b;
+
+	int len_a = ASN1_STRING_length(j_a->serial);
+	int len_b = ASN1_STRING_length(j_b->serial);
+
+	if (len_a != len_b) return len_a < len_b ? -1 : 1;
+
+	return memcmp(ASN1_STRING_get0_data(j_a->serial),
+		ASN1_STRING_get0_data(j_b->serial), (size_t) len_a);
+}
+
+static void put_uint32(unsigned char *buf, uint32_t val) {
+
+	buf[0] = (unsigned char) (val >> 24);
+	buf[1] = (unsigned char) (val >> 16);
+	buf[2] = (unsigned char) (val >> 8);
+	buf[3] = (unsigned char) val;
+}
+
+static void put_uint64(unsigned char *buf, uint64_t val) {
+
+	put_uint32(buf, (uint32_t) (val >> 32));
+	put_uint32(buf + 4, (uint32_t) val);
+}
+
+/* Loads the serials (hex, one per line) of the issued certificates */
+static int load_serials(const char *url_s, OCSP_JOB **jobs, int *num,
+			int *size, const PKI_X509_CRL_INDEX *idx) {
+
+	PKI_MEM_STACK *sk = NULL;
+	PKI_MEM *mem = NULL;
+	char *line = NULL;
+	char *next = NULL;
+	char *p = NULL;
+	char *q = NULL;
+	size_t i = 0;
+
+	if ((sk = URL_get_data(url_s, 0, 0, NULL)) == NULL ||
+			(mem = PKI_STACK_MEM_get_num(sk, 0)) == NULL) {
+		if (sk) PKI_STACK_MEM_free_all(sk);
+		return PKI_ERR;
+	}
+
+	// Makes sure the buffer is NULL terminated
+	if (PKI_MEM_add(mem, "\x0", 1) == PKI_ERR) {
+		PKI_STACK_MEM_free_all(sk);
+		return PKI_ERR;
+	}
+
+	for (line = (char *) mem->data; line && *line; line = next) {
+
+		if ((next = strchr(line, '\n')) != NULL) *next++ = '\x0';
+
+		// Strips separators, white spaces and comments
+		for (p = q = line; *p && *p != '#'; p++) {
+			if (*p == ':' || isspace((unsigned char) *p)) continue;
+			*q++ = *p;
+		}
+		*q = '\x0';
+
+		if (*line == '\x0') continue;
+
+		for (i = 0; line[i]; i++) {
+			if (!isxdigit((unsigned char) line[i])) break;
+		}
+
+		if (line[i]) {
+			fprintf(stderr, "ERROR, invalid serial \"%s\" in %s\n\n",
+				line, url_s);
+			PKI_STACK_MEM_free_all(sk);
+			return PKI_ERR;
+		}
+
+		// Revoked serials are already covered by the CRL entries
+		if (PKI_X509_CRL_INDEX_lookup_serial(idx, line, NULL, NULL))
+			continue;
+
+		if (*num >= *size) {
+			OCSP_JOB *tmp = NULL;
+
+			if ((tmp = realloc(*jobs, sizeof(OCSP_JOB) *
+					(size_t) (*size * 2))) == NULL) {
+				PKI_STACK_MEM_free_all(sk);
+				return PKI_ERR;
+			}
+			*jobs = tmp;
+			*size *= 2;
+		}
+
+		memset(&(*jobs)[*num], 0, sizeof(OCSP_JOB));
+		if (((*jobs)[*num].serial = PKI_INTEGER_new_char(line)) == NULL) {
+			PKI_STACK_MEM_free_all(sk);
+			return PKI_ERR;
+		}
+		(*jobs)[*num].status = PKI_OCSP_CERTSTATUS_GOOD;
+		(*jobs)[*num].reason = -1;
+		(*num)++;
+	}
+
+	PKI_STACK_MEM_free_all(sk);
+
+	return PKI_OK;
+}
+
+/* Signs the responses for every step-th job, starting from first */
+static void * sign_thread(void *arg) {
+
+	OCSP_WORKER *w = (OCSP_WORKER *) arg;
+	PKI_X509_OCSP_RESP *resp = NULL;
+	PKI_OCSP_CERTID *cid = NULL;
+	const PKI_X509_NAME *iname = NULL;
+	int i = 0;
+
+	iname = PKI_X509_CERT_get_data(w->issuer, PKI_X509_DATA_SUBJECT);
+
+	for (i = w->first; i < w->num; i += w->step) {
+
+		OCSP_JOB *job = &w->jobs[i];
+
+		if ((cid = OCSP_cert_id_new(EVP_sha1(), (PKI_X509_NAME *) iname,
+				X509_get0_pubkey_bitstr(w->issuer->value),
+				job->serial)) == NULL ||
+			(resp = PKI_X509_OCSP_RESP_new()) == NULL ||
+			PKI_X509_OCSP_RESP_add(resp, cid, job->status,
+				job->revDate, NULL, w->nextUpdate,
+				job->reason, NULL) != PKI_OK ||
+			PKI_X509_OCSP_RESP_sign(resp, w->tk->keypair, w->tk->cert,
+				w->issuer, NULL, w->digest, w->respidType) != PKI_OK ||
+			(job->der = PKI_X509_put_mem(resp, PKI_DATA_FORMAT_ASN1,
+				NULL, NULL)) == NULL) {
+			w->errors++;
+		}
+
+		if (resp) PKI_X509_OCSP_RESP_free(resp);
+		if (cid) OCSP_CERTID_free(cid);
+
+		resp = NULL;
+		cid = NULL;
+	}
+
+	return NULL;
+}
+
+/* Writes the response store to a temporary file and moves it in place */
+static int write_store(const char *outfile, OCSP_JOB *jobs, int num,
+			uint64_t nextUpdate) {
+
+	unsigned char hdr[PKI_OCSP_STORE_HEADER_SIZE];
+	unsigned char rec[PKI_OCSP_STORE_RECORD_SIZE];
+	uint64_t offset = 0;
+	char *tmpfile = NULL;
+	size_t len = 0;
+	FILE *fp = NULL;
+	int ok = 1;
+	int i = 0;
+
+	len = strlen(outfile) + 5;
+	if ((tmpfile = PKI_Malloc(len)) == NULL) return PKI_ERR;
+	snprintf(tmpfile, len, "%s.tmp", outfile);
+
+	if ((fp = fopen(tmpfile, "wb")) == NULL) {
+		PKI_Free(tmpfile);
+		return PKI_ERR;
+	}
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, PKI_OCSP_STORE_MAGIC, 8);
+	put_uint32(hdr + 8, PKI_OCSP_STORE_VERSION);
+	put_uint32(hdr + 12, (uint32_t) num);
+	put_uint64(hdr + 16, nextUpdate);
+
+	if (fwrite(hdr, sizeof(hdr), 1, fp) != 1) ok = 0;
+
+	offset = PKI_OCSP_STORE_HEADER_SIZE +
+			(uint64_t) num * PKI_OCSP_STORE_RECORD_SIZE;
+
+	for (i = 0; ok && i < num; i++) {
+
+		int s_len = ASN1_STRING_length(jobs[i].serial);
+
+		memset(rec, 0, sizeof(rec));
+		rec[0] = (unsigned char) s_len;
+		rec[1] = (unsigned char) jobs[i].status;
+		put_uint32(rec + 4, (uint32_t) jobs[i].der->size);
+		put_uint64(rec + 8, offset);
+		memcpy(rec + 16, ASN1_STRING_get0_data(jobs[i].serial),
+							(size_t) s_len);
+
+		if (fwrite(rec, sizeof(rec), 1, fp) != 1) ok = 0;
+
+		offset += jobs[i].der->size;
+	}
+
+	for (i = 0; ok && i < num; i++) {
+		if (fwrite(jobs[i].der->data, jobs[i].der->size, 1, fp) != 1)
+			ok = 0;
+	}
+
+	if (fclose(fp) != 0) ok = 0;
+
+	if (ok && rename(tmpfile, outfile) != 0) ok = 0;
+	if (!ok) unlink(tmpfile);
+
+	PKI_Free(tmpfile);
+
+	return ok ? PKI_OK : PKI_ERR;
+}
+
+int main (int argc, char *argv[] ) {
+	PKI_X509_CRL *crl = NULL;
+	PKI_X509_CRL_INDEX *idx = NULL;
+	PKI_X509_CERT *issuer = NULL;
+	PKI_TIME *nextUpdate = NULL;
+	PKI_DIGEST_ALG *digest = NULL;
+	PKI_TOKEN *tk = NULL;
+	PKI_THREAD **th = NULL;
+	OCSP_WORKER *workers = NULL;
+	OCSP_JOB *jobs = NULL;
+	int i, j, error;
+
+	int debug = 0;
+	int verbose = 0;
+	PKI_LOG_FLAGS log_debug = 0;
+	int log_level = PKI_LOG_ERR;
+
+	char *token = NULL;
+	char *config = NULL;
+	char *crl_s = NULL;
+	char *serials_s = NULL;
+	char *outfile = NULL;
+	char *cert_s = NULL;
+	char *key_s = NULL;
+	char *issuer_s = NULL;
+	char *passin = NULL;
+	char *password = NULL;
+	char *digest_s = NULL;
+	char *respid_s = NULL;
+
+	PKI_X509_OCSP_RESPID_TYPE respidType = PKI_X509_OCSP_RESPID_TYPE_BY_NAME;
+	long long validity = 0;
+	long cpus = 1;
+	int threads = 0;
+	int num = 0;
+	int size = 0;
+	int errors = 0;
+	int revoked = 0;
+
+	uint64_t nextUpdate_epoch = 0;
+	int days = 0;
+	int secs = 0;
+
+	PKI_init_all();
+
+	error = 0;
+	for(i=1; i < argc; i++ ) {
+		if( strncmp_nocase( argv[i], "-crl", 4 ) == 0 ) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			crl_s=(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-serials", 8 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			serials_s=(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-config", 6 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			config=(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-token", 6 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			token=(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-cert", 5 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			cert_s=(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-key", 4 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			key_s=(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-issuer", 7 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			issuer_s=(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-passin", 7 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			passin=(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-password", 7 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			password=(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-digest", 7 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			digest_s=(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-respid", 7 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			respid_s=(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-validity", 9 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			validity=atoll(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-threads", 8 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			threads=atoi(argv[++i]);
+		} else if ( strncmp_nocase ( argv[i], "-out", 4 ) == 0) {
+			if( argv[i+1] == NULL ) {
+				error=1;
+				break;
+			}
+			outfile=(argv[++i]);
+		} else if(strncmp_nocase(argv[i], "-h", 2) == 0 ) {
+			usage();
+		} else if(strncmp_nocase(argv[i],"-debug", 6) == 0 ) {
+			debug=1;
+		} else if(strncmp_nocase(argv[i],"-verbose", 8) == 0 ) {
+			verbose=1;
+		} else {
+			if(verbose) fprintf(stderr, "%s", banner );
+			fprintf( stderr, BOLD RED "\n    ERROR: "
+				NORM "Unreckognized parameter \'" BOLD BLUE
+						"%s" NORM "\'\n\n",
+				argv[i]);
+			usage();
+			exit(1);
+		}
+	}
+
+	if( error == 1 || !crl_s || !outfile ) {
+		usage();
+	}
+
+	if (respid_s) {
+		if (strncmp_nocase(respid_s, "name", 4) == 0) {
+			respidType = PKI_X509_OCSP_RESPID_TYPE_BY_NAME;
+		} else if (strncmp_nocase(respid_s, "key", 3) == 0) {
+			respidType = PKI_X509_OCSP_RESPID_TYPE_BY_KEYID;
+		} else {
+			fprintf(stderr, BOLD RED "\n    ERROR: "
+				NORM "responder id type \"" BLUE "%s" NORM
+				"\" is not valid (use one of name, key)!\n\n", respid_s );
+			exit(1);
+		}
+	}
+
+	if( verbose ) log_level = PKI_LOG_INFO;
+	if( debug ) log_debug |= PKI_LOG_FLAGS_ENABLE_DEBUG;
+
+	if(( PKI_log_init (PKI_LOG_TYPE_STDERR, log_level, NULL,
+                        log_debug, NULL )) == PKI_ERR ) {
+		printf("ERROR, can not initialize logging facility!\n\n");
+		exit(1);
+	}
+
+	if(verbose) fprintf( stderr, "%s", banner );
+
+	if ( !token ) {
+		if((tk = PKI_TOKEN_new_null ()) == NULL ) {
+			fprintf( stderr, "ERROR, memory allocation in Token Initialization!\n\n");
+			exit ( 1 );
+		};
+
+		if( password ) {
+			PKI_CRED *cred = NULL;
+
+			if((cred = PKI_CRED_new_null()) == NULL ) {
+				fprintf( stderr, "ERROR, memory allocation\n\n");
+				exit(1);
+			};
+			cred->username = NULL;
+			cred->password = strdup(password);
+
+			PKI_TOKEN_set_cred( tk, cred );
+			PKI_TOKEN_cred_set_cb(tk, NULL, NULL);
+
+		} else if( passin ) {
+			if( strncmp_nocase( passin, "env:", 4) == 0) {
+				PKI_TOKEN_cred_set_cb ( tk, PKI_TOKEN_cred_cb_env, passin+4);
+			} else if (strncmp_nocase( passin, "stdin", 5) == 0 ) {
+				PKI_TOKEN_cred_set_cb ( tk, PKI_TOKEN_cred_cb_stdin, NULL);
+			} else if (strncmp_nocase( passin, "none", 4) == 0 ) {
+				PKI_TOKEN_cred_set_cb ( tk, NULL, NULL);
+			} else if (strlen(passin) < 1) {
+				PKI_TOKEN_cred_set_cb ( tk, NULL, NULL );
+			}
+		} else {
+			PKI_TOKEN_cred_set_cb(tk, PKI_TOKEN_cred_cb_stdin, NULL);
+		}
+
+		if ( !cert_s || !key_s )
+		{
+			fprintf( stderr, "\n    " RED BOLD "ERROR:" NORM " -token "
+				BLUE "<name>" NORM " or -cert " BLUE "<uri>" NORM " and -key "
+				BLUE "<uri>" NORM " required!\n\n");
+
+			exit(1);
+		}
+
+		if( PKI_TOKEN_load_cert( tk, cert_s ) == PKI_ERR ) {
+			fprintf( stderr, "ERROR, can not load certificate %s\n\n", cert_s );
+			exit(1);
+		};
+
+		if ( PKI_TOKEN_load_keypair( tk, key_s ) == PKI_ERR ) {
+			fprintf( stderr, "ERROR, can not load KeyPair %s\n\n", key_s );
+			exit(1);
+		};
+
+	} else {
+		if((tk = PKI_TOKEN_new ( config, token )) == NULL ) {
+			fprintf(stderr, "ERROR, can not load token %s\n\n", token);
+			exit ( 1 );
+		};
+	};
+
+	if (issuer_s && PKI_TOKEN_load_cacert(tk, issuer_s) == PKI_ERR) {
+		fprintf( stderr, "ERROR, can not load issuer certificate %s\n\n",
+			issuer_s );
+		exit(1);
+	}
+
+	// The CA can sign its own responses, in that case there is no cacert
+	if ((issuer = PKI_TOKEN_get_cacert(tk)) == NULL)
+		issuer = PKI_TOKEN_get_cert(tk);
+
+	if (!issuer || !tk->keypair) {
+		fprintf( stderr, "ERROR, missing signer or issuer certificate!\n\n");
+		exit(1);
+	}
+
+	if (PKI_TOKEN_login(tk) != PKI_OK) {
+		fprintf( stderr, "ERROR, can not login into the token!\n\n");
+		exit(1);
+	}
+
+	if (digest_s) {
+		if ((digest = PKI_DIGEST_ALG_get_by_name(digest_s)) == NULL) {
+			fprintf( stderr, "ERROR, unknown digest %s\n\n", digest_s );
+			exit(1);
+		}
+	} else if (tk->algor) {
+		digest = PKI_X509_ALGOR_VALUE_get_digest(tk->algor);
+	}
+
+	if (verbose) fprintf( stderr, "    * Loading CRL .............." );
+
+	if ((crl = PKI_X509_CRL_get(crl_s, PKI_DATA_FORMAT_UNKNOWN, NULL, NULL)) == NULL ||
+			(idx = PKI_X509_CRL_INDEX_new(crl)) == NULL) {
+		fprintf( stderr, "ERROR, can not load CRL %s\n\n", crl_s );
+		exit(1);
+	}
+
+	if (verbose) fprintf( stderr, GREEN " Ok" NORM "\n");
+
+	// Responses must not outlive the CRL they are built from
+	if (validity > 0) {
+		nextUpdate = PKI_TIME_new(validity);
+	} else {
+		const PKI_TIME *crlNext = PKI_X509_CRL_get_data(crl,
+						PKI_X509_DATA_NEXTUPDATE);
+		if (crlNext) nextUpdate = PKI_TIME_dup(crlNext);
+	}
+
+	if (nextUpdate && ASN1_TIME_diff(&days, &secs, NULL, nextUpdate)) {
+		nextUpdate_epoch = (uint64_t) ((long long) time(NULL) +
+					(long long) days * 86400 + secs);
+	}
+
+	size = PKI_X509_CRL_INDEX_elements(idx) + 1024;
+	if ((jobs = malloc(sizeof(OCSP_JOB) * (size_t) size)) == NULL) {
+		fprintf( stderr, "ERROR, memory allocation\n\n");
+		exit(1);
+	}
+
+	// One revoked response for every entry in the CRL
+	for (i = 0; i < PKI_X509_CRL_INDEX_elements(idx); i++) {
+		const PKI_X509_CRL_ENTRY *entry = NULL;
+
+		memset(&jobs[num], 0, sizeof(OCSP_JOB));
+		entry = PKI_X509_CRL_INDEX_get_num(idx, i, &jobs[num].reason,
+						&jobs[num].revDate);
+
+		if ((jobs[num].serial = ASN1_INTEGER_dup(
+				X509_REVOKED_get0_serialNumber(entry))) == NULL) {
+			fprintf( stderr, "ERROR, memory allocation\n\n");
+			exit(1);
+		}
+		jobs[num].status = PKI_OCSP_CERTSTATUS_REVOKED;
+		num++;
+	}
+
+	revoked = num;
+
+	if (serials_s) {
+		if (verbose) fprintf( stderr, "    * Loading Serials .........." );
+		if (load_serials(serials_s, &jobs, &num, &size, idx) != PKI_OK) {
+			fprintf( stderr, "ERROR, can not load serials from %s\n\n",
+				serials_s );
+			exit(1);
+		}
+		if (verbose) fprintf( stderr, GREEN " Ok" NORM "\n");
+	}
+
+	// Sorts the jobs in index order and drops duplicates and serials
+	// that do not fit in an index record
+	qsort(jobs, (size_t) num, sizeof(OCSP_JOB), cmp_job);
+
+	for (i = 0, j = 0; i < num; i++) {
+		if ((j > 0 && cmp_job(&jobs[j-1], &jobs[i]) == 0) ||
+				ASN1_STRING_type(jobs[i].serial) == V_ASN1_NEG_INTEGER ||
+				ASN1_STRING_length(jobs[i].serial) >
+						PKI_OCSP_STORE_SERIAL_SIZE) {
+			PKI_INTEGER_free(jobs[i].serial);
+			continue;
+		}
+		jobs[j++] = jobs[i];
+	}
+	num = j;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	if ((cpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1) cpus = 1;
+#endif
+
+	if (threads <= 0) threads = (int) cpus;
+	if (threads > PKI_OCSP_MAX_THREADS) threads = PKI_OCSP_MAX_THREADS;
+	if (threads > num) threads = num > 0 ? num : 1;
+
+	if (verbose) {
+		fprintf( stderr, "    * Signing %d responses (%d revoked) "
+			"with %d threads ...", num, revoked, threads);
+	}
+
+	if ((workers = PKI_Malloc(sizeof(OCSP_WORKER) * (size_t) threads)) == NULL ||
+			(th = PKI_Malloc(sizeof(PKI_THREAD *) * (size_t) threads)) == NULL) {
+		fprintf( stderr, "ERROR, memory allocation\n\n");
+		exit(1);
+	}
+
+	for (i = 0; i < threads; i++) {
+		workers[i].jobs = jobs;
+		workers[i].num = num;
+		workers[i].first = i;
+		workers[i].step = threads;
+		workers[i].tk = tk;
+		workers[i].issuer = issuer;
+		workers[i].nextUpdate = nextUpdate;
+		workers[i].digest = digest;
+		workers[i].respidType = respidType;
+	}
+
+	// The main thread takes the first share of the work
+	for (i = 1; i < threads; i++) {
+		if ((th[i] = PKI_THREAD_new(sign_thread, &workers[i])) == NULL)
+			sign_thread(&workers[i]);
+	}
+
+	sign_thread(&workers[0]);
+
+	for (i = 0; i < threads; i++) {
+		if (th[i]) {
+			PKI_THREAD_join(th[i], NULL);
+			PKI_Free(th[i]);
+		}
+		errors += workers[i].errors;
+	}
+
+	if (errors > 0) {
+		fprintf( stderr, "ERROR, can not sign %d responses!\n\n", errors);
+		exit(1);
+	}
+
+	if (verbose) fprintf( stderr, GREEN " Ok" NORM "\n");
+
+	if (write_store(outfile, jobs, num, nextUpdate_epoch) != PKI_OK) {
+		fprintf( stderr, "ERROR, can not write responses to %s\n\n",
+			outfile);
+		exit(1);
+	}
+
+	if (verbose) fprintf( stderr, "    * Responses saved to %s\n\n", outfile);
+
+	for (i = 0; i < num; i++) {
+		PKI_INTEGER_free(jobs[i].serial);
+		PKI_MEM_free(jobs[i].der);
+	}
+
+	free(jobs);
+	PKI_Free(workers);
+	PKI_Free(th);
+
+	if (nextUpdate) PKI_TIME_free(nextUpdate);
+
+	PKI_X509_CRL_INDEX_free(idx);
+	PKI_X509_CRL_free(crl);
+	PKI_TOKEN_free(tk);
+
+	PKI_log_end();
+
+	return 0;
+}